@@ -0,0 +1,63 @@
+#pragma once
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// --------------------------------------------------------
+// Finding set bits in 64 bit masks, for walking dirty flags
+// a word at a time. Uses the compiler's intrinsic where there
+// is one, and a plain binary search everywhere else.
+//
+// Both are undefined for 0, like the instructions they use.
+// --------------------------------------------------------
+
+/// <summary>
+/// Index of the lowest set bit
+/// </summary>
+inline unsigned int LowestBit(unsigned long long bits)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+	unsigned long bit;
+	_BitScanForward64(&bit, bits);
+	return (unsigned int)bit;
+#elif defined(__GNUC__) || defined(__clang__)
+	return (unsigned int)__builtin_ctzll(bits);
+#else
+	unsigned int bit = 0;
+	for (unsigned int shift = 32; shift > 0; shift >>= 1)
+	{
+		if ((bits & ((1ull << shift) - 1)) == 0)
+		{
+			bits >>= shift;
+			bit += shift;
+		}
+	}
+	return bit;
+#endif
+}
+
+/// <summary>
+/// Index of the highest set bit
+/// </summary>
+inline unsigned int HighestBit(unsigned long long bits)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+	unsigned long bit;
+	_BitScanReverse64(&bit, bits);
+	return (unsigned int)bit;
+#elif defined(__GNUC__) || defined(__clang__)
+	return 63u - (unsigned int)__builtin_clzll(bits);
+#else
+	unsigned int bit = 0;
+	for (unsigned int shift = 32; shift > 0; shift >>= 1)
+	{
+		if (bits >> shift)
+		{
+			bits >>= shift;
+			bit += shift;
+		}
+	}
+	return bit;
+#endif
+}
@@ -0,0 +1,66 @@
+// How many pixels of a row or column each thread slides its window across.
+// Matches BLUR_SEGMENT_LENGTH in BoxBlur.h.
+#define BLUR_SEGMENT_LENGTH 32
+
+cbuffer ExternalData : register(b0)
+{
+    int blurRadius;
+    int vertical; // 0 to blur along rows, 1 along columns
+}
+
+
+Texture2D Input : register(t0);
+RWTexture2D<float4> Output : register(u0);
+
+
+// Where the pixel i along a line is
+int3 PixelOnLine(int line, int i)
+{
+    return vertical ? int3(line, i, 0) : int3(i, line, 0);
+}
+
+
+// One pass of a box blur, the same as PostProcessPixelShader.hlsl's,
+// except each thread slides a running sum along its own segment of
+// a line: the first window gets summed, then each step adds the
+// pixel coming in and takes away the one going out, so the cost
+// hardly changes with the radius.  Coordinates past the ends of the
+// line clamp to the end pixels, like the clamp sampler does.
+//
+// Dispatched with a thread per segment in x and per line in y.  Short
+// segments keep enough threads around to fill the GPU (about 65k of
+// them at 1080p, where 128 pixel segments only made 16k), for a few
+// more loads per pixel at the start of each one.  A group spans 32
+// neighbouring lines, so on every step its threads load the same spot
+// along each of them, which the texture's tiling keeps close together.
+[numthreads(4, 32, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+    uint width, height;
+    Input.GetDimensions(width, height);
+    int length = vertical ? height : width;
+    int lines = vertical ? width : height;
+
+    int line = id.y;
+    int first = id.x * BLUR_SEGMENT_LENGTH;
+    if (line >= lines || first >= length)
+        return;
+
+    float scale = 1.0f / (2 * blurRadius + 1);
+
+    // The whole window around the segment's first pixel
+    float4 total = 0;
+    for (int k = -blurRadius; k <= blurRadius; k++)
+        total += Input.Load(PixelOnLine(line, clamp(first + k, 0, length - 1)));
+    Output[PixelOnLine(line, first).xy] = total * scale;
+
+    // Then slide it along the rest of the segment
+    int end = min(first + BLUR_SEGMENT_LENGTH, length);
+    for (int i = first + 1; i < end; i++)
+    {
+        float4 entering = Input.Load(PixelOnLine(line, min(i + blurRadius, length - 1)));
+        float4 leaving = Input.Load(PixelOnLine(line, max(i - blurRadius - 1, 0)));
+        total += entering - leaving;
+        Output[PixelOnLine(line, i).xy] = total * scale;
+    }
+}
@@ -0,0 +1,594 @@
+#include "BoundingVolumeHierarchy.h"
+#include "BitScan.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+// Parent of the root
+#define BVH_NO_PARENT 0xFFFFFFFF
+
+// Deepest a query can go: Morton splits use up a bit of the code
+// each level (30 at most), and runs of equal codes get halved
+// (32 at most), so this is plenty
+#define BVH_STACK_SIZE 128
+
+namespace
+{
+	// Spreads 10 bits out so there are two zeros between each of them
+	unsigned int SpreadBits(unsigned int bits)
+	{
+		bits = (bits | (bits << 16)) & 0x030000FF;
+		bits = (bits | (bits << 8)) & 0x0300F00F;
+		bits = (bits | (bits << 4)) & 0x030C30C3;
+		bits = (bits | (bits << 2)) & 0x09249249;
+		return bits;
+	}
+
+	// Where a ray enters a box, if it does before maxDistance. Starting inside counts as 0.
+	bool RayHitsBox(const XMFLOAT3& origin, const XMFLOAT3& inverseDirection, const XMFLOAT3& min, const XMFLOAT3& max, float maxDistance, float& distance)
+	{
+		float x1 = (min.x - origin.x) * inverseDirection.x;
+		float x2 = (max.x - origin.x) * inverseDirection.x;
+		float y1 = (min.y - origin.y) * inverseDirection.y;
+		float y2 = (max.y - origin.y) * inverseDirection.y;
+		float z1 = (min.z - origin.z) * inverseDirection.z;
+		float z2 = (max.z - origin.z) * inverseDirection.z;
+
+		float enter = std::max(std::max(std::min(x1, x2), std::min(y1, y2)), std::max(std::min(z1, z2), 0.0f));
+		float exit = std::min(std::min(std::max(x1, x2), std::max(y1, y2)), std::min(std::max(z1, z2), maxDistance));
+		if (enter > exit)
+			return false;
+
+		distance = enter;
+		return true;
+	}
+
+	bool RayHitsBounds(const XMFLOAT3& origin, const XMFLOAT3& inverseDirection, const WorldBounds& bounds, float maxDistance, float& distance)
+	{
+		XMFLOAT3 min(bounds.Center.x - bounds.Extents.x, bounds.Center.y - bounds.Extents.y, bounds.Center.z - bounds.Extents.z);
+		XMFLOAT3 max(bounds.Center.x + bounds.Extents.x, bounds.Center.y + bounds.Extents.y, bounds.Center.z + bounds.Extents.z);
+		return RayHitsBox(origin, inverseDirection, min, max, maxDistance, distance);
+	}
+
+	// A direction with a zero in it would make 0 * infinity in the slab test
+	XMFLOAT3 InverseDirection(const XMFLOAT3& direction)
+	{
+		XMFLOAT3 safe = direction;
+		for (float* component : { &safe.x, &safe.y, &safe.z })
+		{
+			if (fabsf(*component) < 1e-20f)
+				*component = *component < 0.0f ? -1e-20f : 1e-20f;
+		}
+		return XMFLOAT3(1.0f / safe.x, 1.0f / safe.y, 1.0f / safe.z);
+	}
+
+	// FrustumCuller's test for one object against the planes in the mask
+	bool BoundsInFrustum(const FrustumPlanes& frustum, unsigned int planeMask, const WorldBounds& bounds)
+	{
+		for (int p = 0; p < 6; p++)
+		{
+			if (!(planeMask & (1u << p)))
+				continue;
+
+			const XMFLOAT4& plane = frustum.Planes[p];
+			float centerDistance = plane.z * bounds.Center.z + (plane.y * bounds.Center.y + plane.x * bounds.Center.x) + plane.w;
+			float boxReach = fabsf(plane.z) * bounds.Extents.z + (fabsf(plane.y) * bounds.Extents.y + fabsf(plane.x) * bounds.Extents.x);
+			if (centerDistance + std::min(bounds.Radius, boxReach) < 0.0f)
+				return false;
+		}
+		return true;
+	}
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy()
+{
+	anyDirty = false;
+}
+
+void BoundingVolumeHierarchy::Build(const WorldBounds* bounds, unsigned int count)
+{
+	nodes.clear();
+	parents.clear();
+	dirtyNodes.clear();
+	anyDirty = false;
+
+	codes.resize(count);
+	objects.resize(count);
+	positions.resize(count);
+	leaves.resize(count);
+	sortedBounds.resize(count);
+	if (count == 0)
+		return;
+
+	// Morton codes of the centers, relative to the box around all of them
+	XMVECTOR sceneMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR sceneMax = XMVectorReplicate(-FLT_MAX);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		XMVECTOR center = XMLoadFloat3(&bounds[i].Center);
+		sceneMin = XMVectorMin(sceneMin, center);
+		sceneMax = XMVectorMax(sceneMax, center);
+	}
+	XMVECTOR scale = XMVectorReplicate(1023.0f) / XMVectorMax(sceneMax - sceneMin, XMVectorReplicate(1e-20f));
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		XMFLOAT3 cell;
+		XMStoreFloat3(&cell, XMVectorClamp((XMLoadFloat3(&bounds[i].Center) - sceneMin) * scale, XMVectorZero(), XMVectorReplicate(1023.0f)));
+		codes[i] = (SpreadBits((unsigned int)cell.x) << 2) | (SpreadBits((unsigned int)cell.y) << 1) | SpreadBits((unsigned int)cell.z);
+		objects[i] = i;
+	}
+
+	// Radix sort the 30 bit codes, 10 bits at a time, carrying the objects along
+	scratchCodes.resize(count);
+	scratchObjects.resize(count);
+	for (unsigned int shift = 0; shift < 30; shift += 10)
+	{
+		unsigned int offsets[1024] = {};
+		for (unsigned int i = 0; i < count; i++)
+			offsets[(codes[i] >> shift) & 1023]++;
+
+		unsigned int total = 0;
+		for (unsigned int& offset : offsets)
+		{
+			unsigned int bucketCount = offset;
+			offset = total;
+			total += bucketCount;
+		}
+
+		for (unsigned int i = 0; i < count; i++)
+		{
+			unsigned int destination = offsets[(codes[i] >> shift) & 1023]++;
+			scratchCodes[destination] = codes[i];
+			scratchObjects[destination] = objects[i];
+		}
+		codes.swap(scratchCodes);
+		objects.swap(scratchObjects);
+	}
+
+	for (unsigned int position = 0; position < count; position++)
+	{
+		positions[objects[position]] = position;
+		sortedBounds[position] = bounds[objects[position]];
+	}
+
+	nodes.reserve(2 * ((count + BVH_LEAF_SIZE - 1) / BVH_LEAF_SIZE));
+	parents.reserve(nodes.capacity());
+	BuildNode(0, count, BVH_NO_PARENT);
+
+	dirtyNodes.resize((nodes.size() + 63) / 64, 0);
+}
+
+unsigned int BoundingVolumeHierarchy::BuildNode(unsigned int first, unsigned int count, unsigned int parent)
+{
+	unsigned int index = (unsigned int)nodes.size();
+	nodes.push_back(Node());
+	parents.push_back(parent);
+	nodes[index].First = first;
+	nodes[index].Count = count;
+	nodes[index].Right = 0;
+
+	if (count <= BVH_LEAF_SIZE)
+	{
+		for (unsigned int position = first; position < first + count; position++)
+			leaves[objects[position]] = index;
+	}
+	else
+	{
+		// The left child is always the next node
+		unsigned int split = FindSplit(first, count);
+		BuildNode(first, split - first, index);
+
+		// Not straight into nodes[index], which can move while the right side builds
+		unsigned int right = BuildNode(split, first + count - split, index);
+		nodes[index].Right = right;
+	}
+
+	FitNode(index);
+	return index;
+}
+
+unsigned int BoundingVolumeHierarchy::FindSplit(unsigned int first, unsigned int count)
+{
+	unsigned int last = first + count - 1;
+	unsigned int differentBits = codes[first] ^ codes[last];
+
+	// Nothing to go on, so just halve it
+	if (differentBits == 0)
+		return first + count / 2;
+
+	// Every code in the run shares the bits above the highest one that
+	// differs, so it's clear for the front of the run and set for the rest
+	unsigned int splitBit = 1u << HighestBit(differentBits);
+	unsigned int low = first;
+	unsigned int high = last;
+	while (low + 1 < high)
+	{
+		unsigned int middle = (low + high) / 2;
+		if (codes[middle] & splitBit)
+			high = middle;
+		else
+			low = middle;
+	}
+	return high;
+}
+
+void BoundingVolumeHierarchy::FitNode(unsigned int node)
+{
+	Node& fit = nodes[node];
+	XMVECTOR min, max;
+	if (fit.Right == 0)
+	{
+		min = XMVectorReplicate(FLT_MAX);
+		max = XMVectorReplicate(-FLT_MAX);
+		for (unsigned int position = fit.First; position < fit.First + fit.Count; position++)
+		{
+			XMVECTOR center = XMLoadFloat3(&sortedBounds[position].Center);
+			XMVECTOR extents = XMLoadFloat3(&sortedBounds[position].Extents);
+			min = XMVectorMin(min, center - extents);
+			max = XMVectorMax(max, center + extents);
+		}
+	}
+	else
+	{
+		const Node& left = nodes[node + 1];
+		const Node& right = nodes[fit.Right];
+		min = XMVectorMin(XMLoadFloat3(&left.Min), XMLoadFloat3(&right.Min));
+		max = XMVectorMax(XMLoadFloat3(&left.Max), XMLoadFloat3(&right.Max));
+	}
+
+	XMStoreFloat3(&fit.Min, min);
+	XMStoreFloat3(&fit.Max, max);
+}
+
+void BoundingVolumeHierarchy::Update(unsigned int object, const WorldBounds& bounds)
+{
+	sortedBounds[positions[object]] = bounds;
+
+	unsigned int leaf = leaves[object];
+	dirtyNodes[leaf >> 6] |= 1ull << (leaf & 63);
+	anyDirty = true;
+}
+
+unsigned int BoundingVolumeHierarchy::Refit()
+{
+	if (!anyDirty)
+		return 0;
+	anyDirty = false;
+
+	// Back to front, so children are always done before their parents. A parent
+	// can be marked further back in the same word, so keep checking it.
+	unsigned int refit = 0;
+	for (size_t word = dirtyNodes.size(); word-- > 0;)
+	{
+		while (dirtyNodes[word] != 0)
+		{
+			unsigned int bit = HighestBit(dirtyNodes[word]);
+			dirtyNodes[word] &= ~(1ull << bit);
+
+			unsigned int node = (unsigned int)word * 64 + bit;
+			XMFLOAT3 oldMin = nodes[node].Min;
+			XMFLOAT3 oldMax = nodes[node].Max;
+			FitNode(node);
+			refit++;
+
+			// Nothing above needs to change if this box didn't
+			const Node& fit = nodes[node];
+			bool changed =
+				fit.Min.x != oldMin.x || fit.Min.y != oldMin.y || fit.Min.z != oldMin.z ||
+				fit.Max.x != oldMax.x || fit.Max.y != oldMax.y || fit.Max.z != oldMax.z;
+
+			unsigned int parent = parents[node];
+			if (changed && parent != BVH_NO_PARENT)
+				dirtyNodes[parent >> 6] |= 1ull << (parent & 63);
+		}
+	}
+
+	return refit;
+}
+
+unsigned int BoundingVolumeHierarchy::Cull(const FrustumPlanes& frustum, std::vector<unsigned int>& visible)
+{
+	visible.clear();
+	if (nodes.empty())
+		return 0;
+
+	// Each node carries the planes it still has to be tested against,
+	// since one its parent was entirely inside can't cull it
+	struct Entry
+	{
+		unsigned int Node;
+		unsigned int PlaneMask;
+	};
+	Entry stack[BVH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = { 0, 0x3F };
+
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+		const Node& node = nodes[entry.Node];
+
+		XMFLOAT3 center((node.Min.x + node.Max.x) * 0.5f, (node.Min.y + node.Max.y) * 0.5f, (node.Min.z + node.Max.z) * 0.5f);
+		XMFLOAT3 extents((node.Max.x - node.Min.x) * 0.5f, (node.Max.y - node.Min.y) * 0.5f, (node.Max.z - node.Min.z) * 0.5f);
+
+		unsigned int planeMask = entry.PlaneMask;
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; p++)
+		{
+			if (!(planeMask & (1u << p)))
+				continue;
+
+			const XMFLOAT4& plane = frustum.Planes[p];
+			float centerDistance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+			float reach = fabsf(plane.x) * extents.x + fabsf(plane.y) * extents.y + fabsf(plane.z) * extents.z;
+			if (centerDistance + reach < 0.0f)
+				outside = true;
+			else if (centerDistance - reach >= 0.0f)
+				planeMask &= ~(1u << p);
+		}
+
+		if (outside)
+			continue;
+
+		// Entirely inside, so everything under it is visible
+		if (planeMask == 0)
+		{
+			AddRun(node.First, node.Count, visible);
+			continue;
+		}
+
+		if (node.Right == 0)
+		{
+			for (unsigned int position = node.First; position < node.First + node.Count; position++)
+			{
+				if (BoundsInFrustum(frustum, planeMask, sortedBounds[position]))
+					visible.push_back(objects[position]);
+			}
+			continue;
+		}
+
+		stack[top++] = { node.Right, planeMask };
+		stack[top++] = { entry.Node + 1, planeMask };
+	}
+
+	return (unsigned int)visible.size();
+}
+
+void BoundingVolumeHierarchy::AddRun(unsigned int first, unsigned int count, std::vector<unsigned int>& visible)
+{
+	visible.insert(visible.end(), objects.begin() + first, objects.begin() + first + count);
+}
+
+bool BoundingVolumeHierarchy::Raycast(XMFLOAT3 origin, XMFLOAT3 direction, float maxDistance, BVHRayHit& hit)
+{
+	if (nodes.empty())
+		return false;
+
+	XMFLOAT3 inverseDirection = InverseDirection(direction);
+	float nearest = maxDistance;
+	bool found = false;
+
+	float rootDistance;
+	if (!RayHitsBox(origin, inverseDirection, nodes[0].Min, nodes[0].Max, nearest, rootDistance))
+		return false;
+
+	// Nodes waiting to be visited, with where the ray enters them
+	struct Entry
+	{
+		unsigned int Node;
+		float Distance;
+	};
+	Entry stack[BVH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = { 0, rootDistance };
+
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+
+		// Something nearer was found since this was pushed
+		if (entry.Distance > nearest)
+			continue;
+
+		const Node& node = nodes[entry.Node];
+		if (node.Right == 0)
+		{
+			for (unsigned int position = node.First; position < node.First + node.Count; position++)
+			{
+				float distance;
+				if (RayHitsBounds(origin, inverseDirection, sortedBounds[position], nearest, distance) && (!found || distance < nearest))
+				{
+					nearest = distance;
+					hit.Object = objects[position];
+					hit.Distance = distance;
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first, so the other can often be skipped
+		unsigned int left = entry.Node + 1;
+		unsigned int right = node.Right;
+		float leftDistance, rightDistance;
+		bool hitLeft = RayHitsBox(origin, inverseDirection, nodes[left].Min, nodes[left].Max, nearest, leftDistance);
+		bool hitRight = RayHitsBox(origin, inverseDirection, nodes[right].Min, nodes[right].Max, nearest, rightDistance);
+		if (hitLeft && hitRight)
+		{
+			if (leftDistance <= rightDistance)
+			{
+				stack[top++] = { right, rightDistance };
+				stack[top++] = { left, leftDistance };
+			}
+			else
+			{
+				stack[top++] = { left, leftDistance };
+				stack[top++] = { right, rightDistance };
+			}
+		}
+		else if (hitLeft)
+			stack[top++] = { left, leftDistance };
+		else if (hitRight)
+			stack[top++] = { right, rightDistance };
+	}
+
+	return found;
+}
+
+unsigned int BoundingVolumeHierarchy::GetObjectCount()
+{
+	return (unsigned int)objects.size();
+}
+
+unsigned int BoundingVolumeHierarchy::GetNodeCount()
+{
+	return (unsigned int)nodes.size();
+}
+
+const WorldBounds& BoundingVolumeHierarchy::GetBounds(unsigned int object)
+{
+	return sortedBounds[positions[object]];
+}
+
+BVHBenchmark BenchmarkBoundingVolumeHierarchy(unsigned int count, int repeats)
+{
+	BVHBenchmark results = {};
+	results.Count = count;
+
+	// The same kind of scene as BenchmarkFrustumCulling(): a camera at the
+	// origin looking down +Z, with objects all around it
+	XMFLOAT4X4 view, projection;
+	XMStoreFloat4x4(&view, XMMatrixLookToLH(XMVectorZero(), XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0)));
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, 16.0f / 9.0f, 0.1f, 500.0f));
+	FrustumPlanes frustum = ExtractFrustumPlanes(view, projection);
+
+	std::mt19937 random(18);
+	std::uniform_real_distribution<float> positions(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> sizes(0.1f, 5.0f);
+	std::uniform_real_distribution<float> angles(0.0f, XM_2PI);
+	std::vector<WorldBounds> bounds(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		MeshBounds local;
+		XMFLOAT3 halfSize(sizes(random), sizes(random), sizes(random));
+		local.Min = XMFLOAT3(-halfSize.x, -halfSize.y, -halfSize.z);
+		local.Max = halfSize;
+		local.Center = XMFLOAT3(0, 0, 0);
+		local.Radius = sqrtf(halfSize.x * halfSize.x + halfSize.y * halfSize.y + halfSize.z * halfSize.z);
+
+		XMFLOAT4X4 world;
+		XMStoreFloat4x4(&world,
+			XMMatrixRotationRollPitchYaw(angles(random), angles(random), angles(random)) *
+			XMMatrixTranslation(positions(random), positions(random), positions(random)));
+		bounds[i] = TransformBounds(local, world);
+	}
+
+	BoundingVolumeHierarchy bvh;
+	std::chrono::high_resolution_clock::duration bestBuild = std::chrono::high_resolution_clock::duration::max();
+	for (int r = 0; r < repeats; r++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		bvh.Build(bounds.data(), count);
+		bestBuild = std::min(bestBuild, std::chrono::high_resolution_clock::now() - start);
+	}
+	results.NodeCount = bvh.GetNodeCount();
+
+	// One in ten objects nudged back and forth, like a mostly static scene
+	std::chrono::high_resolution_clock::duration bestRefit = std::chrono::high_resolution_clock::duration::max();
+	for (int r = 0; r < repeats; r++)
+	{
+		float offset = (r % 2 == 0) ? 0.5f : -0.5f;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < count; i += 10)
+		{
+			bounds[i].Center.x += offset;
+			bvh.Update(i, bounds[i]);
+		}
+		bvh.Refit();
+		bestRefit = std::min(bestRefit, std::chrono::high_resolution_clock::now() - start);
+	}
+	results.MovedCount = (count + 9) / 10;
+
+	// The tree against checking everything four at a time
+	FrustumCuller flat;
+	flat.Reserve(count);
+	for (const WorldBounds& objectBounds : bounds)
+		flat.Add(objectBounds);
+
+	std::vector<unsigned int> treeVisible, flatVisible;
+	std::chrono::high_resolution_clock::duration bestCull = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration bestFlatCull = bestCull;
+	for (int r = 0; r < repeats; r++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		bvh.Cull(frustum, treeVisible);
+		std::chrono::high_resolution_clock::time_point cullEnd = std::chrono::high_resolution_clock::now();
+		flat.Cull(frustum, flatVisible);
+		std::chrono::high_resolution_clock::time_point flatEnd = std::chrono::high_resolution_clock::now();
+
+		bestCull = std::min(bestCull, cullEnd - start);
+		bestFlatCull = std::min(bestFlatCull, flatEnd - cullEnd);
+	}
+	results.VisibleCount = (unsigned int)treeVisible.size();
+	std::sort(treeVisible.begin(), treeVisible.end());
+	results.CullMatches = treeVisible == flatVisible;
+
+	// Rays from near the camera in every direction
+	results.RayCount = 256;
+	std::uniform_real_distribution<float> directions(-1.0f, 1.0f);
+	std::vector<XMFLOAT3> origins(results.RayCount), rayDirections(results.RayCount);
+	for (unsigned int i = 0; i < results.RayCount; i++)
+	{
+		origins[i] = XMFLOAT3(directions(random) * 10.0f, directions(random) * 10.0f, directions(random) * 10.0f);
+		rayDirections[i] = XMFLOAT3(directions(random), directions(random), directions(random));
+	}
+
+	std::vector<BVHRayHit> treeHits(results.RayCount);
+	std::vector<bool> treeFound(results.RayCount);
+	std::chrono::high_resolution_clock::duration bestRays = std::chrono::high_resolution_clock::duration::max();
+	for (int r = 0; r < repeats; r++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < results.RayCount; i++)
+			treeFound[i] = bvh.Raycast(origins[i], rayDirections[i], 2000.0f, treeHits[i]);
+		bestRays = std::min(bestRays, std::chrono::high_resolution_clock::now() - start);
+	}
+
+	// Brute force is slow enough at a million objects that once is plenty
+	results.RaysMatch = true;
+	std::chrono::high_resolution_clock::time_point bruteStart = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < results.RayCount; i++)
+	{
+		XMFLOAT3 inverseDirection = InverseDirection(rayDirections[i]);
+		float nearest = 2000.0f;
+		bool found = false;
+		for (unsigned int object = 0; object < count; object++)
+		{
+			float distance;
+			if (RayHitsBounds(origins[i], inverseDirection, bounds[object], nearest, distance) && (!found || distance < nearest))
+			{
+				nearest = distance;
+				found = true;
+			}
+		}
+
+		// Ties can pick different objects, so compare how far away the hit is
+		if (found != treeFound[i] || (found && nearest != treeHits[i].Distance))
+			results.RaysMatch = false;
+	}
+	std::chrono::high_resolution_clock::duration bruteForce = std::chrono::high_resolution_clock::now() - bruteStart;
+
+	results.BuildMilliseconds = std::chrono::duration<double, std::milli>(bestBuild).count();
+	results.RefitMilliseconds = std::chrono::duration<double, std::milli>(bestRefit).count();
+	results.CullMilliseconds = std::chrono::duration<double, std::milli>(bestCull).count();
+	results.FlatCullMilliseconds = std::chrono::duration<double, std::milli>(bestFlatCull).count();
+	results.RayMicroseconds = std::chrono::duration<double, std::micro>(bestRays).count() / results.RayCount;
+	results.BruteForceRayMicroseconds = std::chrono::duration<double, std::micro>(bruteForce).count() / results.RayCount;
+	return results;
+}
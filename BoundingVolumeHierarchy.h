@@ -0,0 +1,145 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+#include "Frustum.h"
+
+// Most objects a leaf holds
+#define BVH_LEAF_SIZE 4
+
+// The nearest object a ray hit
+struct BVHRayHit
+{
+	unsigned int Object;	// Index the object was built with
+	float Distance;			// Along the ray, in units of its direction's length
+};
+
+// --------------------------------------------------------
+// A tree of boxes over lots of objects' WorldBounds, for
+// culling and ray queries that don't look at every object
+//
+// Build() makes a linear BVH: each object's center gets a
+// 30 bit Morton code within the scene's box, the codes get
+// radix sorted, and every node splits its run of codes
+// where their highest differing bit flips.  That's quick
+// enough to rebuild tens of thousands of objects every
+// frame, and every node covers a contiguous run of the sorted
+// objects, so a node that's entirely in view hands back
+// its whole run without visiting anything below it.
+//
+// Nodes are stored depth first, so a node's left child
+// comes right after it and its parent always comes before
+// it.  Update() changes an object's bounds and marks its
+// leaf, and Refit() grows or shrinks the boxes of just the
+// marked nodes and their parents, children before parents,
+// with one bit per node like TransformSystem.  The tree's
+// shape doesn't change, so after things have moved a long
+// way Build() again to get tight boxes back.
+//
+// Only uses DirectXMath and the standard library.
+// --------------------------------------------------------
+class BoundingVolumeHierarchy
+{
+public:
+	BoundingVolumeHierarchy();
+
+	/// <summary>
+	/// Throws out the old tree and builds one over these objects
+	/// </summary>
+	/// <param name="bounds">One per object, indexed the same as everything the queries hand back</param>
+	void Build(const WorldBounds* bounds, unsigned int count);
+
+	/// <summary>
+	/// Changes an object's bounds. Nothing above it changes until Refit().
+	/// </summary>
+	void Update(unsigned int object, const WorldBounds& bounds);
+
+	/// <summary>
+	/// Fixes the boxes of every node above an object that changed since the last call
+	/// </summary>
+	/// <returns>How many nodes were refit</returns>
+	unsigned int Refit();
+
+	/// <summary>
+	/// Finds every object at least partly inside the frustum, with the same test as FrustumCuller
+	/// </summary>
+	/// <param name="visible">Gets replaced with the indices of the visible objects, in no particular order</param>
+	/// <returns>How many objects are visible</returns>
+	unsigned int Cull(const FrustumPlanes& frustum, std::vector<unsigned int>& visible);
+
+	/// <summary>
+	/// Finds the nearest object whose box the ray hits. Only the bounds are tested, not the meshes inside them.
+	/// </summary>
+	/// <param name="direction">Doesn't need to be normalized</param>
+	/// <param name="maxDistance">How far along the ray to look, in units of the direction's length</param>
+	/// <returns>False if the ray missed everything</returns>
+	bool Raycast(DirectX::XMFLOAT3 origin, DirectX::XMFLOAT3 direction, float maxDistance, BVHRayHit& hit);
+
+	unsigned int GetObjectCount();
+	unsigned int GetNodeCount();
+
+	/// <summary>
+	/// Gets an object's bounds, as of its last Build() or Update()
+	/// </summary>
+	const WorldBounds& GetBounds(unsigned int object);
+
+private:
+
+	struct Node
+	{
+		DirectX::XMFLOAT3 Min;
+		unsigned int First;		// First of this node's run of sorted objects
+		DirectX::XMFLOAT3 Max;
+		unsigned int Count;		// How many objects are in the run
+		unsigned int Right;		// Index of the right child (the left one is next), or 0 for a leaf
+	};
+
+	unsigned int BuildNode(unsigned int first, unsigned int count, unsigned int parent);
+	unsigned int FindSplit(unsigned int first, unsigned int count);
+	void FitNode(unsigned int node);
+	void AddRun(unsigned int first, unsigned int count, std::vector<unsigned int>& visible);
+
+	std::vector<Node> nodes;
+	std::vector<unsigned int> parents;
+
+	// Everything about objects is kept in Morton order, so the objects
+	// of a node sit next to each other in memory
+	std::vector<unsigned int> codes;
+	std::vector<unsigned int> objects;		// Sorted position -> object index
+	std::vector<unsigned int> positions;	// Object index -> sorted position
+	std::vector<unsigned int> leaves;		// Object index -> the leaf it's in
+	std::vector<WorldBounds> sortedBounds;
+
+	// One bit per node, 64 to a word, for Refit()
+	std::vector<unsigned long long> dirtyNodes;
+	bool anyDirty;
+
+	// Scratch space for Build()'s sort
+	std::vector<unsigned int> scratchCodes;
+	std::vector<unsigned int> scratchObjects;
+};
+
+// Results of building and querying a BVH over a big made up scene, against doing the same without one
+struct BVHBenchmark
+{
+	unsigned int Count;					// How many objects
+	unsigned int NodeCount;				// How many nodes the tree came out with
+	double BuildMilliseconds;			// Build()
+	unsigned int MovedCount;			// How many objects moved before the refit
+	double RefitMilliseconds;			// Update() for each of those, then Refit()
+	unsigned int VisibleCount;			// How many objects the frustum query found
+	double CullMilliseconds;			// Cull() on the tree
+	double FlatCullMilliseconds;		// FrustumCuller::Cull() on the same bounds, four at a time
+	bool CullMatches;					// Both should find the same objects
+	unsigned int RayCount;				// How many rays were cast
+	double RayMicroseconds;				// Per ray, Raycast() on the tree
+	double BruteForceRayMicroseconds;	// Per ray, testing every object's box
+	bool RaysMatch;						// Both should hit the same objects at the same distances
+};
+
+/// <summary>
+/// Builds, refits and queries a BVH over objects scattered around a camera, and checks it against brute force
+/// </summary>
+/// <param name="count">How many objects</param>
+/// <param name="repeats">How many times to time each step (the fastest one counts)</param>
+BVHBenchmark BenchmarkBoundingVolumeHierarchy(unsigned int count, int repeats);
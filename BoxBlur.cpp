@@ -0,0 +1,269 @@
+#include "BoxBlur.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+	// Where a pass walks: lines of pixels, each length long, with pixels
+	// step apart along a line and lines lineStep apart
+	struct PassLayout
+	{
+		unsigned int Lines;
+		int Length;
+		size_t Step;
+		size_t LineStep;
+	};
+
+	PassLayout GetPassLayout(const BlurImage& image, bool vertical)
+	{
+		if (vertical)
+			return { image.Width, (int)image.Height, image.Width, 1 };
+		return { image.Height, (int)image.Width, 1, image.Width };
+	}
+
+	void MatchSize(const BlurImage& source, BlurImage& destination)
+	{
+		destination.Width = source.Width;
+		destination.Height = source.Height;
+		destination.Pixels.resize(source.Pixels.size());
+	}
+
+	// Largest difference in any channel of any pixel
+	float MaxDifference(const BlurImage& a, const BlurImage& b)
+	{
+		float difference = 0.0f;
+		for (size_t i = 0; i < a.Pixels.size(); i++)
+		{
+			difference = std::max(difference, fabsf(a.Pixels[i].x - b.Pixels[i].x));
+			difference = std::max(difference, fabsf(a.Pixels[i].y - b.Pixels[i].y));
+			difference = std::max(difference, fabsf(a.Pixels[i].z - b.Pixels[i].z));
+			difference = std::max(difference, fabsf(a.Pixels[i].w - b.Pixels[i].w));
+		}
+		return difference;
+	}
+
+	BlurImage MakeNoise(unsigned int width, unsigned int height, std::mt19937& random)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		BlurImage image = { width, height, {} };
+		image.Pixels.resize((size_t)width * height);
+		for (XMFLOAT4& pixel : image.Pixels)
+			pixel = XMFLOAT4(unit(random), unit(random), unit(random), unit(random));
+		return image;
+	}
+}
+
+void BoxBlurReference(const BlurImage& source, int radius, BlurImage& destination)
+{
+	MatchSize(source, destination);
+	int width = (int)source.Width;
+	int height = (int)source.Height;
+	float sampleCount = (float)((2 * radius + 1) * (2 * radius + 1));
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			XMFLOAT4 total(0, 0, 0, 0);
+			for (int offsetX = -radius; offsetX <= radius; offsetX++)
+			{
+				for (int offsetY = -radius; offsetY <= radius; offsetY++)
+				{
+					int sampleX = std::min(std::max(x + offsetX, 0), width - 1);
+					int sampleY = std::min(std::max(y + offsetY, 0), height - 1);
+					const XMFLOAT4& sample = source.Pixels[(size_t)sampleY * width + sampleX];
+					total.x += sample.x;
+					total.y += sample.y;
+					total.z += sample.z;
+					total.w += sample.w;
+				}
+			}
+			destination.Pixels[(size_t)y * width + x] =
+				XMFLOAT4(total.x / sampleCount, total.y / sampleCount, total.z / sampleCount, total.w / sampleCount);
+		}
+	}
+}
+
+void BoxBlurPass(const BlurImage& source, int radius, bool vertical, BlurImage& destination)
+{
+	MatchSize(source, destination);
+	PassLayout layout = GetPassLayout(source, vertical);
+	XMVECTOR scale = XMVectorReplicate(1.0f / (2 * radius + 1));
+
+	for (unsigned int line = 0; line < layout.Lines; line++)
+	{
+		const XMFLOAT4* in = source.Pixels.data() + line * layout.LineStep;
+		XMFLOAT4* out = destination.Pixels.data() + line * layout.LineStep;
+		for (int i = 0; i < layout.Length; i++)
+		{
+			XMVECTOR total = XMVectorZero();
+			if (i - radius >= 0 && i + radius < layout.Length)
+			{
+				// Nowhere near an edge, so nothing to clamp
+				const XMFLOAT4* sample = in + (i - radius) * layout.Step;
+				for (int k = -radius; k <= radius; k++, sample += layout.Step)
+					total += XMLoadFloat4(sample);
+			}
+			else
+			{
+				for (int k = -radius; k <= radius; k++)
+					total += XMLoadFloat4(in + std::min(std::max(i + k, 0), layout.Length - 1) * layout.Step);
+			}
+			XMStoreFloat4(out + i * layout.Step, total * scale);
+		}
+	}
+}
+
+void BoxBlurSeparable(const BlurImage& source, int radius, BlurImage& scratch, BlurImage& destination)
+{
+	BoxBlurPass(source, radius, false, scratch);
+	BoxBlurPass(scratch, radius, true, destination);
+}
+
+void SlidingBoxBlurPass(const BlurImage& source, int radius, bool vertical, BlurImage& destination)
+{
+	MatchSize(source, destination);
+	PassLayout layout = GetPassLayout(source, vertical);
+	XMVECTOR scale = XMVectorReplicate(1.0f / (2 * radius + 1));
+
+	for (unsigned int line = 0; line < layout.Lines; line++)
+	{
+		const XMFLOAT4* in = source.Pixels.data() + line * layout.LineStep;
+		XMFLOAT4* out = destination.Pixels.data() + line * layout.LineStep;
+
+		// Each segment starts its own sum, like each thread in the compute shader,
+		// which also keeps the running sums from drifting along long lines
+		for (int first = 0; first < layout.Length; first += BLUR_SEGMENT_LENGTH)
+		{
+			XMVECTOR total = XMVectorZero();
+			for (int k = -radius; k <= radius; k++)
+				total += XMLoadFloat4(in + std::min(std::max(first + k, 0), layout.Length - 1) * layout.Step);
+			XMStoreFloat4(out + first * layout.Step, total * scale);
+
+			int end = std::min(first + BLUR_SEGMENT_LENGTH, layout.Length);
+			for (int i = first + 1; i < end; i++)
+			{
+				XMVECTOR entering = XMLoadFloat4(in + std::min(i + radius, layout.Length - 1) * layout.Step);
+				XMVECTOR leaving = XMLoadFloat4(in + std::max(i - radius - 1, 0) * layout.Step);
+				total += entering - leaving;
+				XMStoreFloat4(out + i * layout.Step, total * scale);
+			}
+		}
+	}
+}
+
+void SlidingBoxBlur(const BlurImage& source, int radius, BlurImage& scratch, BlurImage& destination)
+{
+	SlidingBoxBlurPass(source, radius, false, scratch);
+	SlidingBoxBlurPass(scratch, radius, true, destination);
+}
+
+BoxBlurChecks CheckBoxBlur()
+{
+	BoxBlurChecks results = {};
+	BlurImage scratch, separable, sliding, reference;
+
+	// Checks one blurred pixel's red against what it should be, for every way of blurring
+	auto allEqual = [&](unsigned int x, unsigned int y, float expected) {
+		size_t i = (size_t)y * reference.Width + x;
+		return fabsf(reference.Pixels[i].x - expected) < 1e-6f &&
+			fabsf(separable.Pixels[i].x - expected) < 1e-6f &&
+			fabsf(sliding.Pixels[i].x - expected) < 1e-6f;
+	};
+	auto blurEveryWay = [&](const BlurImage& image, int radius) {
+		BoxBlurReference(image, radius, reference);
+		BoxBlurSeparable(image, radius, scratch, separable);
+		SlidingBoxBlur(image, radius, scratch, sliding);
+	};
+
+	// One white pixel in the middle of a 9x9 image, blurred by 1,
+	// covers the 3x3 around it with a ninth each and leaves the rest black
+	BlurImage impulse = { 9, 9, {} };
+	impulse.Pixels.assign(81, XMFLOAT4(0, 0, 0, 0));
+	impulse.Pixels[4 * 9 + 4] = XMFLOAT4(1, 1, 1, 1);
+	blurEveryWay(impulse, 1);
+	results.ImpulseGolden = true;
+	for (unsigned int y = 0; y < 9; y++)
+	{
+		for (unsigned int x = 0; x < 9; x++)
+		{
+			bool inBox = x >= 3 && x <= 5 && y >= 3 && y <= 5;
+			results.ImpulseGolden = results.ImpulseGolden && allEqual(x, y, inBox ? 1.0f / 9.0f : 0.0f);
+		}
+	}
+
+	// One in the top left corner gets sampled by every clamped coordinate
+	// past the edges: four times for itself, twice for its neighbours
+	BlurImage corner = impulse;
+	corner.Pixels.assign(81, XMFLOAT4(0, 0, 0, 0));
+	corner.Pixels[0] = XMFLOAT4(1, 1, 1, 1);
+	blurEveryWay(corner, 1);
+	results.CornerGolden =
+		allEqual(0, 0, 4.0f / 9.0f) && allEqual(1, 0, 2.0f / 9.0f) && allEqual(0, 1, 2.0f / 9.0f) &&
+		allEqual(1, 1, 1.0f / 9.0f) && allEqual(2, 0, 0.0f) && allEqual(2, 2, 0.0f);
+
+	// Noise with sides that aren't a multiple of anything, so segments end partway along lines.
+	// The reference adds up to 141 x 141 samples one at a time, so it's only good to about 1e-5 itself.
+	std::mt19937 random(25);
+	BlurImage noise = MakeNoise(197, 61, random);
+	blurEveryWay(noise, 0);
+	results.RadiusZeroCopies = MaxDifference(noise, reference) == 0.0f &&
+		MaxDifference(noise, separable) == 0.0f && MaxDifference(noise, sliding) < 1e-6f;
+
+	for (int radius : { 1, 5, 16, 70 })
+	{
+		blurEveryWay(noise, radius);
+		results.MaxSeparableError = std::max(results.MaxSeparableError, MaxDifference(reference, separable));
+		results.MaxSlidingError = std::max(results.MaxSlidingError, MaxDifference(reference, sliding));
+	}
+	results.SeparableMatches = results.MaxSeparableError < 1e-4f;
+	results.SlidingMatches = results.MaxSlidingError < 1e-4f;
+
+	// Rows as wide as a 4K screen, where a sum slid all the way along would wander off
+	BlurImage wide = MakeNoise(3840, 4, random);
+	BoxBlurSeparable(wide, 16, scratch, separable);
+	SlidingBoxBlur(wide, 16, scratch, sliding);
+	results.SlidingDoesntDrift = MaxDifference(separable, sliding) < 1e-5f;
+
+	return results;
+}
+
+BoxBlurBenchmark BenchmarkBoxBlur(unsigned int width, unsigned int height, int radius, int repeats)
+{
+	BoxBlurBenchmark results = {};
+	results.Width = width;
+	results.Height = height;
+	results.Radius = radius;
+
+	std::mt19937 random(25);
+	BlurImage image = MakeNoise(width, height, random);
+	BlurImage scratch, reference, separable, sliding;
+
+	std::chrono::high_resolution_clock::duration referenceTime = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration separableTime = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration slidingTime = std::chrono::high_resolution_clock::duration::max();
+	for (int r = 0; r < repeats; r++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		BoxBlurReference(image, radius, reference);
+		referenceTime = std::min(referenceTime, std::chrono::high_resolution_clock::now() - start);
+
+		start = std::chrono::high_resolution_clock::now();
+		BoxBlurSeparable(image, radius, scratch, separable);
+		separableTime = std::min(separableTime, std::chrono::high_resolution_clock::now() - start);
+
+		start = std::chrono::high_resolution_clock::now();
+		SlidingBoxBlur(image, radius, scratch, sliding);
+		slidingTime = std::min(slidingTime, std::chrono::high_resolution_clock::now() - start);
+	}
+	results.ReferenceMilliseconds = std::chrono::duration<double, std::milli>(referenceTime).count();
+	results.SeparableMilliseconds = std::chrono::duration<double, std::milli>(separableTime).count();
+	results.SlidingMilliseconds = std::chrono::duration<double, std::milli>(slidingTime).count();
+	results.MaxError = std::max(MaxDifference(reference, separable), MaxDifference(reference, sliding));
+	return results;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+// How many pixels of a row or column each thread of BlurComputeShader.hlsl
+// slides its window across. Matches BLUR_SEGMENT_LENGTH there.
+#define BLUR_SEGMENT_LENGTH 32
+
+// An RGBA image in floats, row by row from the top
+struct BlurImage
+{
+	unsigned int Width;
+	unsigned int Height;
+	std::vector<DirectX::XMFLOAT4> Pixels;
+};
+
+// --------------------------------------------------------
+// CPU versions of the post process blurs, for checking the
+// shaders against and timing them without a GPU
+//
+// Every one of them is the same box blur: the average of the
+// (2r+1) x (2r+1) pixels around each pixel, with coordinates
+// past the edges clamped to the nearest edge pixel, which is
+// what the clamp sampler did in the original pixel shader.
+//
+// BoxBlurReference() is that shader, one sample at a time.
+// A box is separable, so BoxBlurSeparable() does a row of
+// 2r+1 samples, then a column of them over the result, like
+// PostProcessPixelShader.hlsl's two passes.  SlidingBoxBlur()
+// does the same two passes like BlurComputeShader.hlsl: each
+// run of BLUR_SEGMENT_LENGTH pixels sums its first window,
+// then slides it along by adding the pixel coming in and
+// taking away the one going out, so it costs about the same
+// for any radius.  The passes work on whole pixels at once
+// with DirectXMath.
+// --------------------------------------------------------
+
+/// <summary>
+/// Averages every pixel's whole (2r+1) x (2r+1) box, like the original post process
+/// </summary>
+void BoxBlurReference(const BlurImage& source, int radius, BlurImage& destination);
+
+/// <summary>
+/// Averages 2r+1 pixels along each row (or column), like one pass of PostProcessPixelShader.hlsl
+/// </summary>
+void BoxBlurPass(const BlurImage& source, int radius, bool vertical, BlurImage& destination);
+
+/// <summary>
+/// A row pass, then a column pass
+/// </summary>
+/// <param name="scratch">Holds the row pass, so it can be reused from call to call</param>
+void BoxBlurSeparable(const BlurImage& source, int radius, BlurImage& scratch, BlurImage& destination);
+
+/// <summary>
+/// Same as BoxBlurPass(), with a running sum slid along each segment, like one dispatch of BlurComputeShader.hlsl
+/// </summary>
+void SlidingBoxBlurPass(const BlurImage& source, int radius, bool vertical, BlurImage& destination);
+
+/// <summary>
+/// A sliding row pass, then a sliding column pass
+/// </summary>
+/// <param name="scratch">Holds the row pass, so it can be reused from call to call</param>
+void SlidingBoxBlur(const BlurImage& source, int radius, BlurImage& scratch, BlurImage& destination);
+
+// Results of checking the blurs against each other and against blurs worked out by hand
+struct BoxBlurChecks
+{
+	bool ImpulseGolden;			// A lone pixel in the middle spreads evenly over its box, for all three
+	bool CornerGolden;			// ...and a lone pixel in a corner counts once for every clamped sample that lands on it
+	bool RadiusZeroCopies;		// A radius of 0 leaves the image alone (the sliding sums to within rounding)
+	bool SeparableMatches;		// BoxBlurSeparable() matches BoxBlurReference() on noise, for small, large and bigger-than-the-image radii
+	bool SlidingMatches;		// ...and so does SlidingBoxBlur()
+	bool SlidingDoesntDrift;	// The running sums stay close along rows as wide as 4K
+	float MaxSeparableError;	// Biggest difference from BoxBlurReference() in any channel
+	float MaxSlidingError;
+};
+
+/// <summary>
+/// Runs the blurs over made up images with known answers, and over noise against each other
+/// </summary>
+BoxBlurChecks CheckBoxBlur();
+
+// Results of blurring the same image every way
+struct BoxBlurBenchmark
+{
+	unsigned int Width;
+	unsigned int Height;
+	int Radius;
+	double ReferenceMilliseconds;	// BoxBlurReference()
+	double SeparableMilliseconds;	// BoxBlurSeparable()
+	double SlidingMilliseconds;		// SlidingBoxBlur()
+	float MaxError;					// Biggest difference from BoxBlurReference() for either of the others
+};
+
+/// <summary>
+/// Blurs an image of noise every way
+/// </summary>
+/// <param name="repeats">How many times to blur it each way (the fastest one counts)</param>
+BoxBlurBenchmark BenchmarkBoxBlur(unsigned int width, unsigned int height, int radius, int repeats);
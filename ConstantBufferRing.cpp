@@ -0,0 +1,239 @@
+#include "ConstantBufferRing.h"
+
+ConstantBufferRing::ConstantBufferRing(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, unsigned int size,
+	std::shared_ptr<RenderStateCache> stateCache)
+	: allocator(size, CONSTANT_BUFFER_RING_ALIGNMENT)
+{
+	this->device = device;
+	this->context = context;
+	this->stateCache = stateCache;
+	mappedData = 0;
+	mappedBefore = false;
+	frameNumber = 0;
+	fallbackBufferSize = 0;
+
+	supported = IsSupported(device) && SUCCEEDED(context.As(&context1));
+	CreateBuffer(size);
+}
+
+bool ConstantBufferRing::IsSupported(Microsoft::WRL::ComPtr<ID3D11Device> device)
+{
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+	if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))))
+		return false;
+
+	return options.ConstantBufferOffsetting && options.MapNoOverwriteOnDynamicConstantBuffer;
+}
+
+void ConstantBufferRing::CreateBuffer(unsigned int size)
+{
+	allocator.Reset(size);
+	size = allocator.GetSize();
+
+	// Whatever the old buffer's frames were waiting on doesn't matter to the new one
+	while (!pendingFences.empty())
+	{
+		freeQueries.push_back(pendingFences.front().Query);
+		pendingFences.pop_front();
+	}
+
+	if (!supported)
+	{
+		fallbackData.resize(size);
+		return;
+	}
+
+	D3D11_BUFFER_DESC desc = {};
+	desc.ByteWidth = size;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	buffer.Reset();
+	device->CreateBuffer(&desc, 0, buffer.GetAddressOf());
+	mappedBefore = false;
+}
+
+bool ConstantBufferRing::RetireFinishedFrames(bool wait)
+{
+	unsigned long long completedFence = 0;
+	bool anyCompleted = false;
+
+	// Queries finish in the order they were issued
+	while (!pendingFences.empty())
+	{
+		ID3D11Query* query = pendingFences.front().Query.Get();
+		HRESULT hr = context->GetData(query, 0, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH);
+
+		// When out of room, wait for the oldest frame (flushing so it
+		// actually gets there), which is usually enough to make some
+		if (hr == S_FALSE && wait)
+		{
+			while ((hr = context->GetData(query, 0, 0, 0)) == S_FALSE) {}
+			wait = false;
+		}
+		if (hr != S_OK)
+			break;
+
+		completedFence = pendingFences.front().Fence;
+		anyCompleted = true;
+		freeQueries.push_back(pendingFences.front().Query);
+		pendingFences.pop_front();
+	}
+
+	if (anyCompleted)
+		allocator.Retire(completedFence);
+	return anyCompleted;
+}
+
+void ConstantBufferRing::BeginFrame(unsigned int expectedBytes)
+{
+	RetireFinishedFrames(false);
+
+	// Grow if a few frames of this wouldn't fit
+	unsigned long long needed = (unsigned long long)expectedBytes * CONSTANT_BUFFER_RING_FRAMES;
+	if (needed > allocator.GetSize())
+	{
+		unsigned long long newSize = allocator.GetSize();
+		while (newSize < needed)
+			newSize *= 2;
+		CreateBuffer((unsigned int)newSize);
+	}
+
+	if (!supported)
+	{
+		mappedData = fallbackData.data();
+		return;
+	}
+
+	// Everything the allocator hands out is free of GPU reads, so
+	// there's no need to discard, except the first time
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	context->Map(buffer.Get(), 0, mappedBefore ? D3D11_MAP_WRITE_NO_OVERWRITE : D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+	mappedData = (unsigned char*)mapped.pData;
+	mappedBefore = true;
+}
+
+ConstantBufferSlot ConstantBufferRing::Allocate(unsigned int size)
+{
+	unsigned int offset = allocator.Allocate(size);
+	while (offset == RING_ALLOCATION_FAILED && RetireFinishedFrames(true))
+	{
+		offset = allocator.Allocate(size);
+	}
+
+	// Still no room means this frame alone filled the ring,
+	// which BeginFrame() growing it should have prevented
+	ConstantBufferSlot slot = {};
+	if (offset == RING_ALLOCATION_FAILED || mappedData == 0)
+		return slot;
+
+	slot.Data = mappedData + offset;
+	slot.FirstConstant = offset / 16;
+	slot.NumConstants = (size + CONSTANT_BUFFER_RING_ALIGNMENT - 1) / CONSTANT_BUFFER_RING_ALIGNMENT * CONSTANT_BUFFER_RING_ALIGNMENT / 16;
+	return slot;
+}
+
+void ConstantBufferRing::EndWrites()
+{
+	if (supported && mappedData)
+		context->Unmap(buffer.Get(), 0);
+	mappedData = 0;
+}
+
+void ConstantBufferRing::BindVertexShader(unsigned int slotRegister, const ConstantBufferSlot& slot)
+{
+	if (slot.NumConstants == 0)
+		return;
+
+	if (supported)
+	{
+		if (stateCache)
+			stateCache->VSSetConstantBuffer(slotRegister, buffer.Get(), slot.FirstConstant, slot.NumConstants);
+		else
+			context1->VSSetConstantBuffers1(slotRegister, 1, buffer.GetAddressOf(), &slot.FirstConstant, &slot.NumConstants);
+	}
+	else
+	{
+		// Uploading renames the buffer, so it stays bound if it already was
+		ID3D11Buffer* uploaded = Upload(slot);
+		if (stateCache)
+			stateCache->VSSetConstantBuffer(slotRegister, uploaded);
+		else
+			context->VSSetConstantBuffers(slotRegister, 1, &uploaded);
+	}
+}
+
+void ConstantBufferRing::BindPixelShader(unsigned int slotRegister, const ConstantBufferSlot& slot)
+{
+	if (slot.NumConstants == 0)
+		return;
+
+	if (supported)
+	{
+		if (stateCache)
+			stateCache->PSSetConstantBuffer(slotRegister, buffer.Get(), slot.FirstConstant, slot.NumConstants);
+		else
+			context1->PSSetConstantBuffers1(slotRegister, 1, buffer.GetAddressOf(), &slot.FirstConstant, &slot.NumConstants);
+	}
+	else
+	{
+		ID3D11Buffer* uploaded = Upload(slot);
+		if (stateCache)
+			stateCache->PSSetConstantBuffer(slotRegister, uploaded);
+		else
+			context->PSSetConstantBuffers(slotRegister, 1, &uploaded);
+	}
+}
+
+ID3D11Buffer* ConstantBufferRing::Upload(const ConstantBufferSlot& slot)
+{
+	unsigned int size = slot.NumConstants * 16;
+	if (size > fallbackBufferSize)
+	{
+		D3D11_BUFFER_DESC desc = {};
+		desc.ByteWidth = size;
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		fallbackBuffer.Reset();
+		device->CreateBuffer(&desc, 0, fallbackBuffer.GetAddressOf());
+		fallbackBufferSize = size;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	context->Map(fallbackBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+	memcpy(mapped.pData, fallbackData.data() + slot.FirstConstant * 16, size);
+	context->Unmap(fallbackBuffer.Get(), 0);
+	return fallbackBuffer.Get();
+}
+
+void ConstantBufferRing::EndFrame()
+{
+	// The query finishes once the GPU gets through everything before it
+	Microsoft::WRL::ComPtr<ID3D11Query> query;
+	if (!freeQueries.empty())
+	{
+		query = freeQueries.back();
+		freeQueries.pop_back();
+	}
+	else
+	{
+		D3D11_QUERY_DESC desc = {};
+		desc.Query = D3D11_QUERY_EVENT;
+		if (FAILED(device->CreateQuery(&desc, query.GetAddressOf())))
+			return;
+	}
+	context->End(query.Get());
+
+	frameNumber++;
+	FrameFence fence = {};
+	fence.Query = query;
+	fence.Fence = frameNumber;
+	pendingFences.push_back(fence);
+	allocator.EndFrame(frameNumber);
+}
+
+unsigned int ConstantBufferRing::GetSize()
+{
+	return allocator.GetSize();
+}
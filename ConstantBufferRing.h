@@ -0,0 +1,117 @@
+#pragma once
+
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <deque>
+#include <vector>
+#include <memory>
+#include "RingAllocator.h"
+#include "RenderStateCache.h"
+
+// Constant buffer offsets and sizes are counted in 16 byte constants, 16 of them at a time
+#define CONSTANT_BUFFER_RING_ALIGNMENT 256
+
+// How many frames the CPU can get ahead of the GPU before it waits
+#define CONSTANT_BUFFER_RING_FRAMES 3
+
+// Part of the ring's buffer handed out by ConstantBufferRing::Allocate()
+struct ConstantBufferSlot
+{
+	void* Data;					// Where to write the constants, until EndWrites()
+	unsigned int FirstConstant;	// Offset into the buffer, in 16 byte constants
+	unsigned int NumConstants;	// Size, in 16 byte constants
+};
+
+// --------------------------------------------------------
+// One big dynamic constant buffer that per-object data is
+// sub-allocated from, instead of a buffer update per draw
+//
+// Every frame: BeginFrame() maps the buffer once, Allocate()
+// hands out slots to write each object's constants into,
+// EndWrites() unmaps it, Bind*() points a shader register at
+// a slot for each draw, and EndFrame() drops an event query
+// in as the fence that says when the GPU is done with it.
+//
+// RingAllocator keeps track of which parts the GPU might
+// still be reading. Binding part of a buffer needs D3D11.1's
+// VSSetConstantBuffers1(), so without it (IsSupported()) the
+// slots live in CPU memory and every Bind*() uploads its slot
+// into a small buffer the old way.
+//
+// Given a RenderStateCache, slots are bound through it, so
+// a draw that uses the same slot as the last one (like the
+// same object in another pass) doesn't rebind it.
+// --------------------------------------------------------
+class ConstantBufferRing
+{
+public:
+	ConstantBufferRing(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, unsigned int size,
+		std::shared_ptr<RenderStateCache> stateCache = nullptr);
+
+	/// <summary>
+	/// Checks for the D3D11.1 features the ring needs: binding part of a constant buffer, and mapping one without discarding it
+	/// </summary>
+	static bool IsSupported(Microsoft::WRL::ComPtr<ID3D11Device> device);
+
+	/// <summary>
+	/// Frees everything the GPU has finished with and maps the buffer
+	/// </summary>
+	/// <param name="expectedBytes">About how much this frame will allocate, so the ring can grow first if it's too small</param>
+	void BeginFrame(unsigned int expectedBytes);
+
+	/// <summary>
+	/// Takes space for one set of constants. Waits on the GPU if every frame in flight is still using the ring.
+	/// </summary>
+	/// <param name="size">Size in bytes, which gets rounded up to a multiple of 256</param>
+	ConstantBufferSlot Allocate(unsigned int size);
+
+	/// <summary>
+	/// Unmaps the buffer, which has to happen before drawing with it
+	/// </summary>
+	void EndWrites();
+
+	/// <summary>
+	/// Binds a slot to a constant buffer register, after the shader itself is set
+	/// </summary>
+	void BindVertexShader(unsigned int slotRegister, const ConstantBufferSlot& slot);
+	void BindPixelShader(unsigned int slotRegister, const ConstantBufferSlot& slot);
+
+	/// <summary>
+	/// Marks the end of the GPU work that uses this frame's slots
+	/// </summary>
+	void EndFrame();
+
+	unsigned int GetSize();
+
+private:
+
+	void CreateBuffer(unsigned int size);
+	bool RetireFinishedFrames(bool wait);
+	ID3D11Buffer* Upload(const ConstantBufferSlot& slot);
+
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext1> context1;
+	std::shared_ptr<RenderStateCache> stateCache;
+	bool supported;
+
+	RingAllocator allocator;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> buffer;
+	unsigned char* mappedData;
+	bool mappedBefore;
+
+	// Event queries standing in for fences, oldest first, and ones ready for reuse
+	struct FrameFence
+	{
+		Microsoft::WRL::ComPtr<ID3D11Query> Query;
+		unsigned long long Fence;
+	};
+	std::deque<FrameFence> pendingFences;
+	std::vector<Microsoft::WRL::ComPtr<ID3D11Query>> freeQueries;
+	unsigned long long frameNumber;
+
+	// Without D3D11.1: where slots are written, and the buffer each Bind*() uploads to
+	std::vector<unsigned char> fallbackData;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> fallbackBuffer;
+	unsigned int fallbackBufferSize;
+};
@@ -2,10 +2,13 @@
 
 using namespace DirectX;
 
-Entity::Entity(shared_ptr<Mesh> _mesh)
+Entity::Entity(shared_ptr<Mesh> _mesh, shared_ptr<TransformSystem> _transforms, unsigned int parentTransformIndex)
 {
 	mesh = _mesh;
-	transform = make_shared<Transform>();
+	transforms = _transforms;
+	transformIndex = transforms->Create(parentTransformIndex);
+	occluder = false;
+	isStatic = false;
 }
 
 Entity::~Entity()
@@ -17,9 +20,9 @@ shared_ptr<Mesh> Entity::GetMesh()
 	return mesh;
 }
 
-shared_ptr<Transform> Entity::GetTransform()
+unsigned int Entity::GetTransformIndex()
 {
-	return transform;
+	return transformIndex;
 }
 
 shared_ptr<Material> Entity::GetMaterial()
@@ -32,25 +35,32 @@ void Entity::SetMaterial(shared_ptr<Material> _material)
 	material = _material;
 }
 
-void Entity::Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, shared_ptr<Camera> camera, XMFLOAT4X4 shadowViewMatrix, XMFLOAT4X4 shadowProjectionMatrix) {
-
-	material->PrepareMaterial();
-
-	std::shared_ptr<SimpleVertexShader> vs = material->GetVertexShader();
-	vs->SetMatrix4x4("worldMatrix", transform->GetWorldMatrix()); // match variable
-	vs->SetMatrix4x4("viewMatrix", camera->GetViewMatrix()); // names in your
-	vs->SetMatrix4x4("projectionMatrix", camera->GetProjectionMatrix()); // shaders cbuffer!
-	vs->SetMatrix4x4("worldInvTranspose", transform->GetWorldInverseTransposeMatrix());
+void Entity::SetOccluder(bool _occluder)
+{
+	occluder = _occluder;
+}
 
-	vs->SetMatrix4x4("lightView", shadowViewMatrix);
-	vs->SetMatrix4x4("lightProjection", shadowProjectionMatrix);
+bool Entity::IsOccluder()
+{
+	return occluder;
+}
 
-	vs->CopyAllBufferData();
+void Entity::SetStatic(bool _isStatic)
+{
+	isStatic = _isStatic;
+}
 
-	std::shared_ptr<SimplePixelShader> ps = material->GetPixelShader();
-	ps->SetFloat4("colorTint", material->GetColorTint());
+bool Entity::IsStatic()
+{
+	return isStatic;
+}
 
-	ps->CopyAllBufferData();
+void Entity::WriteInstance(void* destination)
+{
+	InstanceData instance;
+	instance.World = transforms->GetWorldMatrix(transformIndex);
+	instance.WorldInvTranspose = transforms->GetWorldInverseTransposeMatrix(transformIndex);
 
-	mesh->Draw();
+	// Written all at once, since the destination is probably write combined GPU memory
+	memcpy(destination, &instance, sizeof(InstanceData));
 }
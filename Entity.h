@@ -1,30 +1,60 @@
 #pragma once
 #include <memory>
 #include "Mesh.h"
-#include "Transform.h"
+#include "TransformSystem.h"
 #include "Camera.h"
 #include "Material.h"
 using namespace std;
 
+// One entity's slot in an InstanceBuffer, which matches InstanceInput in ObjectConstants.hlsli
+struct InstanceData
+{
+	XMFLOAT4X4 World;
+	XMFLOAT4X4 WorldInvTranspose;
+};
+
 
 class Entity
 {
 
 public:
-	Entity(shared_ptr<Mesh> _mesh);
+	Entity(shared_ptr<Mesh> _mesh, shared_ptr<TransformSystem> _transforms, unsigned int parentTransformIndex = TRANSFORM_NONE);
 	~Entity();
 
 	shared_ptr<Mesh> GetMesh();
-	shared_ptr<Transform> GetTransform();
+	unsigned int GetTransformIndex();
 	shared_ptr<Material> GetMaterial();
 	void SetMaterial(shared_ptr<Material> _material);
 
-	void Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, shared_ptr<Camera> camera, XMFLOAT4X4 shadowViewMatrix, XMFLOAT4X4 shadowProjectionMatrix);
+	/// <summary>
+	/// Marks this entity as something that hides whatever's behind it, in the occlusion buffer.
+	/// Its mesh has to fill its bounds, like a wall or a floor.
+	/// </summary>
+	void SetOccluder(bool _occluder);
+	bool IsOccluder();
+
+	/// <summary>
+	/// Marks this entity as something that never moves, so its shadow can be cached between frames.
+	/// If it does move, the shadow cache notices and draws every cascade again.
+	/// </summary>
+	void SetStatic(bool _isStatic);
+	bool IsStatic();
+
+	/// <summary>
+	/// Writes this entity's InstanceData, for an instanced draw of its mesh
+	/// </summary>
+	/// <param name="destination">Where to write it, like somewhere in a mapped InstanceBuffer</param>
+	void WriteInstance(void* destination);
 private:
 
 	shared_ptr<Mesh> mesh;
-	shared_ptr<Transform> transform;
+	// Where this entity's position, rotation and scale live
+	shared_ptr<TransformSystem> transforms;
+	unsigned int transformIndex;
 
 	shared_ptr<Material> material;
+
+	bool occluder;
+	bool isStatic;
 };
 
@@ -0,0 +1,248 @@
+#include "Frustum.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+FrustumPlanes ExtractFrustumPlanes(const XMFLOAT4X4& view, const XMFLOAT4X4& projection)
+{
+	XMFLOAT4X4 viewProjection;
+	XMStoreFloat4x4(&viewProjection, XMMatrixMultiply(XMLoadFloat4x4(&view), XMLoadFloat4x4(&projection)));
+	const XMFLOAT4X4& m = viewProjection;
+
+	// Points are row vectors, so clip space x, y, z and w are dot products
+	// with the matrix's columns. Each plane is one of -w <= x <= w,
+	// -w <= y <= w and 0 <= z <= w, rearranged to be >= 0.
+	XMVECTOR x = XMVectorSet(m._11, m._21, m._31, m._41);
+	XMVECTOR y = XMVectorSet(m._12, m._22, m._32, m._42);
+	XMVECTOR z = XMVectorSet(m._13, m._23, m._33, m._43);
+	XMVECTOR w = XMVectorSet(m._14, m._24, m._34, m._44);
+
+	XMVECTOR planes[6] = { w + x, w - x, w + y, w - y, z, w - z };
+
+	FrustumPlanes frustum;
+	for (int i = 0; i < 6; i++)
+		XMStoreFloat4(&frustum.Planes[i], XMPlaneNormalize(planes[i]));
+	return frustum;
+}
+
+WorldBounds TransformBounds(const MeshBounds& bounds, const XMFLOAT4X4& world)
+{
+	XMMATRIX worldMatrix = XMLoadFloat4x4(&world);
+	XMVECTOR center = XMVector3TransformCoord(XMLoadFloat3(&bounds.Center), worldMatrix);
+
+	// Each world axis of the box reaches as far as the absolute
+	// values of the matrix say the local axes push it
+	XMVECTOR halfSize = (XMLoadFloat3(&bounds.Max) - XMLoadFloat3(&bounds.Min)) * 0.5f;
+	XMVECTOR extents =
+		XMVectorAbs(worldMatrix.r[0]) * XMVectorSplatX(halfSize) +
+		XMVectorAbs(worldMatrix.r[1]) * XMVectorSplatY(halfSize) +
+		XMVectorAbs(worldMatrix.r[2]) * XMVectorSplatZ(halfSize);
+
+	float scale = sqrtf(std::max(std::max(
+		XMVectorGetX(XMVector3LengthSq(worldMatrix.r[0])),
+		XMVectorGetX(XMVector3LengthSq(worldMatrix.r[1]))),
+		XMVectorGetX(XMVector3LengthSq(worldMatrix.r[2]))));
+
+	WorldBounds result;
+	XMStoreFloat3(&result.Center, center);
+	XMStoreFloat3(&result.Extents, extents);
+	result.Radius = bounds.Radius * scale;
+	return result;
+}
+
+FrustumCuller::FrustumCuller()
+{
+	count = 0;
+}
+
+void FrustumCuller::Clear()
+{
+	count = 0;
+}
+
+void FrustumCuller::Reserve(unsigned int count)
+{
+	unsigned int padded = (count + 3) & ~3u;
+	for (std::vector<float>* component : { &centerX, &centerY, &centerZ, &radius, &extentX, &extentY, &extentZ })
+		component->reserve(padded);
+}
+
+unsigned int FrustumCuller::Add(const MeshBounds& bounds, const XMFLOAT4X4& world)
+{
+	return Add(TransformBounds(bounds, world));
+}
+
+unsigned int FrustumCuller::Add(const WorldBounds& bounds)
+{
+	// Grow every array by a whole block of four at a time
+	if (count == centerX.size())
+	{
+		unsigned int padded = count + 4;
+		for (std::vector<float>* component : { &centerX, &centerY, &centerZ, &radius, &extentX, &extentY, &extentZ })
+			component->resize(padded, 0.0f);
+	}
+
+	unsigned int index = count++;
+	centerX[index] = bounds.Center.x;
+	centerY[index] = bounds.Center.y;
+	centerZ[index] = bounds.Center.z;
+	radius[index] = bounds.Radius;
+	extentX[index] = bounds.Extents.x;
+	extentY[index] = bounds.Extents.y;
+	extentZ[index] = bounds.Extents.z;
+	return index;
+}
+
+unsigned int FrustumCuller::GetCount()
+{
+	return count;
+}
+
+unsigned int FrustumCuller::Cull(const FrustumPlanes& frustum, std::vector<unsigned int>& visible)
+{
+	visible.clear();
+
+	// Every plane's parts splatted across all four lanes, once
+	XMVECTOR normalX[6], normalY[6], normalZ[6], distance[6];
+	XMVECTOR absNormalX[6], absNormalY[6], absNormalZ[6];
+	for (int p = 0; p < 6; p++)
+	{
+		XMVECTOR plane = XMLoadFloat4(&frustum.Planes[p]);
+		normalX[p] = XMVectorSplatX(plane);
+		normalY[p] = XMVectorSplatY(plane);
+		normalZ[p] = XMVectorSplatZ(plane);
+		distance[p] = XMVectorSplatW(plane);
+		absNormalX[p] = XMVectorAbs(normalX[p]);
+		absNormalY[p] = XMVectorAbs(normalY[p]);
+		absNormalZ[p] = XMVectorAbs(normalZ[p]);
+	}
+
+	for (unsigned int first = 0; first < count; first += 4)
+	{
+		XMVECTOR x = XMLoadFloat4((const XMFLOAT4*)&centerX[first]);
+		XMVECTOR y = XMLoadFloat4((const XMFLOAT4*)&centerY[first]);
+		XMVECTOR z = XMLoadFloat4((const XMFLOAT4*)&centerZ[first]);
+		XMVECTOR r = XMLoadFloat4((const XMFLOAT4*)&radius[first]);
+		XMVECTOR ex = XMLoadFloat4((const XMFLOAT4*)&extentX[first]);
+		XMVECTOR ey = XMLoadFloat4((const XMFLOAT4*)&extentY[first]);
+		XMVECTOR ez = XMLoadFloat4((const XMFLOAT4*)&extentZ[first]);
+
+		XMVECTOR inside = XMVectorTrueInt();
+		for (int p = 0; p < 6; p++)
+		{
+			XMVECTOR centerDistance = XMVectorMultiplyAdd(normalZ[p], z, XMVectorMultiplyAdd(normalY[p], y, normalX[p] * x)) + distance[p];
+			XMVECTOR boxReach = XMVectorMultiplyAdd(absNormalZ[p], ez, XMVectorMultiplyAdd(absNormalY[p], ey, absNormalX[p] * ex));
+			XMVECTOR reach = XMVectorMin(r, boxReach);
+			inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(centerDistance + reach, XMVectorZero()));
+		}
+
+		// Most blocks of a big scene are all in or all out
+		if (XMVector4EqualInt(inside, XMVectorFalseInt()))
+			continue;
+
+		uint32_t lanes[4];
+		XMStoreInt4(lanes, inside);
+		unsigned int laneCount = std::min(4u, count - first);
+		for (unsigned int k = 0; k < laneCount; k++)
+		{
+			if (lanes[k])
+				visible.push_back(first + k);
+		}
+	}
+
+	return (unsigned int)visible.size();
+}
+
+unsigned int FrustumCuller::CullScalar(const FrustumPlanes& frustum, std::vector<unsigned int>& visible)
+{
+	visible.clear();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++)
+		{
+			const XMFLOAT4& plane = frustum.Planes[p];
+			float centerDistance = plane.z * centerZ[i] + (plane.y * centerY[i] + plane.x * centerX[i]) + plane.w;
+			float boxReach = fabsf(plane.z) * extentZ[i] + (fabsf(plane.y) * extentY[i] + fabsf(plane.x) * extentX[i]);
+			inside = centerDistance + std::min(radius[i], boxReach) >= 0.0f;
+		}
+
+		if (inside)
+			visible.push_back(i);
+	}
+
+	return (unsigned int)visible.size();
+}
+
+FrustumCullBenchmark BenchmarkFrustumCulling(unsigned int count, int repeats)
+{
+	FrustumCullBenchmark results = {};
+	results.Count = count;
+
+	// A camera at the origin looking down +Z, with a 90 degree field of view
+	XMFLOAT4X4 view, projection;
+	XMStoreFloat4x4(&view, XMMatrixLookToLH(XMVectorZero(), XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0)));
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, 16.0f / 9.0f, 0.1f, 500.0f));
+	FrustumPlanes frustum = ExtractFrustumPlanes(view, projection);
+
+	// Objects all around it, so most of them are behind or beside it
+	std::mt19937 random(17);
+	std::uniform_real_distribution<float> positions(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> sizes(0.1f, 5.0f);
+	std::uniform_real_distribution<float> angles(0.0f, XM_2PI);
+	std::vector<MeshBounds> bounds(count);
+	std::vector<XMFLOAT4X4> worlds(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		XMFLOAT3 halfSize(sizes(random), sizes(random), sizes(random));
+		bounds[i].Min = XMFLOAT3(-halfSize.x, -halfSize.y, -halfSize.z);
+		bounds[i].Max = halfSize;
+		bounds[i].Center = XMFLOAT3(0, 0, 0);
+		bounds[i].Radius = sqrtf(halfSize.x * halfSize.x + halfSize.y * halfSize.y + halfSize.z * halfSize.z);
+
+		XMMATRIX world =
+			XMMatrixScaling(sizes(random), sizes(random), sizes(random)) *
+			XMMatrixRotationRollPitchYaw(angles(random), angles(random), angles(random)) *
+			XMMatrixTranslation(positions(random), positions(random), positions(random));
+		XMStoreFloat4x4(&worlds[i], world);
+	}
+
+	FrustumCuller culler;
+	culler.Reserve(count);
+	std::vector<unsigned int> scalarVisible, simdVisible;
+	scalarVisible.reserve(count);
+	simdVisible.reserve(count);
+
+	std::chrono::high_resolution_clock::duration bestAdd = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration bestScalar = bestAdd;
+	std::chrono::high_resolution_clock::duration bestSimd = bestAdd;
+	for (int r = 0; r < repeats; r++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		culler.Clear();
+		for (unsigned int i = 0; i < count; i++)
+			culler.Add(bounds[i], worlds[i]);
+		std::chrono::high_resolution_clock::time_point addEnd = std::chrono::high_resolution_clock::now();
+
+		culler.CullScalar(frustum, scalarVisible);
+		std::chrono::high_resolution_clock::time_point scalarEnd = std::chrono::high_resolution_clock::now();
+
+		culler.Cull(frustum, simdVisible);
+		std::chrono::high_resolution_clock::time_point simdEnd = std::chrono::high_resolution_clock::now();
+
+		bestAdd = std::min(bestAdd, addEnd - start);
+		bestScalar = std::min(bestScalar, scalarEnd - addEnd);
+		bestSimd = std::min(bestSimd, simdEnd - scalarEnd);
+	}
+
+	results.VisibleCount = (unsigned int)simdVisible.size();
+	results.ResultsMatch = scalarVisible == simdVisible;
+	results.AddMilliseconds = std::chrono::duration<double, std::milli>(bestAdd).count();
+	results.ScalarMilliseconds = std::chrono::duration<double, std::milli>(bestScalar).count();
+	results.SimdMilliseconds = std::chrono::duration<double, std::milli>(bestSimd).count();
+	return results;
+}
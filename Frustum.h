@@ -0,0 +1,112 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+#include "MeshBounds.h"
+
+// The six planes of a view frustum, each as (normal, distance) with
+// the normal pointing inward and normalized, so a point p is inside
+// a plane when dot(normal, p) + distance >= 0.
+// In order: left, right, bottom, top, near, far.
+struct FrustumPlanes
+{
+	DirectX::XMFLOAT4 Planes[6];
+};
+
+// An object's bounds in world space: a box (which stays axis aligned, so
+// it grows when the object rotates) and a sphere, around the same center
+struct WorldBounds
+{
+	DirectX::XMFLOAT3 Center;
+	float Radius;
+	DirectX::XMFLOAT3 Extents;	// Half the box's size on each axis
+};
+
+/// <summary>
+/// Pulls the planes out of a view and projection matrix (Gribb and Hartmann), in world space
+/// </summary>
+FrustumPlanes ExtractFrustumPlanes(const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& projection);
+
+/// <summary>
+/// Moves a mesh's bounds into world space: the box with Arvo's method, and the sphere scaled by the most any axis is stretched
+/// </summary>
+WorldBounds TransformBounds(const MeshBounds& bounds, const DirectX::XMFLOAT4X4& world);
+
+// --------------------------------------------------------
+// World space bounds for lots of objects at once, tested
+// against a frustum four at a time
+//
+// Add() takes a mesh's bounds and its object's world matrix,
+// and keeps a world space center, sphere radius and box
+// extents, one array per component like TransformSystem.
+// Cull() then splats each plane once and tests blocks of
+// four objects with DirectXMath.
+//
+// Both volumes share a center (ComputeMeshBounds() puts the
+// sphere at the middle of the box), so each plane only needs
+// one distance: an object is outside a plane when its center
+// is further behind it than the smaller of the radius and
+// the box's reach towards the plane.  That's whichever of the
+// two volumes fits tighter in that direction, for about the
+// cost of a sphere test.
+//
+// Like any plane by plane test, something just outside a
+// corner of the frustum can still come back visible.
+// --------------------------------------------------------
+class FrustumCuller
+{
+public:
+	FrustumCuller();
+
+	void Clear();
+	void Reserve(unsigned int count);
+
+	/// <summary>
+	/// Adds an object's bounds, moved into world space
+	/// </summary>
+	/// <param name="bounds">Bounds in the mesh's own space, like Mesh::GetBounds()</param>
+	/// <returns>The object's index, which Cull() hands back if it's visible</returns>
+	unsigned int Add(const MeshBounds& bounds, const DirectX::XMFLOAT4X4& world);
+	unsigned int Add(const WorldBounds& bounds);
+	unsigned int GetCount();
+
+	/// <summary>
+	/// Finds every object at least partly inside the frustum, four at a time
+	/// </summary>
+	/// <param name="visible">Gets replaced with the indices of the visible objects, in order</param>
+	/// <returns>How many objects are visible</returns>
+	unsigned int Cull(const FrustumPlanes& frustum, std::vector<unsigned int>& visible);
+
+	/// <summary>
+	/// Same test and results as Cull(), one object at a time, for checking and timing it against
+	/// </summary>
+	unsigned int CullScalar(const FrustumPlanes& frustum, std::vector<unsigned int>& visible);
+
+private:
+
+	// One array per component, always a multiple of 4 long
+	// so Cull() can load any block of four
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> radius;
+	std::vector<float> extentX, extentY, extentZ;
+
+	unsigned int count;
+};
+
+// Results of culling a big made up scene both ways
+struct FrustumCullBenchmark
+{
+	unsigned int Count;			// How many objects
+	unsigned int VisibleCount;	// How many of them are in the frustum
+	double AddMilliseconds;		// Moving everything's bounds into world space with Add()
+	double ScalarMilliseconds;	// CullScalar()
+	double SimdMilliseconds;	// Cull()
+	bool ResultsMatch;			// Both should find exactly the same objects
+};
+
+/// <summary>
+/// Culls objects scattered around a camera, with random sizes, rotations and scales
+/// </summary>
+/// <param name="count">How many objects</param>
+/// <param name="repeats">How many times to cull each way (the fastest one counts)</param>
+FrustumCullBenchmark BenchmarkFrustumCulling(unsigned int count, int repeats);
@@ -2,7 +2,12 @@
 #include "Vertex.h"
 #include "Input.h"
 #include "Helpers.h"
+#include "ShadowCascades.h"
+#include "BoxBlur.h"
 #include <memory>
+#include <algorithm>
+#include <chrono>
+#include <random>
 
 #include "ImGui/imgui.h"
 #include "ImGui/imgui_impl_dx11.h"
@@ -35,8 +40,12 @@ Game::Game(HINSTANCE hInstance)
 		false,				// Sync the framerate to the monitor refresh? (lock framerate)
 		true)				// Show extra stats (fps) in title bar?
 {
-	shadowProjectionMatrix = {};
 	shadowViewMatrix = {};
+	for (ShadowCascade& cascade : shadowCascades)
+		cascade = {};
+	for (bool& redraw : redrawStaticShadows)
+		redraw = true;
+	shadowCasterStats = {};
 	ambientColor = XMFLOAT3(0.0f, 0.0f, 0.0f);
 #if defined(DEBUG) || defined(_DEBUG)
 	// Do we want a console window?  Probably only in debug mode
@@ -76,6 +85,41 @@ void Game::Init()
 	//  - You'll be expanding and/or replacing these later
 	LoadShaders();
 
+	// Shaders and meshes bind through the cache from here on
+	stateCache = std::make_shared<RenderStateCache>(context);
+	ISimpleShader::StateCache = stateCache;
+	Mesh::StateCache = stateCache;
+
+	// Per-draw constants, starting with room for a few frames of a thousand draws (it grows if needed)
+	drawRing = std::make_shared<ConstantBufferRing>(device, context, CONSTANT_BUFFER_RING_ALIGNMENT * 1024 * CONSTANT_BUFFER_RING_FRAMES, stateCache);
+	if (!ConstantBufferRing::IsSupported(device))
+		printf("Constant buffer offsets aren't supported, so per-draw constants get uploaded for every draw.\n");
+
+	renderQueue = std::make_shared<RenderQueue>();
+	shadowBatchCount = 0;
+
+	// Per-object data, with room for both passes of a thousand objects (it grows if needed)
+	instanceBuffer = std::make_shared<InstanceBuffer>(device, context, (unsigned int)sizeof(InstanceData), 2048);
+
+	sceneBVH = std::make_shared<BoundingVolumeHierarchy>();
+
+	// Small enough to rasterize in a fraction of a millisecond
+	occlusionBuffer = std::make_shared<OcclusionBuffer>(256, 144);
+	occludedCount = 0;
+	occlusionRasterMilliseconds = 0;
+	occlusionTestMilliseconds = 0;
+
+	shadowCache = std::make_shared<ShadowCache>();
+	shadowAtlasStats = {};
+	shadowAtlasCasterCount = 0;
+
+	// The lights, and room for four lights per cluster (they grow if needed)
+	lightClusters = std::make_shared<LightClusters>();
+	lightBuffer = std::make_shared<StructuredBuffer>(device, context, (unsigned int)sizeof(Light), 256);
+	clusterRangeBuffer = std::make_shared<StructuredBuffer>(device, context, (unsigned int)sizeof(ClusterRange), CLUSTER_COUNT);
+	clusterLightBuffer = std::make_shared<StructuredBuffer>(device, context, (unsigned int)sizeof(unsigned int), CLUSTER_COUNT * 4);
+	lightClusterMilliseconds = 0;
+
 	CreatePostProcessingResurces(false);
 	CalculatePixelSize();
 
@@ -139,7 +183,18 @@ void Game::Init()
 	pointLight2.Intensity = 1.0f;
 	pointLight2.Range = 5.0f;
 
-	lights = { directionalLight1, directionalLight2, directionalLight3, pointLight1, pointLight2 };
+	Light spotLight1 = {};
+
+	spotLight1.Type = LIGHT_TYPE_SPOT;
+	spotLight1.Position = XMFLOAT3(0.0f, 6.0f, -1.0f);
+	spotLight1.Direction = XMFLOAT3(0.0f, -1.0f, 0.3f);
+	spotLight1.Color = XMFLOAT3(1.0f, 0.8f, 0.6f);
+	spotLight1.Intensity = 2.0f;
+	spotLight1.Range = 12.0f;
+	spotLight1.SpotFalloff = 8.0f;
+
+	lights = { directionalLight1, directionalLight2, directionalLight3, pointLight1, pointLight2, spotLight1 };
+	SetExtraLights();
 
 	CreateShadowResources(directionalLight1);
 
@@ -197,7 +252,7 @@ void Game::Init()
 		// Tell the input assembler (IA) stage of the pipeline what kind of
 		// geometric primitives (points, lines or triangles) we want to draw.  
 		// Essentially: "What kind of shape should the GPU draw with our vertices?"
-		context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		stateCache->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 
 	}
@@ -245,19 +300,30 @@ shared_ptr<Material> Game::CreatePBRMaterial(const std::wstring& materialName, M
 // --------------------------------------------------------
 void Game::LoadShaders()
 {
-	vertexShader = std::make_shared<SimpleVertexShader>(device, context,
-		FixPath(L"VertexShader.cso").c_str());
+	vertexShader = Mesh::LoadVertexShader(device, context,
+		FixPath(L"VertexShader.cso"), FixPath(L"PackedVertexShader.cso"));
 	pixelShader = std::make_shared<SimplePixelShader>(device, context,
 		FixPath(L"PixelShader.cso").c_str());
 
-	shadowVertexShader = std::make_shared<SimpleVertexShader>(device, context,
-		FixPath(L"ShadowVertexShader.cso").c_str());
+	shadowVertexShader = Mesh::LoadVertexShader(device, context,
+		FixPath(L"ShadowVertexShader.cso"), FixPath(L"PackedShadowVertexShader.cso"));
+
+	// PerDraw comes from drawRing, so the shaders shouldn't bind their own copy over it
+	vertexShader->SetExternalConstantBuffer("PerDraw");
+	shadowVertexShader->SetExternalConstantBuffer("PerDraw");
+
+	// Every entity is drawn instanced, which needs the instance matrices in their own slot
+	if (!vertexShader->GetPerInstanceCompatible() || !shadowVertexShader->GetPerInstanceCompatible())
+		printf("The entity vertex shaders don't read per-instance data, so instanced draws won't move anything.\n");
 
 	ppVS = std::make_shared<SimpleVertexShader>(device, context,
 		FixPath(L"PostProcessVertexShader.cso").c_str());
 
 	ppPS = std::make_shared<SimplePixelShader>(device, context,
 		FixPath(L"PostProcessPixelShader.cso").c_str());
+
+	blurCS = std::make_shared<SimpleComputeShader>(device, context,
+		FixPath(L"BlurComputeShader.cso").c_str());
 }
 
 
@@ -265,6 +331,9 @@ std::vector<DirectX::XMFLOAT3> positions;
 std::vector<DirectX::XMFLOAT3> rotations;
 std::vector<DirectX::XMFLOAT3> scales;
 
+// The little cube riding on the first sphere, which spins on its own as well
+size_t childCubeIndex;
+
 // --------------------------------------------------------
 // Creates the geometry we're going to draw - a single triangle for now
 // --------------------------------------------------------
@@ -282,19 +351,21 @@ void Game::CreateGeometry()
 		std::make_shared<Mesh>(FixPath(L"../../Assets/Meshes/quad.obj").c_str(), device, context),
 	};
 
-	entities = { std::make_shared<Entity>(meshes[0]),
-		std::make_shared<Entity>(meshes[1]),
-		std::make_shared<Entity>(meshes[2]),
-		std::make_shared<Entity>(meshes[3]),
-		std::make_shared<Entity>(meshes[4]),
-		std::make_shared<Entity>(meshes[5]),
-		std::make_shared<Entity>(meshes[0]),
-		std::make_shared<Entity>(meshes[0]),
-		std::make_shared<Entity>(meshes[0]),
-		std::make_shared<Entity>(meshes[0]),
-		std::make_shared<Entity>(meshes[0]),
-		std::make_shared<Entity>(meshes[0]),
-		std::make_shared<Entity>(meshes[0]),
+	transforms = std::make_shared<TransformSystem>();
+
+	entities = { std::make_shared<Entity>(meshes[0], transforms),
+		std::make_shared<Entity>(meshes[1], transforms),
+		std::make_shared<Entity>(meshes[2], transforms),
+		std::make_shared<Entity>(meshes[3], transforms),
+		std::make_shared<Entity>(meshes[4], transforms),
+		std::make_shared<Entity>(meshes[5], transforms),
+		std::make_shared<Entity>(meshes[0], transforms),
+		std::make_shared<Entity>(meshes[0], transforms),
+		std::make_shared<Entity>(meshes[0], transforms),
+		std::make_shared<Entity>(meshes[0], transforms),
+		std::make_shared<Entity>(meshes[0], transforms),
+		std::make_shared<Entity>(meshes[0], transforms),
+		std::make_shared<Entity>(meshes[0], transforms),
 	};
 
 	entities[0]->SetMaterial(materials[0]);
@@ -304,31 +375,70 @@ void Game::CreateGeometry()
 	entities[4]->SetMaterial(materials[2]);
 	entities[5]->SetMaterial(materials[3]);
 
+	//the cube and the floor fill their boxes, so they can hide things
+	entities[2]->SetOccluder(true);
+	entities[5]->SetOccluder(true);
+
+	//only the first sphere (0), the cube (2), the torus (3), the helix (4) and
+	//the little cube riding on that sphere (childCubeIndex, added below) ever
+	//move, so everything else's shadow only gets drawn when it has to be
+	entities[1]->SetStatic(true);
+	entities[5]->SetStatic(true);
+
 	for (int i = 6; i < entities.size(); i++) {
 		entities[i]->SetMaterial(materials[i - 6]);
+		entities[i]->SetStatic(true);
 	}
 
-	entities[0]->GetTransform()->SetPosition(XMFLOAT3(-6, 0, 0));
-	entities[1]->GetTransform()->SetPosition(XMFLOAT3(-3, 0, 0));
-	entities[2]->GetTransform()->SetPosition(XMFLOAT3(0, 2, -3));
-	entities[3]->GetTransform()->SetPosition(XMFLOAT3(3, 0, 0));
-	entities[4]->GetTransform()->SetPosition(XMFLOAT3(6, 0, 0));
-	entities[5]->GetTransform()->SetPosition(XMFLOAT3(0, -2, 5));
-	entities[5]->GetTransform()->SetScale(XMFLOAT3(10, 1, 10));
+	transforms->SetPosition(entities[0]->GetTransformIndex(), XMFLOAT3(-6, 0, 0));
+	transforms->SetPosition(entities[1]->GetTransformIndex(), XMFLOAT3(-3, 0, 0));
+	transforms->SetPosition(entities[2]->GetTransformIndex(), XMFLOAT3(0, 2, -3));
+	transforms->SetPosition(entities[3]->GetTransformIndex(), XMFLOAT3(3, 0, 0));
+	transforms->SetPosition(entities[4]->GetTransformIndex(), XMFLOAT3(6, 0, 0));
+	transforms->SetPosition(entities[5]->GetTransformIndex(), XMFLOAT3(0, -2, 5));
+	transforms->SetScale(entities[5]->GetTransformIndex(), XMFLOAT3(10, 1, 10));
 
 	for (int i = 6; i < entities.size(); i++) {
-		entities[i]->GetTransform()->SetPosition(XMFLOAT3(-8 + ((i - 6) * 2.5f), 2.5f, 0));
+		transforms->SetPosition(entities[i]->GetTransformIndex(), XMFLOAT3(-8 + ((i - 6) * 2.5f), 2.5f, 0));
 	}
 
+	//a little cube riding on top of the first sphere, which follows it around as its child
+	childCubeIndex = entities.size();
+	entities.push_back(std::make_shared<Entity>(meshes[2], transforms, entities[0]->GetTransformIndex()));
+	entities.back()->SetMaterial(materials[2]);
+	transforms->SetPosition(entities.back()->GetTransformIndex(), XMFLOAT3(0, 1.25f, 0));
+	transforms->SetScale(entities.back()->GetTransformIndex(), XMFLOAT3(0.4f, 0.4f, 0.4f));
+
 	for (int i = 0; i < entities.size(); i++) {
-		positions.push_back(entities[i]->GetTransform()->GetPosition());
-		rotations.push_back(entities[i]->GetTransform()->GetPitchYawRoll());
-		scales.push_back(entities[i]->GetTransform()->GetScale());
+		positions.push_back(transforms->GetPosition(entities[i]->GetTransformIndex()));
+		rotations.push_back(transforms->GetPitchYawRoll(entities[i]->GetTransformIndex()));
+		scales.push_back(transforms->GetScale(entities[i]->GetTransformIndex()));
 	}
 }
 
 int shadowResolution = 2048;
-float shadowProjSize = 25;
+
+// How far from the camera the cascades reach, and how their splits lean
+// between even sizes (0) and even resolution (1)
+float shadowDistance = 60;
+float cascadeSplitBlend = 0.75f;
+
+// How far towards the light past a cascade things can still cast into it
+float shadowCasterDistance = 100;
+
+// Which light gets the cascades. Every other one shares the atlas.
+int cascadedLightIndex = 0;
+
+// Width of the shadow atlas, the smallest and largest tiles it hands out,
+// and how far importance has to move before a light's tiles change size
+int shadowAtlasSize = 4096;
+int shadowAtlasMinTile = 128;
+int shadowAtlasMaxTile = 1024;
+float shadowAtlasHysteresis = 0.25f;
+
+// Shadow batches' material ids: two per cascade (static and moving
+// casters), then one per atlas view
+const unsigned int shadowAtlasMaterialStart = SHADOW_CASCADE_COUNT * 2;
 
 
 void Game::CreateShadowResources(Light light)
@@ -338,25 +448,59 @@ void Game::CreateShadowResources(Light light)
 	D3D11_RASTERIZER_DESC shadowRasterizerDesc = {};
 	shadowRasterizerDesc.CullMode = D3D11_CULL_BACK;
 	shadowRasterizerDesc.FillMode = D3D11_FILL_SOLID;
-	shadowRasterizerDesc.DepthClipEnable = true;
+	// Casters between the light and a cascade's near plane still get drawn,
+	// so they get flattened onto it instead of clipped away
+	shadowRasterizerDesc.DepthClipEnable = false;
 	shadowRasterizerDesc.DepthBiasClamp = 0.0f;
 	shadowRasterizerDesc.DepthBias = 1000;
 	shadowRasterizerDesc.SlopeScaledDepthBias = 1.0f;
 	device->CreateRasterizerState(&shadowRasterizerDesc, &shadowRasterizer);
 
+	// Point and spot lights see in every direction from where they are,
+	// so anything behind their near plane has to be clipped
+	shadowRasterizerDesc.DepthClipEnable = true;
+	device->CreateRasterizerState(&shadowRasterizerDesc, &shadowAtlasRasterizer);
+
+	//one big depth texture for every other light, split up into tiles each frame
+	shadowAtlas = std::make_shared<ShadowAtlas>(shadowAtlasSize, shadowAtlasMinTile, shadowAtlasMaxTile, shadowAtlasHysteresis);
+
+	D3D11_TEXTURE2D_DESC atlasDesc = {};
+	atlasDesc.Width = shadowAtlasSize;
+	atlasDesc.Height = shadowAtlasSize;
+	atlasDesc.Usage = D3D11_USAGE_DEFAULT;
+	atlasDesc.ArraySize = 1;
+	atlasDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+	atlasDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	atlasDesc.SampleDesc.Count = 1;
+	atlasDesc.MipLevels = 1;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> atlasTexture;
+	device->CreateTexture2D(&atlasDesc, 0, atlasTexture.GetAddressOf());
+
+	D3D11_DEPTH_STENCIL_VIEW_DESC atlasDSVDesc = {};
+	atlasDSVDesc.Format = DXGI_FORMAT_D32_FLOAT;
+	atlasDSVDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+	device->CreateDepthStencilView(atlasTexture.Get(), &atlasDSVDesc, shadowAtlasDSV.GetAddressOf());
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC atlasSRVDesc = {};
+	atlasSRVDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	atlasSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	atlasSRVDesc.Texture2D.MipLevels = 1;
+	device->CreateShaderResourceView(atlasTexture.Get(), &atlasSRVDesc, shadowAtlasSRV.GetAddressOf());
+
+	for (std::shared_ptr<Material> m : materials) {
+		m->AddTextureSRV("ShadowAtlas", shadowAtlasSRV);
+	}
+
 	SetShadowDirection(light);
 }
 
 void Game::CreateShadowTextures(bool release) {
-	if (release) {
-		shadowDSV.Get()->Release();
-		shadowSRV.Get()->Release();
-	}
+	//replacing the textures and views lets go of the old ones
 	D3D11_TEXTURE2D_DESC shadowDesc = {};
 	shadowDesc.Width = shadowResolution;
 	shadowDesc.Height = shadowResolution;
 	shadowDesc.Usage = D3D11_USAGE_DEFAULT;
-	shadowDesc.ArraySize = 1;
+	shadowDesc.ArraySize = SHADOW_CASCADE_COUNT;
 	shadowDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
 	shadowDesc.CPUAccessFlags = 0;
 	shadowDesc.Format = DXGI_FORMAT_R32_TYPELESS;
@@ -364,21 +508,33 @@ void Game::CreateShadowTextures(bool release) {
 	shadowDesc.SampleDesc.Quality = 0;
 	shadowDesc.MipLevels = 1;
 	shadowDesc.MiscFlags = 0;
-	Microsoft::WRL::ComPtr<ID3D11Texture2D> shadowTexture;
-	device->CreateTexture2D(&shadowDesc, 0, shadowTexture.GetAddressOf());
-
-	D3D11_DEPTH_STENCIL_VIEW_DESC shadowDepthStencilDesc = {};
-	shadowDepthStencilDesc.Format = DXGI_FORMAT_D32_FLOAT;
-	shadowDepthStencilDesc.Texture2D.MipSlice = 0;
-	shadowDepthStencilDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
-	device->CreateDepthStencilView(shadowTexture.Get(), &shadowDepthStencilDesc, shadowDSV.GetAddressOf());
+	device->CreateTexture2D(&shadowDesc, 0, shadowTexture.ReleaseAndGetAddressOf());
+
+	// Only ever drawn into and copied from
+	shadowDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+	device->CreateTexture2D(&shadowDesc, 0, staticShadowTexture.ReleaseAndGetAddressOf());
+
+	//each cascade renders into its own slice
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+		D3D11_DEPTH_STENCIL_VIEW_DESC shadowDepthStencilDesc = {};
+		shadowDepthStencilDesc.Format = DXGI_FORMAT_D32_FLOAT;
+		shadowDepthStencilDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+		shadowDepthStencilDesc.Texture2DArray.MipSlice = 0;
+		shadowDepthStencilDesc.Texture2DArray.FirstArraySlice = i;
+		shadowDepthStencilDesc.Texture2DArray.ArraySize = 1;
+		device->CreateDepthStencilView(shadowTexture.Get(), &shadowDepthStencilDesc, shadowDSVs[i].ReleaseAndGetAddressOf());
+		device->CreateDepthStencilView(staticShadowTexture.Get(), &shadowDepthStencilDesc, staticShadowDSVs[i].ReleaseAndGetAddressOf());
+	}
 
+	//and the pixel shader picks between all of them
 	D3D11_SHADER_RESOURCE_VIEW_DESC shadowSRVDesc = {};
 	shadowSRVDesc.Format = DXGI_FORMAT_R32_FLOAT;
-	shadowSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	shadowSRVDesc.Texture2D.MipLevels = 1;
-	shadowSRVDesc.Texture2D.MostDetailedMip = 0;
-	device->CreateShaderResourceView(shadowTexture.Get(), &shadowSRVDesc, shadowSRV.GetAddressOf());
+	shadowSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+	shadowSRVDesc.Texture2DArray.MipLevels = 1;
+	shadowSRVDesc.Texture2DArray.MostDetailedMip = 0;
+	shadowSRVDesc.Texture2DArray.FirstArraySlice = 0;
+	shadowSRVDesc.Texture2DArray.ArraySize = SHADOW_CASCADE_COUNT;
+	device->CreateShaderResourceView(shadowTexture.Get(), &shadowSRVDesc, shadowSRV.ReleaseAndGetAddressOf());
 
 	//add sampler to materials only on the first time creating all this stuff
 	if (!release) {
@@ -404,19 +560,133 @@ void Game::CreateShadowTextures(bool release) {
 	for (std::shared_ptr<Material> m : materials) {
 		m->AddTextureSRV("ShadowMap", shadowSRV);
 	}
+
+	//the new static layers start out empty
+	shadowCache->Invalidate();
 }
 
 void Game::SetShadowDirection(Light light) {
-	XMVECTOR lightDirection = XMLoadFloat3(&light.Direction);
+	shadowViewMatrix = MakeShadowLightView(light.Direction);
+}
+
+// The scene's own lights, which are the only ones that cast shadows,
+// and how many more small ones get scattered around after them (a quarter of them spots)
+const unsigned int sceneLightCount = 6;
+int extraLightCount = 256;
 
-	XMMATRIX shadowView = XMMatrixLookAtLH(
-		-lightDirection * 20,
-		lightDirection,
-		XMVectorSet(0, 1, 0, 0));
-	XMStoreFloat4x4(&shadowViewMatrix, shadowView);
+// Where the first slice of light clusters ends, and the exponential ones start
+float lightClusterFirstSlice = 2.0f;
 
-	XMMATRIX lightProjection = XMMatrixOrthographicLH(shadowProjSize, shadowProjSize, 0.1f, 100.0f);
-	XMStoreFloat4x4(&shadowProjectionMatrix, lightProjection);
+void Game::SetExtraLights()
+{
+	// The same lights every time for the same count
+	std::mt19937 random(23);
+	std::uniform_real_distribution<float> xs(-12.0f, 12.0f);
+	std::uniform_real_distribution<float> ys(-1.5f, 3.5f);
+	std::uniform_real_distribution<float> zs(-6.0f, 8.0f);
+	std::uniform_real_distribution<float> ranges(1.0f, 3.0f);
+	std::uniform_real_distribution<float> colors(0.2f, 1.0f);
+	std::uniform_real_distribution<float> tilts(-0.5f, 0.5f);
+	std::uniform_real_distribution<float> falloffs(4.0f, 32.0f);
+
+	lights.resize(sceneLightCount);
+	for (int i = 0; i < extraLightCount; i++)
+	{
+		Light light = {};
+		light.Type = LIGHT_TYPE_POINT;
+		light.Position = XMFLOAT3(xs(random), ys(random), zs(random));
+		light.Range = ranges(random);
+		light.Color = XMFLOAT3(colors(random), colors(random), colors(random));
+		light.Intensity = 0.5f;
+		light.ShadowIndex = -1;
+		if (i % 4 == 3)
+		{
+			// Pointing down, give or take
+			light.Type = LIGHT_TYPE_SPOT;
+			light.Position.y += 2.0f;
+			light.Range *= 2.0f;
+			light.Direction = XMFLOAT3(tilts(random), -1.0f, tilts(random));
+			light.SpotFalloff = falloffs(random);
+		}
+		lights.push_back(light);
+	}
+}
+
+void Game::PackShadowAtlas(const XMFLOAT4X4& cameraView, const XMFLOAT4X4& cameraProjection)
+{
+	// Directional lights reach everything the camera sees, and the
+	// rest matter as much as the sphere they light looks big on screen
+	FrustumPlanes cameraFrustum = ExtractFrustumPlanes(cameraView, cameraProjection);
+	shadowAtlasRequests.clear();
+	for (unsigned int i = 0; i < std::min((unsigned int)lights.size(), sceneLightCount); i++)
+	{
+		lights[i].ShadowIndex = -1;
+		if (i == (unsigned int)cascadedLightIndex)
+			continue;
+
+		XMFLOAT3 center = lights[i].Position;
+		float radius = lights[i].Range;
+		if (lights[i].Type == LIGHT_TYPE_SPOT)
+			GetSpotLightBounds(lights[i], center, radius);
+		float importance = lights[i].Type == LIGHT_TYPE_DIRECTIONAL ? 1.0f :
+			ComputeShadowImportance(center, radius, cameraFrustum, cameraView, cameraProjection);
+		if (importance > 0.0f)
+			shadowAtlasRequests.push_back({ i, lights[i].Type == LIGHT_TYPE_POINT ? 6u : 1u, importance });
+	}
+	shadowAtlasStats = shadowAtlas->Pack(shadowAtlasRequests);
+
+	// Each light's views, as long as there's room for all of them in the shader
+	float nearPlane, farPlane;
+	GetPerspectiveDepthRange(cameraProjection, nearPlane, farPlane);
+	shadowAtlasViews.clear();
+	for (const ShadowAtlasRequest& request : shadowAtlasRequests)
+	{
+		const ShadowAtlasTile* tiles;
+		unsigned int tileCount = shadowAtlas->GetTiles(request.Owner, &tiles);
+		if (tileCount == 0 || shadowAtlasViews.size() + tileCount > MAX_SHADOW_ATLAS_VIEWS)
+			continue;
+
+		Light& light = lights[request.Owner];
+		light.ShadowIndex = (int)shadowAtlasViews.size();
+		for (unsigned int t = 0; t < tileCount; t++)
+		{
+			ShadowAtlasView view = {};
+			view.Tile = tiles[t];
+			if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+			{
+				// Like a single cascade over everything shadows reach
+				view.View = MakeShadowLightView(light.Direction);
+				view.Projection = FitShadowCascade(cameraView, cameraProjection, nearPlane, std::min(farPlane, shadowDistance),
+					view.View, tiles[t].Size, shadowCasterDistance).Projection;
+				view.Perspective = false;
+			}
+			else
+			{
+				// A point light gets a face of a cube per tile, in the order
+				// SamplePointShadow() expects, and a spot light covers its cone
+				static const XMFLOAT3 faceDirections[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+				static const XMFLOAT3 faceUps[6] = { { 0, 1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, 1, 0 } };
+				XMVECTOR direction, up;
+				float fov;
+				if (light.Type == LIGHT_TYPE_POINT)
+				{
+					direction = XMLoadFloat3(&faceDirections[t]);
+					up = XMLoadFloat3(&faceUps[t]);
+					fov = XM_PIDIV2;
+				}
+				else
+				{
+					direction = XMVector3Normalize(XMLoadFloat3(&light.Direction));
+					up = fabsf(XMVectorGetY(direction)) > 0.99f ? XMVectorSet(0, 0, 1, 0) : XMVectorSet(0, 1, 0, 0);
+					fov = std::min(GetSpotLightAngle(light) * 2.0f, XMConvertToRadians(170.0f));
+				}
+				XMStoreFloat4x4(&view.View, XMMatrixLookToLH(XMLoadFloat3(&light.Position), direction, up));
+				XMStoreFloat4x4(&view.Projection, XMMatrixPerspectiveFovLH(fov, 1.0f, light.Range * 0.01f, light.Range));
+				view.Perspective = true;
+			}
+			shadowAtlasViews.push_back(view);
+		}
+	}
 }
 
 
@@ -424,6 +694,8 @@ void Game::SetShadowDirection(Light light) {
 int blurRadius;
 float pixelWidth;
 float pixelHeight;
+// 0 blurs with two pixel shader passes, 1 with two compute shader passes
+int blurMode = 0;
 
 void Game::CreatePostProcessingResurces(bool remakeTexture)
 {
@@ -471,15 +743,104 @@ void Game::CreatePostProcessingResurces(bool remakeTexture)
 		ppTexture.Get(),
 		0,
 		ppSRV.ReleaseAndGetAddressOf());
+
+	// The blur's intermediate textures, in floats so the first
+	// pass's averages don't get rounded before the second one
+	textureDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+	textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> blurTexture;
+	device->CreateTexture2D(&textureDesc, 0, blurTexture.GetAddressOf());
+	device->CreateRenderTargetView(blurTexture.Get(), 0, blurRTV.ReleaseAndGetAddressOf());
+	device->CreateUnorderedAccessView(blurTexture.Get(), 0, blurUAV.ReleaseAndGetAddressOf());
+	device->CreateShaderResourceView(blurTexture.Get(), 0, blurSRV.ReleaseAndGetAddressOf());
+
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> blurOutputTexture;
+	device->CreateTexture2D(&textureDesc, 0, blurOutputTexture.GetAddressOf());
+	device->CreateUnorderedAccessView(blurOutputTexture.Get(), 0, blurOutputUAV.ReleaseAndGetAddressOf());
+	device->CreateShaderResourceView(blurOutputTexture.Get(), 0, blurOutputSRV.ReleaseAndGetAddressOf());
 }
 
 void Game::ResetAndRecreatePostProcessingTexture()
 {
 	ppRTV.Reset();
 	ppSRV.Reset();
+	blurRTV.Reset();
+	blurUAV.Reset();
+	blurSRV.Reset();
+	blurOutputUAV.Reset();
+	blurOutputSRV.Reset();
 	CreatePostProcessingResurces(true);
 }
 
+void Game::DrawBlur()
+{
+	// Draws one pass of the post process pixel shader from source into target
+	auto drawPass = [&](ID3D11RenderTargetView* target, ID3D11ShaderResourceView* source, int radius, XMFLOAT2 direction) {
+		stateCache->OMSetRenderTargets(1, &target, 0);
+		ppPS->SetShaderResourceView("Pixels", source);
+		ppPS->SetInt("blurRadius", radius);
+		ppPS->SetFloat2("blurDirection", direction);
+		ppPS->CopyAllBufferData();
+		context->Draw(3, 0); // Draw exactly 3 vertices (one triangle)
+	};
+
+	stateCache->RSSetState(0);
+	stateCache->OMSetDepthStencilState(0, 0);
+
+	// Activate shaders and bind resources
+	ppVS->SetShader();
+	ppPS->SetShader();
+	ppPS->SetSamplerState("ClampSampler", ppSampler.Get());
+	ppPS->SetFloat("pixelWidth", pixelWidth);
+	ppPS->SetFloat("pixelHeight", pixelHeight);
+
+	if (blurRadius == 0)
+	{
+		// Nothing to blur, just copy it over
+		drawPass(backBufferRTV.Get(), ppSRV.Get(), 0, XMFLOAT2(1, 0));
+		return;
+	}
+
+	if (blurMode == 0)
+	{
+		drawPass(blurRTV.Get(), ppSRV.Get(), blurRadius, XMFLOAT2(1, 0));
+		drawPass(backBufferRTV.Get(), blurSRV.Get(), blurRadius, XMFLOAT2(0, 1));
+		return;
+	}
+
+	// The compute shader reads the texture the scene was drawn into,
+	// so that can't still be bound as a render target
+	stateCache->OMSetRenderTargets(1, backBufferRTV.GetAddressOf(), 0);
+
+	// A thread for every segment of every row, then every column
+	unsigned int rowSegments = (windowWidth + BLUR_SEGMENT_LENGTH - 1) / BLUR_SEGMENT_LENGTH;
+	unsigned int columnSegments = (windowHeight + BLUR_SEGMENT_LENGTH - 1) / BLUR_SEGMENT_LENGTH;
+	blurCS->SetShader();
+	blurCS->SetInt("blurRadius", blurRadius);
+	blurCS->SetInt("vertical", 0);
+	blurCS->CopyAllBufferData();
+	blurCS->SetUnorderedAccessView("Output", blurUAV);
+	blurCS->SetShaderResourceView("Input", ppSRV);
+	blurCS->DispatchByThreads(rowSegments, windowHeight, 1);
+
+	// The output goes on before the row pass is read, so its
+	// texture is never bound for reading and writing at once
+	blurCS->SetInt("vertical", 1);
+	blurCS->CopyAllBufferData();
+	blurCS->SetUnorderedAccessView("Output", blurOutputUAV);
+	blurCS->SetShaderResourceView("Input", blurSRV);
+	blurCS->DispatchByThreads(columnSegments, windowWidth, 1);
+
+	// Unbind them so the output can be drawn from
+	ID3D11ShaderResourceView* nullSRV = 0;
+	ID3D11UnorderedAccessView* nullUAV = 0;
+	context->CSSetShaderResources(0, 1, &nullSRV);
+	context->CSSetUnorderedAccessViews(0, 1, &nullUAV, 0);
+
+	drawPass(backBufferRTV.Get(), blurOutputSRV.Get(), 0, XMFLOAT2(1, 0));
+}
+
 void Game::CalculatePixelSize() 
 {
 	pixelWidth = 1.0f / (float)windowWidth;
@@ -496,6 +857,9 @@ void Game::OnResize()
 	// Handle base-level DX resize stuff
 	DXCore::OnResize();
 
+	// That rebinds the render targets without going through the cache
+	stateCache->Invalidate();
+
 	////loop through our vector of mesh pointers and draw each one!
 	for (std::shared_ptr<Camera> cam : cameras)
 	{
@@ -532,6 +896,41 @@ void Game::UpdateImGui(float deltaTime, float totalTime)
 	ImGui::Begin("Game Info", nullptr, ImGuiWindowFlags_NoCollapse);
 	ImGui::Text("Window Size: %d x %d", windowWidth, windowHeight);
 	ImGui::Text("FPS: %.f", ImGui::GetIO().Framerate);
+	ImGui::Text("Constant Buffer Uploads: %u (%u skipped, nothing changed)", lastFrameUploads.UploadsIssued, lastFrameUploads.UploadsSkipped);
+	ImGui::Text("Draw Calls: %u shadow, %u main", shadowBatchCount, (unsigned int)batches.size() - shadowBatchCount);
+	ImGui::Text("Frustum Culling: %u visible, %u culled",
+		(unsigned int)visibleEntities.size() + occludedCount, sceneBVH->GetObjectCount() - (unsigned int)visibleEntities.size() - occludedCount);
+	ImGui::Text("Occlusion Culling: %u hidden, raster %.3f ms, test %.3f ms", occludedCount, occlusionRasterMilliseconds, occlusionTestMilliseconds);
+
+	// A ray from the camera through the mouse, against last frame's bounds
+	{
+		XMFLOAT4X4 view = cameras[activeCameraIndex]->GetViewMatrix();
+		XMFLOAT4X4 projection = cameras[activeCameraIndex]->GetProjectionMatrix();
+		XMVECTOR mouse = XMVectorSet((float)input.GetMouseX(), (float)input.GetMouseY(), 0.0f, 0.0f);
+		XMVECTOR nearPoint = XMVector3Unproject(mouse, 0.0f, 0.0f, (float)windowWidth, (float)windowHeight, 0.0f, 1.0f,
+			XMLoadFloat4x4(&projection), XMLoadFloat4x4(&view), XMMatrixIdentity());
+		XMVECTOR farPoint = XMVector3Unproject(XMVectorSetZ(mouse, 1.0f), 0.0f, 0.0f, (float)windowWidth, (float)windowHeight, 0.0f, 1.0f,
+			XMLoadFloat4x4(&projection), XMLoadFloat4x4(&view), XMMatrixIdentity());
+
+		XMFLOAT3 origin, direction;
+		XMStoreFloat3(&origin, nearPoint);
+		XMStoreFloat3(&direction, XMVector3Normalize(farPoint - nearPoint));
+
+		BVHRayHit hit;
+		if (sceneBVH->Raycast(origin, direction, 1000.0f, hit))
+			ImGui::Text("Under Cursor: entity %u, %.1f units away", hit.Object, hit.Distance);
+		else
+			ImGui::Text("Under Cursor: nothing");
+	}
+	if (ImGui::TreeNode("State Calls (issued / filtered)")) {
+		ImGui::Text("Shaders: %u / %u", lastFrameStates.Shaders.Issued, lastFrameStates.Shaders.Filtered);
+		ImGui::Text("Constant Buffers: %u / %u", lastFrameStates.ConstantBuffers.Issued, lastFrameStates.ConstantBuffers.Filtered);
+		ImGui::Text("Shader Resources: %u / %u", lastFrameStates.ShaderResources.Issued, lastFrameStates.ShaderResources.Filtered);
+		ImGui::Text("Samplers: %u / %u", lastFrameStates.Samplers.Issued, lastFrameStates.Samplers.Filtered);
+		ImGui::Text("Input Assembler: %u / %u", lastFrameStates.InputAssembler.Issued, lastFrameStates.InputAssembler.Filtered);
+		ImGui::Text("Rasterizer & Depth: %u / %u", lastFrameStates.States.Issued, lastFrameStates.States.Filtered);
+		ImGui::TreePop();
+	}
 
 	if (ImGui::Button("Toggle Demo Window"))
 	{
@@ -543,6 +942,9 @@ void Game::UpdateImGui(float deltaTime, float totalTime)
 	ImGui::ColorEdit3("Directional Light 3 Color", &lights[2].Color.x);
 	ImGui::DragFloat3("Point Light 1 Position", &lights[3].Position.x, .1f);
 	ImGui::DragFloat3("Point Light 2 Position", &lights[4].Position.x, .1f);
+	ImGui::DragFloat3("Spot Light Position", &lights[5].Position.x, .1f);
+	ImGui::DragFloat3("Spot Light Direction", &lights[5].Direction.x, .01f);
+	ImGui::SliderFloat("Spot Light Falloff", &lights[5].SpotFalloff, 1.0f, 128.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
 
 	ImGui::RadioButton("Camera 0", &activeCameraIndex, 0);
 	ImGui::RadioButton("Camera 1", &activeCameraIndex, 1);
@@ -556,6 +958,9 @@ void Game::UpdateImGui(float deltaTime, float totalTime)
 	}
 
 	ImGui::SliderInt("Blur Radius", &blurRadius, 0, 16);
+	ImGui::RadioButton("Separable Blur", &blurMode, 0);
+	ImGui::SameLine();
+	ImGui::RadioButton("Compute Blur", &blurMode, 1);
 
 	if (ImGui::BeginCombo("Shadow Resolution", std::to_string(shadowResolution).c_str()))
 	{
@@ -571,11 +976,33 @@ void Game::UpdateImGui(float deltaTime, float totalTime)
 		ImGui::EndCombo();
 	}
 
-	if (ImGui::SliderFloat("Shadow Projection Size", &shadowProjSize, 5.0f, 500.0f, "%.3f", ImGuiSliderFlags_Logarithmic)) {
-		SetShadowDirection(lights[0]);
+	ImGui::SliderFloat("Shadow Distance", &shadowDistance, 5.0f, 500.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+	ImGui::SliderFloat("Cascade Split Blend", &cascadeSplitBlend, 0.0f, 1.0f);
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+		ImGui::Text("Cascade %d: %.2f to %.2f, %.4f units per texel", i,
+			shadowCascades[i].NearDistance, shadowCascades[i].FarDistance, shadowCascades[i].TexelSize);
+	}
+	ImGui::Text("Shadow Casters: %u static drawn, %u static cached, %u moving, %u culled",
+		shadowCasterStats.StaticDrawn, shadowCasterStats.StaticCached, shadowCasterStats.DynamicDrawn, shadowCasterStats.Culled);
+	ImGui::Text("Static Shadow Cache: %u hits, %u misses", shadowCache->GetHits(), shadowCache->GetMisses());
+	ImGui::Text("Shadow Atlas: %u views, %u casters, %u tiles placed, %.0f%% used, fragmentation %.2f%s",
+		(unsigned int)shadowAtlasViews.size(), shadowAtlasCasterCount, shadowAtlasStats.TilesPlaced,
+		100.0 * shadowAtlasStats.UsedTexels / ((double)shadowAtlasSize * shadowAtlasSize), shadowAtlasStats.Fragmentation,
+		shadowAtlasStats.Repacked ? ", repacked" : "");
+
+	if (ImGui::SliderInt("Extra Lights", &extraLightCount, 0, 4096, "%d", ImGuiSliderFlags_Logarithmic))
+		SetExtraLights();
+	{
+		unsigned int litClusters = 0, maxLights = 0;
+		for (const ClusterRange& range : lightClusters->GetRanges())
+		{
+			litClusters += range.Count > 0 ? 1 : 0;
+			maxLights = std::max(maxLights, range.Count);
+		}
+		unsigned int clusteredCount = (unsigned int)lightClusters->GetIndices().size() - lightClusters->GetGlobalCount();
+		ImGui::Text("Light Clusters: %u lights, %.1f average and %u most per lit cluster, assigned in %.3f ms",
+			(unsigned int)lights.size(), litClusters > 0 ? (double)clusteredCount / litClusters : 0.0, maxLights, lightClusterMilliseconds);
 	}
-
-	ImGui::Image(shadowSRV.Get(), ImVec2(128, 128));
 
 
 	ImGui::NewLine();
@@ -618,12 +1045,15 @@ void Game::Update(float deltaTime, float totalTime)
 	rotations[3].z = totalTime;
 	rotations[3].x = totalTime;
 	rotations[4].z = totalTime;
+	rotations[childCubeIndex].y = totalTime;
 
 	for (int i = 0; i < entities.size(); i++) {
-		entities[i]->GetTransform()->SetPosition(positions[i]);
-		entities[i]->GetTransform()->SetRotation(rotations[i]);
-		entities[i]->GetTransform()->SetScale(scales[i]);
+		transforms->SetPosition(entities[i]->GetTransformIndex(), positions[i]);
+		transforms->SetRotation(entities[i]->GetTransformIndex(), rotations[i]);
+		transforms->SetScale(entities[i]->GetTransformIndex(), scales[i]);
 	}
+	transforms->UpdateMatrices();
+
 	// Example input checking: Quit if the escape key is pressed
 	if (Input::GetInstance().KeyDown(VK_ESCAPE))
 		Quit();
@@ -634,6 +1064,156 @@ void Game::Update(float deltaTime, float totalTime)
 // --------------------------------------------------------
 void Game::Draw(float deltaTime, float totalTime)
 {
+	// The UI was already built this frame, so it shows the previous one's uploads
+	lastFrameUploads = ISimpleShader::UploadStats;
+	ISimpleShader::ResetUploadStats();
+	lastFrameStates = stateCache->GetStats();
+	stateCache->ResetStats();
+
+	// Only what the active camera can see goes in the main pass. The tree
+	// is rebuilt when entities come or go, and otherwise only the boxes
+	// above whatever moved this frame get refit.
+	// Static casters coming, going or moving means their cached shadows are out of date.
+	if (sceneBVH->GetObjectCount() != entities.size())
+	{
+		std::vector<WorldBounds> bounds(entities.size());
+		for (size_t i = 0; i < entities.size(); i++)
+			bounds[i] = TransformBounds(entities[i]->GetMesh()->GetBounds(), transforms->GetWorldMatrix(entities[i]->GetTransformIndex()));
+		sceneBVH->Build(bounds.data(), (unsigned int)bounds.size());
+		shadowCache->InvalidateStatic();
+	}
+	else
+	{
+		for (size_t i = 0; i < entities.size(); i++)
+		{
+			unsigned int transformIndex = entities[i]->GetTransformIndex();
+			if (transforms->WorldMatrixChanged(transformIndex))
+			{
+				sceneBVH->Update((unsigned int)i, TransformBounds(entities[i]->GetMesh()->GetBounds(), transforms->GetWorldMatrix(transformIndex)));
+				if (entities[i]->IsStatic())
+					shadowCache->InvalidateStatic();
+			}
+		}
+		sceneBVH->Refit();
+	}
+
+	XMFLOAT4X4 cameraView = cameras[activeCameraIndex]->GetViewMatrix();
+	XMFLOAT4X4 cameraProjection = cameras[activeCameraIndex]->GetProjectionMatrix();
+	sceneBVH->Cull(ExtractFrustumPlanes(cameraView, cameraProjection), visibleEntities);
+
+	// Then anything hidden behind the visible occluders comes out too.
+	// Occluders always stay, since they'd only be testing against themselves.
+	std::chrono::high_resolution_clock::time_point occlusionStart = std::chrono::high_resolution_clock::now();
+	occlusionBuffer->Begin(cameraView, cameraProjection);
+	for (unsigned int i : visibleEntities)
+	{
+		if (entities[i]->IsOccluder())
+			occlusionBuffer->RasterizeBox(entities[i]->GetMesh()->GetBounds(), transforms->GetWorldMatrix(entities[i]->GetTransformIndex()));
+	}
+	occlusionBuffer->BuildHierarchy();
+	std::chrono::high_resolution_clock::time_point occlusionRasterEnd = std::chrono::high_resolution_clock::now();
+
+	size_t keptCount = 0;
+	for (unsigned int i : visibleEntities)
+	{
+		if (entities[i]->IsOccluder() || occlusionBuffer->IsVisible(sceneBVH->GetBounds(i)))
+			visibleEntities[keptCount++] = i;
+	}
+	occludedCount = (unsigned int)(visibleEntities.size() - keptCount);
+	visibleEntities.resize(keptCount);
+	std::chrono::high_resolution_clock::time_point occlusionTestEnd = std::chrono::high_resolution_clock::now();
+
+	occlusionRasterMilliseconds = std::chrono::duration<double, std::milli>(occlusionRasterEnd - occlusionStart).count();
+	occlusionTestMilliseconds = std::chrono::duration<double, std::milli>(occlusionTestEnd - occlusionRasterEnd).count();
+
+	// Each cascade covers a slice of what the camera can see, refit every frame,
+	// and every other light gets as much of the atlas as it deserves
+	FitShadowCascades(cameraView, cameraProjection, shadowDistance, cascadeSplitBlend,
+		shadowViewMatrix, shadowResolution, shadowCasterDistance, shadowCascades);
+	PackShadowAtlas(cameraView, cameraProjection);
+
+	// Sort both passes' draws, and each pass goes front to back from wherever it's looking.
+	// A cascade's shadow casters are whatever's in its box or between it and the light,
+	// visible or not, since their shadows can land somewhere visible. Their material id
+	// is just which cascade and layer they go in (static casters first), since the shadow
+	// pass only cares about meshes. Static casters only go in if their layer needs redrawing.
+	renderQueue->Clear();
+	shadowCasterStats = {};
+	for (unsigned int c = 0; c < SHADOW_CASCADE_COUNT; c++)
+	{
+		redrawStaticShadows[c] = shadowCache->NeedsRedraw(c, shadowCascades[c].ViewProjection);
+		sceneBVH->Cull(ExtractShadowCasterPlanes(shadowViewMatrix, shadowCascades[c].Projection), shadowCasters);
+		shadowCasterStats.Culled += (unsigned int)(entities.size() - shadowCasters.size());
+
+		for (unsigned int i : shadowCasters)
+		{
+			bool isStatic = entities[i]->IsStatic();
+			if (isStatic && !redrawStaticShadows[c])
+			{
+				shadowCasterStats.StaticCached++;
+				continue;
+			}
+			(isStatic ? shadowCasterStats.StaticDrawn : shadowCasterStats.DynamicDrawn)++;
+
+			const XMFLOAT4X4& world = transforms->GetWorldMatrix(entities[i]->GetTransformIndex());
+			float lightDepth = world._41 * shadowViewMatrix._13 + world._42 * shadowViewMatrix._23 + world._43 * shadowViewMatrix._33 + shadowViewMatrix._43;
+			renderQueue->Add(RENDER_PASS_SHADOW, c * 2 + (isStatic ? 0 : 1), entities[i]->GetMesh()->GetSortId(), lightDepth, i);
+		}
+	}
+
+	// Atlas views are drawn from scratch every frame, all their casters included
+	shadowAtlasCasterCount = 0;
+	for (unsigned int v = 0; v < shadowAtlasViews.size(); v++)
+	{
+		const ShadowAtlasView& view = shadowAtlasViews[v];
+		sceneBVH->Cull(view.Perspective ? ExtractFrustumPlanes(view.View, view.Projection) : ExtractShadowCasterPlanes(view.View, view.Projection), shadowCasters);
+		shadowAtlasCasterCount += (unsigned int)shadowCasters.size();
+		for (unsigned int i : shadowCasters)
+		{
+			const XMFLOAT4X4& world = transforms->GetWorldMatrix(entities[i]->GetTransformIndex());
+			float viewDepth = world._41 * view.View._13 + world._42 * view.View._23 + world._43 * view.View._33 + view.View._43;
+			renderQueue->Add(RENDER_PASS_SHADOW, shadowAtlasMaterialStart + v, entities[i]->GetMesh()->GetSortId(), viewDepth, i);
+		}
+	}
+	for (unsigned int i : visibleEntities)
+	{
+		const XMFLOAT4X4& world = transforms->GetWorldMatrix(entities[i]->GetTransformIndex());
+
+		// View space z of the entity's origin
+		float cameraDepth = world._41 * cameraView._13 + world._42 * cameraView._23 + world._43 * cameraView._33 + cameraView._43;
+		renderQueue->Add(RENDER_PASS_OPAQUE, entities[i]->GetMaterial()->GetSortId(), entities[i]->GetMesh()->GetSortId(), cameraDepth, i);
+	}
+	renderQueue->Sort();
+
+	// Neighbours that only differ by depth become one instanced draw
+	batches.clear();
+	shadowBatchCount = renderQueue->GetBatches(RENDER_PASS_SHADOW, batches);
+	renderQueue->GetBatches(RENDER_PASS_OPAQUE, batches);
+
+	// Each sorted item's InstanceData goes at the item's own index,
+	// so every batch's instances are already next to each other.
+	// An entity drawn in several passes is written once per pass
+	const RenderItem* items = renderQueue->GetItems();
+	unsigned char* instances = (unsigned char*)instanceBuffer->Map(renderQueue->GetCount());
+	if (instances)
+	{
+		for (unsigned int i = 0; i < renderQueue->GetCount(); i++)
+			entities[items[i].Index]->WriteInstance(instances + i * sizeof(InstanceData));
+		instanceBuffer->Unmap();
+	}
+
+	// Every batch's DrawConstants go into the ring in one pass,
+	// and each draw after this just points at its slot
+	drawRing->BeginFrame((unsigned int)batches.size() * CONSTANT_BUFFER_RING_ALIGNMENT);
+	batchConstants.resize(batches.size());
+	for (size_t b = 0; b < batches.size(); b++)
+	{
+		batchConstants[b] = drawRing->Allocate(sizeof(DrawConstants));
+		if (batchConstants[b].Data)
+			entities[items[batches[b].FirstItem].Index]->GetMesh()->WriteDrawConstants(batchConstants[b].Data);
+	}
+	drawRing->EndWrites();
+
 	RenderShadows();
 
 
@@ -658,30 +1238,81 @@ void Game::Draw(float deltaTime, float totalTime)
 	//pixelShader->SetFloat("totalTime", totalTime);
 	pixelShader->SetFloat3("cameraPosition", cameras[activeCameraIndex]->GetTransform().GetPosition());
 
-	pixelShader->SetData("lights", &lights[0], sizeof(Light) * (int)lights.size());
+	// Every light goes in one buffer, and each pixel only shades the
+	// ones that can reach its cluster, after the ones that reach everything
+	std::chrono::high_resolution_clock::time_point clusterStart = std::chrono::high_resolution_clock::now();
+	lightClusters->SetProjection(cameraProjection, lightClusterFirstSlice);
+	lightClusters->Assign(lights.data(), (unsigned int)lights.size(), cameraView, GetClusterThreadCount((unsigned int)lights.size()));
+	lightClusterMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - clusterStart).count();
+
+	const std::vector<unsigned int>& clusterLights = lightClusters->GetIndices();
+	lightBuffer->SetData(lights.data(), (unsigned int)lights.size());
+	clusterRangeBuffer->SetData(lightClusters->GetRanges().data(), CLUSTER_COUNT);
+	clusterLightBuffer->SetData(clusterLights.data(), (unsigned int)clusterLights.size());
+	pixelShader->SetShaderResourceView("Lights", lightBuffer->GetSRV());
+	pixelShader->SetShaderResourceView("ClusterRanges", clusterRangeBuffer->GetSRV());
+	pixelShader->SetShaderResourceView("ClusterLights", clusterLightBuffer->GetSRV());
+
+	XMFLOAT2 depthSlicing = lightClusters->GetDepthSlicing();
+	pixelShader->SetFloat4("clusterScale", XMFLOAT4((float)CLUSTER_COUNT_X / windowWidth, (float)CLUSTER_COUNT_Y / windowHeight, depthSlicing.x, depthSlicing.y));
+	pixelShader->SetInt("globalLightCount", (int)lightClusters->GetGlobalCount());
+
+	// Where each cascade ends, and how to get into its slice of the shadow map
+	XMFLOAT4X4 cascadeViewProjections[SHADOW_CASCADE_COUNT];
+	float cascadeSplits[4] = {}; // A float4 in the shader, so room for up to 4 cascades
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+		cascadeViewProjections[i] = shadowCascades[i].ViewProjection;
+		cascadeSplits[i] = shadowCascades[i].FarDistance;
+	}
+	pixelShader->SetData("cascadeViewProjections", cascadeViewProjections, sizeof(cascadeViewProjections));
+	pixelShader->SetData("cascadeSplits", cascadeSplits, sizeof(cascadeSplits));
+	pixelShader->SetInt("cascadedLight", cascadedLightIndex);
+
+	// And where each atlas view's tile is
+	XMFLOAT4X4 atlasViewProjections[MAX_SHADOW_ATLAS_VIEWS] = {};
+	XMFLOAT4 atlasTiles[MAX_SHADOW_ATLAS_VIEWS] = {};
+	for (size_t v = 0; v < shadowAtlasViews.size(); v++) {
+		const ShadowAtlasView& view = shadowAtlasViews[v];
+		XMStoreFloat4x4(&atlasViewProjections[v], XMLoadFloat4x4(&view.View) * XMLoadFloat4x4(&view.Projection));
+		atlasTiles[v] = XMFLOAT4((float)view.Tile.X / shadowAtlasSize, (float)view.Tile.Y / shadowAtlasSize,
+			(float)view.Tile.Size / shadowAtlasSize, (float)view.Tile.Size / shadowAtlasSize);
+	}
+	pixelShader->SetData("atlasViewProjections", atlasViewProjections, sizeof(atlasViewProjections));
+	pixelShader->SetData("atlasTiles", atlasTiles, sizeof(atlasTiles));
 
-	////loop through our vector of mesh pointers and draw each one!
-	for (std::shared_ptr<Entity> entity : entities)
+	// The rest of the PerFrame constants, which get uploaded with the first entity
+	vertexShader->SetMatrix4x4("viewMatrix", cameras[activeCameraIndex]->GetViewMatrix());
+	vertexShader->SetMatrix4x4("projectionMatrix", cameras[activeCameraIndex]->GetProjectionMatrix());
+
+	// Whatever the sky or ImGui left set last frame
+	stateCache->RSSetState(0);
+	stateCache->OMSetDepthStencilState(0, 0);
+
+	// Draw every batch in the queue's order, so each material and mesh gets set once per run of draws
+	for (size_t b = shadowBatchCount; b < batches.size(); b++)
 	{
-		entity->Draw(context, cameras[activeCameraIndex], shadowViewMatrix, shadowProjectionMatrix);
-	}
+		const RenderBatch& batch = batches[b];
+		std::shared_ptr<Entity> entity = entities[items[batch.FirstItem].Index];
+		std::shared_ptr<Material> material = entity->GetMaterial();
+		material->PrepareMaterial();
 
-	sky->Draw(context, cameras[activeCameraIndex]);
+		// The shaders leave this register to the ring
+		drawRing->BindVertexShader(DRAW_CONSTANTS_REGISTER, batchConstants[b]);
 
-	context->OMSetRenderTargets(1, backBufferRTV.GetAddressOf(), 0);
+		// Only the buffers that changed since the last draw get uploaded,
+		// which for PerFrame is just the first draw with these shaders
+		material->GetVertexShader()->CopyAllBufferData();
+		material->GetPixelShader()->CopyAllBufferData();
 
-	// Activate shaders and bind resources
-	// Also set any required cbuffer data (not shown)
-	ppVS->SetShader();
+		entity->GetMesh()->DrawInstanced(instanceBuffer->GetBuffer(), instanceBuffer->GetStride(), batch.FirstItem, batch.Count);
+	}
 
-	ppPS->SetShader();
-	ppPS->SetShaderResourceView("Pixels", ppSRV.Get());
-	ppPS->SetSamplerState("ClampSampler", ppSampler.Get());
-	ppPS->SetInt("blurRadius", blurRadius);
-	ppPS->SetFloat("pixelWidth", pixelWidth);
-	ppPS->SetFloat("pixelHeight", pixelHeight);
-	ppPS->CopyAllBufferData();
-	context->Draw(3, 0); // Draw exactly 3 vertices (one triangle)
+	// The GPU is done with this frame's DrawConstants once it gets here
+	drawRing->EndFrame();
+
+	sky->Draw(stateCache, cameras[activeCameraIndex]);
+
+	DrawBlur();
 
 	//draw ImGui
 	ImGui::Render();
@@ -700,23 +1331,16 @@ void Game::Draw(float deltaTime, float totalTime)
 			vsyncNecessary ? 0 : DXGI_PRESENT_ALLOW_TEARING);
 
 		// Must re-bind buffers after presenting, as they become unbound
-		context->OMSetRenderTargets(1, backBufferRTV.GetAddressOf(), depthBufferDSV.Get());
+		stateCache->OMSetRenderTargets(1, backBufferRTV.GetAddressOf(), depthBufferDSV.Get());
 
 		//reset shadow srv's
-		ID3D11ShaderResourceView* nullSRVs[128] = {};
-		context->PSSetShaderResources(0, 128, nullSRVs);
+		stateCache->UnbindShaderResources();
 	}
 }
 
 
 void Game::RenderShadows()
 {
-	//clear depth
-	context->ClearDepthStencilView(shadowDSV.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
-
-	ID3D11RenderTargetView* nullRTV{};
-	context->OMSetRenderTargets(1, &nullRTV, shadowDSV.Get());
-
 	//set our render's size with a viewport
 	D3D11_VIEWPORT viewport = {};
 	viewport.Width = (float)shadowResolution;
@@ -724,33 +1348,85 @@ void Game::RenderShadows()
 	viewport.MaxDepth = 1.0f;
 	context->RSSetViewports(1, &viewport);
 
-	//start renderin' by setting our shader data and looping
+	//start renderin' by setting our shader
 	shadowVertexShader->SetShader();
-	shadowVertexShader->SetMatrix4x4("view", shadowViewMatrix);
-	shadowVertexShader->SetMatrix4x4("projection", shadowProjectionMatrix);
 
 	//set NO pixel shader
-	context->PSSetShader(0, 0, 0);
+	stateCache->PSSetShader(0);
 
 	//set our shadow rasterizer state!
+	//(the main pass puts back the default one)
+	stateCache->RSSetState(shadowRasterizer.Get());
+	stateCache->OMSetDepthStencilState(0, 0);
+
+	// The shadow batches are sorted by cascade, then static before moving casters
+	// (their material id is cascade * 2, plus 1 for moving ones), so each cascade
+	// walks its own runs. Only meshes matter here, so every entity with the same
+	// mesh is one draw.
+	const RenderItem* items = renderQueue->GetItems();
+	ID3D11RenderTargetView* nullRTV{};
+	unsigned int b = 0;
+	for (unsigned int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		shadowVertexShader->SetMatrix4x4("view", shadowViewMatrix);
+		shadowVertexShader->SetMatrix4x4("projection", shadowCascades[i].Projection);
+		shadowVertexShader->CopyAllBufferData();
+
+		//static casters go in their own layer, only when it's out of date
+		if (redrawStaticShadows[i])
+		{
+			context->ClearDepthStencilView(staticShadowDSVs[i].Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
+			stateCache->OMSetRenderTargets(1, &nullRTV, staticShadowDSVs[i].Get());
+			for (; b < shadowBatchCount && RenderQueue::GetMaterialId(items[batches[b].FirstItem].Key) == i * 2; b++)
+			{
+				drawRing->BindVertexShader(DRAW_CONSTANTS_REGISTER, batchConstants[b]);
+				entities[items[batches[b].FirstItem].Index]->GetMesh()->DrawInstanced(instanceBuffer->GetBuffer(), instanceBuffer->GetStride(), batches[b].FirstItem, batches[b].Count);
+			}
+		}
 
-	context->RSSetState(shadowRasterizer.Get());
+		//that layer starts off the cascade's slice, and moving casters go on top.
+		//neither can be bound while it's copied.
+		stateCache->OMSetRenderTargets(1, &nullRTV, 0);
+		unsigned int slice = D3D11CalcSubresource(0, i, 1);
+		context->CopySubresourceRegion(shadowTexture.Get(), slice, 0, 0, 0, staticShadowTexture.Get(), slice, nullptr);
+		stateCache->OMSetRenderTargets(1, &nullRTV, shadowDSVs[i].Get());
+		for (; b < shadowBatchCount && RenderQueue::GetMaterialId(items[batches[b].FirstItem].Key) == i * 2 + 1; b++)
+		{
+			drawRing->BindVertexShader(DRAW_CONSTANTS_REGISTER, batchConstants[b]);
+			entities[items[batches[b].FirstItem].Index]->GetMesh()->DrawInstanced(instanceBuffer->GetBuffer(), instanceBuffer->GetStride(), batches[b].FirstItem, batches[b].Count);
+		}
+	}
 
-	for (std::shared_ptr<Entity> entity : entities)
+	//every atlas view draws into its own tile of the atlas, through a viewport
+	context->ClearDepthStencilView(shadowAtlasDSV.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
+	stateCache->OMSetRenderTargets(1, &nullRTV, shadowAtlasDSV.Get());
+	for (unsigned int v = 0; v < shadowAtlasViews.size(); v++)
 	{
-		shadowVertexShader->SetMatrix4x4("world", entity->GetTransform()->GetWorldMatrix());
+		const ShadowAtlasView& view = shadowAtlasViews[v];
+		D3D11_VIEWPORT tileViewport = {};
+		tileViewport.TopLeftX = (float)view.Tile.X;
+		tileViewport.TopLeftY = (float)view.Tile.Y;
+		tileViewport.Width = (float)view.Tile.Size;
+		tileViewport.Height = (float)view.Tile.Size;
+		tileViewport.MaxDepth = 1.0f;
+		context->RSSetViewports(1, &tileViewport);
+		stateCache->RSSetState(view.Perspective ? shadowAtlasRasterizer.Get() : shadowRasterizer.Get());
+
+		shadowVertexShader->SetMatrix4x4("view", view.View);
+		shadowVertexShader->SetMatrix4x4("projection", view.Projection);
 		shadowVertexShader->CopyAllBufferData();
 
-		entity->GetMesh()->Draw();
+		for (; b < shadowBatchCount && RenderQueue::GetMaterialId(items[batches[b].FirstItem].Key) == shadowAtlasMaterialStart + v; b++)
+		{
+			drawRing->BindVertexShader(DRAW_CONSTANTS_REGISTER, batchConstants[b]);
+			entities[items[batches[b].FirstItem].Index]->GetMesh()->DrawInstanced(instanceBuffer->GetBuffer(), instanceBuffer->GetStride(), batches[b].FirstItem, batches[b].Count);
+		}
 	}
 
-	//disable our shadow rasterizer state!
-	context->RSSetState(0);
-
 	//reset our render settings for the normal rendering
 	viewport.Width = (float)this->windowWidth;
 	viewport.Height = (float)this->windowHeight;
 	context->RSSetViewports(1, &viewport);
-	context->OMSetRenderTargets(1, ppRTV.GetAddressOf(), depthBufferDSV.Get());
+	stateCache->OMSetRenderTargets(1, ppRTV.GetAddressOf(), depthBufferDSV.Get());
 }
 
@@ -11,6 +11,16 @@
 #include "SimpleShader.h"
 #include "Lights.h"
 #include "Sky.h"
+#include "RenderQueue.h"
+#include "ConstantBufferRing.h"
+#include "InstanceBuffer.h"
+#include "BoundingVolumeHierarchy.h"
+#include "OcclusionBuffer.h"
+#include "ShadowCascades.h"
+#include "ShadowCache.h"
+#include "ShadowAtlas.h"
+#include "LightClusters.h"
+#include "StructuredBuffer.h"
 
 
 class Game
@@ -43,19 +53,33 @@ private:
 	void CreateShadowResources(Light light);
 
 	/// <summary>
-	/// Specifically creates the textures (DSV and SRV) for the shadowmaps
+	/// Specifically creates the texture arrays for the shadow cascades and their cached static casters,
+	/// with a DSV per cascade for each and one SRV for the shadow map
 	/// </summary>
 	/// <param name="release">If true then it releases the old shadow maps. Only make true if you are updating resolution</param>
 	void CreateShadowTextures(bool release);
 
 	/// <summary>
-	/// Sets the view and projection matrix for the shadow camera from the light
+	/// Gives every light besides the cascaded one room in the shadow atlas by how much of the screen it
+	/// can shadow, sets each one's ShadowIndex, and works out the views that get drawn into its tiles
+	/// </summary>
+	void PackShadowAtlas(const DirectX::XMFLOAT4X4& cameraView, const DirectX::XMFLOAT4X4& cameraProjection);
+
+	/// <summary>
+	/// Replaces every light after the scene's own with extraLightCount small, unshadowed point and spot lights scattered around it
+	/// </summary>
+	void SetExtraLights();
+
+	/// <summary>
+	/// Sets the view matrix that every shadow cascade shares from the light. The projections get fit to the camera every frame.
 	/// </summary>
 	/// <param name="light">The light you want to cast shadows</param>
 	void SetShadowDirection(Light light);
 
 	/// <summary>
-	/// Sets proper shadow shaders and renders shadows to the depth buffer
+	/// Sets proper shadow shaders and renders shadows into each cascade's slice of the shadow map:
+	/// its cached static casters (drawn again first if they need it), then the moving ones over the top.
+	/// Then every atlas view gets drawn into its tile of the shadow atlas.
 	/// </summary>
 	void RenderShadows();
 
@@ -75,6 +99,12 @@ private:
 	/// </summary>
 	void ResetAndRecreatePostProcessingTexture();
 
+	/// <summary>
+	/// Blurs the post process texture onto the back buffer: a row pass and a column pass,
+	/// either with the post process pixel shader or with the sliding window compute shader
+	/// </summary>
+	void DrawBlur();
+
 	/// <summary>
 	/// Updates the ImGui at the beginning of each frame.
 	/// </summary>
@@ -84,6 +114,9 @@ private:
 	std::vector<std::shared_ptr<Material>> materials;
 	std::vector<std::shared_ptr<Entity>> entities;
 
+	// Every entity's transform, with matrices rebuilt once per frame in Update()
+	std::shared_ptr<TransformSystem> transforms;
+
 	std::vector<std::shared_ptr<Camera>> cameras;
 
 	std::shared_ptr<Sky> sky;
@@ -99,16 +132,88 @@ private:
 
 	std::shared_ptr<SimpleVertexShader> shadowVertexShader;
 
+	// Every state change goes through this, so ones that wouldn't change anything never reach the context
+	std::shared_ptr<RenderStateCache> stateCache;
+	RenderStateStats lastFrameStates;
+
+	// Every batch's DrawConstants, written once per frame for both the shadow and main passes
+	std::shared_ptr<ConstantBufferRing> drawRing;
+	std::vector<ConstantBufferSlot> batchConstants;
+
+	// Both passes' draws, rebuilt and sorted every frame
+	std::shared_ptr<RenderQueue> renderQueue;
+
+	// Runs of the queue with the same mesh and material, each drawn with one instanced call:
+	// the shadow pass's first, then the main pass's
+	std::vector<RenderBatch> batches;
+	unsigned int shadowBatchCount;
+
+	// Every sorted item's InstanceData, at the same index as the item
+	std::shared_ptr<InstanceBuffer> instanceBuffer;
+
+	// A tree over every entity's world space bounds, indexed like entities,
+	// and which ones the active camera can see this frame
+	std::shared_ptr<BoundingVolumeHierarchy> sceneBVH;
+	std::vector<unsigned int> visibleEntities;
+
+	// Depth of the occluders the camera can see, for hiding what's behind them,
+	// and how that went last frame
+	std::shared_ptr<OcclusionBuffer> occlusionBuffer;
+	unsigned int occludedCount;
+	double occlusionRasterMilliseconds;
+	double occlusionTestMilliseconds;
+
+	// Constant buffer uploads during the last full frame, for the UI
+	SimpleShaderUploadStats lastFrameUploads;
+
 	XMFLOAT3 ambientColor;
 
 	std::vector<Light> lights;
 
-	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> shadowDSV;
+	// One slice of the shadow map per cascade, and another array with just the static casters' depth,
+	// which gets copied into the shadow map every frame and only redrawn when it has to be
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> shadowTexture;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> staticShadowTexture;
+	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> shadowDSVs[SHADOW_CASCADE_COUNT];
+	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> staticShadowDSVs[SHADOW_CASCADE_COUNT];
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> shadowSRV;
 	Microsoft::WRL::ComPtr<ID3D11RasterizerState> shadowRasterizer;
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> shadowSampler;
 	DirectX::XMFLOAT4X4 shadowViewMatrix;
-	DirectX::XMFLOAT4X4 shadowProjectionMatrix;
+	ShadowCascade shadowCascades[SHADOW_CASCADE_COUNT];
+
+	// Which cascades' static layers need drawing this frame, the entities
+	// that can cast into one cascade, and how that went last frame
+	std::shared_ptr<ShadowCache> shadowCache;
+	bool redrawStaticShadows[SHADOW_CASCADE_COUNT];
+	std::vector<unsigned int> shadowCasters;
+	ShadowCasterStats shadowCasterStats;
+
+	// One depth texture shared by every other light's shadows, a tile per
+	// view, and the views the atlas handed out this frame
+	struct ShadowAtlasView
+	{
+		DirectX::XMFLOAT4X4 View;
+		DirectX::XMFLOAT4X4 Projection;
+		ShadowAtlasTile Tile;
+		bool Perspective;	// Point and spot lights clip casters behind them; directional lights flatten them
+	};
+	std::shared_ptr<ShadowAtlas> shadowAtlas;
+	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> shadowAtlasDSV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> shadowAtlasSRV;
+	Microsoft::WRL::ComPtr<ID3D11RasterizerState> shadowAtlasRasterizer;
+	std::vector<ShadowAtlasRequest> shadowAtlasRequests;
+	std::vector<ShadowAtlasView> shadowAtlasViews;
+	ShadowAtlasStats shadowAtlasStats;
+	unsigned int shadowAtlasCasterCount;
+
+	// Which lights reach each cluster of the camera's view, the buffers
+	// the pixel shader finds them in, and how long assigning them took
+	std::shared_ptr<LightClusters> lightClusters;
+	std::shared_ptr<StructuredBuffer> lightBuffer;
+	std::shared_ptr<StructuredBuffer> clusterRangeBuffer;
+	std::shared_ptr<StructuredBuffer> clusterLightBuffer;
+	double lightClusterMilliseconds;
 
 
 	//needed for post processing
@@ -119,6 +224,14 @@ private:
 	std::shared_ptr<SimplePixelShader> ppPS;
 	Microsoft::WRL::ComPtr<ID3D11RenderTargetView> ppRTV; // For rendering
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> ppSRV; // For sampling
+	// The blur's row pass goes into blurRTV/blurUAV, and the compute shader's
+	// column pass into blurOutputUAV, both in floats so the passes don't round
+	std::shared_ptr<SimpleComputeShader> blurCS;
+	Microsoft::WRL::ComPtr<ID3D11RenderTargetView> blurRTV;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> blurUAV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> blurSRV;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> blurOutputUAV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> blurOutputSRV;
 
 
 };
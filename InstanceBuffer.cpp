@@ -0,0 +1,57 @@
+#include "InstanceBuffer.h"
+
+InstanceBuffer::InstanceBuffer(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, unsigned int stride, unsigned int initialCount)
+{
+	this->device = device;
+	this->context = context;
+	this->stride = stride;
+	capacity = 0;
+	CreateBuffer(initialCount > 0 ? initialCount : 1);
+}
+
+void* InstanceBuffer::Map(unsigned int count)
+{
+	if (count > capacity)
+		CreateBuffer(count * 2);
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (!buffer || FAILED(context->Map(buffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return 0;
+	return mapped.pData;
+}
+
+void InstanceBuffer::Unmap()
+{
+	context->Unmap(buffer.Get(), 0);
+}
+
+ID3D11Buffer* InstanceBuffer::GetBuffer()
+{
+	return buffer.Get();
+}
+
+unsigned int InstanceBuffer::GetStride()
+{
+	return stride;
+}
+
+unsigned int InstanceBuffer::GetCapacity()
+{
+	return capacity;
+}
+
+void InstanceBuffer::CreateBuffer(unsigned int count)
+{
+	D3D11_BUFFER_DESC desc = {};
+	desc.ByteWidth = stride * count;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	// Anything still bound keeps the old one alive until it's rebound
+	buffer.Reset();
+	if (SUCCEEDED(device->CreateBuffer(&desc, 0, buffer.GetAddressOf())))
+		capacity = count;
+	else
+		capacity = 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <d3d11.h>
+#include <wrl/client.h>
+
+// --------------------------------------------------------
+// A dynamic vertex buffer of per-instance data, rewritten
+// every frame for instanced draws
+//
+// Map() discards the old contents and hands back room for
+// at least that many instances, growing (to double what it
+// needs, so it settles quickly) if they don't fit.  Write
+// every instance for the frame, Unmap(), then draw ranges of
+// it with Mesh::DrawInstanced().
+//
+// It's only mapped once per frame, so discarding is cheaper
+// than keeping a ring like ConstantBufferRing does: the
+// driver renames the buffer and nothing waits on the GPU.
+// --------------------------------------------------------
+class InstanceBuffer
+{
+public:
+	InstanceBuffer(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, unsigned int stride, unsigned int initialCount);
+
+	/// <summary>
+	/// Discards the buffer and maps it for writing
+	/// </summary>
+	/// <param name="count">How many instances will be written</param>
+	/// <returns>Where instance 0 goes, with each one stride bytes after the last, or null if mapping failed</returns>
+	void* Map(unsigned int count);
+
+	/// <summary>
+	/// Unmaps the buffer, which has to happen before drawing with it
+	/// </summary>
+	void Unmap();
+
+	ID3D11Buffer* GetBuffer();
+	unsigned int GetStride();
+	unsigned int GetCapacity();
+
+private:
+
+	void CreateBuffer(unsigned int count);
+
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> buffer;
+	unsigned int stride;
+	unsigned int capacity;
+};
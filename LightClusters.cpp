@@ -0,0 +1,784 @@
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <thread>
+
+using namespace DirectX;
+
+namespace
+{
+	// Splits count items into parts runs as evenly as it can
+	unsigned int RangeStart(unsigned int count, unsigned int parts, unsigned int part)
+	{
+		return (unsigned int)((unsigned long long)count * part / parts);
+	}
+
+	// Which tile a normalized device coordinate lands in, clamped to the screen
+	unsigned int TileFromNdc(float ndc, unsigned int tiles)
+	{
+		float tile = (ndc + 1.0f) * 0.5f * tiles;
+		if (tile <= 0.0f)
+			return 0;
+		return std::min((unsigned int)tile, tiles - 1);
+	}
+
+	// Whether a world space point is somewhere a spot light reaches
+	bool InSpotCone(const Light& light, const XMFLOAT3& point)
+	{
+		XMVECTOR toPoint = XMLoadFloat3(&point) - XMLoadFloat3(&light.Position);
+		float distance = XMVectorGetX(XMVector3Length(toPoint));
+		if (distance > light.Range)
+			return false;
+		if (distance == 0.0f)
+			return true;
+		float cosine = XMVectorGetX(XMVector3Dot(toPoint, XMVector3Normalize(XMLoadFloat3(&light.Direction)))) / distance;
+		return cosine >= cosf(GetSpotLightAngle(light));
+	}
+
+	// Samples points all through a light's sphere (or cone, for a spot light),
+	// and checks the cluster each one's in, found the way the pixel shader
+	// would, lists the light. Points outside the view don't count.
+	bool ClustersHaveLight(LightClusters& clusters, const Light& light, unsigned int index,
+		const XMFLOAT4X4& view, const XMFLOAT4X4& projection, int samples, std::mt19937& random)
+	{
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		XMMATRIX viewMatrix = XMLoadFloat4x4(&view);
+		float nearPlane = -projection._43 / projection._33;
+		float farPlane = projection._43 / (1.0f - projection._33);
+		const std::vector<ClusterRange>& ranges = clusters.GetRanges();
+		const std::vector<unsigned int>& indices = clusters.GetIndices();
+
+		for (int s = 0; s < samples; s++)
+		{
+			XMFLOAT3 offset(unit(random), unit(random), unit(random));
+			if (offset.x * offset.x + offset.y * offset.y + offset.z * offset.z > 1.0f)
+				continue;
+
+			XMFLOAT3 point(light.Position.x + offset.x * light.Range, light.Position.y + offset.y * light.Range, light.Position.z + offset.z * light.Range);
+			if (light.Type == LIGHT_TYPE_SPOT && !InSpotCone(light, point))
+				continue;
+
+			XMFLOAT3 viewPoint;
+			XMStoreFloat3(&viewPoint, XMVector3TransformCoord(XMLoadFloat3(&point), viewMatrix));
+			if (viewPoint.z < nearPlane || viewPoint.z > farPlane)
+				continue;
+			float ndcX = viewPoint.x * projection._11 / viewPoint.z;
+			float ndcY = viewPoint.y * projection._22 / viewPoint.z;
+			if (fabsf(ndcX) > 1.0f || fabsf(ndcY) > 1.0f)
+				continue;
+
+			unsigned int cluster = TileFromNdc(ndcX, CLUSTER_COUNT_X) +
+				CLUSTER_COUNT_X * (TileFromNdc(-ndcY, CLUSTER_COUNT_Y) + CLUSTER_COUNT_Y * clusters.GetSlice(viewPoint.z));
+			const unsigned int* first = indices.data() + ranges[cluster].Offset;
+			const unsigned int* end = first + ranges[cluster].Count;
+			if (!std::binary_search(first, end, index))
+				return false;
+		}
+		return true;
+	}
+
+	// How many cluster entries are lights of one type
+	unsigned int CountClustersOfType(LightClusters& clusters, const std::vector<Light>& lights, int type)
+	{
+		unsigned int count = 0;
+		const std::vector<unsigned int>& indices = clusters.GetIndices();
+		for (size_t i = clusters.GetGlobalCount(); i < indices.size(); i++)
+			count += lights[indices[i]].Type == type ? 1 : 0;
+		return count;
+	}
+}
+
+LightClusters::LightClusters()
+{
+	minX.resize(CLUSTER_COUNT);
+	minY.resize(CLUSTER_COUNT);
+	minZ.resize(CLUSTER_COUNT);
+	maxX.resize(CLUSTER_COUNT);
+	maxY.resize(CLUSTER_COUNT);
+	maxZ.resize(CLUSTER_COUNT);
+	ranges.resize(CLUSTER_COUNT);
+	globalCount = 0;
+
+	workGeneration = 0;
+	workThreadCount = 1;
+	workRemaining = 0;
+	workersStopping = false;
+
+	XMFLOAT4X4 projection;
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.01f, 1000.0f));
+	SetProjection(projection, 1.0f);
+}
+
+LightClusters::~LightClusters()
+{
+	{
+		std::lock_guard<std::mutex> lock(workMutex);
+		workersStopping = true;
+	}
+	workStarted.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void LightClusters::SetProjection(const XMFLOAT4X4& projection, float firstSlice)
+{
+	// Undoing how XMMatrixPerspectiveFovLH() maps depth
+	projectionX = projection._11;
+	projectionY = projection._22;
+	nearPlane = -projection._43 / projection._33;
+	farPlane = projection._43 / (1.0f - projection._33);
+	firstSliceDepth = std::min(std::max(firstSlice, nearPlane * 2.0f), farPlane * 0.5f);
+	sliceScale = (CLUSTER_COUNT_Z - 1) / logf(farPlane / firstSliceDepth);
+
+	for (unsigned int z = 0; z < CLUSTER_COUNT_Z; z++)
+	{
+		float nearDepth = z == 0 ? nearPlane : firstSliceDepth * expf((z - 1) / sliceScale);
+		float farDepth = z == 0 ? firstSliceDepth :
+			z == CLUSTER_COUNT_Z - 1 ? farPlane : firstSliceDepth * expf(z / sliceScale);
+
+		for (unsigned int y = 0; y < CLUSTER_COUNT_Y; y++)
+		{
+			// Rows go down the screen, so down NDC y
+			float top = 1.0f - 2.0f * y / CLUSTER_COUNT_Y;
+			float bottom = 1.0f - 2.0f * (y + 1) / CLUSTER_COUNT_Y;
+
+			for (unsigned int x = 0; x < CLUSTER_COUNT_X; x++)
+			{
+				float left = -1.0f + 2.0f * x / CLUSTER_COUNT_X;
+				float right = -1.0f + 2.0f * (x + 1) / CLUSTER_COUNT_X;
+
+				// The sides of the cluster fan out from the camera, so the
+				// box around it reaches whichever end of it is wider
+				unsigned int cluster = x + CLUSTER_COUNT_X * (y + CLUSTER_COUNT_Y * z);
+				minX[cluster] = std::min(left * nearDepth, left * farDepth) / projectionX;
+				maxX[cluster] = std::max(right * nearDepth, right * farDepth) / projectionX;
+				minY[cluster] = std::min(bottom * nearDepth, bottom * farDepth) / projectionY;
+				maxY[cluster] = std::max(top * nearDepth, top * farDepth) / projectionY;
+				minZ[cluster] = nearDepth;
+				maxZ[cluster] = farDepth;
+			}
+		}
+	}
+}
+
+unsigned int LightClusters::GetSlice(float viewDepth)
+{
+	if (viewDepth < firstSliceDepth)
+		return 0;
+	return std::min(1 + (unsigned int)(logf(viewDepth / firstSliceDepth) * sliceScale), (unsigned int)CLUSTER_COUNT_Z - 1);
+}
+
+XMFLOAT2 LightClusters::GetDepthSlicing()
+{
+	return XMFLOAT2(firstSliceDepth, sliceScale);
+}
+
+const std::vector<ClusterRange>& LightClusters::GetRanges()
+{
+	return ranges;
+}
+
+const std::vector<unsigned int>& LightClusters::GetIndices()
+{
+	return indices;
+}
+
+unsigned int LightClusters::GetGlobalCount()
+{
+	return globalCount;
+}
+
+void LightClusters::FindVisibleLights(const Light* lights, unsigned int lightCount, const XMFLOAT4X4& view)
+{
+	visibleLights.clear();
+	indices.clear();
+	XMMATRIX viewMatrix = XMLoadFloat4x4(&view);
+
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		const Light& light = lights[i];
+		if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+		{
+			indices.push_back(i);
+			continue;
+		}
+
+		// A spot light only needs the sphere around its cone
+		bool spot = light.Type == LIGHT_TYPE_SPOT;
+		XMFLOAT3 center = light.Position;
+		float radius = light.Range;
+		if (spot)
+			GetSpotLightBounds(light, center, radius);
+		XMStoreFloat3(&center, XMVector3TransformCoord(XMLoadFloat3(&center), viewMatrix));
+		if (center.z + radius < nearPlane || center.z - radius > farPlane)
+			continue;
+
+		// The tiles the box around the sphere covers on screen. x / depth is
+		// smallest and largest at the box's corners, so checking those is enough.
+		float nearDepth = std::max(center.z - radius, nearPlane);
+		float farDepth = std::min(center.z + radius, farPlane);
+		float leftNdc = std::min((center.x - radius) / nearDepth, (center.x - radius) / farDepth) * projectionX;
+		float rightNdc = std::max((center.x + radius) / nearDepth, (center.x + radius) / farDepth) * projectionX;
+		float bottomNdc = std::min((center.y - radius) / nearDepth, (center.y - radius) / farDepth) * projectionY;
+		float topNdc = std::max((center.y + radius) / nearDepth, (center.y + radius) / farDepth) * projectionY;
+		if (rightNdc < -1.0f || leftNdc > 1.0f || topNdc < -1.0f || bottomNdc > 1.0f)
+			continue;
+
+		ClusterLight clusterLight;
+		clusterLight.Center = center;
+		clusterLight.Radius = radius;
+		clusterLight.Index = i;
+		clusterLight.MinX = TileFromNdc(leftNdc, CLUSTER_COUNT_X);
+		clusterLight.MaxX = TileFromNdc(rightNdc, CLUSTER_COUNT_X);
+		clusterLight.MinY = TileFromNdc(-topNdc, CLUSTER_COUNT_Y);
+		clusterLight.MaxY = TileFromNdc(-bottomNdc, CLUSTER_COUNT_Y);
+		clusterLight.MinZ = GetSlice(nearDepth);
+		clusterLight.MaxZ = GetSlice(farDepth);
+
+		clusterLight.Spot = spot;
+		clusterLight.Apex = XMFLOAT3(0, 0, 0);
+		clusterLight.Direction = XMFLOAT3(0, 0, 1);
+		clusterLight.Range = light.Range;
+		clusterLight.CosAngle = -1.0f;
+		clusterLight.SinAngle = 0.0f;
+		if (spot)
+		{
+			float angle = GetSpotLightAngle(light);
+			XMStoreFloat3(&clusterLight.Apex, XMVector3TransformCoord(XMLoadFloat3(&light.Position), viewMatrix));
+			XMStoreFloat3(&clusterLight.Direction, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&light.Direction), viewMatrix)));
+			clusterLight.CosAngle = cosf(angle);
+			clusterLight.SinAngle = sinf(angle);
+		}
+		visibleLights.push_back(clusterLight);
+	}
+
+	globalCount = (unsigned int)indices.size();
+}
+
+void LightClusters::AssignSlices(unsigned int firstSlice, unsigned int endSlice, ThreadHits& hits, bool simd)
+{
+	const unsigned int sliceSize = CLUSTER_COUNT_X * CLUSTER_COUNT_Y;
+	const unsigned int firstCluster = firstSlice * sliceSize;
+	hits.Clusters.clear();
+	hits.Lights.clear();
+
+	// Slices, then lights in order, so each cluster's
+	// hits come out in the order the lights were passed in
+	for (unsigned int z = firstSlice; z < endSlice; z++)
+	{
+		for (const ClusterLight& light : visibleLights)
+		{
+			if (z < light.MinZ || z > light.MaxZ)
+				continue;
+
+			float radiusSquared = light.Radius * light.Radius;
+			for (unsigned int y = light.MinY; y <= light.MaxY; y++)
+			{
+				unsigned int row = CLUSTER_COUNT_X * (y + CLUSTER_COUNT_Y * z);
+				if (simd)
+				{
+					XMVECTOR cx = XMVectorReplicate(light.Center.x);
+					XMVECTOR cy = XMVectorReplicate(light.Center.y);
+					XMVECTOR cz = XMVectorReplicate(light.Center.z);
+					XMVECTOR r2 = XMVectorReplicate(radiusSquared);
+					XMVECTOR half = XMVectorReplicate(0.5f);
+					XMVECTOR ax = XMVectorReplicate(light.Apex.x);
+					XMVECTOR ay = XMVectorReplicate(light.Apex.y);
+					XMVECTOR az = XMVectorReplicate(light.Apex.z);
+					XMVECTOR directionX = XMVectorReplicate(light.Direction.x);
+					XMVECTOR directionY = XMVectorReplicate(light.Direction.y);
+					XMVECTOR directionZ = XMVectorReplicate(light.Direction.z);
+					XMVECTOR range = XMVectorReplicate(light.Range);
+					XMVECTOR cosAngle = XMVectorReplicate(light.CosAngle);
+					XMVECTOR sinAngle = XMVectorReplicate(light.SinAngle);
+
+					// Rows are a multiple of 4 wide, so every group of 4 stays in the row
+					for (unsigned int first = light.MinX & ~3u; first <= light.MaxX; first += 4)
+					{
+						unsigned int cluster = row + first;
+						XMVECTOR boxMinX = XMLoadFloat4((const XMFLOAT4*)&minX[cluster]);
+						XMVECTOR boxMinY = XMLoadFloat4((const XMFLOAT4*)&minY[cluster]);
+						XMVECTOR boxMinZ = XMLoadFloat4((const XMFLOAT4*)&minZ[cluster]);
+						XMVECTOR boxMaxX = XMLoadFloat4((const XMFLOAT4*)&maxX[cluster]);
+						XMVECTOR boxMaxY = XMLoadFloat4((const XMFLOAT4*)&maxY[cluster]);
+						XMVECTOR boxMaxZ = XMLoadFloat4((const XMFLOAT4*)&maxZ[cluster]);
+						XMVECTOR dx = XMVectorMax(XMVectorMax(boxMinX - cx, cx - boxMaxX), XMVectorZero());
+						XMVECTOR dy = XMVectorMax(XMVectorMax(boxMinY - cy, cy - boxMaxY), XMVectorZero());
+						XMVECTOR dz = XMVectorMax(XMVectorMax(boxMinZ - cz, cz - boxMaxZ), XMVectorZero());
+						XMVECTOR inside = XMVectorLessOrEqual(dx * dx + dy * dy + dz * dz, r2);
+						if (XMVector4EqualInt(inside, XMVectorFalseInt()))
+							continue;
+
+						// The same as ConeIntersectsSphere(), against the sphere around each box
+						if (light.Spot)
+						{
+							XMVECTOR extentX = (boxMaxX - boxMinX) * half;
+							XMVECTOR extentY = (boxMaxY - boxMinY) * half;
+							XMVECTOR extentZ = (boxMaxZ - boxMinZ) * half;
+							XMVECTOR boxRadius = XMVectorSqrt(extentX * extentX + extentY * extentY + extentZ * extentZ);
+							XMVECTOR vx = (boxMinX + boxMaxX) * half - ax;
+							XMVECTOR vy = (boxMinY + boxMaxY) * half - ay;
+							XMVECTOR vz = (boxMinZ + boxMaxZ) * half - az;
+							XMVECTOR lengthSquared = vx * vx + vy * vy + vz * vz;
+							XMVECTOR along = vx * directionX + vy * directionY + vz * directionZ;
+							XMVECTOR across = XMVectorSqrt(XMVectorMax(lengthSquared - along * along, XMVectorZero()));
+							inside = XMVectorAndInt(inside, XMVectorLessOrEqual(along, range + boxRadius));
+							if (light.CosAngle >= 0.0f)
+								inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(along, -boxRadius));
+							inside = XMVectorAndInt(inside, XMVectorLessOrEqual(cosAngle * across - along * sinAngle, boxRadius));
+							if (XMVector4EqualInt(inside, XMVectorFalseInt()))
+								continue;
+						}
+
+						uint32_t lanes[4];
+						XMStoreInt4(lanes, inside);
+						for (unsigned int k = 0; k < 4; k++)
+						{
+							unsigned int x = first + k;
+							if (lanes[k] && x >= light.MinX && x <= light.MaxX)
+							{
+								hits.Clusters.push_back(row + x - firstCluster);
+								hits.Lights.push_back(light.Index);
+							}
+						}
+					}
+				}
+				else
+				{
+					for (unsigned int x = light.MinX; x <= light.MaxX; x++)
+					{
+						unsigned int cluster = row + x;
+						float dx = std::max(std::max(minX[cluster] - light.Center.x, light.Center.x - maxX[cluster]), 0.0f);
+						float dy = std::max(std::max(minY[cluster] - light.Center.y, light.Center.y - maxY[cluster]), 0.0f);
+						float dz = std::max(std::max(minZ[cluster] - light.Center.z, light.Center.z - maxZ[cluster]), 0.0f);
+						if (dx * dx + dy * dy + dz * dz > radiusSquared)
+							continue;
+
+						if (light.Spot)
+						{
+							XMFLOAT3 extent((maxX[cluster] - minX[cluster]) * 0.5f, (maxY[cluster] - minY[cluster]) * 0.5f, (maxZ[cluster] - minZ[cluster]) * 0.5f);
+							XMFLOAT3 boxCenter((minX[cluster] + maxX[cluster]) * 0.5f, (minY[cluster] + maxY[cluster]) * 0.5f, (minZ[cluster] + maxZ[cluster]) * 0.5f);
+							float boxRadius = sqrtf(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z);
+							if (!ConeIntersectsSphere(light.Apex, light.Direction, light.Range, light.CosAngle, light.SinAngle, boxCenter, boxRadius))
+								continue;
+						}
+
+						hits.Clusters.push_back(cluster - firstCluster);
+						hits.Lights.push_back(light.Index);
+					}
+				}
+			}
+		}
+	}
+
+	// Counting sort by cluster, which keeps each cluster's lights in order
+	unsigned int clusterCount = (endSlice - firstSlice) * sliceSize;
+	hits.Counts.assign(clusterCount, 0);
+	hits.Starts.resize(clusterCount);
+	for (unsigned int cluster : hits.Clusters)
+		hits.Counts[cluster]++;
+
+	unsigned int start = 0;
+	for (unsigned int c = 0; c < clusterCount; c++)
+	{
+		hits.Starts[c] = start;
+		start += hits.Counts[c];
+	}
+
+	hits.Sorted.resize(hits.Lights.size());
+	std::vector<unsigned int>& next = hits.Counts;
+	for (unsigned int c = 0; c < clusterCount; c++)
+		next[c] = hits.Starts[c];
+	for (size_t h = 0; h < hits.Clusters.size(); h++)
+		hits.Sorted[next[hits.Clusters[h]]++] = hits.Lights[h];
+
+	// Turn the cursors back into counts
+	for (unsigned int c = 0; c < clusterCount; c++)
+		hits.Counts[c] -= hits.Starts[c];
+}
+
+void LightClusters::GatherHits(unsigned int threadCount)
+{
+	const unsigned int sliceSize = CLUSTER_COUNT_X * CLUSTER_COUNT_Y;
+	size_t total = globalCount;
+	for (unsigned int t = 0; t < threadCount; t++)
+		total += threadHits[t].Sorted.size();
+	indices.resize(total);
+
+	unsigned int offset = globalCount;
+	for (unsigned int t = 0; t < threadCount; t++)
+	{
+		const ThreadHits& hits = threadHits[t];
+		unsigned int firstCluster = sliceStarts[t] * sliceSize;
+		for (size_t c = 0; c < hits.Counts.size(); c++)
+		{
+			ranges[firstCluster + c].Offset = offset + hits.Starts[c];
+			ranges[firstCluster + c].Count = hits.Counts[c];
+		}
+
+		if (!hits.Sorted.empty())
+			memcpy(&indices[offset], hits.Sorted.data(), hits.Sorted.size() * sizeof(unsigned int));
+		offset += (unsigned int)hits.Sorted.size();
+	}
+}
+
+void LightClusters::Assign(const Light* lights, unsigned int lightCount, const XMFLOAT4X4& view, unsigned int threadCount)
+{
+	FindVisibleLights(lights, lightCount, view);
+
+	threadCount = std::min(std::max(threadCount, 1u), (unsigned int)CLUSTER_COUNT_Z);
+	if (threadHits.size() < threadCount)
+		threadHits.resize(threadCount);
+
+	sliceStarts.resize(threadCount + 1);
+	for (unsigned int t = 0; t <= threadCount; t++)
+		sliceStarts[t] = RangeStart(CLUSTER_COUNT_Z, threadCount, t);
+
+	if (threadCount == 1)
+	{
+		AssignSlices(0, CLUSTER_COUNT_Z, threadHits[0], true);
+	}
+	else
+	{
+		// Each thread has its own slices, so nothing they write overlaps.
+		// The workers wake up for the rest while this one does the first.
+		StartWorkers(threadCount - 1);
+		{
+			std::lock_guard<std::mutex> lock(workMutex);
+			workThreadCount = threadCount;
+			workRemaining = threadCount - 1;
+			workGeneration++;
+		}
+		workStarted.notify_all();
+
+		AssignSlices(sliceStarts[0], sliceStarts[1], threadHits[0], true);
+
+		std::unique_lock<std::mutex> lock(workMutex);
+		workFinished.wait(lock, [this]() { return workRemaining == 0; });
+	}
+
+	GatherHits(threadCount);
+}
+
+void LightClusters::AssignScalar(const Light* lights, unsigned int lightCount, const XMFLOAT4X4& view)
+{
+	FindVisibleLights(lights, lightCount, view);
+
+	if (threadHits.empty())
+		threadHits.resize(1);
+
+	sliceStarts = { 0, CLUSTER_COUNT_Z };
+	AssignSlices(0, CLUSTER_COUNT_Z, threadHits[0], false);
+	GatherHits(1);
+}
+
+void LightClusters::StartWorkers(unsigned int count)
+{
+	// Nothing's handed out while this runs, so the generation can't change under it
+	while (workers.size() < count)
+		workers.emplace_back(&LightClusters::WorkerLoop, this, (unsigned int)workers.size() + 1, workGeneration);
+}
+
+void LightClusters::WorkerLoop(unsigned int thread, unsigned int generation)
+{
+	std::unique_lock<std::mutex> lock(workMutex);
+	while (true)
+	{
+		workStarted.wait(lock, [this, generation]() { return workersStopping || workGeneration != generation; });
+		if (workersStopping)
+			return;
+		generation = workGeneration;
+
+		// Fewer threads than workers this time
+		if (thread >= workThreadCount)
+			continue;
+
+		lock.unlock();
+		AssignSlices(sliceStarts[thread], sliceStarts[thread + 1], threadHits[thread], true);
+		lock.lock();
+
+		if (--workRemaining == 0)
+			workFinished.notify_one();
+	}
+}
+
+bool ConeIntersectsSphere(const XMFLOAT3& apex, const XMFLOAT3& direction, float range, float cosAngle, float sinAngle,
+	const XMFLOAT3& center, float radius)
+{
+	// How far the sphere's center is along the cone and out from its axis
+	float vx = center.x - apex.x;
+	float vy = center.y - apex.y;
+	float vz = center.z - apex.z;
+	float lengthSquared = vx * vx + vy * vy + vz * vz;
+	float along = vx * direction.x + vy * direction.y + vz * direction.z;
+	float across = sqrtf(std::max(lengthSquared - along * along, 0.0f));
+
+	// Past the end, behind the tip (unless the cone's wider than a
+	// hemisphere), or further than the radius outside the cone's edge
+	if (!(along <= range + radius) || (cosAngle >= 0.0f && !(along >= -radius)))
+		return false;
+	return cosAngle * across - along * sinAngle <= radius;
+}
+
+unsigned int GetClusterThreadCount(unsigned int lightCount)
+{
+	// Waking threads and gathering their hits costs more than a few hundred lights take on one
+	if (lightCount < 512)
+		return 1;
+	return std::min(std::max(std::thread::hardware_concurrency(), 1u), 8u);
+}
+
+LightClusterBenchmark BenchmarkLightClusters(unsigned int lightCount, int repeats)
+{
+	LightClusterBenchmark results = {};
+	results.LightCount = lightCount;
+	results.ThreadCount = GetClusterThreadCount(lightCount);
+
+	// A couple of suns, then a field of small lights spread
+	// out in front of the camera and off to the sides
+	std::mt19937 random(23);
+	std::uniform_real_distribution<float> xs(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> ys(-5.0f, 15.0f);
+	std::uniform_real_distribution<float> zs(-20.0f, 200.0f);
+	std::uniform_real_distribution<float> rangeDistribution(1.0f, 10.0f);
+	std::uniform_real_distribution<float> tilts(-0.5f, 0.5f);
+	std::uniform_real_distribution<float> falloffs(2.0f, 40.0f);
+	std::vector<Light> lights(lightCount);
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		Light& light = lights[i];
+		light = {};
+		light.Intensity = 1.0f;
+		light.Color = XMFLOAT3(1, 1, 1);
+		light.ShadowIndex = -1;
+		if (i < 2)
+		{
+			light.Type = LIGHT_TYPE_DIRECTIONAL;
+			light.Direction = XMFLOAT3(0.3f, -1.0f, 0.2f * i);
+			continue;
+		}
+		light.Type = i % 4 == 0 ? LIGHT_TYPE_SPOT : LIGHT_TYPE_POINT;
+		light.Position = XMFLOAT3(xs(random), ys(random), zs(random));
+		light.Range = rangeDistribution(random);
+		light.Direction = XMFLOAT3(tilts(random), -1.0f, tilts(random));
+		light.SpotFalloff = falloffs(random);
+	}
+
+	// Like Game's camera
+	XMFLOAT4X4 view, projection;
+	XMStoreFloat4x4(&view, XMMatrixLookToLH(XMVectorSet(0, 2, -6, 0), XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0)));
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, 16.0f / 9.0f, 0.01f, 1000.0f));
+
+	LightClusters scalar, simd, threaded;
+	scalar.SetProjection(projection, 1.0f);
+	simd.SetProjection(projection, 1.0f);
+	threaded.SetProjection(projection, 1.0f);
+
+	std::chrono::high_resolution_clock::duration scalarTime = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration simdTime = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration threadedTime = std::chrono::high_resolution_clock::duration::max();
+	for (int r = 0; r < repeats; r++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		scalar.AssignScalar(lights.data(), lightCount, view);
+		scalarTime = std::min(scalarTime, std::chrono::high_resolution_clock::now() - start);
+
+		start = std::chrono::high_resolution_clock::now();
+		simd.Assign(lights.data(), lightCount, view, 1);
+		simdTime = std::min(simdTime, std::chrono::high_resolution_clock::now() - start);
+
+		start = std::chrono::high_resolution_clock::now();
+		threaded.Assign(lights.data(), lightCount, view, results.ThreadCount);
+		threadedTime = std::min(threadedTime, std::chrono::high_resolution_clock::now() - start);
+	}
+	results.ScalarMilliseconds = std::chrono::duration<double, std::milli>(scalarTime).count();
+	results.SimdMilliseconds = std::chrono::duration<double, std::milli>(simdTime).count();
+	results.ThreadedMilliseconds = std::chrono::duration<double, std::milli>(threadedTime).count();
+
+	const std::vector<ClusterRange>& ranges = threaded.GetRanges();
+	const std::vector<unsigned int>& indices = threaded.GetIndices();
+	results.Matches = scalar.GetIndices() == indices && simd.GetIndices() == indices &&
+		scalar.GetGlobalCount() == threaded.GetGlobalCount() && simd.GetGlobalCount() == threaded.GetGlobalCount();
+	for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+	{
+		results.Matches = results.Matches &&
+			scalar.GetRanges()[c].Offset == ranges[c].Offset && scalar.GetRanges()[c].Count == ranges[c].Count &&
+			simd.GetRanges()[c].Offset == ranges[c].Offset && simd.GetRanges()[c].Count == ranges[c].Count;
+	}
+	results.IndexCount = (unsigned int)indices.size();
+
+	unsigned int litClusters = 0;
+	for (const ClusterRange& range : ranges)
+	{
+		if (range.Count == 0)
+			continue;
+		litClusters++;
+		results.AverageLightsPerCluster += range.Count;
+		results.MaxLightsPerCluster = std::max(results.MaxLightsPerCluster, range.Count);
+	}
+	if (litClusters > 0)
+		results.AverageLightsPerCluster /= litClusters;
+
+	// Points all through each light's sphere (or cone), found the way
+	// the pixel shader would, should always land in a cluster that lists the light
+	results.Conservative = true;
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		if (lights[i].Type != LIGHT_TYPE_DIRECTIONAL)
+			results.Conservative = results.Conservative && ClustersHaveLight(threaded, lights[i], i, view, projection, 16, random);
+	}
+
+	// And how much the cones saved over treating spot lights as points
+	std::vector<Light> spheres = lights;
+	for (Light& light : spheres)
+	{
+		if (light.Type == LIGHT_TYPE_SPOT)
+			light.Type = LIGHT_TYPE_POINT;
+	}
+	LightClusters sphereClusters;
+	sphereClusters.SetProjection(projection, 1.0f);
+	sphereClusters.Assign(spheres.data(), lightCount, view, 1);
+	results.SpotClusters = CountClustersOfType(threaded, lights, LIGHT_TYPE_SPOT);
+	results.SpotSphereClusters = CountClustersOfType(sphereClusters, lights, LIGHT_TYPE_SPOT);
+
+	return results;
+}
+
+SpotLightChecks CheckSpotLights()
+{
+	SpotLightChecks results = {};
+	results.BoundsContainCones = true;
+	results.BoundsTight = true;
+	results.ConeTestConservative = true;
+	std::mt19937 random(24);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> radii(0.05f, 2.0f);
+
+	// From a pencil beam, through narrow and wide cones, to
+	// one that lights everything around it
+	for (float falloff : { 500.0f, 20.0f, 4.0f, 1.5f, 0.5f, 0.0f })
+	{
+		Light light = {};
+		light.Type = LIGHT_TYPE_SPOT;
+		light.Position = XMFLOAT3(1, 2, 3);
+		XMStoreFloat3(&light.Direction, XMVector3Normalize(XMVectorSet(0.3f, -1.0f, 0.5f, 0)));
+		light.Range = 5.0f;
+		light.SpotFalloff = falloff;
+		float angle = GetSpotLightAngle(light);
+
+		XMFLOAT3 center;
+		float radius;
+		GetSpotLightBounds(light, center, radius);
+		XMVECTOR boundsCenter = XMLoadFloat3(&center);
+
+		// Points all through the cone, plus its tip, the end of its cap and
+		// around its rim, which are as far out as a cone gets
+		std::vector<XMFLOAT3> points;
+		XMVECTOR position = XMLoadFloat3(&light.Position);
+		XMVECTOR direction = XMLoadFloat3(&light.Direction);
+		XMVECTOR side = XMVector3Normalize(XMVector3Cross(direction, XMVectorSet(1, 0, 0, 0)));
+		XMVECTOR otherSide = XMVector3Cross(direction, side);
+		float rimAngle = std::min(angle, XM_PI);
+		for (int r = 0; r < 16; r++)
+		{
+			float around = r * XM_2PI / 16;
+			XMVECTOR rimDirection = direction * cosf(rimAngle) + (side * cosf(around) + otherSide * sinf(around)) * sinf(rimAngle);
+			XMFLOAT3 point;
+			XMStoreFloat3(&point, position + rimDirection * light.Range);
+			points.push_back(point);
+		}
+		XMFLOAT3 end;
+		XMStoreFloat3(&end, position + direction * light.Range);
+		points.push_back(light.Position);
+		points.push_back(end);
+		while (points.size() < 2000)
+		{
+			XMFLOAT3 point(light.Position.x + unit(random) * light.Range, light.Position.y + unit(random) * light.Range, light.Position.z + unit(random) * light.Range);
+			if (InSpotCone(light, point))
+				points.push_back(point);
+		}
+
+		float farthest = 0.0f;
+		for (const XMFLOAT3& point : points)
+			farthest = std::max(farthest, XMVectorGetX(XMVector3Length(XMLoadFloat3(&point) - boundsCenter)));
+		results.BoundsContainCones = results.BoundsContainCones && farthest <= radius * 1.0001f;
+		results.BoundsTight = results.BoundsTight && farthest >= radius * 0.999f && radius <= light.Range * 1.0001f;
+
+		// Spheres scattered all around the light, and any with a point of the cone in it has to count
+		for (int s = 0; s < 500; s++)
+		{
+			XMFLOAT3 sphereCenter(light.Position.x + unit(random) * 8.0f, light.Position.y + unit(random) * 8.0f, light.Position.z + unit(random) * 8.0f);
+			float sphereRadius = radii(random);
+			bool touches = false;
+			for (const XMFLOAT3& point : points)
+			{
+				if (XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&point) - XMLoadFloat3(&sphereCenter))) <= sphereRadius * sphereRadius)
+				{
+					touches = true;
+					break;
+				}
+			}
+			if (touches && !ConeIntersectsSphere(light.Position, light.Direction, light.Range, cosf(angle), sinf(angle), sphereCenter, sphereRadius))
+				results.ConeTestConservative = false;
+		}
+	}
+
+	// A cone down +Z, about 37 degrees from its axis to its edge: spheres behind
+	// it, beside it and past its end are out, and one right in front of it isn't
+	{
+		Light light = {};
+		light.Range = 5.0f;
+		light.SpotFalloff = 20.0f;
+		float angle = GetSpotLightAngle(light);
+		XMFLOAT3 apex(0, 0, 0);
+		XMFLOAT3 direction(0, 0, 1);
+		results.ConeTestCulls =
+			!ConeIntersectsSphere(apex, direction, light.Range, cosf(angle), sinf(angle), XMFLOAT3(0, 0, -2), 1.0f) &&
+			!ConeIntersectsSphere(apex, direction, light.Range, cosf(angle), sinf(angle), XMFLOAT3(3, 0, 0.5f), 0.5f) &&
+			!ConeIntersectsSphere(apex, direction, light.Range, cosf(angle), sinf(angle), XMFLOAT3(0, 3, 2), 0.5f) &&
+			!ConeIntersectsSphere(apex, direction, light.Range, cosf(angle), sinf(angle), XMFLOAT3(0, 0, 7), 1.0f) &&
+			ConeIntersectsSphere(apex, direction, light.Range, cosf(angle), sinf(angle), XMFLOAT3(0, 0, 3), 0.1f) &&
+			ConeIntersectsSphere(apex, direction, light.Range, cosf(angle), sinf(angle), XMFLOAT3(2.6f, 0, 3), 0.5f);
+	}
+
+	// Spot lights pointing every which way in front of a camera like Game's
+	// reach far fewer clusters than points would, and still every one they light
+	{
+		std::vector<Light> lights(200);
+		for (Light& light : lights)
+		{
+			light = {};
+			light.Type = LIGHT_TYPE_SPOT;
+			light.Position = XMFLOAT3(unit(random) * 20.0f, unit(random) * 5.0f, 10.0f + unit(random) * 10.0f);
+			XMStoreFloat3(&light.Direction, XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0) + XMVectorSet(0, 0, 0.001f, 0)));
+			light.Range = 6.0f;
+			light.SpotFalloff = 20.0f;
+			light.ShadowIndex = -1;
+		}
+
+		XMFLOAT4X4 view, projection;
+		XMStoreFloat4x4(&view, XMMatrixLookToLH(XMVectorSet(0, 2, -6, 0), XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0)));
+		XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, 16.0f / 9.0f, 0.01f, 1000.0f));
+
+		LightClusters cones, spheres;
+		cones.SetProjection(projection, 1.0f);
+		spheres.SetProjection(projection, 1.0f);
+		cones.Assign(lights.data(), (unsigned int)lights.size(), view, 1);
+		std::vector<Light> points = lights;
+		for (Light& light : points)
+			light.Type = LIGHT_TYPE_POINT;
+		spheres.Assign(points.data(), (unsigned int)points.size(), view, 1);
+
+		unsigned int coneCount = CountClustersOfType(cones, lights, LIGHT_TYPE_SPOT);
+		unsigned int sphereCount = CountClustersOfType(spheres, points, LIGHT_TYPE_POINT);
+		results.ClustersFollowCone = coneCount > 0 && coneCount * 2 < sphereCount;
+		for (unsigned int i = 0; i < lights.size(); i++)
+			results.ClustersFollowCone = results.ClustersFollowCone && ClustersHaveLight(cones, lights[i], i, view, projection, 256, random);
+	}
+
+	return results;
+}
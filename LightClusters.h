@@ -0,0 +1,236 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Lights.h"
+
+// How many clusters the camera's view gets split into across, down and
+// away from the camera. Matches CLUSTER_COUNT_X/Y/Z in PixelShader.hlsl.
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+#define CLUSTER_COUNT (CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z)
+
+// Where one cluster's lights are in GetIndices(). Matches the uint2 in PixelShader.hlsl.
+struct ClusterRange
+{
+	unsigned int Offset;
+	unsigned int Count;
+};
+
+// --------------------------------------------------------
+// Works out which lights can reach each small box of the
+// camera's view, so a pixel only shades the lights that
+// can actually touch it
+//
+// The view gets split into a grid of clusters: even tiles
+// across the screen, and slices away from the camera that
+// get deeper the further out they are (the first one runs
+// up to a fixed depth, and the rest grow exponentially to
+// the far plane), so clusters stay roughly cube shaped.
+// SetProjection() works out every cluster's box in view
+// space, which only changes with the projection.
+//
+// Assign() then finds each point or spot light's sphere in
+// view space and the range of clusters its bounds touch,
+// and tests the sphere against each of those clusters' boxes
+// four at a time with DirectXMath.  A spot light's sphere
+// is the one around its cone, and each cluster it touches
+// also has to touch the cone itself, tested against the
+// sphere around the cluster's box, so clusters off to the
+// side of the cone don't pay for it.  Threads split the slices
+// between them, so none of them write to the same cluster,
+// and each one counting sorts its own hits by cluster before
+// they get copied into one list.  The calling thread takes
+// the first slices, and the rest go to worker threads that
+// are started the first time they're needed and then sleep
+// between calls, so a frame only pays for waking them.  Directional lights reach
+// everything, so they go at the start of the list instead.
+//
+// The result is what the pixel shader reads: a range per
+// cluster into one list of light indices, with each
+// cluster's lights in the order they were passed in.
+//
+// Nothing here touches D3D, so it can be checked and timed
+// on its own.
+// --------------------------------------------------------
+class LightClusters
+{
+public:
+	LightClusters();
+	~LightClusters();
+
+	LightClusters(const LightClusters&) = delete;
+	LightClusters& operator=(const LightClusters&) = delete;
+
+	/// <summary>
+	/// Sets up every cluster's box for a projection made by XMMatrixPerspectiveFovLH()
+	/// </summary>
+	/// <param name="firstSliceDepth">Where the first slice ends and the exponential ones start</param>
+	void SetProjection(const DirectX::XMFLOAT4X4& projection, float firstSliceDepth);
+
+	/// <summary>
+	/// Finds which clusters every light can reach, four clusters at a time, spread over some threads
+	/// </summary>
+	/// <param name="view">The camera's view matrix</param>
+	/// <param name="threadCount">How many threads to split the slices between, like from GetClusterThreadCount()</param>
+	void Assign(const Light* lights, unsigned int lightCount, const DirectX::XMFLOAT4X4& view, unsigned int threadCount);
+
+	/// <summary>
+	/// Same results as Assign(), one cluster at a time on one thread, for checking and timing it against
+	/// </summary>
+	void AssignScalar(const Light* lights, unsigned int lightCount, const DirectX::XMFLOAT4X4& view);
+
+	// One range per cluster, x first, then y (top to bottom of the screen), then z
+	const std::vector<ClusterRange>& GetRanges();
+
+	// The directional lights, then every cluster's lights
+	const std::vector<unsigned int>& GetIndices();
+
+	// How many directional lights are at the start of GetIndices()
+	unsigned int GetGlobalCount();
+
+	/// <summary>
+	/// Gets what the pixel shader needs to find its slice from its depth: the first slice's depth in x, and slices per unit of log depth in y
+	/// </summary>
+	DirectX::XMFLOAT2 GetDepthSlicing();
+
+	/// <summary>
+	/// Which slice a view space depth lands in, the same way the pixel shader works it out
+	/// </summary>
+	unsigned int GetSlice(float viewDepth);
+
+private:
+
+	// Every cluster's box in view space, one array per component
+	std::vector<float> minX, minY, minZ;
+	std::vector<float> maxX, maxY, maxZ;
+	float projectionX;	// _11 and _22 of the projection
+	float projectionY;
+	float nearPlane;
+	float farPlane;
+	float firstSliceDepth;
+	float sliceScale;	// Slices per unit of log depth past the first one
+
+	// A point or spot light that made it into view, with the clusters its bounds touch
+	struct ClusterLight
+	{
+		DirectX::XMFLOAT3 Center;	// In view space
+		float Radius;
+		unsigned int Index;			// In what was passed to Assign()
+		unsigned int MinX, MaxX;
+		unsigned int MinY, MaxY;
+		unsigned int MinZ, MaxZ;
+
+		// Spot lights' cones, also in view space
+		bool Spot;
+		DirectX::XMFLOAT3 Apex;
+		DirectX::XMFLOAT3 Direction;
+		float Range;
+		float CosAngle;
+		float SinAngle;
+	};
+	std::vector<ClusterLight> visibleLights;
+
+	// What one thread found for its slices
+	struct ThreadHits
+	{
+		std::vector<unsigned int> Clusters;	// One per hit
+		std::vector<unsigned int> Lights;	// ...the light for it
+		std::vector<unsigned int> Counts;	// Per cluster in the thread's slices
+		std::vector<unsigned int> Starts;	// Where each of those clusters starts in Sorted
+		std::vector<unsigned int> Sorted;	// The hits' lights, sorted by cluster
+	};
+	std::vector<ThreadHits> threadHits;
+
+	// Where each thread's slices start, with one more on the end
+	std::vector<unsigned int> sliceStarts;
+
+	// Worker threads for the second set of slices on, which stay
+	// around between Assign() calls waiting for the next one
+	std::vector<std::thread> workers;
+	std::mutex workMutex;
+	std::condition_variable workStarted;
+	std::condition_variable workFinished;
+	unsigned int workGeneration;	// Goes up every time Assign() hands out work
+	unsigned int workThreadCount;	// How many threads that work is split between, the calling one included
+	unsigned int workRemaining;		// Workers that haven't finished it yet
+	bool workersStopping;
+
+	std::vector<ClusterRange> ranges;
+	std::vector<unsigned int> indices;
+	unsigned int globalCount;
+
+	void FindVisibleLights(const Light* lights, unsigned int lightCount, const DirectX::XMFLOAT4X4& view);
+	void AssignSlices(unsigned int firstSlice, unsigned int endSlice, ThreadHits& hits, bool simd);
+	void GatherHits(unsigned int threadCount);
+
+	/// <summary>
+	/// Starts more workers, if needed, until there are at least this many
+	/// </summary>
+	void StartWorkers(unsigned int count);
+
+	/// <summary>
+	/// What each worker runs: wait for work, do this thread's slices if it has any, repeat until stopping
+	/// </summary>
+	/// <param name="thread">Which thread's slices are this worker's, from 1 up</param>
+	/// <param name="generation">The workGeneration when it started, so it doesn't do old work</param>
+	void WorkerLoop(unsigned int thread, unsigned int generation);
+};
+
+/// <summary>
+/// Says whether a sphere touches a cone capped at range, like a spot light's, without ever
+/// saying no when it does. Can say yes for a sphere that's just past the cone's edge near its tip.
+/// </summary>
+/// <param name="direction">Which way the cone points, normalized</param>
+/// <param name="cosAngle">Cosine of the angle from the cone's direction to its edge, like from GetSpotLightAngle()</param>
+/// <param name="sinAngle">...and its sine</param>
+bool ConeIntersectsSphere(const DirectX::XMFLOAT3& apex, const DirectX::XMFLOAT3& direction, float range, float cosAngle, float sinAngle,
+	const DirectX::XMFLOAT3& center, float radius);
+
+/// <summary>
+/// Picks how many threads Assign() should use: one for a handful of lights, or up to 8 once there are enough to be worth it
+/// </summary>
+unsigned int GetClusterThreadCount(unsigned int lightCount);
+
+// Results of clustering a made up field of lights every way
+struct LightClusterBenchmark
+{
+	unsigned int LightCount;
+	unsigned int ThreadCount;
+	double ScalarMilliseconds;			// AssignScalar()
+	double SimdMilliseconds;			// Assign() on one thread
+	double ThreadedMilliseconds;		// Assign() on ThreadCount threads
+	bool Matches;						// All three came out exactly the same
+	bool Conservative;					// Points all through each light's sphere (or cone) land in clusters that have the light
+	unsigned int SpotClusters;			// Clusters the spot lights reached
+	unsigned int SpotSphereClusters;	// ...and how many they would have as plain spheres of their range
+	double AverageLightsPerCluster;		// Among clusters with any lights
+	unsigned int MaxLightsPerCluster;
+	unsigned int IndexCount;			// Length of the whole list
+};
+
+/// <summary>
+/// Clusters a field of point and spot lights in front of a camera like Game's
+/// </summary>
+/// <param name="lightCount">How many lights</param>
+/// <param name="repeats">How many times to assign each way (the fastest one counts)</param>
+LightClusterBenchmark BenchmarkLightClusters(unsigned int lightCount, int repeats);
+
+// Results of checking the spot light bounds and cone tests against points sampled all through made up cones
+struct SpotLightChecks
+{
+	bool BoundsContainCones;	// Every point in a cone is in GetSpotLightBounds()'s sphere, for narrow, wide and hemisphere cones
+	bool BoundsTight;			// Each cone's farthest point is right on its sphere, and none of them is bigger than the light's range
+	bool ConeTestConservative;	// ConeIntersectsSphere() never misses a sphere with a point of the cone in it
+	bool ConeTestCulls;			// ...and does rule out spheres behind, beside and past the end of the cone
+	bool ClustersFollowCone;	// Spot lights reach far fewer clusters than point lights of the same range, and still every one their cones do
+};
+
+/// <summary>
+/// Runs GetSpotLightBounds(), ConeIntersectsSphere() and LightClusters through made up spot lights
+/// </summary>
+SpotLightChecks CheckSpotLights();
@@ -1,5 +1,6 @@
 #pragma once
 #include <DirectXMath.h>
+#include <cmath>
 using namespace DirectX;
 
 #define LIGHT_TYPE_DIRECTIONAL 0
@@ -15,6 +16,46 @@ struct Light {
 	float Intensity; // All lights need an intensity
 	XMFLOAT3 Color; // All lights need a color
 	float SpotFalloff; // Spot lights need a value to define their cone size
-	XMFLOAT3 Padding; // Purposefully padding to hit the 16-byte boundary
+	int ShadowIndex; // Where its shadow views start in the shadow atlas, or -1 if it doesn't have any
+	XMFLOAT2 Padding; // Purposefully padding to hit the 16-byte boundary
 
-};
\ No newline at end of file
+};
+
+// How far a spot light's cone reaches from its direction, in radians:
+// where pow(cos(angle), SpotFalloff) fades to 1%, which the pixel shader
+// treats as the edge of the cone. A SpotFalloff of 0 or less lights everything.
+inline float GetSpotLightAngle(const Light& light)
+{
+	if (light.SpotFalloff <= 0.0f)
+		return XM_PI;
+	return acosf(powf(0.01f, 1.0f / light.SpotFalloff));
+}
+
+// The smallest sphere around everything a spot light reaches: its cone,
+// capped by its range. Only a cone wider than a hemisphere needs the
+// light's whole range around it.
+inline void GetSpotLightBounds(const Light& light, XMFLOAT3& center, float& radius)
+{
+	float angle = GetSpotLightAngle(light);
+	XMVECTOR position = XMLoadFloat3(&light.Position);
+	XMVECTOR direction = XMVector3Normalize(XMLoadFloat3(&light.Direction));
+	float offset;
+	if (angle >= XM_PIDIV2)
+	{
+		// Everything around the light
+		offset = 0.0f;
+		radius = light.Range;
+	}
+	else if (angle > XM_PIDIV4)
+	{
+		// Wide: the rim of the cone's cap is the widest part
+		offset = light.Range * cosf(angle);
+		radius = light.Range * sinf(angle);
+	}
+	else
+	{
+		// Narrow: the sphere through the light and the rim, which reaches the end of the cap too
+		offset = radius = light.Range / (2.0f * cosf(angle));
+	}
+	XMStoreFloat3(&center, position + direction * offset);
+}
\ No newline at end of file
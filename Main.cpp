@@ -1,6 +1,282 @@
 
 #include <Windows.h>
+#include <shellapi.h>
 #include "Game.h"
+#include "TransformBenchmark.h"
+#include "ShaderBenchmark.h"
+#include "MeshBenchmark.h"
+#include "RenderQueue.h"
+#include "RenderStateCache.h"
+#include "Frustum.h"
+#include "BoundingVolumeHierarchy.h"
+#include "OcclusionBuffer.h"
+#include "ShadowCascades.h"
+#include "ShadowCache.h"
+#include "ShadowAtlas.h"
+#include "LightClusters.h"
+#include "BoxBlur.h"
+
+// --------------------------------------------------------
+// Handles "DX11Starter.exe -cook [-packed] a.obj b.obj ..." by writing
+// a .cmesh next to each .obj and reporting how long the .obj
+// and cooked load paths take, all without opening a window
+//
+// Returns the number of files that failed to cook
+// --------------------------------------------------------
+int CookMeshes(int argc, wchar_t** argv)
+{
+	// We're a windows app, so borrow the console we were launched from (if any)
+	if (AttachConsole(ATTACH_PARENT_PROCESS))
+	{
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+	}
+
+	int failures = 0;
+	for (int i = 2; i < argc; i++)
+	{
+		if (wcscmp(argv[i], L"-packed") == 0)
+			continue;
+
+		MeshCookStats stats = {};
+		if (Mesh::Cook(argv[i], &stats))
+		{
+			wprintf(L"%s: %d verts, %d indices (%d bit), .obj load %.3f ms, cooked load %.3f ms\n",
+				argv[i], stats.VertexCount, stats.IndexCount, stats.IndexSize * 8, stats.ObjLoadMilliseconds, stats.CookedLoadMilliseconds);
+			wprintf(L"    ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+				stats.CacheBefore.ACMR, stats.CacheAfter.ACMR, stats.CacheBefore.ATVR, stats.CacheAfter.ATVR);
+			wprintf(L"    vertex data %d -> %d bytes (%d byte vertices), packing error: position %f, normal %.4f deg, tangent %.4f deg, uv %f\n",
+				stats.VertexCount * (int)sizeof(Vertex), stats.VertexCount * (int)sizeof(PackedVertex), stats.VertexSize,
+				stats.PackingError.Position, stats.PackingError.NormalDegrees, stats.PackingError.TangentDegrees, stats.PackingError.UV);
+			wprintf(L"    tangents: scalar %.1f, simd %.1f (%s), %u threads %.1f (max diff %g) million triangles/sec\n",
+				stats.Tangents.ScalarTrianglesPerSecond / 1e6, stats.Tangents.SimdTrianglesPerSecond / 1e6,
+				stats.Tangents.SimdMatchesScalar ? L"exact" : L"MISMATCH", stats.Tangents.ThreadCount,
+				stats.Tangents.ParallelTrianglesPerSecond / 1e6, stats.Tangents.ParallelMaxDifference);
+		}
+		else
+		{
+			wprintf(L"%s: failed to cook\n", argv[i]);
+			failures++;
+		}
+	}
+
+	return failures;
+}
+
+// --------------------------------------------------------
+// Handles "DX11Starter.exe -bench" by timing the CPU side
+// systems that don't need a window or a device
+// --------------------------------------------------------
+void RunBenchmarks()
+{
+	if (AttachConsole(ATTACH_PARENT_PROCESS))
+	{
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+	}
+
+	// About 15 MB of .obj text, through the old getline/sscanf_s loop and through ParseObj()
+	ObjParserBenchmark obj = BenchmarkObjParser(300, 3);
+	wprintf(L"obj parser: %.1f MB, %u triangles, old loader %.1f MB/s, ParseObj %.1f MB/s (%s)\n",
+		obj.Bytes / (1024.0 * 1024.0), obj.TriangleCount, obj.LegacyMBPerSecond, obj.ParserMBPerSecond,
+		obj.TrianglesMatch ? L"same triangles" : L"TRIANGLES DIFFER");
+
+	// Welded corners against the old loader's three vertices per triangle
+	ObjWeldChecks weld = CheckObjWelding();
+	wprintf(L"obj welding: %u -> %u vertices, same triangles %s, same after optimizing %s, no duplicates %s\n",
+		weld.UnweldedVertices, weld.WeldedVertices, weld.SameTriangles ? L"ok" : L"FAILED",
+		weld.SameTrianglesOptimized ? L"ok" : L"FAILED", weld.NoDuplicates ? L"ok" : L"FAILED");
+
+	// Meshes right at the 16 bit index limit and one vertex past it
+	IndexSizeChecks indexSizes = CheckIndexSizes();
+	wprintf(L"index sizes: %u vertices 16 bit %s, %u vertices 32 bit %s, narrowed indices match %s\n",
+		indexSizes.ShortVertexCount, indexSizes.ShortIndices ? L"ok" : L"FAILED", indexSizes.LongVertexCount,
+		indexSizes.LongIndices ? L"ok" : L"FAILED", indexSizes.NarrowedMatch ? L"ok" : L"FAILED");
+
+	// PackedVertex round trips against the error 16 bit quantization should allow
+	VertexPackingChecks packing = CheckVertexPacking(1000000);
+	wprintf(L"vertex packing: position %f (bound %f) %s, normal %.4f tangent %.4f deg (bound %.4f) %s, uv %f (bound %f) %s, flat axis exact %s\n",
+		packing.Error.Position, packing.Bound.Position, packing.PositionWithinBound ? L"ok" : L"FAILED",
+		packing.Error.NormalDegrees, packing.Error.TangentDegrees, packing.Bound.NormalDegrees, packing.DirectionsWithinBound ? L"ok" : L"FAILED",
+		packing.Error.UV, packing.Bound.UV, packing.UVWithinBound ? L"ok" : L"FAILED", packing.FlatAxisExact ? L"ok" : L"FAILED");
+
+	// Everything moving, then one in ten moving like a mostly static scene
+	const unsigned int transformCounts[] = { 10000, 100000, 1000000 };
+	const unsigned int movingStrides[] = { 1, 10 };
+	for (unsigned int count : transformCounts)
+	{
+		for (unsigned int movingStride : movingStrides)
+		{
+			TransformBenchmark results = BenchmarkTransforms(count, movingStride, count >= 1000000 ? 5 : 20);
+			wprintf(L"transforms: %u (%u moving), per object %.3f ms, system %.3f ms, max difference %g\n",
+				results.Count, results.MovingCount, results.PerObjectMilliseconds, results.SystemMilliseconds, results.MaxDifference);
+		}
+	}
+
+	// The cost of a hierarchy should follow how much of it changed, not how big it is
+	const unsigned int changedCounts[] = { 1, 100, 10000 };
+	for (unsigned int count : transformCounts)
+	{
+		for (unsigned int changedCount : changedCounts)
+		{
+			HierarchyBenchmark results = BenchmarkTransformHierarchy(count, changedCount, 20);
+			wprintf(L"hierarchy: %u transforms, %u changed, %u rebuilt in %.4f ms\n",
+				results.Count, results.ChangedCount, results.RebuiltCount, results.UpdateMilliseconds);
+		}
+	}
+
+	// Long parent to child chains, within one dirty bit word and across one word per link
+	for (unsigned int depth : { 64u, 1000u })
+	{
+		HierarchyChecks chain = CheckTransformHierarchy(depth);
+		wprintf(L"hierarchy chains: depth %u, max difference %g %s, root rebuilds chain %s, middle rebuilds below %s, leaf rebuilds leaf %s, unchanged rebuilds nothing %s\n",
+			chain.Depth, chain.MaxDifference, chain.MatchesReference ? L"ok" : L"FAILED", chain.RootRebuildsChain ? L"ok" : L"FAILED",
+			chain.MiddleRebuildsBelow ? L"ok" : L"FAILED", chain.LeafRebuildsOnlyLeaf ? L"ok" : L"FAILED", chain.NothingWhenUnchanged ? L"ok" : L"FAILED");
+	}
+
+	// A camera's Transform calls for one frame, standing still and while being turned
+	for (int rotating = 0; rotating < 2; rotating++)
+	{
+		BasisBenchmark results = BenchmarkTransformBasis(1000000, rotating != 0);
+		wprintf(L"camera transform (%s): uncached %.1f ns, cached %.1f ns per frame, max difference %g\n",
+			rotating ? L"turning" : L"not turning", results.UncachedNanoseconds, results.CachedNanoseconds, results.MaxDifference);
+	}
+
+	// Each draw's PerDraw constants, through SimpleShader by name and by handle, and into ring slots
+	ShaderSetterBenchmark setters = BenchmarkShaderSetters(100000, 20);
+	wprintf(L"per draw constants: %u draws, by name %.1f ns, handles %.1f ns, ring %.1f ns per draw (%s)\n",
+		setters.DrawCount, setters.NameNanoseconds, setters.HandleNanoseconds, setters.RingNanoseconds,
+		setters.ResultsMatch ? L"results match" : L"RESULTS DIFFER");
+
+	// The ring those slots come from, filling up, wrapping around and retiring frames by fence
+	RingAllocatorChecks ringChecks = CheckRingAllocator();
+	wprintf(L"ring allocator: aligned %s, refuses when full %s, keeps unfinished frames %s, retires finished frames %s, wraps to start %s, skipped bytes retired %s, never overlaps %s\n",
+		ringChecks.Aligned ? L"ok" : L"FAILED", ringChecks.RefusesWhenFull ? L"ok" : L"FAILED", ringChecks.KeepsUnfinishedFrames ? L"ok" : L"FAILED",
+		ringChecks.RetiresFinishedFrames ? L"ok" : L"FAILED", ringChecks.WrapsToStart ? L"ok" : L"FAILED", ringChecks.SkippedBytesRetired ? L"ok" : L"FAILED",
+		ringChecks.NeverOverlaps ? L"ok" : L"FAILED");
+
+	// Which of a shader's buffer copies actually go to the GPU
+	ConstantBufferUploadChecks uploads = CheckConstantBufferUploads();
+	wprintf(L"constant buffer uploads: %u issued, %u skipped, untouched skipped %s, change uploaded %s, skipped after upload %s, same values skipped %s, dirty range %s\n",
+		uploads.UploadsIssued, uploads.UploadsSkipped, uploads.SkipsUntouched ? L"ok" : L"FAILED", uploads.UploadsChange ? L"ok" : L"FAILED",
+		uploads.SkipsAfterUpload ? L"ok" : L"FAILED", uploads.SkipsSameValues ? L"ok" : L"FAILED", uploads.RangeCoversBoth ? L"ok" : L"FAILED");
+
+	// Which state calls get past the cache, on a software device
+	RenderStateCacheChecks stateChecks = CheckRenderStateCache();
+	if (stateChecks.DeviceCreated)
+		wprintf(L"render state cache: %u of %u repeats filtered, filters repeats %s, issues changes %s, invalidate reissues %s, render targets forget srvs %s, unbind clears srvs %s\n",
+			stateChecks.RepeatsFiltered, stateChecks.CallsPerSet, stateChecks.FiltersRepeats ? L"ok" : L"FAILED", stateChecks.IssuesChanges ? L"ok" : L"FAILED",
+			stateChecks.InvalidateReissues ? L"ok" : L"FAILED", stateChecks.RenderTargetsForgetSRVs ? L"ok" : L"FAILED", stateChecks.UnbindClearsSRVs ? L"ok" : L"FAILED");
+	else
+		wprintf(L"render state cache: FAILED, couldn't create a WARP device\n");
+
+	// A frame of draws in creation order, sorted into as few material and mesh changes as possible
+	RenderQueueBenchmark queue = BenchmarkRenderQueue(100000, 50, 200, 20);
+	wprintf(L"render queue: %u draws, radix %.3f ms, std::stable_sort %.3f ms (%s), material changes %u -> %u, mesh changes %u -> %u, fewer changes %s\n",
+		queue.ItemCount, queue.RadixMilliseconds, queue.StdSortMilliseconds, queue.OrderMatches ? L"same order" : L"ORDER DIFFERS",
+		queue.MaterialChangesUnsorted, queue.MaterialChangesSorted, queue.MeshChangesUnsorted, queue.MeshChangesSorted,
+		queue.FewerChanges ? L"ok" : L"FAILED");
+
+	// Lots of copies of a few props, one draw each versus one per material and mesh pair
+	const unsigned int instanceCounts[] = { 1000, 10000, 100000 };
+	for (unsigned int count : instanceCounts)
+	{
+		InstanceBatchBenchmark instancing = BenchmarkInstanceBatching(count, 1 + SHADOW_CASCADE_COUNT, 8, 16, 20);
+		wprintf(L"instancing: %u entities in %u passes, draws %u -> %u, bytes written %u -> %u (%u of them repeated instance data), prepare %.3f ms -> %.3f ms\n",
+			instancing.EntityCount, instancing.PassCount, instancing.UnbatchedDrawCalls, instancing.BatchedDrawCalls,
+			instancing.UnbatchedBytes, instancing.BatchedBytes, instancing.RepeatedInstanceBytes,
+			instancing.UnbatchedMilliseconds, instancing.BatchedMilliseconds);
+	}
+
+	// Objects scattered all around a camera, so most of them get culled
+	FrustumCullBenchmark culling = BenchmarkFrustumCulling(1000000, 10);
+	wprintf(L"frustum culling: %u bounds, %u visible, world bounds %.3f ms, cull one at a time %.3f ms, four at a time %.3f ms (%s)\n",
+		culling.Count, culling.VisibleCount, culling.AddMilliseconds, culling.ScalarMilliseconds, culling.SimdMilliseconds,
+		culling.ResultsMatch ? L"same results" : L"RESULTS DIFFER");
+
+	// The same sort of scene in a tree, with a tenth of it moving
+	const unsigned int bvhCounts[] = { 10000, 100000, 1000000 };
+	for (unsigned int count : bvhCounts)
+	{
+		BVHBenchmark bvh = BenchmarkBoundingVolumeHierarchy(count, 5);
+		wprintf(L"bvh: %u objects, %u nodes, build %.3f ms, refit %u moved %.3f ms, cull %.3f ms vs flat %.3f ms (%s), ray %.2f us vs brute force %.2f us (%s)\n",
+			bvh.Count, bvh.NodeCount, bvh.BuildMilliseconds, bvh.MovedCount, bvh.RefitMilliseconds,
+			bvh.CullMilliseconds, bvh.FlatCullMilliseconds, bvh.CullMatches ? L"same results" : L"RESULTS DIFFER",
+			bvh.RayMicroseconds, bvh.BruteForceRayMicroseconds, bvh.RaysMatch ? L"same hits" : L"HITS DIFFER");
+	}
+
+	// Walls in front of a camera hiding objects behind them
+	OcclusionBenchmark occlusion = BenchmarkOcclusionCulling(320, 180, 64, 10000, 20);
+	wprintf(L"occlusion: %ux%u, %u triangles, raster %.3f ms vs one pixel at a time %.3f ms (%u pixels differ), hi-z %.3f ms, %u of %u hidden, test %.3f ms (%s)\n",
+		occlusion.Width, occlusion.Height, occlusion.OccluderTriangles, occlusion.RasterMilliseconds, occlusion.ScalarRasterMilliseconds,
+		occlusion.PixelsDifferent, occlusion.HierarchyMilliseconds, occlusion.HiddenCount, occlusion.ObjectCount, occlusion.TestMilliseconds,
+		occlusion.Conservative ? L"conservative" : L"HID VISIBLE OBJECTS");
+
+	// The rasterizer against a ray cast through every pixel, and the Hi-Z test against a few walls
+	OcclusionChecks occlusionChecks = CheckOcclusionBuffer(32);
+	wprintf(L"occlusion checks: %u of %u pixels differ from reference %s, scalar matches %s, hi-z furthest %s, hides behind wall %s, shows in front %s, shows beside wall %s, shows across near plane %s\n",
+		occlusionChecks.PixelsDifferent, occlusionChecks.PixelsCompared, occlusionChecks.MatchesReference ? L"ok" : L"FAILED",
+		occlusionChecks.ScalarMatches ? L"ok" : L"FAILED", occlusionChecks.HierarchyFurthest ? L"ok" : L"FAILED",
+		occlusionChecks.HidesBehindWall ? L"ok" : L"FAILED", occlusionChecks.ShowsInFront ? L"ok" : L"FAILED",
+		occlusionChecks.ShowsBesideWall ? L"ok" : L"FAILED", occlusionChecks.ShowsAcrossNearPlane ? L"ok" : L"FAILED");
+
+	// The cascade math against a camera that keeps moving and turning
+	ShadowCascadeChecks cascades = CheckShadowCascades(100);
+	wprintf(L"shadow cascades: uniform splits %s, log splits %s, splits increase %s, size stable %s, snapped to texels %s, covers slices %s, fit %.2f us\n",
+		cascades.UniformSplits ? L"ok" : L"FAILED", cascades.LogarithmicSplits ? L"ok" : L"FAILED", cascades.SplitsIncrease ? L"ok" : L"FAILED",
+		cascades.SizeStable ? L"ok" : L"FAILED", cascades.SnappedToTexels ? L"ok" : L"FAILED", cascades.CoversSlices ? L"ok" : L"FAILED",
+		cascades.FitMicroseconds);
+
+	// When cascades' static layers get redrawn, and which casters can reach them
+	ShadowCacheChecks cache = CheckShadowCache();
+	wprintf(L"shadow cache: misses first time %s, hits when unchanged %s, misses when moved %s, misses when static moved %s, cascades independent %s, casters extruded %s\n",
+		cache.MissesFirstTime ? L"ok" : L"FAILED", cache.HitsWhenUnchanged ? L"ok" : L"FAILED", cache.MissesWhenMoved ? L"ok" : L"FAILED",
+		cache.MissesWhenStaticMoved ? L"ok" : L"FAILED", cache.CascadesIndependent ? L"ok" : L"FAILED", cache.CastersExtruded ? L"ok" : L"FAILED");
+
+	// Churn and fragmentation in the shadow atlas, with and without hysteresis
+	for (unsigned int lights : { 16u, 64u })
+	{
+		for (float hysteresis : { 0.0f, 0.25f })
+		{
+			ShadowAtlasBenchmark atlas = BenchmarkShadowAtlas(lights, 2000, hysteresis);
+			wprintf(L"shadow atlas: %u lights, hysteresis %.2f, %.2f tiles placed and %.2f resized per frame, %u repacks, %.2f unplaced, fragmentation %.2f, %.0f%% used, pack %.2f us (%s)\n",
+				atlas.LightCount, hysteresis, atlas.TilesPlacedPerFrame, atlas.ResizesPerFrame, atlas.Repacks, atlas.UnplacedPerFrame,
+				atlas.AverageFragmentation, atlas.AverageUtilization * 100.0, atlas.PackMicroseconds, atlas.Valid ? L"ok" : L"FAILED");
+		}
+	}
+
+	// Assigning a field of lights to clusters each way, which should all agree
+	for (unsigned int lights : { 1000u, 10000u })
+	{
+		LightClusterBenchmark clusters = BenchmarkLightClusters(lights, 20);
+		wprintf(L"light clusters: %u lights, scalar %.3f ms, simd %.3f ms, %u threads %.3f ms, %.2f average and %u most per lit cluster, %u indices, spot lights in %u clusters (%u as spheres) (%s, %s)\n",
+			clusters.LightCount, clusters.ScalarMilliseconds, clusters.SimdMilliseconds, clusters.ThreadCount, clusters.ThreadedMilliseconds,
+			clusters.AverageLightsPerCluster, clusters.MaxLightsPerCluster, clusters.IndexCount, clusters.SpotClusters, clusters.SpotSphereClusters,
+			clusters.Matches ? L"matches" : L"MISMATCH", clusters.Conservative ? L"conservative" : L"MISSED LIGHTS");
+	}
+
+	// Spot light bounds and cone culling against points sampled through made up cones
+	SpotLightChecks spots = CheckSpotLights();
+	wprintf(L"spot lights: bounds contain cones %s, bounds tight %s, cone test conservative %s, cone test culls %s, clusters follow cone %s\n",
+		spots.BoundsContainCones ? L"ok" : L"FAILED", spots.BoundsTight ? L"ok" : L"FAILED", spots.ConeTestConservative ? L"ok" : L"FAILED",
+		spots.ConeTestCulls ? L"ok" : L"FAILED", spots.ClustersFollowCone ? L"ok" : L"FAILED");
+
+	// The post process blurs against each other and against blurs worked out by hand
+	BoxBlurChecks blur = CheckBoxBlur();
+	wprintf(L"box blur: impulse %s, corner %s, radius 0 %s, separable %s (%g), sliding %s (%g), no drift %s\n",
+		blur.ImpulseGolden ? L"ok" : L"FAILED", blur.CornerGolden ? L"ok" : L"FAILED", blur.RadiusZeroCopies ? L"ok" : L"FAILED",
+		blur.SeparableMatches ? L"ok" : L"FAILED", blur.MaxSeparableError, blur.SlidingMatches ? L"ok" : L"FAILED", blur.MaxSlidingError,
+		blur.SlidingDoesntDrift ? L"ok" : L"FAILED");
+
+	// Blurring a 640x360 image each way, where only the original box gets slower with the radius squared
+	for (int radius : { 2, 8, 16 })
+	{
+		BoxBlurBenchmark timing = BenchmarkBoxBlur(640, 360, radius, 3);
+		wprintf(L"box blur: %ux%u radius %d, box %.2f ms, separable %.2f ms, sliding %.2f ms, max error %g\n",
+			timing.Width, timing.Height, timing.Radius, timing.ReferenceMilliseconds, timing.SeparableMilliseconds,
+			timing.SlidingMilliseconds, timing.MaxError);
+	}
+}
 
 // --------------------------------------------------------
 // Entry point for a graphical (non-console) Windows application
@@ -18,6 +294,30 @@ int WINAPI WinMain(
 	_CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+	// Cooking meshes doesn't need a window or a device
+	int argc = 0;
+	wchar_t** argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+
+	// Meshes keep the full float Vertex layout unless asked for PackedVertex
+	for (int i = 1; argv && i < argc; i++)
+	{
+		if (wcscmp(argv[i], L"-packed") == 0)
+			Mesh::UsePackedVertices = true;
+	}
+	if (argv && argc >= 2 && wcscmp(argv[1], L"-cook") == 0)
+	{
+		int failures = CookMeshes(argc, argv);
+		LocalFree(argv);
+		return failures;
+	}
+	if (argv && argc >= 2 && wcscmp(argv[1], L"-bench") == 0)
+	{
+		RunBenchmarks();
+		LocalFree(argv);
+		return 0;
+	}
+	LocalFree(argv);
+
 	// Create the Game object using
 	// the app handle we got from WinMain
 	Game dxGame(hInstance);
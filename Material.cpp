@@ -1,10 +1,15 @@
 #include "Material.h"
 
+unsigned int Material::nextSortId = 0;
+
 Material::Material(std::shared_ptr<SimpleVertexShader> _vertexShader, std::shared_ptr<SimplePixelShader> _pixelShader, XMFLOAT4 _colorTint)
 {
 	vertexShader = _vertexShader;
 	pixelShader = _pixelShader;
 	colorTint = _colorTint;
+	sortId = nextSortId++;
+
+	colorTintHandle = pixelShader->GetVariableHandle("colorTint");
 }
 
 void Material::PrepareMaterial()
@@ -13,6 +18,9 @@ void Material::PrepareMaterial()
 	pixelShader->SetShader();
 	for (auto& t : textureSRVs) { pixelShader->SetShaderResourceView(t.first.c_str(), t.second); }
 	for (auto& s : samplers) { pixelShader->SetSamplerState(s.first.c_str(), s.second); }
+
+	// Only uploaded if it's different from the last material's
+	pixelShader->SetFloat4(colorTintHandle, colorTint);
 }
 
 std::shared_ptr<SimpleVertexShader> Material::GetVertexShader()
@@ -30,6 +38,11 @@ XMFLOAT4 Material::GetColorTint()
 	return colorTint;
 }
 
+unsigned int Material::GetSortId()
+{
+	return sortId;
+}
+
 void Material::SetVertexShader(std::shared_ptr<SimpleVertexShader> _vertexShader)
 {
 	vertexShader = _vertexShader;
@@ -38,6 +51,7 @@ void Material::SetVertexShader(std::shared_ptr<SimpleVertexShader> _vertexShader
 void Material::SetPixelShader(std::shared_ptr<SimplePixelShader> _pixelShader)
 {
 	pixelShader = _pixelShader;
+	colorTintHandle = pixelShader->GetVariableHandle("colorTint");
 }
 
 void Material::AddTextureSRV(std::string key, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv)
@@ -16,6 +16,10 @@ public:
 
 	Material(std::shared_ptr<SimpleVertexShader> _vertexShader, std::shared_ptr<SimplePixelShader> _pixelShader, XMFLOAT4 _colorTint);
 
+	/// <summary>
+	/// Sets the shaders, textures and samplers, along with the PerMaterial constants.
+	/// Anything the last material already set gets dropped by the state cache.
+	/// </summary>
 	void PrepareMaterial();
 
 	std::shared_ptr<SimpleVertexShader> GetVertexShader();
@@ -23,6 +27,11 @@ public:
 
 	XMFLOAT4 GetColorTint();
 
+	/// <summary>
+	/// Gets a small number that's different for every material, for RenderQueue keys
+	/// </summary>
+	unsigned int GetSortId();
+
 	void SetVertexShader(std::shared_ptr<SimpleVertexShader> _vertexShader);
 	void SetPixelShader(std::shared_ptr<SimplePixelShader> _pixelShader);
 
@@ -42,5 +51,12 @@ private:
 
 	XMFLOAT4 colorTint;
 
+	// Looked up again whenever the pixel shader changes
+	SimpleShaderVariableHandle colorTintHandle;
+
+	// Handed out in creation order
+	unsigned int sortId;
+	static unsigned int nextSortId;
+
 };
 
@@ -1,241 +1,269 @@
 #include "Mesh.h"
 
+bool Mesh::OptimizeOnLoad = true;
+bool Mesh::UsePackedVertices = false;
+std::shared_ptr<RenderStateCache> Mesh::StateCache;
+unsigned int Mesh::nextSortId = 0;
 
 Mesh::Mesh(Vertex* vertices, int numberOfVertices, unsigned int* indices, int numberOfIndices, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext)
 {
+	sortId = nextSortId++;
 	this->CalculateTangents(vertices, numberOfVertices, indices, numberOfIndices);
-	CreateDirect3DBuffer(vertices, numberOfVertices, indices, numberOfIndices, deviceObject, deviceContext);
+
+	bounds = ComputeMeshBounds(vertices, numberOfVertices);
+	packedRange = GetPackedVertexRange(vertices, numberOfVertices);
+	std::vector<PackedVertex> packed;
+	const void* vertexData = PrepareVertexData(vertices, numberOfVertices, packedRange, packed);
+	CreateDirect3DBuffer(vertexData, numberOfVertices, indices, numberOfIndices, deviceObject, deviceContext);
 }
 
 
 Mesh::Mesh(const std::wstring& nameOfFile, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext)
 {
-	// Author: Chris Cascioli
-// Purpose: Basic .OBJ 3D model loading, supporting positions, uvs and normals
-// 
-// - You are allowed to directly copy/paste this into your code base
-//   for assignments, given that you clearly cite that this is not
-//   code of your own design.
-//
-// - NOTE: You'll need to #include <fstream>
+	sortId = nextSortId++;
 	numberOfIndices = 0;
+	indexFormat = DXGI_FORMAT_R32_UINT;
+	packedRange = {};
+	bounds = {};
+
+	// The .obj's size and write time say whether it's changed since it was cooked, without reading it
+	MeshSourceStamp stamp = {};
+	if (!GetMeshSourceStamp(nameOfFile, stamp))
+		return;
+
+	std::wstring cookedPath = GetCookedMeshPath(nameOfFile);
+	CookedMeshFile cooked;
+	bool cookedOpen = cooked.Open(cookedPath, GetCookedFlags());
+
+	// Fast path: map the cooked file and hand its memory straight to Direct3D
+	if (cookedOpen && cooked.MatchesStamp(stamp))
+	{
+		CreateFromCooked(cooked, deviceObject, deviceContext);
+		return;
+	}
+
+	// Otherwise we need the source bytes, either to parse them or to see
+	// if the cooked copy was built from the same contents anyway
+	std::vector<char> source;
+	if (!ReadSourceFile(nameOfFile, source))
+		return;
+
+	stamp.Size = source.size();
+	unsigned long long sourceHash = HashMeshSource(source.data(), source.size());
+	if (cookedOpen && cooked.MatchesSource(sourceHash, source.size()))
+	{
+		// Touched but not changed, so restamp it to skip the hash next time
+		CreateFromCooked(cooked, deviceObject, deviceContext);
+		cooked.Close();
+		RestampCookedMesh(cookedPath, stamp);
+		return;
+	}
+	cooked.Close();
+
+	// Slow path: parse the .obj, then save the results for next time
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	if (!LoadObjData(source.data(), source.size(), verts, indices, 0))
+		return;
+
+	bounds = ComputeMeshBounds(&verts[0], (int)verts.size());
+	packedRange = GetPackedVertexRange(&verts[0], (int)verts.size());
+	std::vector<PackedVertex> packed;
+	const void* vertexData = PrepareVertexData(&verts[0], (int)verts.size(), packedRange, packed);
+
+	WriteCookedMesh(cookedPath, sourceHash, stamp, GetCookedFlags(),
+		vertexData, (int)verts.size(), &indices[0], (int)indices.size(),
+		bounds, packedRange);
+
+	this->CreateDirect3DBuffer(vertexData, (int)verts.size(), &indices[0], (int)indices.size(), deviceObject, deviceContext);
+}
 
-// File input object
-	std::ifstream obj(nameOfFile);
+void Mesh::CreateFromCooked(CookedMeshFile& cooked, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext)
+{
+	const CookedMeshHeader* header = cooked.GetHeader();
+	packedRange = header->PackedRange;
+	bounds = header->Bounds;
+	this->CreateDirect3DBuffer(cooked.GetVertices(), header->VertexCount, cooked.GetIndices(), header->IndexSize, header->IndexCount, deviceObject, deviceContext);
+}
+
+bool Mesh::ReadSourceFile(const std::wstring& nameOfFile, std::vector<char>& source)
+{
+	// File input object
+	std::ifstream obj(nameOfFile, std::ios::binary);
 
 	// Check for successful open
 	if (!obj.is_open())
-		return;
+		return false;
+
+	return ReadWholeStream(obj, source);
+}
 
-	// Variables used while reading the file
-	std::vector<XMFLOAT3> positions;	// Positions from the file
-	std::vector<XMFLOAT3> normals;		// Normals from the file
-	std::vector<XMFLOAT2> uvs;		// UVs from the file
-	std::vector<Vertex> verts;		// Verts we're assembling
-	std::vector<UINT> indices;		// Indices of these verts
-	int vertCounter = 0;			// Count of vertices
-	int indexCounter = 0;			// Count of indices
-	char chars[100];			// String for line reading
-
-	// Still have data left?
-	while (obj.good())
+bool Mesh::LoadObjData(const char* source, size_t sourceLength, std::vector<Vertex>& verts, std::vector<unsigned int>& indices, MeshCookStats* stats)
+{
+	// Based on the basic .OBJ loader by Chris Cascioli, with the per-line
+	// getline/sscanf_s loop swapped out for the block-reading ObjParser
+	ObjParseResult objData;
+	if (!ParseObj(source, sourceLength, objData) || objData.corners.empty())
+		return false;
+
+	// OBJs index positions, uvs and normals separately, so weld together
+	// every corner that uses the same three to get real shared vertices
+	std::vector<ObjCorner> uniqueCorners;
+	WeldObjCorners(objData.corners, uniqueCorners, indices);
+
+	int vertCounter = (int)uniqueCorners.size();
+	int indexCounter = (int)indices.size();
+
+	// The model is most likely in a right-handed space,
+	// especially if it came from Maya.  We want to convert
+	// to a left-handed space for DirectX.  This means we 
+	// need to:
+	//  - Invert the Z position
+	//  - Invert the normal's Z
+	//  - Flip the winding order
+	// We also need to flip the UV coordinate since DirectX
+	// defines (0,0) as the top left of the texture, and many
+	// 3D modeling packages use the bottom left as (0,0)
+	verts.resize(vertCounter);
+	for (int i = 0; i < vertCounter; i++)
 	{
-		// Get the line (100 characters should be more than enough)
-		obj.getline(chars, 100);
+		const ObjFloat3& position = objData.positions[uniqueCorners[i].Position];
+		const ObjFloat3& normal = objData.normals[uniqueCorners[i].Normal];
+		const ObjFloat2& uv = objData.uvs[uniqueCorners[i].UV];
 
-		// Check the type of line
-		if (chars[0] == 'v' && chars[1] == 'n')
-		{
-			// Read the 3 numbers directly into an XMFLOAT3
-			XMFLOAT3 norm;
-			sscanf_s(
-				chars,
-				"vn %f %f %f",
-				&norm.x, &norm.y, &norm.z);
-
-			// Add to the list of normals
-			normals.push_back(norm);
-		}
-		else if (chars[0] == 'v' && chars[1] == 't')
-		{
-			// Read the 2 numbers directly into an XMFLOAT2
-			XMFLOAT2 uv;
-			sscanf_s(
-				chars,
-				"vt %f %f",
-				&uv.x, &uv.y);
-
-			// Add to the list of uv's
-			uvs.push_back(uv);
-		}
-		else if (chars[0] == 'v')
-		{
-			// Read the 3 numbers directly into an XMFLOAT3
-			XMFLOAT3 pos;
-			sscanf_s(
-				chars,
-				"v %f %f %f",
-				&pos.x, &pos.y, &pos.z);
-
-			// Add to the positions
-			positions.push_back(pos);
-		}
-		else if (chars[0] == 'f')
+		verts[i].Position = XMFLOAT3(position.x, position.y, -position.z);
+		verts[i].Normal = XMFLOAT3(normal.x, normal.y, -normal.z);
+		verts[i].Tangent = XMFLOAT3(0, 0, 0);
+		verts[i].UV = XMFLOAT2(uv.x, 1.0f - uv.y);
+	}
+
+	// Flip the winding order of every triangle
+	for (int i = 0; i < indexCounter; i += 3)
+	{
+		std::swap(indices[i + 1], indices[i + 2]);
+	}
+
+	CalculateTangents(&verts[0], vertCounter, &indices[0], indexCounter);
+
+	if (stats) stats->CacheBefore = AnalyzeVertexCache(&indices[0], indexCounter, vertCounter, MESH_OPTIMIZER_CACHE_SIZE);
+	if (OptimizeOnLoad) Optimize(verts, indices);
+	if (stats) stats->CacheAfter = AnalyzeVertexCache(&indices[0], indices.size(), verts.size(), MESH_OPTIMIZER_CACHE_SIZE);
+
+	return true;
+}
+
+void Mesh::Optimize(std::vector<Vertex>& verts, std::vector<unsigned int>& indices)
+{
+	// Allow 5% more cache misses in exchange for drawing outward facing clusters first,
+	// as long as the result still beats the file's own order
+	OptimizeTriangleOrder(&indices[0], indices.size(), &verts[0].Position.x, verts.size(), sizeof(Vertex), 1.05f);
+
+	size_t usedVertices = OptimizeVertexFetch(&verts[0], &indices[0], indices.size(), verts.size(), sizeof(Vertex));
+	verts.resize(usedVertices);
+}
+
+unsigned int Mesh::GetCookedFlags()
+{
+	return (OptimizeOnLoad ? COOKED_MESH_FLAG_OPTIMIZED : 0) |
+		(UsePackedVertices ? COOKED_MESH_FLAG_PACKED : 0);
+}
+
+const void* Mesh::PrepareVertexData(const Vertex* vertices, int numberOfVertices, const PackedVertexRange& range, std::vector<PackedVertex>& packed)
+{
+	if (!UsePackedVertices)
+		return vertices;
+
+	packed.resize(numberOfVertices);
+	PackVertices(vertices, numberOfVertices, range, &packed[0]);
+	return &packed[0];
+}
+
+unsigned int Mesh::GetVertexSize()
+{
+	return UsePackedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+bool Mesh::Cook(const std::wstring& nameOfFile, MeshCookStats* stats)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	// Everything the slow path of the file constructor does, minus the GPU upload
+	MeshSourceStamp stamp = {};
+	std::vector<char> source;
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	MeshCookStats localStats = {};
+	if (!GetMeshSourceStamp(nameOfFile, stamp) || !ReadSourceFile(nameOfFile, source) ||
+		!LoadObjData(source.data(), source.size(), verts, indices, &localStats))
+		return false;
+	stamp.Size = source.size();
+
+	std::chrono::high_resolution_clock::time_point parsed = std::chrono::high_resolution_clock::now();
+
+	PackedVertexRange range = GetPackedVertexRange(&verts[0], (int)verts.size());
+	std::vector<PackedVertex> packed;
+	const void* vertexData = PrepareVertexData(&verts[0], (int)verts.size(), range, packed);
+
+	unsigned long long sourceHash = HashMeshSource(source.data(), source.size());
+	std::wstring cookedPath = GetCookedMeshPath(nameOfFile);
+	if (!WriteCookedMesh(cookedPath, sourceHash, stamp, GetCookedFlags(),
+		vertexData, (int)verts.size(), &indices[0], (int)indices.size(),
+		ComputeMeshBounds(&verts[0], (int)verts.size()), range))
+		return false;
+
+	// Now time the fast path of the file constructor against what we just wrote
+	std::chrono::high_resolution_clock::time_point cookedStart = std::chrono::high_resolution_clock::now();
+
+	MeshSourceStamp reloadedStamp = {};
+	CookedMeshFile cooked;
+	bool reloaded = GetMeshSourceStamp(nameOfFile, reloadedStamp) &&
+		cooked.Open(cookedPath, GetCookedFlags()) && cooked.MatchesStamp(reloadedStamp);
+
+	std::chrono::high_resolution_clock::time_point cookedEnd = std::chrono::high_resolution_clock::now();
+
+	if (stats)
+	{
+		// Report what packing costs in accuracy even if it's turned off
+		if (packed.empty())
 		{
-			// Read the face indices into an array
-			// NOTE: This assumes the given obj file contains
-			//  vertex positions, uv coordinates AND normals.
-			unsigned int i[12];
-			int numbersRead = sscanf_s(
-				chars,
-				"f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d",
-				&i[0], &i[1], &i[2],
-				&i[3], &i[4], &i[5],
-				&i[6], &i[7], &i[8],
-				&i[9], &i[10], &i[11]);
-
-			// If we only got the first number, chances are the OBJ
-			// file has no UV coordinates.  This isn't great, but we
-			// still want to load the model without crashing, so we
-			// need to re-read a different pattern (in which we assume
-			// there are no UVs denoted for any of the vertices)
-			if (numbersRead == 1)
-			{
-				// Re-read with a different pattern
-				numbersRead = sscanf_s(
-					chars,
-					"f %d//%d %d//%d %d//%d %d//%d",
-					&i[0], &i[2],
-					&i[3], &i[5],
-					&i[6], &i[8],
-					&i[9], &i[11]);
-
-				// The following indices are where the UVs should 
-				// have been, so give them a valid value
-				i[1] = 1;
-				i[4] = 1;
-				i[7] = 1;
-				i[10] = 1;
-
-				// If we have no UVs, create a single UV coordinate
-				// that will be used for all vertices
-				if (uvs.size() == 0)
-					uvs.push_back(XMFLOAT2(0, 0));
-			}
-
-			// - Create the verts by looking up
-			//    corresponding data from vectors
-			// - OBJ File indices are 1-based, so
-			//    they need to be adusted
-			Vertex v1;
-			v1.Position = positions[i[0] - 1];
-			v1.UV = uvs[i[1] - 1];
-			v1.Normal = normals[i[2] - 1];
-
-			Vertex v2;
-			v2.Position = positions[i[3] - 1];
-			v2.UV = uvs[i[4] - 1];
-			v2.Normal = normals[i[5] - 1];
-
-			Vertex v3;
-			v3.Position = positions[i[6] - 1];
-			v3.UV = uvs[i[7] - 1];
-			v3.Normal = normals[i[8] - 1];
-
-			// The model is most likely in a right-handed space,
-			// especially if it came from Maya.  We want to convert
-			// to a left-handed space for DirectX.  This means we 
-			// need to:
-			//  - Invert the Z position
-			//  - Invert the normal's Z
-			//  - Flip the winding order
-			// We also need to flip the UV coordinate since DirectX
-			// defines (0,0) as the top left of the texture, and many
-			// 3D modeling packages use the bottom left as (0,0)
-
-			// Flip the UV's since they're probably "upside down"
-			v1.UV.y = 1.0f - v1.UV.y;
-			v2.UV.y = 1.0f - v2.UV.y;
-			v3.UV.y = 1.0f - v3.UV.y;
-
-			// Flip Z (LH vs. RH)
-			v1.Position.z *= -1.0f;
-			v2.Position.z *= -1.0f;
-			v3.Position.z *= -1.0f;
-
-			// Flip normal's Z
-			v1.Normal.z *= -1.0f;
-			v2.Normal.z *= -1.0f;
-			v3.Normal.z *= -1.0f;
-
-			// Add the verts to the vector (flipping the winding order)
-			verts.push_back(v1);
-			verts.push_back(v3);
-			verts.push_back(v2);
-			vertCounter += 3;
-
-			// Add three more indices
-			indices.push_back(indexCounter); indexCounter += 1;
-			indices.push_back(indexCounter); indexCounter += 1;
-			indices.push_back(indexCounter); indexCounter += 1;
-
-			// Was there a 4th face?
-			// - 12 numbers read means 4 faces WITH uv's
-			// - 8 numbers read means 4 faces WITHOUT uv's
-			if (numbersRead == 12 || numbersRead == 8)
-			{
-				// Make the last vertex
-				Vertex v4;
-				v4.Position = positions[i[9] - 1];
-				v4.UV = uvs[i[10] - 1];
-				v4.Normal = normals[i[11] - 1];
-
-				// Flip the UV, Z pos and normal's Z
-				v4.UV.y = 1.0f - v4.UV.y;
-				v4.Position.z *= -1.0f;
-				v4.Normal.z *= -1.0f;
-
-				// Add a whole triangle (flipping the winding order)
-				verts.push_back(v1);
-				verts.push_back(v4);
-				verts.push_back(v3);
-				vertCounter += 3;
-
-				// Add three more indices
-				indices.push_back(indexCounter); indexCounter += 1;
-				indices.push_back(indexCounter); indexCounter += 1;
-				indices.push_back(indexCounter); indexCounter += 1;
-			}
+			packed.resize(verts.size());
+			PackVertices(&verts[0], (int)verts.size(), range, &packed[0]);
 		}
+
+		*stats = localStats;
+		stats->PackingError = MeasurePackingError(&verts[0], &packed[0], (int)verts.size(), range);
+		stats->VertexCount = (int)verts.size();
+		stats->IndexCount = (int)indices.size();
+		stats->IndexSize = (int)GetIndexSize(verts.size());
+		stats->VertexSize = (int)GetVertexSize();
+		stats->ObjLoadMilliseconds = std::chrono::duration<double, std::milli>(parsed - start).count();
+		stats->CookedLoadMilliseconds = std::chrono::duration<double, std::milli>(cookedEnd - cookedStart).count();
+		stats->Tangents = BenchmarkTangents(&verts[0], (int)verts.size(), &indices[0], (int)indices.size(), 20);
 	}
 
-	// Close the file and create the actual buffers
-	obj.close();
-
-	this->CalculateTangents(&verts[0], vertCounter, &indices[0], indexCounter);
-
-	this->CreateDirect3DBuffer(&verts[0], vertCounter, &indices[0], indexCounter, deviceObject, deviceContext);
-	// - At this point, "verts" is a vector of Vertex structs, and can be used
-	//    directly to create a vertex buffer:  &verts[0] is the address of the first vert
-	//
-	// - The vector "indices" is similar. It's a vector of unsigned ints and
-	//    can be used directly for the index buffer: &indices[0] is the address of the first int
-	//
-	// - "vertCounter" is the number of vertices
-	// - "indexCounter" is the number of indices
-	// - Yes, these are effectively the same since OBJs do not index entire vertices!  This means
-	//    an index buffer isn't doing much for us.  We could try to optimize the mesh ourselves
-	//    and detect duplicate vertices, but at that point it would be better to use a more
-	//    sophisticated model loading library like TinyOBJLoader or The Open Asset Importer Library
+	return reloaded;
+}
 
+void Mesh::CreateDirect3DBuffer(const void* vertices, int numberOfVertices, const unsigned int* indices, int numberOfIndices, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext) {
+	//small meshes get half size indices
+	if (GetIndexSize(numberOfVertices) == sizeof(unsigned short))
+	{
+		std::vector<unsigned short> shortIndices(numberOfIndices);
+		NarrowIndices(indices, numberOfIndices, shortIndices.data());
+		CreateDirect3DBuffer(vertices, numberOfVertices, shortIndices.data(), sizeof(unsigned short), numberOfIndices, deviceObject, deviceContext);
+	}
+	else
+	{
+		CreateDirect3DBuffer(vertices, numberOfVertices, indices, sizeof(unsigned int), numberOfIndices, deviceObject, deviceContext);
+	}
 }
 
-void Mesh::CreateDirect3DBuffer(Vertex* vertices, int numberOfVertices, unsigned int* indices, int numberOfIndices, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext) {
+void Mesh::CreateDirect3DBuffer(const void* vertices, int numberOfVertices, const void* indices, unsigned int indexSize, int numberOfIndices, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext) {
 	//create our vertex buffer
 //start by making the description
 	D3D11_BUFFER_DESC vbd = {};
 	vbd.Usage = D3D11_USAGE_IMMUTABLE;
-	vbd.ByteWidth = sizeof(Vertex) * numberOfVertices;
+	vbd.ByteWidth = GetVertexSize() * numberOfVertices;
 	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
 	vbd.CPUAccessFlags = 0;
 	vbd.MiscFlags = 0;
@@ -252,7 +280,7 @@ void Mesh::CreateDirect3DBuffer(Vertex* vertices, int numberOfVertices, unsigned
 	//describe the buffer we want
 	D3D11_BUFFER_DESC ibd = {};
 	ibd.Usage = D3D11_USAGE_IMMUTABLE;
-	ibd.ByteWidth = sizeof(unsigned int) * numberOfIndices;
+	ibd.ByteWidth = indexSize * numberOfIndices;
 	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
 	ibd.CPUAccessFlags = 0;
 	ibd.MiscFlags = 0;
@@ -266,81 +294,19 @@ void Mesh::CreateDirect3DBuffer(Vertex* vertices, int numberOfVertices, unsigned
 	deviceObject->CreateBuffer(&ibd, &initialIndexData, indexBuffer.GetAddressOf());
 
 	this->numberOfIndices = numberOfIndices;
+	this->indexFormat = indexSize == sizeof(unsigned short) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
 	this->deviceContext = deviceContext;
 }
 
 //citation in header file
 void Mesh::CalculateTangents(Vertex* verts, int numVerts, unsigned int* indices, int numIndices)
 {
-	// Reset tangents
-	for (int i = 0; i < numVerts; i++)
-	{
-		verts[i].Tangent = XMFLOAT3(0, 0, 0);
-	}
-
-	// Calculate tangents one whole triangle at a time
-	for (int i = 0; i < numIndices;)
-	{
-		// Grab indices and vertices of first triangle
-		unsigned int i1 = indices[i++];
-		unsigned int i2 = indices[i++];
-		unsigned int i3 = indices[i++];
-		Vertex* v1 = &verts[i1];
-		Vertex* v2 = &verts[i2];
-		Vertex* v3 = &verts[i3];
-
-		// Calculate vectors relative to triangle positions
-		float x1 = v2->Position.x - v1->Position.x;
-		float y1 = v2->Position.y - v1->Position.y;
-		float z1 = v2->Position.z - v1->Position.z;
-
-		float x2 = v3->Position.x - v1->Position.x;
-		float y2 = v3->Position.y - v1->Position.y;
-		float z2 = v3->Position.z - v1->Position.z;
-
-		// Do the same for vectors relative to triangle uv's
-		float s1 = v2->UV.x - v1->UV.x;
-		float t1 = v2->UV.y - v1->UV.y;
-
-		float s2 = v3->UV.x - v1->UV.x;
-		float t2 = v3->UV.y - v1->UV.y;
-
-		// Create vectors for tangent calculation
-		float r = 1.0f / (s1 * t2 - s2 * t1);
-
-		float tx = (t2 * x1 - t1 * x2) * r;
-		float ty = (t2 * y1 - t1 * y2) * r;
-		float tz = (t2 * z1 - t1 * z2) * r;
-
-		// Adjust tangents of each vert of the triangle
-		v1->Tangent.x += tx;
-		v1->Tangent.y += ty;
-		v1->Tangent.z += tz;
-
-		v2->Tangent.x += tx;
-		v2->Tangent.y += ty;
-		v2->Tangent.z += tz;
-
-		v3->Tangent.x += tx;
-		v3->Tangent.y += ty;
-		v3->Tangent.z += tz;
-	}
-
-	// Ensure all of the tangents are orthogonal to the normals
-	for (int i = 0; i < numVerts; i++)
-	{
-		// Grab the two vectors
-		XMVECTOR normal = XMLoadFloat3(&verts[i].Normal);
-		XMVECTOR tangent = XMLoadFloat3(&verts[i].Tangent);
-
-		// Use Gram-Schmidt orthonormalize to ensure
-		// the normal and tangent are exactly 90 degrees apart
-		tangent = XMVector3Normalize(
-			tangent - normal * XMVector3Dot(normal, tangent));
-
-		// Store the tangent
-		XMStoreFloat3(&verts[i].Tangent, tangent);
-	}
+	// Small meshes stay on the original loop, which is still the fastest single threaded option
+	unsigned int threadCount = GetTangentThreadCount(numIndices);
+	if (threadCount > 1)
+		GenerateTangents(verts, numVerts, indices, numIndices, threadCount);
+	else
+		GenerateTangentsScalar(verts, numVerts, indices, numIndices);
 }
 
 
@@ -363,16 +329,137 @@ int Mesh::GetIndexCount()
 	return numberOfIndices;
 }
 
+DXGI_FORMAT Mesh::GetIndexFormat()
+{
+	return indexFormat;
+}
+
+unsigned int Mesh::GetSortId()
+{
+	return sortId;
+}
+
 
 void Mesh::Draw()
 {
-	UINT stride = sizeof(Vertex);
+	UINT stride = GetVertexSize();
 	UINT offset = 0;
 	//put the buffers in the input assembler!
-	deviceContext->IASetVertexBuffers(0, 1, vertexBuffer.GetAddressOf(), &stride, &offset);
+	if (StateCache)
+	{
+		StateCache->IASetVertexBuffer(0, vertexBuffer.Get(), stride, offset);
+		StateCache->IASetIndexBuffer(indexBuffer.Get(), indexFormat, 0);
+	}
+	else
+	{
+		deviceContext->IASetVertexBuffers(0, 1, vertexBuffer.GetAddressOf(), &stride, &offset);
 
-	deviceContext->IASetIndexBuffer(indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+		deviceContext->IASetIndexBuffer(indexBuffer.Get(), indexFormat, 0);
+	}
 
 	//actually draw the dang mesh!
 	deviceContext->DrawIndexed(numberOfIndices, 0, 0);
 }
+
+void Mesh::DrawInstanced(ID3D11Buffer* instances, unsigned int stride, unsigned int firstInstance, unsigned int instanceCount)
+{
+	UINT vertexStride = GetVertexSize();
+	UINT offset = 0;
+	if (StateCache)
+	{
+		StateCache->IASetVertexBuffer(0, vertexBuffer.Get(), vertexStride, offset);
+		StateCache->IASetVertexBuffer(1, instances, stride, offset);
+		StateCache->IASetIndexBuffer(indexBuffer.Get(), indexFormat, 0);
+	}
+	else
+	{
+		deviceContext->IASetVertexBuffers(0, 1, vertexBuffer.GetAddressOf(), &vertexStride, &offset);
+		deviceContext->IASetVertexBuffers(1, 1, &instances, &stride, &offset);
+		deviceContext->IASetIndexBuffer(indexBuffer.Get(), indexFormat, 0);
+	}
+
+	// The instance buffer stays bound, so a batch just starts further into it
+	deviceContext->DrawIndexedInstanced(numberOfIndices, instanceCount, 0, 0, firstInstance);
+}
+
+void Mesh::WriteDrawConstants(void* destination)
+{
+	DrawConstants constants = {};
+	constants.PositionOffset = packedRange.PositionOffset;
+	constants.PositionScale = packedRange.PositionScale;
+	constants.UVOffset = packedRange.UVOffset;
+	constants.UVScale = packedRange.UVScale;
+
+	// Written all at once, since the destination is probably write combined GPU memory
+	memcpy(destination, &constants, sizeof(DrawConstants));
+}
+
+void Mesh::SetUnpackData(std::shared_ptr<SimpleVertexShader> vs, const PackedVertexHandles& handles)
+{
+	if (!UsePackedVertices)
+		return;
+
+	vs->SetFloat3(handles.PositionOffset, packedRange.PositionOffset);
+	vs->SetFloat3(handles.PositionScale, packedRange.PositionScale);
+	vs->SetFloat2(handles.UVOffset, packedRange.UVOffset);
+	vs->SetFloat2(handles.UVScale, packedRange.UVScale);
+}
+
+PackedVertexRange Mesh::GetPackedRange()
+{
+	return packedRange;
+}
+
+const MeshBounds& Mesh::GetBounds()
+{
+	return bounds;
+}
+
+PackedVertexHandles Mesh::GetUnpackHandles(std::shared_ptr<SimpleVertexShader> vs)
+{
+	// The unpacked shaders don't have these, so leave the handles invalid
+	PackedVertexHandles handles;
+	if (!UsePackedVertices)
+		return handles;
+
+	handles.PositionOffset = vs->GetVariableHandle("positionOffset");
+	handles.PositionScale = vs->GetVariableHandle("positionScale");
+	handles.UVOffset = vs->GetVariableHandle("uvOffset");
+	handles.UVScale = vs->GetVariableHandle("uvScale");
+	return handles;
+}
+
+std::shared_ptr<SimpleVertexShader> Mesh::LoadVertexShader(Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext,
+	const std::wstring& shaderFile, const std::wstring& packedShaderFile)
+{
+	if (!UsePackedVertices)
+		return std::make_shared<SimpleVertexShader>(deviceObject, deviceContext, shaderFile.c_str());
+
+	// Matches the PackedVertex struct in slot 0, then InstanceData in slot 1.
+	// Shaders that don't read the instance part (like the sky's) just ignore it.
+	D3D11_INPUT_ELEMENT_DESC packedLayout[] = {
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_UNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "WORLD_PER_INSTANCE", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD_PER_INSTANCE", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD_PER_INSTANCE", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD_PER_INSTANCE", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD_INV_TRANSPOSE_PER_INSTANCE", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD_INV_TRANSPOSE_PER_INSTANCE", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD_INV_TRANSPOSE_PER_INSTANCE", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD_INV_TRANSPOSE_PER_INSTANCE", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	};
+
+	// The input layout has to be checked against the shader's byte code
+	Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob;
+	Microsoft::WRL::ComPtr<ID3D11InputLayout> inputLayout;
+	if (SUCCEEDED(D3DReadFileToBlob(packedShaderFile.c_str(), shaderBlob.GetAddressOf())))
+	{
+		deviceObject->CreateInputLayout(packedLayout, ARRAYSIZE(packedLayout),
+			shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), inputLayout.GetAddressOf());
+	}
+
+	return std::make_shared<SimpleVertexShader>(deviceObject, deviceContext, packedShaderFile.c_str(), inputLayout, true);
+}
@@ -4,13 +4,57 @@
 #include <wrl/client.h>
 #include <string>
 #include "Vertex.h"
+#include "ObjParser.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "PackedVertex.h"
+#include "TangentGenerator.h"
+#include "SimpleShader.h"
 #include <fstream>
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <DirectXMath.h>
 
 using namespace DirectX;
 
+// Results of cooking a single .obj, used for reporting by the -cook command line
+struct MeshCookStats
+{
+	int VertexCount;
+	int IndexCount;
+	int IndexSize;					// Bytes per index in the cooked file and on the GPU
+	double ObjLoadMilliseconds;		// Reading and fully processing the .obj
+	double CookedLoadMilliseconds;	// Checking the .obj's size and write time, and mapping the .cmesh
+	VertexCacheStats CacheBefore;	// Simulated post-transform cache results in file order
+	VertexCacheStats CacheAfter;	// ...and after optimizing (same as before if that's turned off)
+	int VertexSize;					// Bytes per vertex in the cooked file and on the GPU
+	PackedVertexError PackingError;	// Worst round trip error of packing this mesh's vertices
+	TangentBenchmark Tangents;		// Speed of each tangent generator on this mesh
+};
+
+// Where a vertex shader keeps what it needs to unpack PackedVertex data, from Mesh::GetUnpackHandles()
+struct PackedVertexHandles
+{
+	SimpleShaderVariableHandle PositionOffset;
+	SimpleShaderVariableHandle PositionScale;
+	SimpleShaderVariableHandle UVOffset;
+	SimpleShaderVariableHandle UVScale;
+};
+
+// Register of the PerDraw cbuffer in ObjectConstants.hlsli
+#define DRAW_CONSTANTS_REGISTER 1
+
+// Matches the PerDraw cbuffer in ObjectConstants.hlsli byte for byte
+struct DrawConstants
+{
+	XMFLOAT3 PositionOffset;
+	float Padding0;
+	XMFLOAT3 PositionScale;
+	float Padding1;
+	XMFLOAT2 UVOffset;
+	XMFLOAT2 UVScale;
+};
 
 class Mesh
 {
@@ -38,18 +82,140 @@ public:
 	/// <returns>The number of indicies in this mesh</returns>
 	int GetIndexCount();
 
+	/// <summary>
+	/// Gets the format of the index buffer, which is 16 bit whenever the mesh has few enough vertices
+	/// </summary>
+	/// <returns>DXGI_FORMAT_R16_UINT or DXGI_FORMAT_R32_UINT</returns>
+	DXGI_FORMAT GetIndexFormat();
+
+	/// <summary>
+	/// Gets a small number that's different for every mesh, for RenderQueue keys
+	/// </summary>
+	unsigned int GetSortId();
+
 	/// <summary>
 	/// Draws the mesh to the screen
 	/// </summary>
 	void Draw();
 
+	/// <summary>
+	/// Draws a range of instances of the mesh, with per-instance data from slot 1
+	/// </summary>
+	/// <param name="instances">Vertex buffer of per-instance data, like InstanceBuffer::GetBuffer()</param>
+	/// <param name="firstInstance">Index of the first instance in that buffer</param>
+	/// <param name="instanceCount">How many to draw</param>
+	void DrawInstanced(ID3D11Buffer* instances, unsigned int stride, unsigned int firstInstance, unsigned int instanceCount);
+
+	/// <summary>
+	/// Writes the DrawConstants for drawing this mesh with the shaders that include ObjectConstants.hlsli
+	/// </summary>
+	/// <param name="destination">Where to write them, like a slot from ConstantBufferRing::Allocate()</param>
+	void WriteDrawConstants(void* destination);
+
+	/// <summary>
+	/// Gives a vertex shader what it needs to unpack this mesh's vertices.
+	/// Does nothing if vertices aren't packed. Call before CopyAllBufferData().
+	/// </summary>
+	void SetUnpackData(std::shared_ptr<SimpleVertexShader> vs, const PackedVertexHandles& handles);
+
+	/// <summary>
+	/// Looks up the variables SetUnpackData() sets in a vertex shader, once instead of every draw
+	/// </summary>
+	static PackedVertexHandles GetUnpackHandles(std::shared_ptr<SimpleVertexShader> vs);
+
+	/// <summary>
+	/// Gets what this mesh's packed positions and UVs are relative to, which only means something if UsePackedVertices is set
+	/// </summary>
+	PackedVertexRange GetPackedRange();
+
+	/// <summary>
+	/// Gets the box and sphere around every vertex, in the mesh's own space, from when it was loaded
+	/// </summary>
+	const MeshBounds& GetBounds();
+
+	/// <summary>
+	/// Loads whichever version of a vertex shader matches UsePackedVertices.
+	/// The packed one gets an input layout for PackedVertex, since reflection can't know about UNORM/SNORM,
+	/// plus the per-instance matrices that DrawInstanced() reads from slot 1.
+	/// </summary>
+	/// <param name="shaderFile">Compiled shader that reads Vertex</param>
+	/// <param name="packedShaderFile">Compiled shader that reads PackedVertex</param>
+	static std::shared_ptr<SimpleVertexShader> LoadVertexShader(Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext,
+		const std::wstring& shaderFile, const std::wstring& packedShaderFile);
+
+	/// <summary>
+	/// Processes an .obj file and writes its cooked copy next to it, without needing a device
+	/// </summary>
+	/// <param name="nameOfFile">Path to the .obj file</param>
+	/// <param name="stats">Optional, gets filled with counts and load timings</param>
+	/// <returns>True if the cooked file was written and loads back correctly</returns>
+	static bool Cook(const std::wstring& nameOfFile, MeshCookStats* stats);
+
+	// Should meshes loaded from files have their triangles and vertices reordered
+	// for the post-transform cache, overdraw and vertex fetch before upload?
+	static bool OptimizeOnLoad;
+
+	// Should meshes store PackedVertex (20 bytes) on the GPU instead of Vertex (44 bytes)?
+	// Every mesh has to agree, since the vertex shaders are picked to match. Set it before loading anything.
+	// Off by default; running with "-packed" turns it on for the game and for -cook.
+	static bool UsePackedVertices;
+
+	// If set, Draw() binds its buffers through this, which skips them when the last mesh drawn was the same one
+	static std::shared_ptr<RenderStateCache> StateCache;
+
 private:
 
 	/// <summary>
-	/// Helper method for creating direct 3d buffers
+	/// Helper method for creating direct 3d buffers, narrowing the indices to 16 bit if they fit
 	/// </summary>
-	void CreateDirect3DBuffer(Vertex* vertices, int numberOfVertices, unsigned int* indices, int numberOfIndices, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext);
+	/// <param name="vertices">From PrepareVertexData()</param>
+	void CreateDirect3DBuffer(const void* vertices, int numberOfVertices, const unsigned int* indices, int numberOfIndices, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext);
 
+	/// <summary>
+	/// Creates the buffers straight from a mapped cooked file, and takes its bounds and packed range
+	/// </summary>
+	void CreateFromCooked(CookedMeshFile& cooked, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext);
+
+	/// <summary>
+	/// Helper method for creating direct 3d buffers from data that's already in its final format
+	/// </summary>
+	/// <param name="vertices">PackedVertex data if UsePackedVertices is set, Vertex data otherwise</param>
+	/// <param name="indexSize">2 or 4 bytes per index</param>
+	void CreateDirect3DBuffer(const void* vertices, int numberOfVertices, const void* indices, unsigned int indexSize, int numberOfIndices, Microsoft::WRL::ComPtr<ID3D11Device> deviceObject, Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext);
+
+	/// <summary>
+	/// Packs the vertices if UsePackedVertices is set
+	/// </summary>
+	/// <param name="packed">Storage for the packed vertices, which has to outlive the returned pointer</param>
+	/// <returns>The vertex data to upload: either the packed vertices or the original ones</returns>
+	static const void* PrepareVertexData(const Vertex* vertices, int numberOfVertices, const PackedVertexRange& range, std::vector<PackedVertex>& packed);
+
+	/// <summary>
+	/// Gets the size of each vertex on the GPU
+	/// </summary>
+	static unsigned int GetVertexSize();
+
+	/// <summary>
+	/// Reads an entire source file into memory
+	/// </summary>
+	static bool ReadSourceFile(const std::wstring& nameOfFile, std::vector<char>& source);
+
+	/// <summary>
+	/// Turns the text of an .obj file into welded, left-handed vertices with tangents, and their indices,
+	/// optimized for the GPU if OptimizeOnLoad is set. Fills in the cache stats if given a stats pointer.
+	/// </summary>
+	static bool LoadObjData(const char* source, size_t sourceLength, std::vector<Vertex>& verts, std::vector<unsigned int>& indices, MeshCookStats* stats);
+
+	/// <summary>
+	/// Runs the vertex cache, overdraw and vertex fetch optimizations, in that order. The triangles
+	/// keep the file's order if the first two don't get fewer cache misses out of it.
+	/// </summary>
+	static void Optimize(std::vector<Vertex>& verts, std::vector<unsigned int>& indices);
+
+	/// <summary>
+	/// Gets the flags a cooked file needs to have to match the current settings
+	/// </summary>
+	static unsigned int GetCookedFlags();
 
 	// --------------------------------------------------------
 // Author: Chris Cascioli
@@ -67,8 +233,11 @@ private:
 //         contain an XMFLOAT3 called Tangent
 //
 // - Be sure to call this BEFORE creating your D3D vertex/index buffers
+//
+// - The loop itself now lives in TangentGenerator.cpp, along with
+//   a multithreaded version that big meshes get automatically
 // --------------------------------------------------------
-	void CalculateTangents(Vertex* verts, int numVerts, unsigned int* indices, int numIndices);
+	static void CalculateTangents(Vertex* verts, int numVerts, unsigned int* indices, int numIndices);
 
 	//buffers
 	Microsoft::WRL::ComPtr<ID3D11Buffer> vertexBuffer;
@@ -80,4 +249,17 @@ private:
 	//number of indices that will be in the index buffer
 	int numberOfIndices;
 
+	//R16 or R32, depending on how many vertices there are
+	DXGI_FORMAT indexFormat;
+
+	//what packed positions and uvs are relative to
+	PackedVertexRange packedRange;
+
+	//box and sphere around every vertex, for culling
+	MeshBounds bounds;
+
+	//handed out in creation order
+	unsigned int sortId;
+	static unsigned int nextSortId;
+
 };
\ No newline at end of file
@@ -0,0 +1,447 @@
+#include "MeshBenchmark.h"
+#include "ObjParser.h"
+#include "MeshOptimizer.h"
+#include "Vertex.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The old loop used the secure CRT version, which is only there with MSVC.
+// The format strings have no %s or %c, so plain sscanf reads them the same.
+#ifndef _MSC_VER
+#define sscanf_s sscanf
+#endif
+
+using namespace DirectX;
+
+namespace
+{
+	// Mesh's file constructor before ObjParser, minus the file and the GPU upload:
+	// Chris Cascioli's basic .OBJ loader, reading line by line with sscanf_s
+	void LoadObjLegacy(std::istream& obj, std::vector<Vertex>& verts)
+	{
+		// Variables used while reading the file
+		std::vector<XMFLOAT3> positions;	// Positions from the file
+		std::vector<XMFLOAT3> normals;		// Normals from the file
+		std::vector<XMFLOAT2> uvs;		// UVs from the file
+		char chars[100];			// String for line reading
+
+		// Still have data left?
+		while (obj.good())
+		{
+			// Get the line (100 characters should be more than enough)
+			obj.getline(chars, 100);
+
+			// Check the type of line
+			if (chars[0] == 'v' && chars[1] == 'n')
+			{
+				XMFLOAT3 norm;
+				sscanf_s(chars, "vn %f %f %f", &norm.x, &norm.y, &norm.z);
+				normals.push_back(norm);
+			}
+			else if (chars[0] == 'v' && chars[1] == 't')
+			{
+				XMFLOAT2 uv;
+				sscanf_s(chars, "vt %f %f", &uv.x, &uv.y);
+				uvs.push_back(uv);
+			}
+			else if (chars[0] == 'v')
+			{
+				XMFLOAT3 pos;
+				sscanf_s(chars, "v %f %f %f", &pos.x, &pos.y, &pos.z);
+				positions.push_back(pos);
+			}
+			else if (chars[0] == 'f')
+			{
+				// Only p/t/n corners, which is all BenchmarkObjParser() writes
+				int i[12];
+				int numbersRead = sscanf_s(
+					chars,
+					"f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d",
+					&i[0], &i[1], &i[2],
+					&i[3], &i[4], &i[5],
+					&i[6], &i[7], &i[8],
+					&i[9], &i[10], &i[11]);
+
+				Vertex corners[4];
+				for (int c = 0; c < numbersRead / 3; c++)
+				{
+					// Flip the UV, Z pos and normal's Z
+					corners[c].Position = positions[i[c * 3] - 1];
+					corners[c].UV = uvs[i[c * 3 + 1] - 1];
+					corners[c].Normal = normals[i[c * 3 + 2] - 1];
+					corners[c].Tangent = XMFLOAT3(0, 0, 0);
+					corners[c].UV.y = 1.0f - corners[c].UV.y;
+					corners[c].Position.z *= -1.0f;
+					corners[c].Normal.z *= -1.0f;
+				}
+
+				// Add the verts to the vector (flipping the winding order)
+				verts.push_back(corners[0]);
+				verts.push_back(corners[2]);
+				verts.push_back(corners[1]);
+
+				// Was there a 4th face?
+				if (numbersRead == 12)
+				{
+					verts.push_back(corners[0]);
+					verts.push_back(corners[3]);
+					verts.push_back(corners[2]);
+				}
+			}
+		}
+	}
+
+	// What LoadObjLegacy() makes, but from ParseObj()'s results
+	void ExpandObjCorners(const ObjParseResult& obj, std::vector<Vertex>& verts)
+	{
+		// Flip the winding order by swapping each triangle's last two corners
+		const size_t flipped[3] = { 0, 2, 1 };
+		verts.resize(obj.corners.size());
+		for (size_t i = 0; i < obj.corners.size(); i++)
+		{
+			const ObjCorner& source = obj.corners[i - i % 3 + flipped[i % 3]];
+			const ObjFloat3& position = obj.positions[source.Position];
+			const ObjFloat3& normal = obj.normals[source.Normal];
+			const ObjFloat2& uv = obj.uvs[source.UV];
+			verts[i].Position = XMFLOAT3(position.x, position.y, -position.z);
+			verts[i].Normal = XMFLOAT3(normal.x, normal.y, -normal.z);
+			verts[i].Tangent = XMFLOAT3(0, 0, 0);
+			verts[i].UV = XMFLOAT2(uv.x, 1.0f - uv.y);
+		}
+	}
+
+	// A wavy grid with its own uv and normal per point, quads in
+	// even rows and pairs of triangles in odd ones, like an exporter
+	// that leaves some faces as quads would write
+	std::string MakeObjText(unsigned int gridSize)
+	{
+		std::string text;
+		text.reserve((size_t)(gridSize + 1) * (gridSize + 1) * 100);
+		char line[128];
+
+		unsigned int side = gridSize + 1;
+		for (unsigned int y = 0; y < side; y++)
+		{
+			for (unsigned int x = 0; x < side; x++)
+			{
+				float u = (float)x / gridSize;
+				float v = (float)y / gridSize;
+				snprintf(line, sizeof(line), "v %f %f %f\n", u * 10.0f - 5.0f, sinf(u * 12.0f) * cosf(v * 7.0f), v * 10.0f - 5.0f);
+				text += line;
+				snprintf(line, sizeof(line), "vt %f %f\n", u, v);
+				text += line;
+				snprintf(line, sizeof(line), "vn %f %f %f\n", -0.3f * u, 0.9f, 0.3f * v);
+				text += line;
+			}
+		}
+
+		for (unsigned int y = 0; y < gridSize; y++)
+		{
+			for (unsigned int x = 0; x < gridSize; x++)
+			{
+				// One-based, and the same index for position, uv and normal
+				unsigned int a = y * side + x + 1;
+				unsigned int b = a + 1;
+				unsigned int c = a + side + 1;
+				unsigned int d = a + side;
+				if (y % 2 == 0)
+				{
+					snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c, d, d, d);
+					text += line;
+				}
+				else
+				{
+					snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c);
+					text += line;
+					snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, c, c, c, d, d, d);
+					text += line;
+				}
+			}
+		}
+		return text;
+	}
+
+	// A triangle's corners, rotated to start from the smallest one so the same
+	// triangle compares equal no matter which corner a list started it from
+	struct Triangle
+	{
+		Vertex Corners[3];
+
+		Triangle(const Vertex& a, const Vertex& b, const Vertex& c)
+		{
+			const Vertex* corners[3] = { &a, &b, &c };
+			int first = 0;
+			for (int i = 1; i < 3; i++)
+				if (memcmp(corners[i], corners[first], sizeof(Vertex)) < 0) first = i;
+			for (int i = 0; i < 3; i++)
+				Corners[i] = *corners[(first + i) % 3];
+		}
+
+		bool operator<(const Triangle& other) const { return memcmp(Corners, other.Corners, sizeof(Corners)) < 0; }
+		bool operator==(const Triangle& other) const { return memcmp(Corners, other.Corners, sizeof(Corners)) == 0; }
+	};
+
+	std::vector<Triangle> GetTriangles(const std::vector<Vertex>& verts, const std::vector<unsigned int>& indices)
+	{
+		std::vector<Triangle> triangles;
+		triangles.reserve(indices.size() / 3);
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			triangles.push_back(Triangle(verts[indices[i]], verts[indices[i + 1]], verts[indices[i + 2]]));
+		return triangles;
+	}
+
+	double MBPerSecond(size_t bytes, std::chrono::high_resolution_clock::duration time)
+	{
+		double seconds = std::chrono::duration<double>(time).count();
+		return seconds > 0.0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0;
+	}
+}
+
+ObjParserBenchmark BenchmarkObjParser(unsigned int gridSize, int repeats)
+{
+	ObjParserBenchmark results = {};
+	std::string text = MakeObjText(gridSize);
+	results.Bytes = text.size();
+
+	std::vector<Vertex> legacy, parsed;
+	ObjParseResult obj;
+
+	std::chrono::high_resolution_clock::duration bestLegacy = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration bestParser = bestLegacy;
+	for (int r = 0; r < std::max(repeats, 1); r++)
+	{
+		// The stream only stands in for the file the old loop read from
+		std::istringstream stream(text);
+		legacy.clear();
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		LoadObjLegacy(stream, legacy);
+		std::chrono::high_resolution_clock::time_point legacyEnd = std::chrono::high_resolution_clock::now();
+		ParseObj(text.data(), text.size(), obj);
+		ExpandObjCorners(obj, parsed);
+		std::chrono::high_resolution_clock::time_point parserEnd = std::chrono::high_resolution_clock::now();
+
+		bestLegacy = std::min(bestLegacy, legacyEnd - start);
+		bestParser = std::min(bestParser, parserEnd - legacyEnd);
+	}
+
+	results.TriangleCount = (unsigned int)(parsed.size() / 3);
+	results.LegacyMBPerSecond = MBPerSecond(results.Bytes, bestLegacy);
+	results.ParserMBPerSecond = MBPerSecond(results.Bytes, bestParser);
+
+	// The two float scanners can round the last bit differently, so allow for that
+	results.TrianglesMatch = legacy.size() == parsed.size() && !legacy.empty();
+	for (size_t i = 0; i < legacy.size() && results.TrianglesMatch; i++)
+	{
+		const float* a = &legacy[i].Position.x;
+		const float* b = &parsed[i].Position.x;
+		for (size_t f = 0; f < sizeof(Vertex) / sizeof(float); f++)
+			results.TrianglesMatch = results.TrianglesMatch && fabsf(a[f] - b[f]) <= 1e-6f * std::max(1.0f, fabsf(a[f]));
+	}
+	return results;
+}
+
+ObjWeldChecks CheckObjWelding()
+{
+	ObjWeldChecks results = {};
+
+	// The grid shares every corner between up to six triangles. The extra faces
+	// leave out uvs or normals, so they weld onto ParseObj()'s zeroed defaults.
+	std::string text = MakeObjText(20);
+	text += "f 1//1 2//2 23//23\nf 3 4 25 24\nf 5/5 6/6 27/27\n";
+	ObjParseResult obj;
+	if (!ParseObj(text.data(), text.size(), obj))
+		return results;
+
+	// Unwelded, like the old loader: three vertices per triangle
+	std::vector<Vertex> unwelded;
+	ExpandObjCorners(obj, unwelded);
+	std::vector<unsigned int> unweldedIndices(unwelded.size());
+	for (size_t i = 0; i < unweldedIndices.size(); i++)
+		unweldedIndices[i] = (unsigned int)i;
+
+	// Welded, the way Mesh::LoadObjData() does it (minus tangents, which get averaged across shared corners)
+	std::vector<ObjCorner> uniqueCorners;
+	std::vector<unsigned int> indices;
+	WeldObjCorners(obj.corners, uniqueCorners, indices);
+	std::vector<Vertex> welded(uniqueCorners.size());
+	for (size_t i = 0; i < uniqueCorners.size(); i++)
+	{
+		const ObjFloat3& position = obj.positions[uniqueCorners[i].Position];
+		const ObjFloat3& normal = obj.normals[uniqueCorners[i].Normal];
+		const ObjFloat2& uv = obj.uvs[uniqueCorners[i].UV];
+		welded[i].Position = XMFLOAT3(position.x, position.y, -position.z);
+		welded[i].Normal = XMFLOAT3(normal.x, normal.y, -normal.z);
+		welded[i].Tangent = XMFLOAT3(0, 0, 0);
+		welded[i].UV = XMFLOAT2(uv.x, 1.0f - uv.y);
+	}
+	for (size_t i = 0; i < indices.size(); i += 3)
+		std::swap(indices[i + 1], indices[i + 2]);
+
+	results.UnweldedVertices = (unsigned int)unwelded.size();
+	results.WeldedVertices = (unsigned int)welded.size();
+
+	std::vector<Triangle> expected = GetTriangles(unwelded, unweldedIndices);
+	results.SameTriangles = GetTriangles(welded, indices) == expected;
+
+	// Sorted, any corners that got welded more than once end up next to each other
+	std::vector<ObjCorner> sortedCorners = uniqueCorners;
+	std::sort(sortedCorners.begin(), sortedCorners.end(), [](const ObjCorner& a, const ObjCorner& b) {
+		return a.Position != b.Position ? a.Position < b.Position : a.UV != b.UV ? a.UV < b.UV : a.Normal < b.Normal; });
+	results.NoDuplicates = std::adjacent_find(sortedCorners.begin(), sortedCorners.end(), [](const ObjCorner& a, const ObjCorner& b) {
+		return a.Position == b.Position && a.UV == b.UV && a.Normal == b.Normal; }) == sortedCorners.end();
+
+	// Mesh::Optimize()'s passes reorder the triangles and vertices, but shouldn't change any of them
+	OptimizeTriangleOrder(&indices[0], indices.size(), &welded[0].Position.x, welded.size(), sizeof(Vertex), 1.05f);
+	welded.resize(OptimizeVertexFetch(&welded[0], &indices[0], indices.size(), welded.size(), sizeof(Vertex)));
+
+	std::vector<Triangle> optimized = GetTriangles(welded, indices);
+	std::sort(expected.begin(), expected.end());
+	std::sort(optimized.begin(), optimized.end());
+	results.SameTrianglesOptimized = optimized == expected;
+	return results;
+}
+
+IndexSizeChecks CheckIndexSizes()
+{
+	IndexSizeChecks results = {};
+	results.NarrowedMatch = true;
+
+	for (size_t vertexCount : { (size_t)MESH_MAX_SHORT_INDEX_VERTICES, (size_t)MESH_MAX_SHORT_INDEX_VERTICES + 1 })
+	{
+		// A zigzag strip as a triangle list, so every vertex (including the last) is used
+		std::vector<Vertex> verts(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			verts[i].Position = XMFLOAT3((float)(i / 2), (float)(i % 2), 0.0f);
+			verts[i].Normal = XMFLOAT3(0, 0, -1);
+			verts[i].Tangent = XMFLOAT3(1, 0, 0);
+			verts[i].UV = XMFLOAT2(0, 0);
+		}
+
+		std::vector<unsigned int> indices;
+		indices.reserve((vertexCount - 2) * 3);
+		for (unsigned int i = 0; i + 2 < vertexCount; i++)
+		{
+			indices.push_back(i);
+			indices.push_back(i % 2 == 0 ? i + 1 : i + 2);
+			indices.push_back(i % 2 == 0 ? i + 2 : i + 1);
+		}
+
+		// Same passes as Mesh::Optimize(), which must not drop any of these vertices
+		OptimizeTriangleOrder(&indices[0], indices.size(), &verts[0].Position.x, verts.size(), sizeof(Vertex), 1.05f);
+		verts.resize(OptimizeVertexFetch(&verts[0], &indices[0], indices.size(), verts.size(), sizeof(Vertex)));
+
+		// Then what Mesh::CreateDirect3DBuffer() and WriteCookedMesh() do with the indices
+		unsigned int indexSize = GetIndexSize(verts.size());
+		if (vertexCount <= MESH_MAX_SHORT_INDEX_VERTICES)
+		{
+			results.ShortVertexCount = (unsigned int)verts.size();
+			results.ShortIndices = verts.size() == vertexCount && indexSize == sizeof(unsigned short);
+		}
+		else
+		{
+			results.LongVertexCount = (unsigned int)verts.size();
+			results.LongIndices = verts.size() == vertexCount && indexSize == sizeof(unsigned int);
+		}
+
+		if (indexSize == sizeof(unsigned short))
+		{
+			std::vector<unsigned short> shortIndices(indices.size());
+			NarrowIndices(&indices[0], indices.size(), &shortIndices[0]);
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				if (shortIndices[i] != indices[i] || shortIndices[i] == 0xFFFF)
+					results.NarrowedMatch = false;
+			}
+		}
+	}
+
+	return results;
+}
+
+VertexPackingChecks CheckVertexPacking(int vertexCount)
+{
+	std::mt19937 random(6);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	// Random directions, plus the ones most likely to go wrong: the axes, and the
+	// edges where the lower half of the octahedron gets folded over the upper one
+	std::vector<XMFLOAT3> directions = {
+		XMFLOAT3(1, 0, 0), XMFLOAT3(-1, 0, 0), XMFLOAT3(0, 1, 0), XMFLOAT3(0, -1, 0), XMFLOAT3(0, 0, 1), XMFLOAT3(0, 0, -1),
+		XMFLOAT3(0.70710678f, 0.70710678f, 0), XMFLOAT3(-0.70710678f, 0.70710678f, 0), XMFLOAT3(0.6f, -0.8f, 0), XMFLOAT3(0.6f, 0, -0.8f) };
+
+	std::vector<Vertex> verts(vertexCount);
+	for (int i = 0; i < vertexCount; i++)
+	{
+		XMFLOAT3 normal = i < (int)directions.size() ? directions[i] : XMFLOAT3(unit(random), unit(random), unit(random));
+		XMFLOAT3 tangent = i < (int)directions.size() ? directions[directions.size() - 1 - i] : XMFLOAT3(unit(random), unit(random), unit(random));
+		XMStoreFloat3(&verts[i].Normal, XMVector3Normalize(XMLoadFloat3(&normal)));
+		XMStoreFloat3(&verts[i].Tangent, XMVector3Normalize(XMLoadFloat3(&tangent)));
+
+		// Big enough that a 16 bit step is a millimeter, with UVs that tile like the helix's
+		verts[i].Position = XMFLOAT3(unit(random) * 50.0f, unit(random) * 50.0f, unit(random) * 50.0f + 20.0f);
+		verts[i].UV = XMFLOAT2(unit(random) * 10.0f + 10.0f, unit(random) * 2.0f);
+	}
+
+	PackedVertexRange range = GetPackedVertexRange(&verts[0], vertexCount);
+	std::vector<PackedVertex> packed(vertexCount);
+	PackVertices(&verts[0], vertexCount, range, &packed[0]);
+
+	VertexPackingChecks results = {};
+	results.Error = MeasurePackingError(&verts[0], &packed[0], vertexCount, range);
+
+	// Half a step on each axis, plus a few float roundings of the values involved
+	const float halfStep = 0.5f / 65535.0f;
+	XMFLOAT3 positionRounding(
+		fabsf(range.PositionOffset.x) + fabsf(range.PositionScale.x),
+		fabsf(range.PositionOffset.y) + fabsf(range.PositionScale.y),
+		fabsf(range.PositionOffset.z) + fabsf(range.PositionScale.z));
+	XMVECTOR positionBound =
+		XMLoadFloat3(&range.PositionScale) * halfStep +
+		XMLoadFloat3(&positionRounding) * (4.0f * FLT_EPSILON);
+	results.Bound.Position = XMVectorGetX(XMVector3Length(positionBound));
+	results.Bound.UV =
+		std::max(range.UVScale.x, range.UVScale.y) * halfStep +
+		std::max(fabsf(range.UVOffset.x) + range.UVScale.x, fabsf(range.UVOffset.y) + range.UVScale.y) * 4.0f * FLT_EPSILON;
+
+	// Measured worst case is about 0.0037 degrees over millions of directions
+	results.Bound.NormalDegrees = 0.005f;
+	results.Bound.TangentDegrees = 0.005f;
+
+	results.PositionWithinBound = results.Error.Position <= results.Bound.Position;
+	results.DirectionsWithinBound =
+		results.Error.NormalDegrees <= results.Bound.NormalDegrees &&
+		results.Error.TangentDegrees <= results.Bound.TangentDegrees;
+	results.UVWithinBound = results.Error.UV <= results.Bound.UV;
+
+	// A quad lying flat at y = 3 has no y extent to quantize against
+	Vertex flat[4] = {};
+	for (int i = 0; i < 4; i++)
+	{
+		flat[i].Position = XMFLOAT3((float)(i % 2) * 2.0f - 1.0f, 3.0f, (float)(i / 2) * 2.0f - 1.0f);
+		flat[i].Normal = XMFLOAT3(0, 1, 0);
+		flat[i].Tangent = XMFLOAT3(1, 0, 0);
+	}
+	PackedVertexRange flatRange = GetPackedVertexRange(flat, 4);
+	PackedVertex flatPacked[4];
+	PackVertices(flat, 4, flatRange, flatPacked);
+	results.FlatAxisExact = true;
+	for (int i = 0; i < 4; i++)
+	{
+		Vertex decoded = UnpackVertex(flatPacked[i], flatRange);
+		if (decoded.Position.x != flat[i].Position.x || decoded.Position.y != flat[i].Position.y || decoded.Position.z != flat[i].Position.z)
+			results.FlatAxisExact = false;
+	}
+
+	return results;
+}
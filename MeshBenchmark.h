@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include "PackedVertex.h"
+
+// Results of loading the same made up .obj text with the getline/sscanf_s loop
+// Mesh's file constructor used to have, and with ParseObj()
+struct ObjParserBenchmark
+{
+	size_t Bytes;				// Size of the .obj text
+	unsigned int TriangleCount;
+	double LegacyMBPerSecond;	// The old loop, from text to unwelded vertices
+	double ParserMBPerSecond;	// ParseObj(), then the same unwelded vertices from its corners
+	bool TrianglesMatch;		// Both came up with the same triangles, corner for corner
+};
+
+/// <summary>
+/// Loads a grid of quads and triangles from .obj text, the old way and through ParseObj()
+/// </summary>
+/// <param name="gridSize">How many quads along each side of the grid</param>
+/// <param name="repeats">How many times to load it each way (the fastest one counts)</param>
+ObjParserBenchmark BenchmarkObjParser(unsigned int gridSize, int repeats);
+
+// Results of checking that welding an .obj's corners doesn't change what gets drawn
+struct ObjWeldChecks
+{
+	unsigned int UnweldedVertices;	// Three per triangle, like the old loader made
+	unsigned int WeldedVertices;
+	bool SameTriangles;				// Welded vertices and indices make exactly the unwelded triangles, in the same order and winding
+	bool SameTrianglesOptimized;	// ...and the same set of them (in any order, starting from any corner) after Mesh::Optimize()'s passes
+	bool NoDuplicates;				// No two welded vertices came from the same position, uv and normal
+};
+
+/// <summary>
+/// Welds a made up .obj, with corners that do and don't have uvs and normals, and compares the triangles with the unwelded ones
+/// </summary>
+ObjWeldChecks CheckObjWelding();
+
+// Results of building meshes with vertex counts right on either side of the 16 bit index limit
+struct IndexSizeChecks
+{
+	unsigned int ShortVertexCount;	// MESH_MAX_SHORT_INDEX_VERTICES, after optimizing
+	unsigned int LongVertexCount;	// One more than that, after optimizing
+	bool ShortIndices;				// The first mesh got 2 byte indices
+	bool LongIndices;				// The second one got 4 byte indices
+	bool NarrowedMatch;				// Every 16 bit index is the same as the 32 bit one it came from, and none of them is 0xFFFF
+};
+
+/// <summary>
+/// Builds a strip of triangles through MESH_MAX_SHORT_INDEX_VERTICES vertices and one through one more,
+/// optimizes them like Mesh does, and checks which index size each one ends up with
+/// </summary>
+IndexSizeChecks CheckIndexSizes();
+
+// Results of round tripping made up vertices through PackedVertex
+struct VertexPackingChecks
+{
+	PackedVertexError Error;	// The worst of each attribute
+	PackedVertexError Bound;	// What each one is allowed to be: half a 16 bit step (plus float rounding), and 0.005 degrees for directions
+	bool PositionWithinBound;
+	bool DirectionsWithinBound;	// Normals and tangents, including the axes and the octahedron's folded edges
+	bool UVWithinBound;
+	bool FlatAxisExact;			// Positions on an axis with no extent (like a quad's y) come back exactly
+};
+
+/// <summary>
+/// Packs and unpacks random vertices spread over a big box and tiled UVs, and checks
+/// every attribute comes back within the error 16 bit quantization should allow
+/// </summary>
+/// <param name="vertexCount">How many random vertices to round trip</param>
+VertexPackingChecks CheckVertexPacking(int vertexCount);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// Axis aligned box and bounding sphere around a mesh, in its local space
+struct MeshBounds
+{
+	DirectX::XMFLOAT3 Min;
+	DirectX::XMFLOAT3 Max;
+	DirectX::XMFLOAT3 Center;
+	float Radius;
+};
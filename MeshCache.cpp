@@ -0,0 +1,263 @@
+#include "MeshCache.h"
+
+#include <cfloat>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+using namespace DirectX;
+
+unsigned long long HashMeshSource(const char* data, size_t length)
+{
+	// FNV-1a, but folding in a whole 64 bit word per step instead of a single byte
+	const unsigned long long prime = 0x100000001B3ull;
+	unsigned long long hash = 0xCBF29CE484222325ull ^ length;
+
+	size_t i = 0;
+	for (; i + 8 <= length; i += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * prime;
+	}
+	for (; i < length; i++)
+	{
+		hash = (hash ^ (unsigned char)data[i]) * prime;
+	}
+
+	// Final mix so the high bits depend on everything
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+bool GetMeshSourceStamp(const std::wstring& sourcePath, MeshSourceStamp& stamp)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes = {};
+	if (!GetFileAttributesExW(sourcePath.c_str(), GetFileExInfoStandard, &attributes))
+		return false;
+
+	stamp.Size = ((unsigned long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	stamp.WriteTime = ((unsigned long long)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
+
+std::wstring GetCookedMeshPath(const std::wstring& sourcePath)
+{
+	return sourcePath + L".cmesh";
+}
+
+MeshBounds ComputeMeshBounds(const Vertex* vertices, int numberOfVertices)
+{
+	MeshBounds bounds = {};
+	if (numberOfVertices <= 0)
+		return bounds;
+
+	XMVECTOR min = XMVectorReplicate(FLT_MAX);
+	XMVECTOR max = XMVectorReplicate(-FLT_MAX);
+	for (int i = 0; i < numberOfVertices; i++)
+	{
+		XMVECTOR position = XMLoadFloat3(&vertices[i].Position);
+		min = XMVectorMin(min, position);
+		max = XMVectorMax(max, position);
+	}
+
+	// The sphere is centered on the box, and sized to the farthest vertex from there
+	XMVECTOR center = (min + max) * 0.5f;
+	XMVECTOR radiusSquared = XMVectorZero();
+	for (int i = 0; i < numberOfVertices; i++)
+	{
+		radiusSquared = XMVectorMax(radiusSquared, XMVector3LengthSq(XMLoadFloat3(&vertices[i].Position) - center));
+	}
+
+	XMStoreFloat3(&bounds.Min, min);
+	XMStoreFloat3(&bounds.Max, max);
+	XMStoreFloat3(&bounds.Center, center);
+	bounds.Radius = XMVectorGetX(XMVectorSqrt(radiusSquared));
+	return bounds;
+}
+
+unsigned int GetCookedVertexSize(unsigned int flags)
+{
+	return (flags & COOKED_MESH_FLAG_PACKED) ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+bool WriteCookedMesh(const std::wstring& path, unsigned long long sourceHash, const MeshSourceStamp& sourceStamp, unsigned int flags,
+	const void* vertices, int numberOfVertices, const unsigned int* indices, int numberOfIndices, const MeshBounds& bounds, const PackedVertexRange& packedRange)
+{
+	CookedMeshHeader header = {};
+	memcpy(header.Magic, "DXCM", 4);
+	header.Version = COOKED_MESH_VERSION;
+	header.SourceHash = sourceHash;
+	header.SourceSize = sourceStamp.Size;
+	header.SourceWriteTime = sourceStamp.WriteTime;
+	header.Flags = flags;
+	header.VertexStride = GetCookedVertexSize(flags);
+	header.VertexCount = numberOfVertices;
+	header.IndexCount = numberOfIndices;
+	header.IndexSize = GetIndexSize(numberOfVertices);
+	header.Bounds = bounds;
+	header.PackedRange = packedRange;
+
+	std::ofstream cooked(path, std::ios::binary | std::ios::trunc);
+	if (!cooked.is_open())
+		return false;
+
+	cooked.write((const char*)&header, sizeof(CookedMeshHeader));
+	cooked.write((const char*)vertices, (std::streamsize)header.VertexStride * numberOfVertices);
+	if (header.IndexSize == sizeof(unsigned short))
+	{
+		std::vector<unsigned short> shortIndices(numberOfIndices);
+		NarrowIndices(indices, numberOfIndices, shortIndices.data());
+		cooked.write((const char*)shortIndices.data(), sizeof(unsigned short) * numberOfIndices);
+	}
+	else
+	{
+		cooked.write((const char*)indices, sizeof(unsigned int) * numberOfIndices);
+	}
+	cooked.close();
+
+	// Don't leave a half written file behind to be rejected on every launch
+	if (cooked.fail())
+	{
+		DeleteFileW(path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool RestampCookedMesh(const std::wstring& path, const MeshSourceStamp& sourceStamp)
+{
+	std::fstream cooked(path, std::ios::binary | std::ios::in | std::ios::out);
+	if (!cooked.is_open())
+		return false;
+
+	cooked.seekp(offsetof(CookedMeshHeader, SourceWriteTime));
+	cooked.write((const char*)&sourceStamp.WriteTime, sizeof(sourceStamp.WriteTime));
+	cooked.close();
+	return !cooked.fail();
+}
+
+
+CookedMeshFile::CookedMeshFile()
+{
+	file = INVALID_HANDLE_VALUE;
+	mapping = 0;
+	view = 0;
+	header = 0;
+	vertices = 0;
+	indices = 0;
+}
+
+CookedMeshFile::~CookedMeshFile()
+{
+	Close();
+}
+
+CookedMeshFile::CookedMeshFile(CookedMeshFile&& other) : CookedMeshFile()
+{
+	*this = std::move(other);
+}
+
+CookedMeshFile& CookedMeshFile::operator=(CookedMeshFile&& other)
+{
+	if (this != &other)
+	{
+		Close();
+		file = other.file;
+		mapping = other.mapping;
+		view = other.view;
+		header = other.header;
+		vertices = other.vertices;
+		indices = other.indices;
+
+		// The handles are ours now, so other mustn't close them
+		other.file = INVALID_HANDLE_VALUE;
+		other.mapping = 0;
+		other.view = 0;
+		other.header = 0;
+		other.vertices = 0;
+		other.indices = 0;
+	}
+	return *this;
+}
+
+bool CookedMeshFile::Open(const std::wstring& path, unsigned int flags)
+{
+	Close();
+
+	file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize = {};
+	if (!GetFileSizeEx(file, &fileSize) || (unsigned long long)fileSize.QuadPart < sizeof(CookedMeshHeader))
+	{
+		Close();
+		return false;
+	}
+
+	mapping = CreateFileMappingW(file, 0, PAGE_READONLY, 0, 0, 0);
+	if (!mapping)
+	{
+		Close();
+		return false;
+	}
+
+	view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view)
+	{
+		Close();
+		return false;
+	}
+
+	// Make sure this is a whole cooked mesh made by this code
+	const CookedMeshHeader* mapped = (const CookedMeshHeader*)view;
+	unsigned long long expectedSize = sizeof(CookedMeshHeader) +
+		(unsigned long long)mapped->VertexCount * mapped->VertexStride +
+		(unsigned long long)mapped->IndexCount * mapped->IndexSize;
+
+	if (memcmp(mapped->Magic, "DXCM", 4) != 0 ||
+		mapped->Version != COOKED_MESH_VERSION ||
+		mapped->VertexStride != GetCookedVertexSize(flags) ||
+		mapped->Flags != flags ||
+		mapped->IndexSize != GetIndexSize(mapped->VertexCount) ||
+		mapped->VertexCount == 0 ||
+		mapped->IndexCount == 0 ||
+		(unsigned long long)fileSize.QuadPart != expectedSize)
+	{
+		Close();
+		return false;
+	}
+
+	header = mapped;
+	vertices = header + 1;
+	indices = (const char*)vertices + (size_t)header->VertexStride * header->VertexCount;
+	return true;
+}
+
+bool CookedMeshFile::MatchesStamp(const MeshSourceStamp& sourceStamp)
+{
+	return header && header->SourceSize == sourceStamp.Size && header->SourceWriteTime == sourceStamp.WriteTime;
+}
+
+bool CookedMeshFile::MatchesSource(unsigned long long sourceHash, unsigned long long sourceSize)
+{
+	return header && header->SourceSize == sourceSize && header->SourceHash == sourceHash;
+}
+
+void CookedMeshFile::Close()
+{
+	if (view) UnmapViewOfFile(view);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+
+	file = INVALID_HANDLE_VALUE;
+	mapping = 0;
+	view = 0;
+	header = 0;
+	vertices = 0;
+	indices = 0;
+}
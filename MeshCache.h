@@ -0,0 +1,151 @@
+#pragma once
+
+#include <Windows.h>
+#include <DirectXMath.h>
+#include <string>
+#include <vector>
+#include "Vertex.h"
+#include "MeshBounds.h"
+#include "MeshOptimizer.h"
+#include "PackedVertex.h"
+
+// Bump this whenever the .obj -> vertex/index processing changes,
+// so every old cooked file gets rebuilt on the next load
+#define COOKED_MESH_VERSION 5
+
+// Bits in CookedMeshHeader::Flags
+#define COOKED_MESH_FLAG_OPTIMIZED 0x1 // Went through the Mesh::Optimize() pass
+#define COOKED_MESH_FLAG_PACKED    0x2 // Stores PackedVertex instead of Vertex
+
+// How big a source file is and when it was last written, which is
+// enough to tell it hasn't changed without reading all of it
+struct MeshSourceStamp
+{
+	unsigned long long Size;
+	unsigned long long WriteTime;	// A FILETIME, in 100ns ticks
+};
+
+// The start of every cooked mesh file. The vertices (Vertex or PackedVertex, see Flags)
+// come right after the header, and the indices (16 or 32 bit, see IndexSize) come right after those.
+struct CookedMeshHeader
+{
+	char Magic[4];					// Always "DXCM"
+	unsigned int Version;			// COOKED_MESH_VERSION when it was written
+	unsigned long long SourceHash;	// HashMeshSource() of the .obj it came from
+	unsigned long long SourceSize;	// Size in bytes of that .obj
+	unsigned long long SourceWriteTime;	// MeshSourceStamp::WriteTime of that .obj
+	unsigned int VertexStride;		// sizeof(Vertex) or sizeof(PackedVertex) when it was written
+	unsigned int VertexCount;
+	unsigned int IndexCount;
+	unsigned int Flags;				// COOKED_MESH_FLAG_* bits for how it was processed
+	unsigned int IndexSize;			// GetIndexSize() of the vertex count: 2 or 4 bytes
+	unsigned int Padding;
+	MeshBounds Bounds;
+	PackedVertexRange PackedRange;	// What the packed vertices are relative to, if they're packed
+};
+
+/// <summary>
+/// Hashes the raw bytes of a source file, eight bytes at a time
+/// </summary>
+/// <param name="data">The contents of the file</param>
+/// <param name="length">The number of bytes in data</param>
+/// <returns>A 64 bit hash of the contents</returns>
+unsigned long long HashMeshSource(const char* data, size_t length);
+
+/// <summary>
+/// Gets a source file's size and last write time from the file system, without opening it
+/// </summary>
+/// <returns>False if the file doesn't exist</returns>
+bool GetMeshSourceStamp(const std::wstring& sourcePath, MeshSourceStamp& stamp);
+
+/// <summary>
+/// Gets where the cooked copy of a source mesh lives, which is right next to it
+/// </summary>
+/// <param name="sourcePath">Path to the .obj file</param>
+/// <returns>The same path with ".cmesh" on the end</returns>
+std::wstring GetCookedMeshPath(const std::wstring& sourcePath);
+
+/// <summary>
+/// Calculates the box and sphere around a set of vertices
+/// </summary>
+MeshBounds ComputeMeshBounds(const Vertex* vertices, int numberOfVertices);
+
+/// <summary>
+/// Writes a cooked mesh file, with 16 bit indices if the mesh is small enough
+/// </summary>
+/// <param name="vertices">PackedVertex data if flags has COOKED_MESH_FLAG_PACKED, Vertex data otherwise</param>
+/// <returns>False if the file couldn't be written (a read only folder, for instance)</returns>
+bool WriteCookedMesh(const std::wstring& path, unsigned long long sourceHash, const MeshSourceStamp& sourceStamp, unsigned int flags,
+	const void* vertices, int numberOfVertices, const unsigned int* indices, int numberOfIndices, const MeshBounds& bounds, const PackedVertexRange& packedRange);
+
+/// <summary>
+/// Rewrites just the source stamp in a cooked file's header, for when the source
+/// was touched without changing, so the next load can skip hashing it again
+/// </summary>
+/// <returns>False if the file couldn't be written</returns>
+bool RestampCookedMesh(const std::wstring& path, const MeshSourceStamp& sourceStamp);
+
+/// <summary>
+/// Gets the size of one vertex in a cooked file with the given flags
+/// </summary>
+unsigned int GetCookedVertexSize(unsigned int flags);
+
+
+// --------------------------------------------------------
+// A read-only, memory mapped view of a cooked mesh file.
+// The vertex and index pointers go straight into the
+// mapped file, so they can be handed to CreateBuffer as-is
+// and are only valid until Close() or destruction.
+//
+// It owns the file and mapping handles, so it can be moved
+// but not copied.
+// --------------------------------------------------------
+class CookedMeshFile
+{
+public:
+	CookedMeshFile();
+	~CookedMeshFile();
+
+	CookedMeshFile(const CookedMeshFile&) = delete;
+	CookedMeshFile& operator=(const CookedMeshFile&) = delete;
+	CookedMeshFile(CookedMeshFile&& other);
+	CookedMeshFile& operator=(CookedMeshFile&& other);
+
+	/// <summary>
+	/// Maps the file and makes sure it's a whole cooked mesh, made by this version of the code with the given flags
+	/// </summary>
+	/// <param name="path">Path to the cooked file</param>
+	/// <param name="flags">The COOKED_MESH_FLAG_* bits the file needs to have been processed with</param>
+	/// <returns>True if the file is mapped and usable. Whether it's from the current source is up to MatchesStamp() and MatchesSource().</returns>
+	bool Open(const std::wstring& path, unsigned int flags);
+
+	/// <summary>
+	/// Checks the source's size and write time against the ones it was cooked from, without reading the source
+	/// </summary>
+	bool MatchesStamp(const MeshSourceStamp& sourceStamp);
+
+	/// <summary>
+	/// Checks the source's contents against the ones it was cooked from, for when the stamp doesn't match
+	/// </summary>
+	/// <param name="sourceHash">HashMeshSource() of the current .obj</param>
+	/// <param name="sourceSize">Size of the current .obj</param>
+	bool MatchesSource(unsigned long long sourceHash, unsigned long long sourceSize);
+
+	/// <summary>
+	/// Unmaps the file, if one is open
+	/// </summary>
+	void Close();
+
+	const CookedMeshHeader* GetHeader() { return header; }
+	const void* GetVertices() { return vertices; } // VertexStride bytes each
+	const void* GetIndices() { return indices; } // IndexSize bytes each
+
+private:
+	HANDLE file;
+	HANDLE mapping;
+	const void* view;
+
+	const CookedMeshHeader* header;
+	const void* vertices;
+	const void* indices;
+};
@@ -0,0 +1,399 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const unsigned int NO_TRIANGLE = UINT_MAX;
+	const int CACHE_SIZE = MESH_OPTIMIZER_CACHE_SIZE;
+
+	// Forsyth's scoring constants
+	const float LAST_TRIANGLE_SCORE = 0.75f;
+	const float CACHE_DECAY_POWER = 1.5f;
+	const float VALENCE_BOOST_SCALE = 2.0f;
+	const float VALENCE_BOOST_POWER = 0.5f;
+
+	// How badly a vertex wants to be used next. Vertices in the cache score higher
+	// (except the very last triangle's, so we don't just spin in place), and vertices with
+	// only a few triangles left get a boost so we don't strand lone triangles.
+	float VertexScore(int cachePosition, unsigned int remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+			{
+				score = LAST_TRIANGLE_SCORE;
+			}
+			else
+			{
+				float scaler = 1.0f / (CACHE_SIZE - 3);
+				score = powf(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+			}
+		}
+
+		score += VALENCE_BOOST_SCALE * powf((float)remainingTriangles, -VALENCE_BOOST_POWER);
+		return score;
+	}
+
+	// FIFO cache simulation using timestamps: a vertex is in the cache if it was
+	// added fewer than cacheSize misses ago. Returns how many of the three missed.
+	inline unsigned int SimulateTriangle(const unsigned int* triangle, std::vector<unsigned int>& timestamps, unsigned int& time, unsigned int cacheSize)
+	{
+		unsigned int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = triangle[k];
+			if (time - timestamps[v] > cacheSize)
+			{
+				timestamps[v] = time++;
+				misses++;
+			}
+		}
+		return misses;
+	}
+}
+
+void OptimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || vertexCount == 0)
+		return;
+
+	// How many not-yet-emitted triangles use each vertex
+	std::vector<unsigned int> remaining(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		remaining[indices[i]]++;
+
+	// Triangles that use each vertex, packed into one array
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+	}
+
+	// Starting scores
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		vertexScores[v] = VertexScore(-1, remaining[v]);
+
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<char> emitted(triangleCount, 0);
+	unsigned int bestTriangle = 0;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const unsigned int* triangle = indices + t * 3;
+		triangleScores[t] = vertexScores[triangle[0]] + vertexScores[triangle[1]] + vertexScores[triangle[2]];
+		if (triangleScores[t] > triangleScores[bestTriangle])
+			bestTriangle = (unsigned int)t;
+	}
+
+	std::vector<unsigned int> result(triangleCount * 3);
+
+	// LRU cache, with room for the three vertices that get pushed in before the oldest fall out
+	unsigned int cache[CACHE_SIZE + 3];
+	unsigned int newCache[CACHE_SIZE + 3];
+	int cacheCount = 0;
+	size_t nextUnemitted = 0;
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		// Nothing in the cache leads anywhere, so pick up the next triangle in the original order
+		if (bestTriangle == NO_TRIANGLE)
+		{
+			while (emitted[nextUnemitted]) nextUnemitted++;
+			bestTriangle = (unsigned int)nextUnemitted;
+		}
+
+		const unsigned int* triangle = indices + (size_t)bestTriangle * 3;
+		memcpy(&result[emittedCount * 3], triangle, sizeof(unsigned int) * 3);
+		emitted[bestTriangle] = 1;
+
+		// This triangle no longer counts toward its vertices' adjacency
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = triangle[k];
+			unsigned int* begin = &adjacency[offsets[v]];
+			unsigned int* end = begin + remaining[v];
+			unsigned int* found = std::find(begin, end, bestTriangle);
+			if (found != end)
+			{
+				*found = *(end - 1);
+				remaining[v]--;
+			}
+		}
+
+		// The new triangle's vertices go to the front of the cache, then everything else in order
+		int newCount = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = triangle[k];
+			if (std::find(newCache, newCache + newCount, v) == newCache + newCount)
+				newCache[newCount++] = v;
+		}
+		for (int i = 0; i < cacheCount; i++)
+		{
+			unsigned int v = cache[i];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				newCache[newCount++] = v;
+		}
+
+		// Rescore everything that moved (including anything that just fell out)
+		for (int i = 0; i < newCount; i++)
+		{
+			unsigned int v = newCache[i];
+			cachePositions[v] = i < CACHE_SIZE ? i : -1;
+			vertexScores[v] = VertexScore(cachePositions[v], remaining[v]);
+		}
+
+		// Then rescore their triangles, picking the best one for next time
+		bestTriangle = NO_TRIANGLE;
+		float bestScore = -1.0f;
+		for (int i = 0; i < newCount; i++)
+		{
+			unsigned int v = newCache[i];
+			for (unsigned int a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+			{
+				unsigned int t = adjacency[a];
+				const unsigned int* other = indices + (size_t)t * 3;
+				float score = vertexScores[other[0]] + vertexScores[other[1]] + vertexScores[other[2]];
+				triangleScores[t] = score;
+				if (score > bestScore)
+				{
+					bestScore = score;
+					bestTriangle = t;
+				}
+			}
+		}
+
+		cacheCount = newCount < CACHE_SIZE ? newCount : CACHE_SIZE;
+		memcpy(cache, newCache, sizeof(unsigned int) * cacheCount);
+	}
+
+	// Some files are already exported in a cache friendly order, so only take
+	// the new one if it actually misses less
+	VertexCacheStats before = AnalyzeVertexCache(indices, indexCount, vertexCount, CACHE_SIZE);
+	VertexCacheStats after = AnalyzeVertexCache(result.data(), indexCount, vertexCount, CACHE_SIZE);
+	if (after.Misses < before.Misses)
+		memcpy(indices, result.data(), sizeof(unsigned int) * triangleCount * 3);
+}
+
+bool OptimizeTriangleOrder(unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride, float overdrawThreshold)
+{
+	if (indexCount < 3 || vertexCount == 0)
+		return false;
+
+	std::vector<unsigned int> original(indices, indices + indexCount);
+	VertexCacheStats before = AnalyzeVertexCache(indices, indexCount, vertexCount, CACHE_SIZE);
+
+	OptimizeVertexCache(indices, indexCount, vertexCount);
+	OptimizeOverdraw(indices, indexCount, positions, vertexCount, positionStride, overdrawThreshold);
+
+	// The overdraw pass is allowed to give back some of the vertex cache pass's
+	// gains, which can leave a mesh worse off than the order it came in
+	VertexCacheStats after = AnalyzeVertexCache(indices, indexCount, vertexCount, CACHE_SIZE);
+	if (after.Misses < before.Misses)
+		return true;
+
+	memcpy(indices, original.data(), sizeof(unsigned int) * indexCount);
+	return false;
+}
+
+void OptimizeOverdraw(unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride, float threshold)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || vertexCount == 0)
+		return;
+
+	const unsigned int cacheSize = 16;
+	std::vector<unsigned int> timestamps(vertexCount, 0);
+	unsigned int time = cacheSize + 1;
+
+	// Hard boundaries: wherever all three vertices of a triangle miss, the cache
+	// was effectively flushed, so starting a new cluster there costs nothing
+	std::vector<unsigned int> hardBoundaries;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		if (SimulateTriangle(indices + t * 3, timestamps, time, cacheSize) == 3)
+			hardBoundaries.push_back((unsigned int)t);
+	}
+	if (hardBoundaries.empty() || hardBoundaries[0] != 0)
+		hardBoundaries.insert(hardBoundaries.begin(), 0);
+	hardBoundaries.push_back((unsigned int)triangleCount);
+
+	// Soft boundaries: split hard clusters further, as long as each
+	// piece is within the threshold of the whole cluster's miss ratio
+	std::vector<unsigned int> clusters;
+	for (size_t h = 0; h + 1 < hardBoundaries.size(); h++)
+	{
+		unsigned int start = hardBoundaries[h];
+		unsigned int end = hardBoundaries[h + 1];
+
+		time += cacheSize + 1; // Everything is stale, so this resets the cache
+		unsigned int clusterMisses = 0;
+		for (unsigned int t = start; t < end; t++)
+			clusterMisses += SimulateTriangle(indices + (size_t)t * 3, timestamps, time, cacheSize);
+		float clusterThreshold = threshold * clusterMisses / (float)(end - start);
+
+		clusters.push_back(start);
+		time += cacheSize + 1;
+		unsigned int runningMisses = 0;
+		unsigned int runningSize = 0;
+		for (unsigned int t = start; t < end; t++)
+		{
+			runningMisses += SimulateTriangle(indices + (size_t)t * 3, timestamps, time, cacheSize);
+			runningSize++;
+
+			if (runningMisses / (float)runningSize <= clusterThreshold && t + 1 < end)
+			{
+				clusters.push_back(t + 1);
+				time += cacheSize + 1;
+				runningMisses = 0;
+				runningSize = 0;
+			}
+		}
+	}
+	clusters.push_back((unsigned int)triangleCount);
+
+	const char* positionBytes = (const char*)positions;
+	#define POSITION(v) ((const float*)(positionBytes + (size_t)(v) * positionStride))
+
+	// Center of the whole mesh
+	double meshCenter[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		const float* p = POSITION(indices[i]);
+		meshCenter[0] += p[0];
+		meshCenter[1] += p[1];
+		meshCenter[2] += p[2];
+	}
+	for (int c = 0; c < 3; c++)
+		meshCenter[c] /= (double)(triangleCount * 3);
+
+	// Sort key for each cluster: how far out its center is along its average normal.
+	// Clusters on the outside of the mesh, facing away from the middle, get drawn first.
+	size_t clusterCount = clusters.size() - 1;
+	std::vector<float> sortKeys(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float center[3] = { 0, 0, 0 };
+		float normal[3] = { 0, 0, 0 };
+		float totalArea = 0.0f;
+
+		for (unsigned int t = clusters[c]; t < clusters[c + 1]; t++)
+		{
+			const float* a = POSITION(indices[(size_t)t * 3 + 0]);
+			const float* b = POSITION(indices[(size_t)t * 3 + 1]);
+			const float* d = POSITION(indices[(size_t)t * 3 + 2]);
+
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+			float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0] };
+			float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int k = 0; k < 3; k++)
+			{
+				center[k] += (a[k] + b[k] + d[k]) / 3.0f * area;
+				normal[k] += n[k];
+			}
+			totalArea += area;
+		}
+
+		float normalLength = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (totalArea <= 0.0f || normalLength <= 0.0f)
+		{
+			sortKeys[c] = 0.0f;
+			continue;
+		}
+
+		float key = 0.0f;
+		for (int k = 0; k < 3; k++)
+			key += (center[k] / totalArea - (float)meshCenter[k]) * (normal[k] / normalLength);
+		sortKeys[c] = key;
+	}
+
+	#undef POSITION
+
+	std::vector<unsigned int> order(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+		order[c] = (unsigned int)c;
+	std::stable_sort(order.begin(), order.end(), [&sortKeys](unsigned int a, unsigned int b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<unsigned int> result;
+	result.reserve(triangleCount * 3);
+	for (unsigned int c : order)
+		result.insert(result.end(), indices + (size_t)clusters[c] * 3, indices + (size_t)clusters[c + 1] * 3);
+
+	memcpy(indices, result.data(), sizeof(unsigned int) * triangleCount * 3);
+}
+
+size_t OptimizeVertexFetch(void* vertices, unsigned int* indices, size_t indexCount, size_t vertexCount, size_t vertexSize)
+{
+	// Number the vertices in the order they're first used
+	std::vector<unsigned int> remap(vertexCount, UINT_MAX);
+	unsigned int nextVertex = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		unsigned int& newIndex = remap[indices[i]];
+		if (newIndex == UINT_MAX)
+			newIndex = nextVertex++;
+		indices[i] = newIndex;
+	}
+
+	// Then move them there
+	std::vector<unsigned char> original((unsigned char*)vertices, (unsigned char*)vertices + vertexCount * vertexSize);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		if (remap[v] != UINT_MAX)
+			memcpy((unsigned char*)vertices + (size_t)remap[v] * vertexSize, &original[v * vertexSize], vertexSize);
+	}
+
+	return nextVertex;
+}
+
+VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize)
+{
+	VertexCacheStats stats = {};
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || vertexCount == 0)
+		return stats;
+
+	std::vector<unsigned int> timestamps(vertexCount, 0);
+	unsigned int time = cacheSize + 1;
+	for (size_t t = 0; t < triangleCount; t++)
+		stats.Misses += SimulateTriangle(indices + t * 3, timestamps, time, cacheSize);
+
+	stats.ACMR = stats.Misses / (float)triangleCount;
+	stats.ATVR = stats.Misses / (float)vertexCount;
+	return stats;
+}
+
+unsigned int GetIndexSize(size_t vertexCount)
+{
+	return vertexCount <= MESH_MAX_SHORT_INDEX_VERTICES ? sizeof(unsigned short) : sizeof(unsigned int);
+}
+
+void NarrowIndices(const unsigned int* indices, size_t indexCount, unsigned short* shortIndices)
+{
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		shortIndices[i] = (unsigned short)indices[i];
+	}
+}
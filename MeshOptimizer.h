@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+
+// Size of the post-transform cache we optimize for and simulate
+#define MESH_OPTIMIZER_CACHE_SIZE 32
+
+// Results of running indices through a simulated FIFO post-transform cache
+struct VertexCacheStats
+{
+	unsigned int Misses;	// Number of vertices the GPU would have to transform
+	float ACMR;				// Average cache miss ratio: misses per triangle (0.5 is ideal for big grids, 3 is the worst)
+	float ATVR;				// Average transformed vertex ratio: misses per vertex (1 is ideal)
+};
+
+// The triangle list optimizations below are CPU only and don't depend on Direct3D,
+// so they can be run (and measured with AnalyzeVertexCache) anywhere. Run them in
+// order: vertex cache, then overdraw, then vertex fetch.
+
+/// <summary>
+/// Reorders triangles for post-transform cache hits, using Tom Forsyth's
+/// "Linear-Speed Vertex Cache Optimisation" scoring. Leaves the indices alone
+/// if the new order wouldn't have fewer cache misses than the current one.
+/// </summary>
+/// <param name="indices">Triangle list indices, reordered in place</param>
+/// <param name="indexCount">Number of indices (a multiple of 3)</param>
+/// <param name="vertexCount">Number of vertices the indices point into</param>
+void OptimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount);
+
+/// <summary>
+/// Reorders clusters of already cache optimized triangles so that outward facing
+/// parts of the mesh come first and can occlude the rest with early-z. Only cuts the
+/// list where a new cluster would cost at most "threshold" times the cache misses.
+/// </summary>
+/// <param name="indices">Triangle list indices, reordered in place</param>
+/// <param name="indexCount">Number of indices (a multiple of 3)</param>
+/// <param name="positions">Pointer to the x of the first vertex's position (followed by y and z)</param>
+/// <param name="vertexCount">Number of vertices</param>
+/// <param name="positionStride">Bytes from one vertex's position to the next</param>
+/// <param name="threshold">How much worse ACMR is allowed to get, like 1.05 for 5%</param>
+void OptimizeOverdraw(unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride, float threshold);
+
+/// <summary>
+/// Runs OptimizeVertexCache() then OptimizeOverdraw(), and puts the original order back
+/// if the two together didn't end up with fewer cache misses than it had
+/// </summary>
+/// <param name="indices">Triangle list indices, reordered in place</param>
+/// <param name="indexCount">Number of indices (a multiple of 3)</param>
+/// <param name="positions">Pointer to the x of the first vertex's position (followed by y and z)</param>
+/// <param name="vertexCount">Number of vertices</param>
+/// <param name="positionStride">Bytes from one vertex's position to the next</param>
+/// <param name="overdrawThreshold">Passed on to OptimizeOverdraw()</param>
+/// <returns>True if the indices were reordered, false if they were left as they came in</returns>
+bool OptimizeTriangleOrder(unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride, float overdrawThreshold);
+
+/// <summary>
+/// Reorders vertices into the order the indices first use them, so vertex fetches
+/// walk through memory linearly, and rewrites the indices to match. Unused vertices are dropped.
+/// </summary>
+/// <param name="vertices">The vertex data, reordered in place</param>
+/// <param name="indices">Triangle list indices, rewritten in place</param>
+/// <param name="indexCount">Number of indices</param>
+/// <param name="vertexCount">Number of vertices</param>
+/// <param name="vertexSize">Size of one vertex in bytes</param>
+/// <returns>The number of vertices left (all used ones)</returns>
+size_t OptimizeVertexFetch(void* vertices, unsigned int* indices, size_t indexCount, size_t vertexCount, size_t vertexSize);
+
+/// <summary>
+/// Simulates a FIFO post-transform cache to measure how well ordered the indices are
+/// </summary>
+/// <param name="indices">Triangle list indices</param>
+/// <param name="indexCount">Number of indices (a multiple of 3)</param>
+/// <param name="vertexCount">Number of vertices</param>
+/// <param name="cacheSize">Number of entries in the simulated cache</param>
+/// <returns>Miss counts and ratios</returns>
+VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize);
+
+// Meshes with up to this many vertices get 16 bit indices. The largest index is then 65534,
+// which keeps 0xFFFF free since D3D treats it as the strip cut value.
+#define MESH_MAX_SHORT_INDEX_VERTICES 65535
+
+/// <summary>
+/// Picks the smallest index size that can address every vertex
+/// </summary>
+/// <param name="vertexCount">Number of vertices</param>
+/// <returns>2 for 16 bit indices, or 4 for 32 bit ones</returns>
+unsigned int GetIndexSize(size_t vertexCount);
+
+/// <summary>
+/// Copies 32 bit indices into 16 bit ones. Only valid if GetIndexSize() said 2.
+/// </summary>
+/// <param name="indices">The 32 bit indices</param>
+/// <param name="indexCount">Number of indices</param>
+/// <param name="shortIndices">Where to put the 16 bit indices, with room for indexCount of them</param>
+void NarrowIndices(const unsigned int* indices, size_t indexCount, unsigned short* shortIndices);
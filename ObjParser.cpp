@@ -0,0 +1,435 @@
+#include "ObjParser.h"
+
+#include <climits>
+#include <cstring>
+
+namespace
+{
+	// How much we pull from a stream with each read
+	const size_t READ_BLOCK_SIZE = 1 << 20;
+
+	// Marks a uv or normal that the face didn't specify, patched once parsing is done
+	const unsigned int MISSING_INDEX = UINT_MAX;
+
+	// Every power of ten that a double can hold exactly
+	const double POWERS_OF_TEN[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	const int MAX_EXACT_POWER = 22;
+
+	inline bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline bool IsDigit(char c)
+	{
+		return (unsigned char)(c - '0') < 10;
+	}
+
+	inline const char* SkipSpaces(const char* p, const char* end)
+	{
+		while (p < end && IsSpace(*p)) p++;
+		return p;
+	}
+
+	inline const char* FindLineEnd(const char* p, const char* end)
+	{
+		const char* newLine = (const char*)memchr(p, '\n', end - p);
+		return newLine ? newLine : end;
+	}
+
+	//scales the mantissa by 10^exponent, only leaving the exact table for huge exponents
+	double ScaleByPowerOfTen(double value, int exponent)
+	{
+		while (exponent > MAX_EXACT_POWER) { value *= POWERS_OF_TEN[MAX_EXACT_POWER]; exponent -= MAX_EXACT_POWER; }
+		while (exponent < -MAX_EXACT_POWER) { value /= POWERS_OF_TEN[MAX_EXACT_POWER]; exponent += MAX_EXACT_POWER; }
+		return exponent < 0 ? value / POWERS_OF_TEN[-exponent] : value * POWERS_OF_TEN[exponent];
+	}
+
+	// Reads a decimal float like "-1.25e-3". Leaves "out" at zero and returns
+	// the (space skipped) starting point if there is no number there.
+	const char* ParseFloat(const char* p, const char* end, float& out)
+	{
+		out = 0.0f;
+		p = SkipSpaces(p, end);
+		const char* start = p;
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		// Up to 19 significant digits fit in the mantissa, past that
+		// integer digits just bump the exponent and fraction digits are dropped
+		unsigned long long mantissa = 0;
+		int significantDigits = 0;
+		int exponent = 0;
+		bool anyDigits = false;
+
+		for (; p < end && IsDigit(*p); p++)
+		{
+			anyDigits = true;
+			if (significantDigits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0) significantDigits++;
+			}
+			else
+			{
+				exponent++;
+			}
+		}
+
+		if (p < end && *p == '.')
+		{
+			p++;
+			for (; p < end && IsDigit(*p); p++)
+			{
+				anyDigits = true;
+				if (significantDigits < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					if (mantissa != 0) significantDigits++;
+					exponent--;
+				}
+			}
+		}
+
+		if (!anyDigits)
+			return start;
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* exponentStart = p;
+			p++;
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+'))
+			{
+				negativeExponent = *p == '-';
+				p++;
+			}
+
+			if (p < end && IsDigit(*p))
+			{
+				int explicitExponent = 0;
+				for (; p < end && IsDigit(*p); p++)
+				{
+					if (explicitExponent < 10000) explicitExponent = explicitExponent * 10 + (*p - '0');
+				}
+				exponent += negativeExponent ? -explicitExponent : explicitExponent;
+			}
+			else
+			{
+				// Just an "e" with nothing after it, so it isn't part of the number
+				p = exponentStart;
+			}
+		}
+
+		double value = mantissa == 0 ? 0.0 : ScaleByPowerOfTen((double)mantissa, exponent);
+		out = (float)(negative ? -value : value);
+		return p;
+	}
+
+	// Reads a (possibly negative) integer, leaving "out" at zero if there isn't one
+	const char* ParseInt(const char* p, const char* end, long long& out)
+	{
+		out = 0;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		for (; p < end && IsDigit(*p); p++)
+		{
+			if (out < INT_MAX) out = out * 10 + (*p - '0');
+		}
+
+		if (negative) out = -out;
+		return p;
+	}
+
+	// Turns a one-based (or negative, relative) obj index into a zero-based one.
+	// Anything that can't be valid becomes MISSING_INDEX - 1 so it fails validation.
+	inline unsigned int ResolveIndex(long long index, size_t countSoFar)
+	{
+		if (index > 0)
+			return index <= UINT_MAX - 2 ? (unsigned int)(index - 1) : MISSING_INDEX - 1;
+		if (index < 0 && (size_t)(-index) <= countSoFar)
+			return (unsigned int)(countSoFar + index);
+		return MISSING_INDEX - 1;
+	}
+
+	// The first pass: figures out how big every array needs to be
+	void CountElements(const char* data, const char* end, size_t& positionCount, size_t& normalCount, size_t& uvCount, size_t& cornerCount)
+	{
+		positionCount = normalCount = uvCount = cornerCount = 0;
+
+		for (const char* line = data; line < end;)
+		{
+			const char* lineEnd = FindLineEnd(line, end);
+			const char* p = SkipSpaces(line, lineEnd);
+
+			if (lineEnd - p >= 2)
+			{
+				if (p[0] == 'v')
+				{
+					if (IsSpace(p[1])) positionCount++;
+					else if (p[1] == 'n') normalCount++;
+					else if (p[1] == 't') uvCount++;
+				}
+				else if (p[0] == 'f' && IsSpace(p[1]))
+				{
+					// Count the space separated corners, a polygon with n of them is n - 2 triangles
+					size_t faceCorners = 0;
+					bool inToken = false;
+					for (p += 1; p < lineEnd && *p != '#'; p++)
+					{
+						bool space = IsSpace(*p);
+						if (!space && !inToken) faceCorners++;
+						inToken = !space;
+					}
+
+					if (faceCorners >= 3)
+						cornerCount += (faceCorners - 2) * 3;
+				}
+			}
+
+			line = lineEnd + 1;
+		}
+	}
+}
+
+bool ParseObj(const char* data, size_t length, ObjParseResult& result)
+{
+	result.positions.clear();
+	result.normals.clear();
+	result.uvs.clear();
+	result.corners.clear();
+
+	const char* end = data + length;
+
+	// Size everything exactly once so we never reallocate while reading
+	size_t positionCount, normalCount, uvCount, cornerCount;
+	CountElements(data, end, positionCount, normalCount, uvCount, cornerCount);
+	result.positions.reserve(positionCount);
+	result.normals.reserve(normalCount + 1);
+	result.uvs.reserve(uvCount + 1);
+	result.corners.reserve(cornerCount);
+
+	bool missingUV = false;
+	bool missingNormal = false;
+
+	for (const char* line = data; line < end;)
+	{
+		const char* lineEnd = FindLineEnd(line, end);
+		const char* p = SkipSpaces(line, lineEnd);
+
+		if (lineEnd - p >= 2 && p[0] == 'v')
+		{
+			if (IsSpace(p[1]))
+			{
+				ObjFloat3 position;
+				p = ParseFloat(p + 1, lineEnd, position.x);
+				p = ParseFloat(p, lineEnd, position.y);
+				ParseFloat(p, lineEnd, position.z);
+				result.positions.push_back(position);
+			}
+			else if (p[1] == 'n')
+			{
+				ObjFloat3 normal;
+				p = ParseFloat(p + 2, lineEnd, normal.x);
+				p = ParseFloat(p, lineEnd, normal.y);
+				ParseFloat(p, lineEnd, normal.z);
+				result.normals.push_back(normal);
+			}
+			else if (p[1] == 't')
+			{
+				ObjFloat2 uv;
+				p = ParseFloat(p + 2, lineEnd, uv.x);
+				ParseFloat(p, lineEnd, uv.y);
+				result.uvs.push_back(uv);
+			}
+		}
+		else if (lineEnd - p >= 2 && p[0] == 'f' && IsSpace(p[1]))
+		{
+			ObjCorner first = {};
+			ObjCorner previous = {};
+			int faceCorners = 0;
+
+			p++;
+			while (true)
+			{
+				p = SkipSpaces(p, lineEnd);
+				if (p >= lineEnd || *p == '#')
+					break;
+
+				// Each corner is "p", "p/t", "p//n" or "p/t/n"
+				long long index;
+				ObjCorner corner;
+				corner.UV = MISSING_INDEX;
+				corner.Normal = MISSING_INDEX;
+
+				p = ParseInt(p, lineEnd, index);
+				corner.Position = ResolveIndex(index, result.positions.size());
+
+				if (p < lineEnd && *p == '/')
+				{
+					p++;
+					if (p < lineEnd && *p != '/')
+					{
+						p = ParseInt(p, lineEnd, index);
+						corner.UV = ResolveIndex(index, result.uvs.size());
+					}
+					if (p < lineEnd && *p == '/')
+					{
+						p = ParseInt(p + 1, lineEnd, index);
+						corner.Normal = ResolveIndex(index, result.normals.size());
+					}
+				}
+
+				// Skip whatever is left of a malformed corner
+				while (p < lineEnd && !IsSpace(*p)) p++;
+
+				missingUV |= corner.UV == MISSING_INDEX;
+				missingNormal |= corner.Normal == MISSING_INDEX;
+
+				// Fan out the polygon: (first, previous, current) for every corner past the second
+				if (faceCorners == 0)
+				{
+					first = corner;
+				}
+				else if (faceCorners >= 2)
+				{
+					result.corners.push_back(first);
+					result.corners.push_back(previous);
+					result.corners.push_back(corner);
+				}
+				previous = corner;
+				faceCorners++;
+			}
+		}
+
+		line = lineEnd + 1;
+	}
+
+	// Faces that didn't say which uv or normal to use all share one zeroed entry
+	unsigned int defaultUV = (unsigned int)result.uvs.size();
+	unsigned int defaultNormal = (unsigned int)result.normals.size();
+	if (missingUV) result.uvs.push_back({ 0.0f, 0.0f });
+	if (missingNormal) result.normals.push_back({ 0.0f, 0.0f, 0.0f });
+
+	for (ObjCorner& corner : result.corners)
+	{
+		if (corner.UV == MISSING_INDEX) corner.UV = defaultUV;
+		if (corner.Normal == MISSING_INDEX) corner.Normal = defaultNormal;
+
+		if (corner.Position >= result.positions.size() ||
+			corner.UV >= result.uvs.size() ||
+			corner.Normal >= result.normals.size())
+			return false;
+	}
+
+	return true;
+}
+
+bool ReadWholeStream(std::istream& stream, std::vector<char>& data)
+{
+	data.clear();
+
+	// Find out how big the stream is so we only allocate once
+	stream.seekg(0, std::ios::end);
+	std::streamoff size = stream.tellg();
+	stream.seekg(0, std::ios::beg);
+
+	if (size > 0 && stream)
+	{
+		data.resize((size_t)size);
+		size_t used = 0;
+		while (used < data.size())
+		{
+			size_t request = data.size() - used < READ_BLOCK_SIZE ? data.size() - used : READ_BLOCK_SIZE;
+			stream.read(&data[used], (std::streamsize)request);
+			used += (size_t)stream.gcount();
+			if (!stream) break;
+		}
+		data.resize(used);
+	}
+	else
+	{
+		// Not seekable, so just keep reading blocks until it runs dry
+		stream.clear();
+		size_t used = 0;
+		while (stream)
+		{
+			data.resize(used + READ_BLOCK_SIZE);
+			stream.read(&data[used], (std::streamsize)READ_BLOCK_SIZE);
+			used += (size_t)stream.gcount();
+		}
+		data.resize(used);
+	}
+
+	return !stream.bad();
+}
+
+bool ParseObj(std::istream& stream, ObjParseResult& result)
+{
+	std::vector<char> data;
+	if (!ReadWholeStream(stream, data))
+		return false;
+
+	return ParseObj(data.data(), data.size(), result);
+}
+
+void WeldObjCorners(const std::vector<ObjCorner>& corners, std::vector<ObjCorner>& uniqueCorners, std::vector<unsigned int>& indices)
+{
+	uniqueCorners.clear();
+	indices.resize(corners.size());
+
+	// Power of two table at least twice the worst case, so probes stay short
+	size_t capacity = 16;
+	while (capacity < corners.size() * 2) capacity <<= 1;
+	size_t mask = capacity - 1;
+
+	// Each slot holds an index into uniqueCorners, or MISSING_INDEX when empty
+	std::vector<unsigned int> slots(capacity, MISSING_INDEX);
+	uniqueCorners.reserve(corners.size());
+
+	for (size_t i = 0; i < corners.size(); i++)
+	{
+		const ObjCorner& corner = corners[i];
+
+		// Mix the three indices together (large odd multipliers spread out nearby values)
+		size_t hash = (size_t)(corner.Position * 0x9E3779B1u) ^ (size_t)(corner.UV * 0x85EBCA77u) ^ (size_t)(corner.Normal * 0xC2B2AE3Du);
+		hash ^= hash >> 15;
+
+		// Linear probing until we find this corner or an empty slot
+		size_t slot = hash & mask;
+		while (true)
+		{
+			unsigned int existing = slots[slot];
+			if (existing == MISSING_INDEX)
+			{
+				existing = (unsigned int)uniqueCorners.size();
+				slots[slot] = existing;
+				uniqueCorners.push_back(corner);
+				indices[i] = existing;
+				break;
+			}
+
+			const ObjCorner& other = uniqueCorners[existing];
+			if (other.Position == corner.Position && other.UV == corner.UV && other.Normal == corner.Normal)
+			{
+				indices[i] = existing;
+				break;
+			}
+
+			slot = (slot + 1) & mask;
+		}
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <istream>
+#include <vector>
+
+// Plain data types so the parser can be used (and tested) without
+// DirectXMath or Direct3D. They are layout compatible with XMFLOAT2/3.
+struct ObjFloat2
+{
+	float x;
+	float y;
+};
+
+struct ObjFloat3
+{
+	float x;
+	float y;
+	float z;
+};
+
+// One corner of a triangle, as zero-based indices into the
+// position, uv and normal arrays of an ObjParseResult
+struct ObjCorner
+{
+	unsigned int Position;
+	unsigned int UV;
+	unsigned int Normal;
+};
+
+// Everything we pull out of an .obj file. Faces are triangulated as
+// a fan, and every three entries in "corners" make one triangle in the
+// same winding order and coordinate space as the file itself.
+struct ObjParseResult
+{
+	std::vector<ObjFloat3> positions;
+	std::vector<ObjFloat3> normals;
+	std::vector<ObjFloat2> uvs;
+	std::vector<ObjCorner> corners;
+
+	/// <summary>
+	/// Gets the number of triangles that were read
+	/// </summary>
+	/// <returns>The number of triangles in corners</returns>
+	size_t GetTriangleCount() const { return corners.size() / 3; }
+};
+
+/// <summary>
+/// Parses .obj text that is already in memory. Makes a counting pass first so every
+/// array is allocated exactly once, then a second pass that tokenizes the numbers by hand.
+/// Lines can be any length. Faces without uvs or normals point at a single
+/// zeroed entry that gets added to the end of that array.
+/// </summary>
+/// <param name="data">The text of the file (does not need to be null terminated)</param>
+/// <param name="length">The number of bytes in data</param>
+/// <param name="result">Gets cleared and then filled with the file's contents</param>
+/// <returns>False if a face references data that doesn't exist</returns>
+bool ParseObj(const char* data, size_t length, ObjParseResult& result);
+
+/// <summary>
+/// Reads everything that is left in a stream into memory, in large blocks
+/// </summary>
+/// <param name="stream">The stream to read, ideally opened with std::ios::binary</param>
+/// <param name="data">Gets replaced with the contents of the stream</param>
+/// <returns>False if reading failed part way through</returns>
+bool ReadWholeStream(std::istream& stream, std::vector<char>& data);
+
+/// <summary>
+/// Reads the whole stream with ReadWholeStream and then parses it with the in-memory overload
+/// </summary>
+/// <param name="stream">The stream to read, ideally opened with std::ios::binary</param>
+/// <param name="result">Gets cleared and then filled with the file's contents</param>
+/// <returns>False if the stream couldn't be read or the data is invalid</returns>
+bool ParseObj(std::istream& stream, ObjParseResult& result);
+
+/// <summary>
+/// Welds together triangle corners that use the exact same position, uv and normal,
+/// using an open addressing hash table keyed on those three indices.
+/// </summary>
+/// <param name="corners">Three corners per triangle, like ObjParseResult::corners</param>
+/// <param name="uniqueCorners">Gets filled with each distinct corner, in order of first use</param>
+/// <param name="indices">Gets filled with one index into uniqueCorners per input corner</param>
+void WeldObjCorners(const std::vector<ObjCorner>& corners, std::vector<ObjCorner>& uniqueCorners, std::vector<unsigned int>& indices);
@@ -0,0 +1,46 @@
+#ifndef OBJECT_CONSTANTS // Each .hlsli file needs a unique identifier!
+#define OBJECT_CONSTANTS
+
+// Everything that changes from one draw to the next. Each draw
+// binds its own slice of one big ring buffer here instead of
+// updating a buffer (see ConstantBufferRing), so this has to
+// match DrawConstants in Mesh.h byte for byte.
+cbuffer PerDraw : register(b1)
+{
+    // Only used by the PACKED_VERTICES shaders
+    float3 positionOffset;
+    float3 positionScale;
+    float2 uvOffset;
+    float2 uvScale;
+}
+
+// Everything that changes from one object to the next, read from
+// the instance buffer in slot 1. The "_PER_INSTANCE" semantics are
+// what tell SimpleShader (and Mesh::LoadVertexShader's layout) that.
+// Matches InstanceData in Entity.h.
+struct InstanceInput
+{
+    float4 world0 : WORLD_PER_INSTANCE0;
+    float4 world1 : WORLD_PER_INSTANCE1;
+    float4 world2 : WORLD_PER_INSTANCE2;
+    float4 world3 : WORLD_PER_INSTANCE3;
+    float4 worldInvTranspose0 : WORLD_INV_TRANSPOSE_PER_INSTANCE0;
+    float4 worldInvTranspose1 : WORLD_INV_TRANSPOSE_PER_INSTANCE1;
+    float4 worldInvTranspose2 : WORLD_INV_TRANSPOSE_PER_INSTANCE2;
+    float4 worldInvTranspose3 : WORLD_INV_TRANSPOSE_PER_INSTANCE3;
+};
+
+// The rows are the CPU's XMFLOAT4X4 rows, and these shaders
+// multiply matrix * vector, so they come back transposed the
+// same way a column_major cbuffer matrix would
+matrix GetWorldMatrix(InstanceInput instance)
+{
+    return transpose(float4x4(instance.world0, instance.world1, instance.world2, instance.world3));
+}
+
+matrix GetWorldInvTranspose(InstanceInput instance)
+{
+    return transpose(float4x4(instance.worldInvTranspose0, instance.worldInvTranspose1, instance.worldInvTranspose2, instance.worldInvTranspose3));
+}
+
+#endif
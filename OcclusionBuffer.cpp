@@ -0,0 +1,608 @@
+#include "OcclusionBuffer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+	// Twelve triangles over the corners from BoxCorners()
+	const unsigned int BoxIndices[36] =
+	{
+		0, 1, 3, 0, 3, 2,	// -X
+		4, 6, 7, 4, 7, 5,	// +X
+		0, 4, 5, 0, 5, 1,	// -Y
+		2, 3, 7, 2, 7, 6,	// +Y
+		0, 2, 6, 0, 6, 4,	// -Z
+		1, 5, 7, 1, 7, 3,	// +Z
+	};
+
+	// Bit 2 of the index picks the max x, bit 1 the max y, and bit 0 the max z
+	void BoxCorners(const XMFLOAT3& min, const XMFLOAT3& max, XMFLOAT3 corners[8])
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			corners[i] = XMFLOAT3(
+				(i & 4) ? max.x : min.x,
+				(i & 2) ? max.y : min.y,
+				(i & 1) ? max.z : min.z);
+		}
+	}
+}
+
+OcclusionBuffer::OcclusionBuffer(unsigned int width, unsigned int height)
+{
+	this->width = (std::max(width, 1u) + 3) & ~3u;
+	this->height = std::max(height, 1u);
+
+	unsigned int levelWidth = this->width;
+	unsigned int levelHeight = this->height;
+	while (true)
+	{
+		levels.push_back(std::vector<float>(levelWidth * levelHeight, 1.0f));
+		levelWidths.push_back(levelWidth);
+		levelHeights.push_back(levelHeight);
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+	}
+
+	XMStoreFloat4x4(&viewProjection, XMMatrixIdentity());
+}
+
+void OcclusionBuffer::Begin(const XMFLOAT4X4& view, const XMFLOAT4X4& projection)
+{
+	XMStoreFloat4x4(&viewProjection, XMMatrixMultiply(XMLoadFloat4x4(&view), XMLoadFloat4x4(&projection)));
+	std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+}
+
+void OcclusionBuffer::RasterizeOccluder(const XMFLOAT3* positions, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, const XMFLOAT4X4& world)
+{
+	Rasterize(positions, vertexCount, indices, indexCount, world, true);
+}
+
+void OcclusionBuffer::RasterizeOccluderScalar(const XMFLOAT3* positions, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, const XMFLOAT4X4& world)
+{
+	Rasterize(positions, vertexCount, indices, indexCount, world, false);
+}
+
+void OcclusionBuffer::RasterizeBox(const MeshBounds& bounds, const XMFLOAT4X4& world)
+{
+	XMFLOAT3 corners[8];
+	BoxCorners(bounds.Min, bounds.Max, corners);
+	Rasterize(corners, 8, BoxIndices, 36, world, true);
+}
+
+void OcclusionBuffer::Rasterize(const XMFLOAT3* positions, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, const XMFLOAT4X4& world, bool simd)
+{
+	XMMATRIX worldViewProjection = XMMatrixMultiply(XMLoadFloat4x4(&world), XMLoadFloat4x4(&viewProjection));
+	clipPositions.resize(vertexCount);
+	for (unsigned int i = 0; i < vertexCount; i++)
+		XMStoreFloat4(&clipPositions[i], XMVector3Transform(XMLoadFloat3(&positions[i]), worldViewProjection));
+
+	for (unsigned int i = 0; i + 2 < indexCount; i += 3)
+	{
+		const XMFLOAT4 triangle[3] = { clipPositions[indices[i]], clipPositions[indices[i + 1]], clipPositions[indices[i + 2]] };
+
+		// Cut off whatever's in front of the near plane (z < 0), which
+		// leaves nothing, the triangle, or a quad. Everything left has a
+		// positive w, so the divide is safe and the screen box gets
+		// clamped to the buffer for whatever's off to the sides.
+		XMFLOAT4 polygon[4];
+		int polygonCount = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			const XMFLOAT4& p = triangle[k];
+			const XMFLOAT4& q = triangle[(k + 1) % 3];
+			if (p.z >= 0.0f)
+				polygon[polygonCount++] = p;
+			if ((p.z >= 0.0f) != (q.z >= 0.0f))
+			{
+				float t = p.z / (p.z - q.z);
+				polygon[polygonCount++] = XMFLOAT4(p.x + (q.x - p.x) * t, p.y + (q.y - p.y) * t, 0.0f, p.w + (q.w - p.w) * t);
+			}
+		}
+		if (polygonCount < 3)
+			continue;
+
+		XMFLOAT3 screen[4];
+		for (int k = 0; k < polygonCount; k++)
+		{
+			float inverseW = 1.0f / polygon[k].w;
+			screen[k] = XMFLOAT3(
+				(polygon[k].x * inverseW * 0.5f + 0.5f) * width,
+				(0.5f - polygon[k].y * inverseW * 0.5f) * height,
+				polygon[k].z * inverseW);
+		}
+
+		DrawTriangle(screen[0], screen[1], screen[2], simd);
+		if (polygonCount == 4)
+			DrawTriangle(screen[0], screen[2], screen[3], simd);
+	}
+}
+
+void OcclusionBuffer::DrawTriangle(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c, bool simd)
+{
+	// Both windings are drawn, so flip the backwards ones around
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (!(area != 0.0f))
+		return;
+	const XMFLOAT3& first = a;
+	const XMFLOAT3& second = area > 0.0f ? b : c;
+	const XMFLOAT3& third = area > 0.0f ? c : b;
+	area = fabsf(area);
+
+	// Pixels whose centers might be inside
+	float minX = std::max(std::min(std::min(a.x, b.x), c.x), 0.0f);
+	float maxX = std::min(std::max(std::max(a.x, b.x), c.x), (float)(width - 1));
+	float minY = std::max(std::min(std::min(a.y, b.y), c.y), 0.0f);
+	float maxY = std::min(std::max(std::max(a.y, b.y), c.y), (float)(height - 1));
+	if (minX > maxX || minY > maxY)
+		return;
+	int x0 = (int)minX;
+	int x1 = (int)ceilf(maxX);
+	int y0 = (int)minY;
+	int y1 = (int)ceilf(maxY);
+
+	// Each edge function is positive on the inside and zero at the vertex
+	// opposite it's named after, so the ones for second and third double
+	// as weights for interpolating depth across the triangle
+	float edgeFirstX = third.x - second.x, edgeFirstY = third.y - second.y;
+	float edgeSecondX = first.x - third.x, edgeSecondY = first.y - third.y;
+	float edgeThirdX = second.x - first.x, edgeThirdY = second.y - first.y;
+	float depthSecond = (second.z - first.z) / area;
+	float depthThird = (third.z - first.z) / area;
+
+	std::vector<float>& depth = levels[0];
+	if (!simd)
+	{
+		for (int y = y0; y <= y1; y++)
+		{
+			float pixelY = y + 0.5f;
+			float rowFirst = edgeFirstX * (pixelY - second.y);
+			float rowSecond = edgeSecondX * (pixelY - third.y);
+			float rowThird = edgeThirdX * (pixelY - first.y);
+			float* row = &depth[y * width];
+			for (int x = x0; x <= x1; x++)
+			{
+				float pixelX = x + 0.5f;
+				float weightFirst = rowFirst - edgeFirstY * (pixelX - second.x);
+				float weightSecond = rowSecond - edgeSecondY * (pixelX - third.x);
+				float weightThird = rowThird - edgeThirdY * (pixelX - first.x);
+				if (weightFirst < 0.0f || weightSecond < 0.0f || weightThird < 0.0f)
+					continue;
+
+				float z = (first.z + weightSecond * depthSecond) + weightThird * depthThird;
+				row[x] = std::min(row[x], z);
+			}
+		}
+		return;
+	}
+
+	// Same math as above, four pixels at a time. The width is a multiple
+	// of 4, so a block never runs off the end of a row, and the extra
+	// pixels on either side of the box are always outside the triangle.
+	XMVECTOR laneOffsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+	XMVECTOR firstEdgeY = XMVectorReplicate(edgeFirstY);
+	XMVECTOR secondEdgeY = XMVectorReplicate(edgeSecondY);
+	XMVECTOR thirdEdgeY = XMVectorReplicate(edgeThirdY);
+	XMVECTOR firstX = XMVectorReplicate(first.x);
+	XMVECTOR secondX = XMVectorReplicate(second.x);
+	XMVECTOR thirdX = XMVectorReplicate(third.x);
+	XMVECTOR firstZ = XMVectorReplicate(first.z);
+	XMVECTOR secondDepth = XMVectorReplicate(depthSecond);
+	XMVECTOR thirdDepth = XMVectorReplicate(depthThird);
+	XMVECTOR zero = XMVectorZero();
+
+	int blockStart = x0 & ~3;
+	for (int y = y0; y <= y1; y++)
+	{
+		float pixelY = y + 0.5f;
+		XMVECTOR rowFirst = XMVectorReplicate(edgeFirstX * (pixelY - second.y));
+		XMVECTOR rowSecond = XMVectorReplicate(edgeSecondX * (pixelY - third.y));
+		XMVECTOR rowThird = XMVectorReplicate(edgeThirdX * (pixelY - first.y));
+		float* row = &depth[y * width];
+		for (int x = blockStart; x <= x1; x += 4)
+		{
+			XMVECTOR pixelX = XMVectorReplicate((float)x) + laneOffsets;
+			XMVECTOR weightFirst = rowFirst - firstEdgeY * (pixelX - secondX);
+			XMVECTOR weightSecond = rowSecond - secondEdgeY * (pixelX - thirdX);
+			XMVECTOR weightThird = rowThird - thirdEdgeY * (pixelX - firstX);
+			XMVECTOR inside = XMVectorAndInt(XMVectorAndInt(
+				XMVectorGreaterOrEqual(weightFirst, zero),
+				XMVectorGreaterOrEqual(weightSecond, zero)),
+				XMVectorGreaterOrEqual(weightThird, zero));
+			if (XMVector4EqualInt(inside, XMVectorFalseInt()))
+				continue;
+
+			XMVECTOR z = (firstZ + weightSecond * secondDepth) + weightThird * thirdDepth;
+			XMVECTOR old = XMLoadFloat4((const XMFLOAT4*)&row[x]);
+			XMStoreFloat4((XMFLOAT4*)&row[x], XMVectorSelect(old, XMVectorMin(old, z), inside));
+		}
+	}
+}
+
+void OcclusionBuffer::BuildHierarchy()
+{
+	// Each texel keeps the furthest of the (up to) four below it
+	for (size_t level = 1; level < levels.size(); level++)
+	{
+		const std::vector<float>& below = levels[level - 1];
+		unsigned int belowWidth = levelWidths[level - 1];
+		unsigned int belowHeight = levelHeights[level - 1];
+		std::vector<float>& depth = levels[level];
+		for (unsigned int y = 0; y < levelHeights[level]; y++)
+		{
+			const float* top = &below[(y * 2) * belowWidth];
+			const float* bottom = &below[std::min(y * 2 + 1, belowHeight - 1) * belowWidth];
+			for (unsigned int x = 0; x < levelWidths[level]; x++)
+			{
+				unsigned int left = x * 2;
+				unsigned int right = std::min(left + 1, belowWidth - 1);
+				depth[y * levelWidths[level] + x] = std::max(std::max(top[left], top[right]), std::max(bottom[left], bottom[right]));
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::IsVisible(const WorldBounds& bounds, unsigned int coarsestLevel)
+{
+	XMFLOAT3 min(bounds.Center.x - bounds.Extents.x, bounds.Center.y - bounds.Extents.y, bounds.Center.z - bounds.Extents.z);
+	XMFLOAT3 max(bounds.Center.x + bounds.Extents.x, bounds.Center.y + bounds.Extents.y, bounds.Center.z + bounds.Extents.z);
+	XMFLOAT3 corners[8];
+	BoxCorners(min, max, corners);
+
+	// The box's screen rectangle and nearest depth, from its corners
+	XMMATRIX matrix = XMLoadFloat4x4(&viewProjection);
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float nearest = FLT_MAX;
+	for (const XMFLOAT3& corner : corners)
+	{
+		XMFLOAT4 clip;
+		XMStoreFloat4(&clip, XMVector3Transform(XMLoadFloat3(&corner), matrix));
+
+		// Reaches past the near plane, so it's right in front of the camera
+		if (clip.z < 0.0f)
+			return true;
+
+		float inverseW = 1.0f / clip.w;
+		float x = (clip.x * inverseW * 0.5f + 0.5f) * width;
+		float y = (0.5f - clip.y * inverseW * 0.5f) * height;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		nearest = std::min(nearest, clip.z * inverseW);
+	}
+
+	// Entirely off screen is for frustum culling to decide
+	if (maxX < 0.0f || maxY < 0.0f || minX >= (float)width || minY >= (float)height)
+		return true;
+
+	unsigned int x0 = (unsigned int)std::max(minX, 0.0f);
+	unsigned int x1 = (unsigned int)std::min(maxX, (float)(width - 1));
+	unsigned int y0 = (unsigned int)std::max(minY, 0.0f);
+	unsigned int y1 = (unsigned int)std::min(maxY, (float)(height - 1));
+
+	// Go up until the rectangle covers at most 4x4 texels
+	unsigned int level = 0;
+	unsigned int lastLevel = std::min(coarsestLevel, (unsigned int)levels.size() - 1);
+	while (level < lastLevel && (x1 - x0 >= 4 || y1 - y0 >= 4))
+	{
+		x0 >>= 1;
+		x1 >>= 1;
+		y0 >>= 1;
+		y1 >>= 1;
+		level++;
+	}
+
+	const std::vector<float>& depth = levels[level];
+	unsigned int levelWidth = levelWidths[level];
+	for (unsigned int y = y0; y <= y1; y++)
+	{
+		for (unsigned int x = x0; x <= x1; x++)
+		{
+			if (depth[y * levelWidth + x] >= nearest)
+				return true;
+		}
+	}
+	return false;
+}
+
+unsigned int OcclusionBuffer::GetWidth()
+{
+	return width;
+}
+
+unsigned int OcclusionBuffer::GetHeight()
+{
+	return height;
+}
+
+unsigned int OcclusionBuffer::GetLevelCount()
+{
+	return (unsigned int)levels.size();
+}
+
+unsigned int OcclusionBuffer::GetLevelWidth(unsigned int level)
+{
+	return levelWidths[level];
+}
+
+unsigned int OcclusionBuffer::GetLevelHeight(unsigned int level)
+{
+	return levelHeights[level];
+}
+
+const float* OcclusionBuffer::GetDepth(unsigned int level)
+{
+	return levels[level].data();
+}
+
+OcclusionBenchmark BenchmarkOcclusionCulling(unsigned int width, unsigned int height, unsigned int occluderCount, unsigned int objectCount, int repeats)
+{
+	OcclusionBuffer buffer(width, height);
+	OcclusionBenchmark results = {};
+	results.Width = buffer.GetWidth();
+	results.Height = buffer.GetHeight();
+	results.OccluderTriangles = occluderCount * 12;
+	results.ObjectCount = objectCount;
+
+	// A camera at the origin looking down +Z
+	XMFLOAT4X4 view, projection;
+	XMStoreFloat4x4(&view, XMMatrixLookToLH(XMVectorZero(), XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0)));
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, (float)width / height, 0.1f, 500.0f));
+
+	// Walls turned every which way around the Y axis in front of it,
+	// some of them cut by the near plane or hanging off the sides
+	std::mt19937 random(19);
+	std::uniform_real_distribution<float> wallX(-30.0f, 30.0f);
+	std::uniform_real_distribution<float> wallY(-4.0f, 4.0f);
+	std::uniform_real_distribution<float> wallZ(-2.0f, 40.0f);
+	std::uniform_real_distribution<float> wallWidth(2.0f, 12.0f);
+	std::uniform_real_distribution<float> wallHeight(2.0f, 8.0f);
+	std::uniform_real_distribution<float> angles(0.0f, XM_2PI);
+	std::vector<XMFLOAT3> wallCorners(occluderCount * 8);
+	std::vector<XMFLOAT4X4> wallWorlds(occluderCount);
+	for (unsigned int i = 0; i < occluderCount; i++)
+	{
+		float halfWidth = wallWidth(random) * 0.5f;
+		float halfHeight = wallHeight(random) * 0.5f;
+		BoxCorners(XMFLOAT3(-halfWidth, -halfHeight, -0.1f), XMFLOAT3(halfWidth, halfHeight, 0.1f), &wallCorners[i * 8]);
+		XMStoreFloat4x4(&wallWorlds[i], XMMatrixRotationY(angles(random)) * XMMatrixTranslation(wallX(random), wallY(random), wallZ(random)));
+	}
+
+	// Small objects scattered behind and between them
+	std::uniform_real_distribution<float> objectX(-60.0f, 60.0f);
+	std::uniform_real_distribution<float> objectY(-10.0f, 10.0f);
+	std::uniform_real_distribution<float> objectZ(5.0f, 100.0f);
+	std::uniform_real_distribution<float> objectSize(0.25f, 2.0f);
+	std::vector<WorldBounds> objects(objectCount);
+	for (WorldBounds& object : objects)
+	{
+		object.Center = XMFLOAT3(objectX(random), objectY(random), objectZ(random));
+		object.Extents = XMFLOAT3(objectSize(random), objectSize(random), objectSize(random));
+		object.Radius = sqrtf(object.Extents.x * object.Extents.x + object.Extents.y * object.Extents.y + object.Extents.z * object.Extents.z);
+	}
+
+	std::chrono::high_resolution_clock::duration bestScalar = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration bestRaster = bestScalar;
+	std::chrono::high_resolution_clock::duration bestHierarchy = bestScalar;
+	std::chrono::high_resolution_clock::duration bestTest = bestScalar;
+	std::vector<float> scalarDepth;
+	std::vector<bool> visible(objectCount);
+	for (int r = 0; r < repeats; r++)
+	{
+		// The reference image, one pixel at a time
+		buffer.Begin(view, projection);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < occluderCount; i++)
+			buffer.RasterizeOccluderScalar(&wallCorners[i * 8], 8, BoxIndices, 36, wallWorlds[i]);
+		bestScalar = std::min(bestScalar, std::chrono::high_resolution_clock::now() - start);
+		scalarDepth.assign(buffer.GetDepth(0), buffer.GetDepth(0) + buffer.GetWidth() * buffer.GetHeight());
+
+		buffer.Begin(view, projection);
+		start = std::chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < occluderCount; i++)
+			buffer.RasterizeOccluder(&wallCorners[i * 8], 8, BoxIndices, 36, wallWorlds[i]);
+		std::chrono::high_resolution_clock::time_point rasterEnd = std::chrono::high_resolution_clock::now();
+
+		buffer.BuildHierarchy();
+		std::chrono::high_resolution_clock::time_point hierarchyEnd = std::chrono::high_resolution_clock::now();
+
+		for (unsigned int i = 0; i < objectCount; i++)
+			visible[i] = buffer.IsVisible(objects[i]);
+		std::chrono::high_resolution_clock::time_point testEnd = std::chrono::high_resolution_clock::now();
+
+		bestRaster = std::min(bestRaster, rasterEnd - start);
+		bestHierarchy = std::min(bestHierarchy, hierarchyEnd - rasterEnd);
+		bestTest = std::min(bestTest, testEnd - hierarchyEnd);
+	}
+
+	const float* depth = buffer.GetDepth(0);
+	for (size_t i = 0; i < scalarDepth.size(); i++)
+	{
+		if (depth[i] != scalarDepth[i])
+			results.PixelsDifferent++;
+	}
+
+	// Anything the Hi-Z test hides should also be hidden pixel by pixel
+	results.Conservative = true;
+	for (unsigned int i = 0; i < objectCount; i++)
+	{
+		if (visible[i])
+			continue;
+		results.HiddenCount++;
+		if (buffer.IsVisible(objects[i], 0))
+			results.Conservative = false;
+	}
+
+	results.RasterMilliseconds = std::chrono::duration<double, std::milli>(bestRaster).count();
+	results.ScalarRasterMilliseconds = std::chrono::duration<double, std::milli>(bestScalar).count();
+	results.HierarchyMilliseconds = std::chrono::duration<double, std::milli>(bestHierarchy).count();
+	results.TestMilliseconds = std::chrono::duration<double, std::milli>(bestTest).count();
+	return results;
+}
+
+OcclusionChecks CheckOcclusionBuffer(unsigned int triangleCount)
+{
+	OcclusionChecks results = {};
+	OcclusionBuffer buffer(64, 48);
+	unsigned int width = buffer.GetWidth();
+	unsigned int height = buffer.GetHeight();
+
+	// A camera at the origin looking down +Z, so view space is world space
+	const float nearPlane = 0.5f;
+	const float farPlane = 100.0f;
+	XMFLOAT4X4 view, projection;
+	XMStoreFloat4x4(&view, XMMatrixIdentity());
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, (float)width / height, nearPlane, farPlane));
+	XMFLOAT4X4 world = view;
+
+	// Triangles all over the place, some reaching behind the camera
+	std::mt19937 random(190);
+	std::uniform_real_distribution<float> cornerX(-20.0f, 20.0f);
+	std::uniform_real_distribution<float> cornerY(-15.0f, 15.0f);
+	std::uniform_real_distribution<float> cornerZ(-2.0f, 30.0f);
+	std::vector<XMFLOAT3> corners(triangleCount * 3);
+	std::vector<unsigned int> indices(triangleCount * 3);
+	for (unsigned int i = 0; i < triangleCount * 3; i++)
+	{
+		corners[i] = XMFLOAT3(cornerX(random), cornerY(random), cornerZ(random));
+		indices[i] = i;
+	}
+
+	buffer.Begin(view, projection);
+	buffer.RasterizeOccluderScalar(corners.data(), (unsigned int)corners.size(), indices.data(), (unsigned int)indices.size(), world);
+	std::vector<float> scalarDepth(buffer.GetDepth(0), buffer.GetDepth(0) + width * height);
+
+	buffer.Begin(view, projection);
+	buffer.RasterizeOccluder(corners.data(), (unsigned int)corners.size(), indices.data(), (unsigned int)indices.size(), world);
+	const float* depth = buffer.GetDepth(0);
+	results.ScalarMatches = std::equal(scalarDepth.begin(), scalarDepth.end(), depth);
+
+	// The reference: a ray through each pixel center, and the nearest triangle it hits past the
+	// near plane, with the hardware's z / w for that distance. Pixels where any triangle's edge
+	// or the near plane passes too close to the center to call either way are left out.
+	double xScale = projection._11;
+	double yScale = projection._22;
+	double depthScale = (double)farPlane / (farPlane - nearPlane);
+	unsigned int pixelsSkipped = 0;
+	for (unsigned int y = 0; y < height; y++)
+	{
+		for (unsigned int x = 0; x < width; x++)
+		{
+			double directionX = ((x + 0.5) / width * 2.0 - 1.0) / xScale;
+			double directionY = (1.0 - (y + 0.5) / height * 2.0) / yScale;
+
+			double nearest = 1.0;
+			bool ambiguous = false;
+			for (unsigned int t = 0; t < triangleCount; t++)
+			{
+				const XMFLOAT3& a = corners[t * 3];
+				const XMFLOAT3& b = corners[t * 3 + 1];
+				const XMFLOAT3& c = corners[t * 3 + 2];
+				double ab[3] = { (double)b.x - a.x, (double)b.y - a.y, (double)b.z - a.z };
+				double ac[3] = { (double)c.x - a.x, (double)c.y - a.y, (double)c.z - a.z };
+
+				// Solves a + ab * u + ac * v = direction * distance, where direction has a z of 1
+				double normal[3] = { ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2], ab[0] * ac[1] - ab[1] * ac[0] };
+				double facing = normal[0] * directionX + normal[1] * directionY + normal[2];
+				if (fabs(facing) < 1e-12)
+					continue;
+				double distance = (normal[0] * a.x + normal[1] * a.y + normal[2] * a.z) / facing;
+				double hit[3] = { directionX * distance - a.x, directionY * distance - a.y, distance - a.z };
+
+				// Barycentrics from the hit point, through the normal
+				double normalLengthSquared = normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2];
+				double crossHitAc[3] = { hit[1] * ac[2] - hit[2] * ac[1], hit[2] * ac[0] - hit[0] * ac[2], hit[0] * ac[1] - hit[1] * ac[0] };
+				double crossAbHit[3] = { ab[1] * hit[2] - ab[2] * hit[1], ab[2] * hit[0] - ab[0] * hit[2], ab[0] * hit[1] - ab[1] * hit[0] };
+				double u = (crossHitAc[0] * normal[0] + crossHitAc[1] * normal[1] + crossHitAc[2] * normal[2]) / normalLengthSquared;
+				double v = (crossAbHit[0] * normal[0] + crossAbHit[1] * normal[1] + crossAbHit[2] * normal[2]) / normalLengthSquared;
+				double w = 1.0 - u - v;
+
+				const double edgeMargin = 1e-4;
+				double closest = std::min(std::min(u, v), w);
+				if (fabs(closest) < edgeMargin || fabs(distance - nearPlane) < 1e-3)
+				{
+					ambiguous = true;
+					continue;
+				}
+				if (closest < 0.0 || distance < nearPlane)
+					continue;
+
+				nearest = std::min(nearest, depthScale * (1.0 - nearPlane / distance));
+			}
+
+			if (ambiguous)
+			{
+				pixelsSkipped++;
+				continue;
+			}
+
+			results.PixelsCompared++;
+			if (fabs(depth[y * width + x] - nearest) > 1e-5 + nearest * 1e-5)
+				results.PixelsDifferent++;
+		}
+	}
+	results.MatchesReference = results.PixelsDifferent == 0 && pixelsSkipped * 20 < width * height;
+
+	// Every level of the chain against the one below it, with the odd row and column repeated
+	buffer.BuildHierarchy();
+	results.HierarchyFurthest = true;
+	for (unsigned int level = 1; level < buffer.GetLevelCount(); level++)
+	{
+		const float* below = buffer.GetDepth(level - 1);
+		const float* above = buffer.GetDepth(level);
+		unsigned int belowWidth = buffer.GetLevelWidth(level - 1);
+		unsigned int belowHeight = buffer.GetLevelHeight(level - 1);
+		for (unsigned int y = 0; y < buffer.GetLevelHeight(level); y++)
+		{
+			for (unsigned int x = 0; x < buffer.GetLevelWidth(level); x++)
+			{
+				float furthest = 0.0f;
+				for (unsigned int by = y * 2; by <= y * 2 + 1 && by < belowHeight; by++)
+				{
+					for (unsigned int bx = x * 2; bx <= x * 2 + 1 && bx < belowWidth; bx++)
+						furthest = std::max(furthest, below[by * belowWidth + bx]);
+				}
+				if (above[y * buffer.GetLevelWidth(level) + x] != furthest)
+					results.HierarchyFurthest = false;
+			}
+		}
+	}
+
+	// A wall 10 units away, much wider than the screen
+	MeshBounds wall = {};
+	wall.Min = XMFLOAT3(-50.0f, -50.0f, 10.0f);
+	wall.Max = XMFLOAT3(50.0f, 50.0f, 10.5f);
+	buffer.Begin(view, projection);
+	buffer.RasterizeBox(wall, world);
+	buffer.BuildHierarchy();
+
+	WorldBounds box = {};
+	box.Extents = XMFLOAT3(1.0f, 1.0f, 1.0f);
+	box.Radius = sqrtf(3.0f);
+	box.Center = XMFLOAT3(2.0f, 1.0f, 20.0f);
+	results.HidesBehindWall = !buffer.IsVisible(box);
+	box.Center = XMFLOAT3(2.0f, 1.0f, 5.0f);
+	results.ShowsInFront = buffer.IsVisible(box);
+	box.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	results.ShowsAcrossNearPlane = buffer.IsVisible(box);
+
+	// Only the left half of the screen covered, and a box behind it on the right
+	wall.Max.x = 0.0f;
+	buffer.Begin(view, projection);
+	buffer.RasterizeBox(wall, world);
+	buffer.BuildHierarchy();
+	box.Center = XMFLOAT3(10.0f, 0.0f, 20.0f);
+	results.ShowsBesideWall = buffer.IsVisible(box);
+
+	return results;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+#include "Frustum.h"
+
+// --------------------------------------------------------
+// A small depth buffer on the CPU, for throwing out objects
+// that are hidden behind big occluders before the GPU ever
+// sees them
+//
+// Each frame, Begin() clears it for a camera, the occluders
+// get rasterized into it with RasterizeOccluder() (or
+// RasterizeBox() for meshes that fill their bounds, like
+// walls and floors), and BuildHierarchy() makes a Hi-Z
+// chain where each texel of a level holds the furthest
+// depth of the four below it.  IsVisible() then projects an
+// object's box, picks the level where it covers a handful
+// of texels, and calls it hidden if its nearest point is
+// behind the furthest occluder in every one of them.
+//
+// The rasterizer walks each triangle's screen box four
+// pixels at a time with DirectXMath, testing pixel centers
+// against the edge functions and keeping the nearest depth,
+// after clipping the triangle against the near plane.
+// Depth is z / w, the same as the hardware depth buffer.
+//
+// Like any rasterizer that samples pixel centers, a sliver
+// of an object that peeks out less than a pixel past an
+// occluder's edge can be lost, so keep the resolution up
+// if that matters.  Everything else errs towards visible.
+// --------------------------------------------------------
+class OcclusionBuffer
+{
+public:
+	/// <summary>
+	/// Makes a buffer with room for the given resolution. The width gets rounded up to a multiple of 4.
+	/// </summary>
+	OcclusionBuffer(unsigned int width, unsigned int height);
+
+	/// <summary>
+	/// Clears the depth to the far plane and sets the camera for everything after it
+	/// </summary>
+	void Begin(const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& projection);
+
+	/// <summary>
+	/// Rasterizes an indexed triangle list into the depth buffer, four pixels at a time. Both sides of each triangle count.
+	/// </summary>
+	/// <param name="positions">In the occluder's own space</param>
+	/// <param name="indices">Three per triangle</param>
+	void RasterizeOccluder(const DirectX::XMFLOAT3* positions, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, const DirectX::XMFLOAT4X4& world);
+
+	/// <summary>
+	/// Same as RasterizeOccluder(), one pixel at a time, for checking and timing it against
+	/// </summary>
+	void RasterizeOccluderScalar(const DirectX::XMFLOAT3* positions, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, const DirectX::XMFLOAT4X4& world);
+
+	/// <summary>
+	/// Rasterizes the box of a mesh's bounds. Only right for meshes that fill their box, or it hides things it shouldn't.
+	/// </summary>
+	void RasterizeBox(const MeshBounds& bounds, const DirectX::XMFLOAT4X4& world);
+
+	/// <summary>
+	/// Builds the rest of the Hi-Z chain from the rasterized depth. Call after the occluders and before IsVisible().
+	/// </summary>
+	void BuildHierarchy();
+
+	/// <summary>
+	/// Tests world space bounds against the Hi-Z chain
+	/// </summary>
+	/// <param name="coarsestLevel">The highest level it's allowed to use. 0 tests every pixel the bounds cover.</param>
+	/// <returns>False only if the bounds are entirely behind occluders</returns>
+	bool IsVisible(const WorldBounds& bounds, unsigned int coarsestLevel = 0xFFFFFFFF);
+
+	unsigned int GetWidth();
+	unsigned int GetHeight();
+	unsigned int GetLevelCount();
+	unsigned int GetLevelWidth(unsigned int level);
+	unsigned int GetLevelHeight(unsigned int level);
+
+	/// <summary>
+	/// Gets a level's depth values, row by row, GetLevelWidth() to a row. Level 0 is the rasterized depth.
+	/// </summary>
+	const float* GetDepth(unsigned int level);
+
+private:
+
+	void Rasterize(const DirectX::XMFLOAT3* positions, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, const DirectX::XMFLOAT4X4& world, bool simd);
+
+	// Screen space x and y in pixels, and z / w for depth
+	void DrawTriangle(const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b, const DirectX::XMFLOAT3& c, bool simd);
+
+	unsigned int width;
+	unsigned int height;
+
+	// Level 0 is full size, and each one after it is half the size of the last, rounded up
+	std::vector<std::vector<float>> levels;
+	std::vector<unsigned int> levelWidths;
+	std::vector<unsigned int> levelHeights;
+
+	DirectX::XMFLOAT4X4 viewProjection;
+
+	// Clip space positions of the occluder being rasterized
+	std::vector<DirectX::XMFLOAT4> clipPositions;
+};
+
+// Results of rasterizing walls in front of a camera and testing lots of objects behind them
+struct OcclusionBenchmark
+{
+	unsigned int Width;					// Resolution of the depth buffer
+	unsigned int Height;
+	unsigned int OccluderTriangles;		// How many triangles were rasterized
+	double RasterMilliseconds;			// RasterizeOccluder() for every occluder
+	double ScalarRasterMilliseconds;	// RasterizeOccluderScalar() for every occluder
+	unsigned int PixelsDifferent;		// Pixels where the two rasterizers disagree (should be 0)
+	double HierarchyMilliseconds;		// BuildHierarchy()
+	unsigned int ObjectCount;			// How many objects were tested
+	unsigned int HiddenCount;			// How many IsVisible() said were hidden
+	double TestMilliseconds;			// IsVisible() for every object
+	bool Conservative;					// Everything hidden was also hidden at full resolution
+};
+
+/// <summary>
+/// Rasterizes random walls in front of a camera both ways, then tests objects scattered around behind them
+/// </summary>
+/// <param name="repeats">How many times to time each step (the fastest one counts)</param>
+OcclusionBenchmark BenchmarkOcclusionCulling(unsigned int width, unsigned int height, unsigned int occluderCount, unsigned int objectCount, int repeats);
+
+// Results of rasterizing made up scenes and comparing them with images worked out pixel by pixel
+struct OcclusionChecks
+{
+	unsigned int PixelsCompared;	// Pixels checked against the ray cast reference, leaving out any whose center is right on an edge
+	unsigned int PixelsDifferent;	// ...where the rasterized depth is more than a float's rounding away from the reference
+	bool MatchesReference;			// No pixel differs, and hardly any were left out
+	bool ScalarMatches;				// RasterizeOccluderScalar() makes exactly the same image as RasterizeOccluder()
+	bool HierarchyFurthest;			// Every Hi-Z texel is the furthest of the texels below it
+	bool HidesBehindWall;			// A box right behind a wall that fills the screen is hidden
+	bool ShowsInFront;				// ...and one in front of it isn't
+	bool ShowsBesideWall;			// A box behind a wall that only covers half the screen, on the other half, isn't hidden
+	bool ShowsAcrossNearPlane;		// A box reaching behind the camera isn't hidden
+};
+
+/// <summary>
+/// Rasterizes random triangles, some of them cut by the near plane, and compares the depth with a
+/// ray cast through every pixel center, then checks the Hi-Z chain and IsVisible() against a few walls
+/// </summary>
+/// <param name="triangleCount">How many random triangles to rasterize</param>
+OcclusionChecks CheckOcclusionBuffer(unsigned int triangleCount);
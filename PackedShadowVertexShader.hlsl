@@ -0,0 +1,3 @@
+// ShadowVertexShader.hlsl, but reading PackedVertex data instead of Vertex data
+#define PACKED_VERTICES
+#include "ShadowVertexShader.hlsl"
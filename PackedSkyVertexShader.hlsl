@@ -0,0 +1,3 @@
+// SkyVertexShader.hlsl, but reading PackedVertex data instead of Vertex data
+#define PACKED_VERTICES
+#include "SkyVertexShader.hlsl"
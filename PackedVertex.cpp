@@ -0,0 +1,183 @@
+#include "PackedVertex.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	const float UNORM16_MAX = 65535.0f;
+	const float SNORM16_MAX = 32767.0f;
+	const float RADIANS_TO_DEGREES = 57.2957795f;
+
+	float InverseOrZero(float value)
+	{
+		return value > 0.0f ? 1.0f / value : 0.0f;
+	}
+
+	unsigned short QuantizeUnorm16(float value)
+	{
+		value = std::min(std::max(value, 0.0f), 1.0f);
+		return (unsigned short)(value * UNORM16_MAX + 0.5f);
+	}
+
+	short QuantizeSnorm16(float value)
+	{
+		value = std::min(std::max(value, -1.0f), 1.0f);
+		return (short)std::lround(value * SNORM16_MAX);
+	}
+
+	// Matches how the input assembler reads SNORM (both -32768 and -32767 are -1)
+	float DequantizeSnorm16(short value)
+	{
+		return std::max(value / SNORM16_MAX, -1.0f);
+	}
+
+	float SignNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	// Projects the direction onto an octahedron, then unfolds the bottom half
+	// over the corners of the top half so the whole thing fits in a square
+	void OctahedralEncode(const XMFLOAT3& direction, short encoded[2])
+	{
+		float sum = fabsf(direction.x) + fabsf(direction.y) + fabsf(direction.z);
+		if (sum == 0.0f)
+		{
+			encoded[0] = encoded[1] = 0;
+			return;
+		}
+
+		float x = direction.x / sum;
+		float y = direction.y / sum;
+		if (direction.z < 0.0f)
+		{
+			float foldedX = (1.0f - fabsf(y)) * SignNotZero(x);
+			float foldedY = (1.0f - fabsf(x)) * SignNotZero(y);
+			x = foldedX;
+			y = foldedY;
+		}
+
+		encoded[0] = QuantizeSnorm16(x);
+		encoded[1] = QuantizeSnorm16(y);
+	}
+
+	// Same math as OctahedralDecode() in ShaderIncludes.hlsli
+	XMFLOAT3 OctahedralDecode(const short encoded[2])
+	{
+		float x = DequantizeSnorm16(encoded[0]);
+		float y = DequantizeSnorm16(encoded[1]);
+		float z = 1.0f - fabsf(x) - fabsf(y);
+
+		float fold = std::max(-z, 0.0f);
+		x += x >= 0.0f ? -fold : fold;
+		y += y >= 0.0f ? -fold : fold;
+
+		XMFLOAT3 direction;
+		XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSet(x, y, z, 0)));
+		return direction;
+	}
+
+	float AngleBetweenDegrees(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		XMVECTOR first = XMLoadFloat3(&a);
+		XMVECTOR second = XMLoadFloat3(&b);
+
+		// Zero length directions (like the tangents of a mesh with no UVs) have no angle
+		if (XMVectorGetX(XMVector3LengthSq(first)) == 0.0f)
+			return 0.0f;
+
+		// atan2 instead of acos, which can't tell apart angles this small in single precision
+		float sine = XMVectorGetX(XMVector3Length(XMVector3Cross(first, second)));
+		float cosine = XMVectorGetX(XMVector3Dot(first, second));
+		return atan2f(sine, cosine) * RADIANS_TO_DEGREES;
+	}
+}
+
+PackedVertexRange GetPackedVertexRange(const Vertex* vertices, int numberOfVertices)
+{
+	PackedVertexRange range = {};
+	if (numberOfVertices <= 0)
+		return range;
+
+	XMFLOAT3 positionMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 positionMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	XMFLOAT2 uvMin(FLT_MAX, FLT_MAX);
+	XMFLOAT2 uvMax(-FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < numberOfVertices; i++)
+	{
+		const Vertex& v = vertices[i];
+		positionMin = XMFLOAT3(std::min(positionMin.x, v.Position.x), std::min(positionMin.y, v.Position.y), std::min(positionMin.z, v.Position.z));
+		positionMax = XMFLOAT3(std::max(positionMax.x, v.Position.x), std::max(positionMax.y, v.Position.y), std::max(positionMax.z, v.Position.z));
+		uvMin = XMFLOAT2(std::min(uvMin.x, v.UV.x), std::min(uvMin.y, v.UV.y));
+		uvMax = XMFLOAT2(std::max(uvMax.x, v.UV.x), std::max(uvMax.y, v.UV.y));
+	}
+
+	range.PositionOffset = positionMin;
+	range.PositionScale = XMFLOAT3(positionMax.x - positionMin.x, positionMax.y - positionMin.y, positionMax.z - positionMin.z);
+	range.UVOffset = uvMin;
+	range.UVScale = XMFLOAT2(uvMax.x - uvMin.x, uvMax.y - uvMin.y);
+	return range;
+}
+
+void PackVertices(const Vertex* vertices, int numberOfVertices, const PackedVertexRange& range, PackedVertex* packed)
+{
+	// Flat axes (like the y of a quad) have no scale, so everything on them packs to 0
+	float inverseScale[5] = {
+		InverseOrZero(range.PositionScale.x),
+		InverseOrZero(range.PositionScale.y),
+		InverseOrZero(range.PositionScale.z),
+		InverseOrZero(range.UVScale.x),
+		InverseOrZero(range.UVScale.y),
+	};
+
+	for (int i = 0; i < numberOfVertices; i++)
+	{
+		const Vertex& v = vertices[i];
+		PackedVertex& p = packed[i];
+
+		p.Position[0] = QuantizeUnorm16((v.Position.x - range.PositionOffset.x) * inverseScale[0]);
+		p.Position[1] = QuantizeUnorm16((v.Position.y - range.PositionOffset.y) * inverseScale[1]);
+		p.Position[2] = QuantizeUnorm16((v.Position.z - range.PositionOffset.z) * inverseScale[2]);
+		p.Position[3] = 0;
+
+		OctahedralEncode(v.Normal, p.Normal);
+		OctahedralEncode(v.Tangent, p.Tangent);
+
+		p.UV[0] = QuantizeUnorm16((v.UV.x - range.UVOffset.x) * inverseScale[3]);
+		p.UV[1] = QuantizeUnorm16((v.UV.y - range.UVOffset.y) * inverseScale[4]);
+	}
+}
+
+Vertex UnpackVertex(const PackedVertex& packed, const PackedVertexRange& range)
+{
+	Vertex v = {};
+	v.Position.x = range.PositionOffset.x + packed.Position[0] / UNORM16_MAX * range.PositionScale.x;
+	v.Position.y = range.PositionOffset.y + packed.Position[1] / UNORM16_MAX * range.PositionScale.y;
+	v.Position.z = range.PositionOffset.z + packed.Position[2] / UNORM16_MAX * range.PositionScale.z;
+	v.Normal = OctahedralDecode(packed.Normal);
+	v.Tangent = OctahedralDecode(packed.Tangent);
+	v.UV.x = range.UVOffset.x + packed.UV[0] / UNORM16_MAX * range.UVScale.x;
+	v.UV.y = range.UVOffset.y + packed.UV[1] / UNORM16_MAX * range.UVScale.y;
+	return v;
+}
+
+PackedVertexError MeasurePackingError(const Vertex* vertices, const PackedVertex* packed, int numberOfVertices, const PackedVertexRange& range)
+{
+	PackedVertexError error = {};
+	for (int i = 0; i < numberOfVertices; i++)
+	{
+		const Vertex& original = vertices[i];
+		Vertex decoded = UnpackVertex(packed[i], range);
+
+		XMVECTOR positionDelta = XMLoadFloat3(&original.Position) - XMLoadFloat3(&decoded.Position);
+		error.Position = std::max(error.Position, XMVectorGetX(XMVector3Length(positionDelta)));
+		error.NormalDegrees = std::max(error.NormalDegrees, AngleBetweenDegrees(original.Normal, decoded.Normal));
+		error.TangentDegrees = std::max(error.TangentDegrees, AngleBetweenDegrees(original.Tangent, decoded.Tangent));
+		error.UV = std::max(error.UV, std::max(fabsf(original.UV.x - decoded.UV.x), fabsf(original.UV.y - decoded.UV.y)));
+	}
+	return error;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include "Vertex.h"
+
+// --------------------------------------------------------
+// A compressed alternative to Vertex: 20 bytes instead of 44
+//
+// - Position is 16 bit UNORM within the mesh's bounding box
+// - Normal and tangent are octahedral encoded into 16 bit SNORM pairs
+// - UV is 16 bit UNORM within the mesh's UV range. Half floats were
+//   the first try, but they're off by up to 0.007 on the helix,
+//   whose UVs tile up to 20.
+//
+// The matching input layout is R16G16B16A16_UNORM, R16G16_SNORM,
+// R16G16_SNORM and R16G16_UNORM, and UnpackVertex() in
+// ShaderIncludes.hlsli turns it back into a VertexShaderInput.
+// --------------------------------------------------------
+struct PackedVertex
+{
+	unsigned short Position[4];	// xyz within the bounds, w is unused padding
+	short Normal[2];			// Octahedral encoded normal
+	short Tangent[2];			// Octahedral encoded tangent
+	unsigned short UV[2];		// uv within the UV range
+};
+
+// How to get real positions and UVs back from packed ones:
+// position = PositionOffset + unorm * PositionScale (and the same for UVs)
+struct PackedVertexRange
+{
+	DirectX::XMFLOAT3 PositionOffset;
+	DirectX::XMFLOAT3 PositionScale;
+	DirectX::XMFLOAT2 UVOffset;
+	DirectX::XMFLOAT2 UVScale;
+};
+
+// Largest differences between original vertices and what comes back out of the packed ones
+struct PackedVertexError
+{
+	float Position;			// In local space units
+	float NormalDegrees;	// Angle between the original and decoded normal
+	float TangentDegrees;	// Same for the tangent
+	float UV;				// In texture coordinate units
+};
+
+/// <summary>
+/// Finds the position and UV ranges that a set of vertices will be packed relative to
+/// </summary>
+/// <param name="vertices">The original vertices</param>
+/// <param name="numberOfVertices">How many there are</param>
+PackedVertexRange GetPackedVertexRange(const Vertex* vertices, int numberOfVertices);
+
+/// <summary>
+/// Compresses a set of vertices
+/// </summary>
+/// <param name="vertices">The original vertices</param>
+/// <param name="numberOfVertices">How many there are</param>
+/// <param name="range">From GetPackedVertexRange() with these vertices</param>
+/// <param name="packed">Where to put the packed vertices, with room for numberOfVertices of them</param>
+void PackVertices(const Vertex* vertices, int numberOfVertices, const PackedVertexRange& range, PackedVertex* packed);
+
+/// <summary>
+/// Decompresses one vertex exactly the way the vertex shaders do
+/// </summary>
+Vertex UnpackVertex(const PackedVertex& packed, const PackedVertexRange& range);
+
+/// <summary>
+/// Round trips every vertex and reports the worst error of each attribute
+/// </summary>
+PackedVertexError MeasurePackingError(const Vertex* vertices, const PackedVertex* packed, int numberOfVertices, const PackedVertexRange& range);
@@ -0,0 +1,3 @@
+// VertexShader.hlsl, but reading PackedVertex data instead of Vertex data
+#define PACKED_VERTICES
+#include "VertexShader.hlsl"
@@ -4,18 +4,110 @@ Texture2D T_Albedo : register(t0);
 Texture2D T_Normal : register(t1);
 Texture2D T_Roughness : register(t2);
 Texture2D T_Metalness : register(t3); // "t" registers for textures
-Texture2D ShadowMap : register(t4);
+Texture2DArray ShadowMap : register(t4); // One slice per cascade
+Texture2D ShadowAtlas : register(t5); // A tile per shadow view of every other light
+StructuredBuffer<Light> Lights : register(t6); // Every light in the scene
+StructuredBuffer<uint2> ClusterRanges : register(t7); // Offset and count into ClusterLights, per cluster
+StructuredBuffer<uint> ClusterLights : register(t8); // The lights that reach the whole view, then each cluster's lights
 SamplerState BasicSampler : register(s0); // "s" registers for samplers
 SamplerComparisonState ShadowSampler : register(s1);
 
+// Matches ShadowCascades.h
+#define SHADOW_CASCADE_COUNT 4
 
-cbuffer ExternalData : register(b0)
+// Matches ShadowAtlas.h
+#define MAX_SHADOW_ATLAS_VIEWS 32
+
+// Matches LightClusters.h
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+
+// The same for every object, set once per frame
+cbuffer PerFrame : register(b0)
 {
-    float4 colorTint;
     float3 cameraPosition;
+
+    // World space into each cascade's slice of the shadow map
+    matrix cascadeViewProjections[SHADOW_CASCADE_COUNT];
     
-    Light lights[5];
+    // How far along the camera's forward axis each cascade reaches
+    float4 cascadeSplits;
+
+    // Which light the cascades are for
+    int cascadedLight;
+
+    // World space into each atlas view's projection, and where its tile is
+    // in the atlas's UVs (offset in xy, size in zw). A light's views start
+    // at its ShadowIndex: one for a directional or spot light, six for a point.
+    matrix atlasViewProjections[MAX_SHADOW_ATLAS_VIEWS];
+    float4 atlasTiles[MAX_SHADOW_ATLAS_VIEWS];
+
+    // Clusters per pixel across and down in xy, then the depth the first
+    // slice ends at and slices per unit of log depth after it in zw
+    float4 clusterScale;
+
+    // How many lights at the start of ClusterLights reach every pixel
+    uint globalLightCount;
+}
+
+// Only uploaded when the material changes
+cbuffer PerMaterial : register(b1)
+{
+    float4 colorTint;
+}
+
+//Finds how lit a pixel is by the shadowed light, from whichever cascade covers it
+//viewDepth is how far it is along the camera's forward axis, which is what SV_POSITION.w holds
+float SampleCascadedShadow(float3 worldPos, float viewDepth)
+{
+    //past the last cascade there aren't any shadows
+    if (viewDepth > cascadeSplits[SHADOW_CASCADE_COUNT - 1])
+        return 1.0f;
+
+    int cascade = 0;
+    [unroll]
+    for (int i = 0; i < SHADOW_CASCADE_COUNT - 1; i++)
+        cascade += viewDepth > cascadeSplits[i] ? 1 : 0;
+
+    //the projections are orthographic, so there's no divide by w
+    float4 shadowMapPos = mul(cascadeViewProjections[cascade], float4(worldPos, 1.0f));
+    float2 shadowUV = shadowMapPos.xy * 0.5f + 0.5f;
+    shadowUV.y = 1 - shadowUV.y; // Flip the Y
+    return ShadowMap.SampleCmpLevelZero(ShadowSampler, float3(shadowUV, cascade), shadowMapPos.z).r;
+}
+
+//Finds how lit a pixel is from one view in the shadow atlas
+float SampleAtlasShadow(int view, float3 worldPos)
+{
+    float4 shadowMapPos = mul(atlasViewProjections[view], float4(worldPos, 1.0f));
+    shadowMapPos.xyz /= shadowMapPos.w;
+
+    //outside what the view covers there aren't any shadows
+    if (any(abs(shadowMapPos.xy) > 1.0f) || shadowMapPos.z > 1.0f)
+        return 1.0f;
+
+    float2 shadowUV = shadowMapPos.xy * 0.5f + 0.5f;
+    shadowUV.y = 1 - shadowUV.y; // Flip the Y
+
+    //half a texel in from the tile's edges, so filtering never reaches its neighbours
+    float width, height;
+    ShadowAtlas.GetDimensions(width, height);
+    float4 tile = atlasTiles[view];
+    float2 halfTexel = 0.5f / (tile.zw * float2(width, height));
+    shadowUV = tile.xy + clamp(shadowUV, halfTexel, 1.0f - halfTexel) * tile.zw;
+    return ShadowAtlas.SampleCmpLevelZero(ShadowSampler, shadowUV, shadowMapPos.z).r;
+}
 
+//Finds how lit a pixel is by a point light, from whichever of its six cube faces it's in
+float SamplePointShadow(Light light, float3 worldPos)
+{
+    //faces go +x, -x, +y, -y, +z, -z
+    float3 fromLight = worldPos - light.Position;
+    float3 size = abs(fromLight);
+    int face = size.x >= size.y && size.x >= size.z ? (fromLight.x > 0 ? 0 : 1) :
+        size.y >= size.z ? (fromLight.y > 0 ? 2 : 3) : (fromLight.z > 0 ? 4 : 5);
+    return SampleAtlasShadow(light.ShadowIndex + face, worldPos);
 }
 
 //Calculates all lighting data for a directional light for this pixel
@@ -59,6 +151,58 @@ float3 HandlePointLight(Light light, float3 camPos, float3 worldPos, float3 norm
     return (balancedDiff * surfaceColor + spec) * light.Intensity * light.Color * Attenuate(light, worldPos);
 }
 
+//Calculates how much of a spot light's cone a pixel is in: pow(cos(angle), SpotFalloff),
+//rescaled to reach 0 where that fades to 1%, the cone's edge in GetSpotLightAngle(),
+//so nothing past what LightClusters culls is lit at all
+float SpotAmount(Light light, float3 worldPos)
+{
+    if (light.SpotFalloff <= 0.0f)
+        return 1.0f;
+    float3 fromLight = normalize(worldPos - light.Position);
+    float amount = pow(saturate(dot(fromLight, light.Direction)), light.SpotFalloff);
+    return saturate((amount - 0.01f) / 0.99f);
+}
+
+//Calculates all lighting data for a spot light for this pixel: a point light, limited to its cone
+float3 HandleSpotLight(Light light, float3 camPos, float3 worldPos, float3 normal, float3 surfaceColor, float roughness, float metalness, float3 specColor)
+{
+    return SpotAmount(light, worldPos) * HandlePointLight(light, camPos, worldPos, normal, surfaceColor, roughness, metalness, specColor);
+}
+
+//Finds which cluster of LightClusters a pixel is in, the same way LightClusters::GetSlice() does for depth
+uint GetCluster(float4 screenPosition)
+{
+    uint2 tile = min(uint2(screenPosition.xy * clusterScale.xy), uint2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+    uint slice = screenPosition.w < clusterScale.z ? 0 :
+        min(1 + (uint)(log(screenPosition.w / clusterScale.z) * clusterScale.w), CLUSTER_COUNT_Z - 1);
+    return tile.x + CLUSTER_COUNT_X * (tile.y + CLUSTER_COUNT_Y * slice);
+}
+
+//Calculates all lighting data for one light in Lights for this pixel, shadows included
+float3 HandleLight(uint index, float cascadedShadow, float3 worldPos, float3 normal, float3 surfaceColor, float roughness, float metalness, float3 specColor)
+{
+    Light l = Lights[index];
+    l.Direction = normalize(l.Direction);
+
+    //one light has the cascades, and any others might have room in the atlas
+    float shadow = (int)index == cascadedLight ? cascadedShadow : 1.0f;
+    if (l.ShadowIndex >= 0)
+        shadow = l.Type == LIGHT_TYPE_POINT ? SamplePointShadow(l, worldPos) : SampleAtlasShadow(l.ShadowIndex, worldPos);
+
+    switch (l.Type)
+    {
+        case (LIGHT_TYPE_DIRECTIONAL):
+            return shadow * HandleDirectionalLight(l, cameraPosition, worldPos, normal, surfaceColor, roughness, metalness, specColor);
+
+        case (LIGHT_TYPE_POINT):
+            return shadow * HandlePointLight(l, cameraPosition, worldPos, normal, surfaceColor, roughness, metalness, specColor);
+
+        case (LIGHT_TYPE_SPOT):
+            return shadow * HandleSpotLight(l, cameraPosition, worldPos, normal, surfaceColor, roughness, metalness, specColor);
+    }
+    return float3(0, 0, 0);
+}
+
 
 // --------------------------------------------------------
 // The entry point (main method) for our pixel shader
@@ -71,15 +215,7 @@ float3 HandlePointLight(Light light, float3 camPos, float3 worldPos, float3 norm
 // --------------------------------------------------------
 float4 main(VertexToPixel input) : SV_TARGET
 {
-    // Perform the perspective divide (divide by W) ourselves
-    input.shadowMapPos /= input.shadowMapPos.w;
-    // Convert the normalized device coordinates to UVs for sampling
-    float2 shadowUV = input.shadowMapPos.xy * 0.5f + 0.5f;
-    shadowUV.y = 1 - shadowUV.y; // Flip the Y
-    // Grab the distances we need: light-to-pixel and closest-surface
-    float distToLight = input.shadowMapPos.z;
-    
-    float shadowAmount = ShadowMap.SampleCmpLevelZero(ShadowSampler, shadowUV, distToLight).r;
+    float shadowAmount = SampleCascadedShadow(input.worldPosition, input.screenPosition.w);
     
 	// Just return the input color
 	// - This color (like most values passing through the rasterizer) is 
@@ -113,24 +249,15 @@ float4 main(VertexToPixel input) : SV_TARGET
     
     float3 finalLighting = surfaceColor * float3(0, 0, 0);
     
-    //loop through our light array and calculate all lighting for this pixel
-    for (int i = 0; i < 5; i++)
-    {
-        Light l = lights[i];
-        l.Direction = normalize(l.Direction);
-        
-        switch (lights[i].Type)
-        {
-            case (LIGHT_TYPE_DIRECTIONAL):
-                finalLighting += (i == 0 ? shadowAmount : 1.0f) * HandleDirectionalLight(l, cameraPosition, input.worldPosition, input.normal, surfaceColor, roughness, metalness, specularColor);
-                break;
-            
-            case (LIGHT_TYPE_POINT):
-                finalLighting += HandlePointLight(l, cameraPosition, input.worldPosition, input.normal, surfaceColor, roughness, metalness, specularColor);
-                break;
-
-        }
-    }
+    //the lights that reach everything, like the sun
+    uint i;
+    for (i = 0; i < globalLightCount; i++)
+        finalLighting += HandleLight(ClusterLights[i], shadowAmount, input.worldPosition, input.normal, surfaceColor, roughness, metalness, specularColor);
+
+    //then only the lights that can reach this pixel's cluster
+    uint2 range = ClusterRanges[GetCluster(input.screenPosition)];
+    for (i = 0; i < range.y; i++)
+        finalLighting += HandleLight(ClusterLights[range.x + i], shadowAmount, input.worldPosition, input.normal, surfaceColor, roughness, metalness, specularColor);
     
     return float4(pow(finalLighting, 1.0f / 2.2f), 1);
 }
\ No newline at end of file
@@ -3,6 +3,7 @@ cbuffer ExternalData : register(b0)
     int blurRadius;
     float pixelWidth;
     float pixelHeight;
+    float2 blurDirection; // (1,0) to blur along rows, (0,1) along columns
 }
 
 
@@ -17,24 +18,22 @@ Texture2D Pixels : register(t0);
 SamplerState ClampSampler : register(s0);
 
 
+// One pass of a box blur: a box is separable, so a row of samples
+// and then a column of them over the result averages the same
+// (2r+1) x (2r+1) box as sampling all of it, with 2(2r+1) samples
+// instead of (2r+1)^2
 float4 main(VertexToPixel input) : SV_TARGET
 {
-// Track the total color and number of samples
+// How far apart samples are along the line
+    float2 step = blurDirection * float2(pixelWidth, pixelHeight);
+// Track the total color
     float4 total = 0;
-    int sampleCount = 0;
-// Loop through the "box"
-    for (int x = -blurRadius; x <= blurRadius; x++)
+// Loop along the line
+    for (int k = -blurRadius; k <= blurRadius; k++)
     {
-        for (int y = -blurRadius; y <= blurRadius; y++)
-        {
-// Calculate the uv for this sample
-            float2 uv = input.uv;
-            uv += float2(x * pixelWidth, y * pixelHeight);
 // Add this color to the running total
-            total += Pixels.Sample(ClampSampler, uv);
-            sampleCount++;
-        }
+        total += Pixels.Sample(ClampSampler, input.uv + step * k);
     }
 // Return the average
-    return total / sampleCount;
-}
\ No newline at end of file
+    return total / (2 * blurRadius + 1);
+}
@@ -0,0 +1,332 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+RenderQueue::RenderQueue()
+{
+}
+
+void RenderQueue::Clear()
+{
+	items.clear();
+}
+
+void RenderQueue::Reserve(unsigned int count)
+{
+	items.reserve(count);
+	scratch.reserve(count);
+}
+
+void RenderQueue::Add(unsigned int pass, unsigned int materialId, unsigned int meshId, float viewDepth, unsigned int index)
+{
+	items.push_back({ MakeKey(pass, materialId, meshId, viewDepth), index });
+}
+
+void RenderQueue::Sort()
+{
+	size_t count = items.size();
+	if (count < 2)
+		return;
+
+	// Count every byte of every key in one read, instead of one read per byte
+	unsigned int histograms[8][256] = {};
+	for (const RenderItem& item : items)
+	{
+		unsigned long long key = item.Key;
+		for (int b = 0; b < 8; b++)
+			histograms[b][(key >> (b * 8)) & 0xFF]++;
+	}
+
+	scratch.resize(count);
+	for (int b = 0; b < 8; b++)
+	{
+		// A byte every key shares can't change the order
+		unsigned int shift = b * 8;
+		if (histograms[b][(items[0].Key >> shift) & 0xFF] == count)
+			continue;
+
+		// Where each bucket starts
+		unsigned int offsets[256];
+		unsigned int total = 0;
+		for (int i = 0; i < 256; i++)
+		{
+			offsets[i] = total;
+			total += histograms[b][i];
+		}
+
+		// Scatter in order, which keeps the sort stable
+		for (const RenderItem& item : items)
+			scratch[offsets[(item.Key >> shift) & 0xFF]++] = item;
+
+		items.swap(scratch);
+	}
+}
+
+unsigned int RenderQueue::GetCount()
+{
+	return (unsigned int)items.size();
+}
+
+const RenderItem* RenderQueue::GetItems()
+{
+	return items.data();
+}
+
+void RenderQueue::GetPassRange(unsigned int pass, unsigned int& first, unsigned int& end)
+{
+	// Passes are the top of the key, so each one is a run of sorted items
+	unsigned long long passStart = (unsigned long long)pass << RENDER_KEY_PASS_SHIFT;
+	unsigned long long passEnd = (unsigned long long)(pass + 1) << RENDER_KEY_PASS_SHIFT;
+
+	auto lower = std::lower_bound(items.begin(), items.end(), passStart,
+		[](const RenderItem& item, unsigned long long key) { return item.Key < key; });
+	auto upper = pass >= 0xFF ? items.end() :
+		std::lower_bound(lower, items.end(), passEnd,
+			[](const RenderItem& item, unsigned long long key) { return item.Key < key; });
+
+	first = (unsigned int)(lower - items.begin());
+	end = (unsigned int)(upper - items.begin());
+}
+
+unsigned int RenderQueue::GetBatches(unsigned int pass, std::vector<RenderBatch>& batches)
+{
+	unsigned int first, end;
+	GetPassRange(pass, first, end);
+
+	// Everything above the depth has to match
+	size_t startCount = batches.size();
+	for (unsigned int i = first; i < end; i++)
+	{
+		if (i > first && (items[i].Key >> RENDER_KEY_DEPTH_BITS) == (items[i - 1].Key >> RENDER_KEY_DEPTH_BITS))
+			batches.back().Count++;
+		else
+			batches.push_back({ i, 1 });
+	}
+	return (unsigned int)(batches.size() - startCount);
+}
+
+unsigned long long RenderQueue::MakeKey(unsigned int pass, unsigned int materialId, unsigned int meshId, float viewDepth)
+{
+	return
+		((unsigned long long)(pass & 0xFF) << RENDER_KEY_PASS_SHIFT) |
+		((unsigned long long)(materialId & 0xFFFF) << RENDER_KEY_MATERIAL_SHIFT) |
+		((unsigned long long)(meshId & 0xFFFF) << RENDER_KEY_MESH_SHIFT) |
+		QuantizeDepth(viewDepth);
+}
+
+unsigned int RenderQueue::GetMaterialId(unsigned long long key)
+{
+	return (unsigned int)(key >> RENDER_KEY_MATERIAL_SHIFT) & 0xFFFF;
+}
+
+unsigned int RenderQueue::QuantizeDepth(float viewDepth)
+{
+	// Also catches NaN
+	if (!(viewDepth > 0.0f))
+		return 0;
+
+	// Positive floats sort the same as their bits, so the top bits
+	// (minus the sign) are a depth with more precision up close,
+	// and no near and far planes needed to squeeze it into range
+	unsigned int bits;
+	memcpy(&bits, &viewDepth, sizeof(bits));
+	return bits >> (31 - RENDER_KEY_DEPTH_BITS);
+}
+
+namespace
+{
+	// How many times an id changes from one item to the next
+	unsigned int CountChanges(const std::vector<RenderItem>& items, unsigned int shift, unsigned long long mask)
+	{
+		unsigned int changes = 0;
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			if (i == 0 || ((items[i].Key >> shift) & mask) != ((items[i - 1].Key >> shift) & mask))
+				changes++;
+		}
+		return changes;
+	}
+}
+
+RenderQueueBenchmark BenchmarkRenderQueue(unsigned int itemCount, unsigned int materialCount, unsigned int meshCount, int repeats)
+{
+	RenderQueueBenchmark results = {};
+	results.ItemCount = itemCount;
+
+	// A frame's worth of draws in no particular order, like entities in creation order
+	struct Draw
+	{
+		unsigned int Material;
+		unsigned int Mesh;
+		float Depth;
+	};
+	std::vector<Draw> draws(itemCount);
+	std::mt19937 random(15);
+	std::uniform_real_distribution<float> depths(0.1f, 500.0f);
+	for (Draw& draw : draws)
+	{
+		draw.Material = random() % materialCount;
+		draw.Mesh = random() % meshCount;
+		draw.Depth = depths(random);
+	}
+
+	RenderQueue queue;
+	queue.Reserve(itemCount);
+	std::vector<RenderItem> stdSorted(itemCount);
+
+	std::chrono::high_resolution_clock::duration bestRadix = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration bestStdSort = bestRadix;
+	for (int r = 0; r < repeats; r++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		queue.Clear();
+		for (unsigned int i = 0; i < itemCount; i++)
+			queue.Add(RENDER_PASS_OPAQUE, draws[i].Material, draws[i].Mesh, draws[i].Depth, i);
+		queue.Sort();
+		std::chrono::high_resolution_clock::time_point radixEnd = std::chrono::high_resolution_clock::now();
+
+		for (unsigned int i = 0; i < itemCount; i++)
+			stdSorted[i] = { RenderQueue::MakeKey(RENDER_PASS_OPAQUE, draws[i].Material, draws[i].Mesh, draws[i].Depth), i };
+		std::stable_sort(stdSorted.begin(), stdSorted.end(),
+			[](const RenderItem& a, const RenderItem& b) { return a.Key < b.Key; });
+		std::chrono::high_resolution_clock::time_point stdSortEnd = std::chrono::high_resolution_clock::now();
+
+		bestRadix = std::min(bestRadix, radixEnd - start);
+		bestStdSort = std::min(bestStdSort, stdSortEnd - radixEnd);
+	}
+
+	results.RadixMilliseconds = std::chrono::duration<double, std::milli>(bestRadix).count();
+	results.StdSortMilliseconds = std::chrono::duration<double, std::milli>(bestStdSort).count();
+
+	std::vector<RenderItem> sorted(queue.GetItems(), queue.GetItems() + queue.GetCount());
+	results.OrderMatches = sorted.size() == stdSorted.size();
+	for (size_t i = 0; results.OrderMatches && i < sorted.size(); i++)
+		results.OrderMatches = sorted[i].Key == stdSorted[i].Key && sorted[i].Index == stdSorted[i].Index;
+
+	// Same keys in the order they were added
+	std::vector<RenderItem> unsorted(itemCount);
+	for (unsigned int i = 0; i < itemCount; i++)
+		unsorted[i] = { RenderQueue::MakeKey(RENDER_PASS_OPAQUE, draws[i].Material, draws[i].Mesh, draws[i].Depth), i };
+
+	results.MaterialChangesUnsorted = CountChanges(unsorted, RENDER_KEY_MATERIAL_SHIFT, 0xFFFF);
+	results.MaterialChangesSorted = CountChanges(sorted, RENDER_KEY_MATERIAL_SHIFT, 0xFFFF);
+	results.MeshChangesUnsorted = CountChanges(unsorted, RENDER_KEY_MESH_SHIFT, 0xFFFF);
+	results.MeshChangesSorted = CountChanges(sorted, RENDER_KEY_MESH_SHIFT, 0xFFFF);
+	results.FewerChanges =
+		results.MaterialChangesSorted < results.MaterialChangesUnsorted &&
+		results.MeshChangesSorted < results.MeshChangesUnsorted;
+	return results;
+}
+
+InstanceBatchBenchmark BenchmarkInstanceBatching(unsigned int entityCount, unsigned int passCount, unsigned int materialCount, unsigned int meshCount, int repeats)
+{
+	InstanceBatchBenchmark results = {};
+	results.EntityCount = entityCount;
+	results.PassCount = passCount;
+	const unsigned int itemCount = entityCount * passCount;
+	results.UnbatchedDrawCalls = itemCount;
+
+	// Same sizes as an entity's InstanceData, and a mesh's DrawConstants
+	struct Instance
+	{
+		float Matrices[32];
+	};
+	struct Unpack
+	{
+		float Values[12];
+	};
+	struct Prop
+	{
+		unsigned int Material;
+		unsigned int Mesh;
+		float Depth;
+		Instance Data;
+	};
+	const unsigned int slotSize = 256;
+
+	std::vector<Prop> props(entityCount);
+	std::vector<Unpack> unpacks(meshCount);
+	std::mt19937 random(16);
+	std::uniform_real_distribution<float> values(0.1f, 500.0f);
+	for (Prop& prop : props)
+	{
+		prop.Material = random() % materialCount;
+		prop.Mesh = random() % meshCount;
+		prop.Depth = values(random);
+		for (float& f : prop.Data.Matrices)
+			f = values(random);
+	}
+	for (Unpack& unpack : unpacks)
+	{
+		for (float& f : unpack.Values)
+			f = values(random);
+	}
+
+	// Stand in for the mapped constant buffer ring and instance buffer
+	std::vector<unsigned char> slots((size_t)itemCount * slotSize);
+	std::vector<Instance> instances(itemCount);
+	RenderQueue queue;
+	queue.Reserve(itemCount);
+	std::vector<RenderBatch> batches;
+
+	// Everything in the main pass, and in every shadow view (one "material" each, like Game's cascades)
+	auto addAll = [&]()
+	{
+		for (unsigned int i = 0; i < entityCount; i++)
+			queue.Add(RENDER_PASS_OPAQUE, props[i].Material, props[i].Mesh, props[i].Depth, i);
+		for (unsigned int p = 1; p < passCount; p++)
+		{
+			for (unsigned int i = 0; i < entityCount; i++)
+				queue.Add(RENDER_PASS_SHADOW, p - 1, props[i].Mesh, props[i].Depth, i);
+		}
+	};
+
+	std::chrono::high_resolution_clock::duration bestUnbatched = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration bestBatched = bestUnbatched;
+	for (int r = 0; r < repeats; r++)
+	{
+		// A slot per entity per pass, each with its matrices and its mesh's unpack data
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		queue.Clear();
+		addAll();
+		queue.Sort();
+		const RenderItem* items = queue.GetItems();
+		for (unsigned int i = 0; i < itemCount; i++)
+		{
+			const Prop& prop = props[items[i].Index];
+			unsigned char* slot = &slots[(size_t)i * slotSize];
+			memcpy(slot, &prop.Data, sizeof(Instance));
+			memcpy(slot + sizeof(Instance), &unpacks[prop.Mesh], sizeof(Unpack));
+		}
+		std::chrono::high_resolution_clock::time_point unbatchedEnd = std::chrono::high_resolution_clock::now();
+
+		// Matrices packed together at each item's index, so an entity in
+		// several passes is written once for each, and a slot per batch for the unpack data
+		queue.Clear();
+		batches.clear();
+		addAll();
+		queue.Sort();
+		queue.GetBatches(RENDER_PASS_SHADOW, batches);
+		queue.GetBatches(RENDER_PASS_OPAQUE, batches);
+		items = queue.GetItems();
+		for (unsigned int i = 0; i < itemCount; i++)
+			instances[i] = props[items[i].Index].Data;
+		for (size_t b = 0; b < batches.size(); b++)
+			memcpy(&slots[b * slotSize], &unpacks[props[items[batches[b].FirstItem].Index].Mesh], sizeof(Unpack));
+		std::chrono::high_resolution_clock::time_point batchedEnd = std::chrono::high_resolution_clock::now();
+
+		bestUnbatched = std::min(bestUnbatched, unbatchedEnd - start);
+		bestBatched = std::min(bestBatched, batchedEnd - unbatchedEnd);
+	}
+
+	results.BatchedDrawCalls = (unsigned int)batches.size();
+	results.UnbatchedBytes = itemCount * slotSize;
+	results.BatchedBytes = itemCount * (unsigned int)sizeof(Instance) + results.BatchedDrawCalls * slotSize;
+	results.RepeatedInstanceBytes = (itemCount - entityCount) * (unsigned int)sizeof(Instance);
+	results.UnbatchedMilliseconds = std::chrono::duration<double, std::milli>(bestUnbatched).count();
+	results.BatchedMilliseconds = std::chrono::duration<double, std::milli>(bestBatched).count();
+	return results;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <vector>
+
+// Passes, in the order they're drawn
+#define RENDER_PASS_SHADOW 0
+#define RENDER_PASS_OPAQUE 1
+
+// Where each part of a sort key lives, from most to least important:
+// 8 bits of pass, 16 of material, 16 of mesh and 24 of view depth
+#define RENDER_KEY_PASS_SHIFT 56
+#define RENDER_KEY_MATERIAL_SHIFT 40
+#define RENDER_KEY_MESH_SHIFT 24
+#define RENDER_KEY_DEPTH_BITS 24
+
+// One draw waiting in a RenderQueue
+struct RenderItem
+{
+	unsigned long long Key;	// From RenderQueue::MakeKey()
+	unsigned int Index;		// Whatever the caller wants back, like an entity index
+};
+
+// A run of sorted items with the same pass, material and mesh, which can be one instanced draw
+struct RenderBatch
+{
+	unsigned int FirstItem;	// Index of the run's first item in GetItems()
+	unsigned int Count;		// How many items are in it
+};
+
+// --------------------------------------------------------
+// Puts draws in the order that changes the least state
+//
+// Each draw gets a 64-bit key built from its pass, material,
+// mesh and distance from the camera, so sorting the keys
+// groups everything by pass, then material, then mesh, and
+// draws each group front to back so the depth test can
+// throw out hidden pixels early.
+//
+// The keys get radix sorted a byte at a time, skipping bytes
+// every key shares (usually the pass and the top of the
+// material and mesh ids), which beats std::sort by a lot once
+// there are thousands of draws.  It's stable, so draws with
+// the same key stay in the order they were added.
+//
+// Nothing here touches D3D: fill it, sort it, then draw the
+// items of each pass in order.
+// --------------------------------------------------------
+class RenderQueue
+{
+public:
+	RenderQueue();
+
+	void Clear();
+	void Reserve(unsigned int count);
+
+	/// <summary>
+	/// Adds a draw. Ids only need to be the same for draws that share a material or mesh, and get cut to 16 bits.
+	/// </summary>
+	/// <param name="viewDepth">Distance in front of the camera (or light) this pass sees from, in any units</param>
+	/// <param name="index">Handed back in the sorted RenderItem</param>
+	void Add(unsigned int pass, unsigned int materialId, unsigned int meshId, float viewDepth, unsigned int index);
+
+	/// <summary>
+	/// Radix sorts everything added since the last Clear()
+	/// </summary>
+	void Sort();
+
+	unsigned int GetCount();
+	const RenderItem* GetItems();
+
+	/// <summary>
+	/// Finds the sorted items of one pass
+	/// </summary>
+	/// <param name="first">Index of the pass's first item</param>
+	/// <param name="end">One past its last item, which is the same as first if the pass is empty</param>
+	void GetPassRange(unsigned int pass, unsigned int& first, unsigned int& end);
+
+	/// <summary>
+	/// Splits the sorted items of one pass into runs that only differ by depth, so each can be drawn instanced
+	/// </summary>
+	/// <param name="batches">Gets the pass's batches added to the end, in order</param>
+	/// <returns>How many batches were added</returns>
+	unsigned int GetBatches(unsigned int pass, std::vector<RenderBatch>& batches);
+
+	static unsigned long long MakeKey(unsigned int pass, unsigned int materialId, unsigned int meshId, float viewDepth);
+
+	/// <summary>
+	/// Gets the 16 bit material id back out of a key, like to tell which group a batch belongs to
+	/// </summary>
+	static unsigned int GetMaterialId(unsigned long long key);
+
+	/// <summary>
+	/// Turns a depth into RENDER_KEY_DEPTH_BITS bits that sort the same way, with anything behind the viewer as 0
+	/// </summary>
+	static unsigned int QuantizeDepth(float viewDepth);
+
+private:
+	std::vector<RenderItem> items;
+	std::vector<RenderItem> scratch;
+};
+
+// Results of sorting a big made up frame both ways
+struct RenderQueueBenchmark
+{
+	unsigned int ItemCount;					// How many draws
+	double RadixMilliseconds;				// Building the keys and sorting them with RenderQueue
+	double StdSortMilliseconds;				// Building the same keys and sorting them with std::stable_sort
+	bool OrderMatches;						// Both should come out in exactly the same order
+	unsigned int MaterialChangesUnsorted;	// Times the material changes from one draw to the next, in the order they were added
+	unsigned int MaterialChangesSorted;		// ...and after sorting
+	unsigned int MeshChangesUnsorted;		// Same for meshes
+	unsigned int MeshChangesSorted;
+	bool FewerChanges;						// Sorting cut both the material and the mesh changes
+};
+
+/// <summary>
+/// Sorts a frame of draws with random materials, meshes and depths, and counts the state changes before and after
+/// </summary>
+/// <param name="itemCount">How many draws</param>
+/// <param name="materialCount">How many different materials they use</param>
+/// <param name="meshCount">How many different meshes they use</param>
+/// <param name="repeats">How many times to sort each way (the fastest one counts)</param>
+RenderQueueBenchmark BenchmarkRenderQueue(unsigned int itemCount, unsigned int materialCount, unsigned int meshCount, int repeats);
+
+// Results of preparing a frame of repeated props for drawing, one at a time and batched
+struct InstanceBatchBenchmark
+{
+	unsigned int EntityCount;			// How many entities
+	unsigned int PassCount;				// How many passes each one is drawn in
+	unsigned int UnbatchedDrawCalls;	// One per entity per pass
+	unsigned int BatchedDrawCalls;		// One per material and mesh pair per pass
+	unsigned int UnbatchedBytes;		// Written per frame one at a time: a 256 byte constant buffer slot per entity per pass
+	unsigned int BatchedBytes;			// ...and batched: InstanceData per entity per pass, plus a slot per batch
+	unsigned int RepeatedInstanceBytes;	// How much of BatchedBytes is the same InstanceData again for the second pass on
+	double UnbatchedMilliseconds;		// Sorting, then writing each entity's world matrices and unpack data into its own slot
+	double BatchedMilliseconds;			// Sorting, batching, then writing each entity's InstanceData and each batch's slot
+};
+
+/// <summary>
+/// Times the CPU side of instancing: sorting entities into batches and writing their instance data,
+/// against sorting them and writing a constant buffer slot for each one.  Like Game::Draw(), every
+/// pass gets its own copy of each entity's InstanceData, so the bytes saved don't grow with passes
+/// </summary>
+/// <param name="entityCount">How many entities</param>
+/// <param name="passCount">How many passes draw every entity: the main one, then a shadow view for each one after that</param>
+/// <param name="materialCount">How many different materials they use</param>
+/// <param name="meshCount">How many different meshes they use</param>
+/// <param name="repeats">How many frames to prepare each way (the fastest one counts)</param>
+InstanceBatchBenchmark BenchmarkInstanceBatching(unsigned int entityCount, unsigned int passCount, unsigned int materialCount, unsigned int meshCount, int repeats);
@@ -0,0 +1,374 @@
+#include "RenderStateCache.h"
+
+RenderStateCache::RenderStateCache(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+{
+	this->context = context;
+
+	// Only needed for binding part of a constant buffer, so it's fine if this fails
+	context.As(&context1);
+
+	Invalidate();
+}
+
+void RenderStateCache::Invalidate()
+{
+	inputLayout.Known = false;
+	topology.Known = false;
+	for (auto& vb : vertexBuffers) vb.Known = false;
+	indexBuffer.Known = false;
+
+	vertexShader.Known = false;
+	pixelShader.Known = false;
+
+	for (StageState* stage : { &vertexStage, &pixelStage })
+	{
+		for (auto& cb : stage->ConstantBuffers) cb.Known = false;
+		for (auto& sampler : stage->Samplers) sampler.Known = false;
+		ForgetShaderResources(*stage);
+	}
+
+	rasterizerState.Known = false;
+	depthStencilState.Known = false;
+}
+
+void RenderStateCache::IASetInputLayout(ID3D11InputLayout* inputLayout)
+{
+	if (Changed(this->inputLayout, inputLayout, stats.InputAssembler))
+		context->IASetInputLayout(inputLayout);
+}
+
+void RenderStateCache::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+	if (Changed(this->topology, topology, stats.InputAssembler))
+		context->IASetPrimitiveTopology(topology);
+}
+
+void RenderStateCache::IASetVertexBuffer(unsigned int slot, ID3D11Buffer* buffer, unsigned int stride, unsigned int offset)
+{
+	if (slot >= D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT ||
+		Changed(vertexBuffers[slot], { buffer, stride, offset }, stats.InputAssembler))
+		context->IASetVertexBuffers(slot, 1, &buffer, &stride, &offset);
+}
+
+void RenderStateCache::IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, unsigned int offset)
+{
+	if (Changed(indexBuffer, { buffer, (unsigned int)format, offset }, stats.InputAssembler))
+		context->IASetIndexBuffer(buffer, format, offset);
+}
+
+void RenderStateCache::VSSetShader(ID3D11VertexShader* shader)
+{
+	if (Changed(vertexShader, shader, stats.Shaders))
+		context->VSSetShader(shader, 0, 0);
+}
+
+void RenderStateCache::PSSetShader(ID3D11PixelShader* shader)
+{
+	if (Changed(pixelShader, shader, stats.Shaders))
+		context->PSSetShader(shader, 0, 0);
+}
+
+void RenderStateCache::VSSetConstantBuffer(unsigned int slot, ID3D11Buffer* buffer, unsigned int firstConstant, unsigned int numConstants)
+{
+	if (!SetConstantBuffer(vertexStage, slot, buffer, firstConstant, numConstants))
+		return;
+
+	if (numConstants > 0 && context1)
+		context1->VSSetConstantBuffers1(slot, 1, &buffer, &firstConstant, &numConstants);
+	else
+		context->VSSetConstantBuffers(slot, 1, &buffer);
+}
+
+void RenderStateCache::PSSetConstantBuffer(unsigned int slot, ID3D11Buffer* buffer, unsigned int firstConstant, unsigned int numConstants)
+{
+	if (!SetConstantBuffer(pixelStage, slot, buffer, firstConstant, numConstants))
+		return;
+
+	if (numConstants > 0 && context1)
+		context1->PSSetConstantBuffers1(slot, 1, &buffer, &firstConstant, &numConstants);
+	else
+		context->PSSetConstantBuffers(slot, 1, &buffer);
+}
+
+void RenderStateCache::VSSetShaderResource(unsigned int slot, ID3D11ShaderResourceView* srv)
+{
+	if (SetShaderResource(vertexStage, slot, srv))
+		context->VSSetShaderResources(slot, 1, &srv);
+}
+
+void RenderStateCache::PSSetShaderResource(unsigned int slot, ID3D11ShaderResourceView* srv)
+{
+	if (SetShaderResource(pixelStage, slot, srv))
+		context->PSSetShaderResources(slot, 1, &srv);
+}
+
+void RenderStateCache::VSSetSampler(unsigned int slot, ID3D11SamplerState* sampler)
+{
+	if (slot >= RENDER_STATE_SAMPLER_SLOTS ||
+		Changed(vertexStage.Samplers[slot], sampler, stats.Samplers))
+		context->VSSetSamplers(slot, 1, &sampler);
+}
+
+void RenderStateCache::PSSetSampler(unsigned int slot, ID3D11SamplerState* sampler)
+{
+	if (slot >= RENDER_STATE_SAMPLER_SLOTS ||
+		Changed(pixelStage.Samplers[slot], sampler, stats.Samplers))
+		context->PSSetSamplers(slot, 1, &sampler);
+}
+
+void RenderStateCache::UnbindShaderResources()
+{
+	ID3D11ShaderResourceView* nullSRVs[RENDER_STATE_SHADER_RESOURCE_SLOTS] = {};
+
+	// Only as far as the highest slot that might have something in it,
+	// and not at all for a stage with nothing bound
+	if (vertexStage.ShaderResourceEnd > 0)
+	{
+		context->VSSetShaderResources(0, vertexStage.ShaderResourceEnd, nullSRVs);
+		stats.ShaderResources.Issued++;
+	}
+	else
+		stats.ShaderResources.Filtered++;
+
+	if (pixelStage.ShaderResourceEnd > 0)
+	{
+		context->PSSetShaderResources(0, pixelStage.ShaderResourceEnd, nullSRVs);
+		stats.ShaderResources.Issued++;
+	}
+	else
+		stats.ShaderResources.Filtered++;
+
+	for (StageState* stage : { &vertexStage, &pixelStage })
+	{
+		for (auto& srv : stage->ShaderResources)
+		{
+			srv.Value = 0;
+			srv.Known = true;
+		}
+		stage->ShaderResourceEnd = 0;
+	}
+}
+
+void RenderStateCache::RSSetState(ID3D11RasterizerState* state)
+{
+	if (Changed(rasterizerState, state, stats.States))
+		context->RSSetState(state);
+}
+
+void RenderStateCache::OMSetDepthStencilState(ID3D11DepthStencilState* state, unsigned int stencilRef)
+{
+	if (Changed(depthStencilState, { state, stencilRef }, stats.States))
+		context->OMSetDepthStencilState(state, stencilRef);
+}
+
+void RenderStateCache::OMSetRenderTargets(unsigned int count, ID3D11RenderTargetView* const* rtvs, ID3D11DepthStencilView* dsv)
+{
+	context->OMSetRenderTargets(count, rtvs, dsv);
+
+	// D3D unbinds any SRV of these textures for us, and there's
+	// no cheap way to tell which slots those were
+	ForgetShaderResources(vertexStage);
+	ForgetShaderResources(pixelStage);
+}
+
+Microsoft::WRL::ComPtr<ID3D11DeviceContext> RenderStateCache::GetContext()
+{
+	return context;
+}
+
+RenderStateStats RenderStateCache::GetStats()
+{
+	return stats;
+}
+
+void RenderStateCache::ResetStats()
+{
+	stats = RenderStateStats();
+}
+
+bool RenderStateCache::SetConstantBuffer(StageState& stage, unsigned int slot, ID3D11Buffer* buffer, unsigned int firstConstant, unsigned int numConstants)
+{
+	if (slot >= RENDER_STATE_CONSTANT_BUFFER_SLOTS)
+	{
+		stats.ConstantBuffers.Issued++;
+		return true;
+	}
+
+	return Changed(stage.ConstantBuffers[slot], { buffer, firstConstant, numConstants }, stats.ConstantBuffers);
+}
+
+bool RenderStateCache::SetShaderResource(StageState& stage, unsigned int slot, ID3D11ShaderResourceView* srv)
+{
+	if (slot >= RENDER_STATE_SHADER_RESOURCE_SLOTS)
+	{
+		stats.ShaderResources.Issued++;
+		return true;
+	}
+
+	if (!Changed(stage.ShaderResources[slot], srv, stats.ShaderResources))
+		return false;
+
+	if (srv && slot >= stage.ShaderResourceEnd)
+		stage.ShaderResourceEnd = slot + 1;
+	return true;
+}
+
+void RenderStateCache::ForgetShaderResources(StageState& stage)
+{
+	for (auto& srv : stage.ShaderResources) srv.Known = false;
+
+	// Anything could be bound as far as UnbindShaderResources() knows
+	stage.ShaderResourceEnd = RENDER_STATE_SHADER_RESOURCE_SLOTS;
+}
+
+RenderStateCacheChecks CheckRenderStateCache()
+{
+	RenderStateCacheChecks checks = {};
+
+	// WARP, since this runs before (and without) a window, and any adapter will do
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	HRESULT hr = D3D11CreateDevice(0, D3D_DRIVER_TYPE_WARP, 0, 0, 0, 0, D3D11_SDK_VERSION,
+		device.GetAddressOf(), 0, context.GetAddressOf());
+	if (FAILED(hr))
+		return checks;
+
+	// One of each kind of thing the cache remembers, and a second
+	// vertex and constant buffer to change to
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth = 256;
+	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> vertexBuffers[2];
+	Microsoft::WRL::ComPtr<ID3D11Buffer> constantBuffers[2];
+	for (int i = 0; i < 2; i++)
+	{
+		bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		device->CreateBuffer(&bufferDesc, 0, vertexBuffers[i].GetAddressOf());
+		bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		device->CreateBuffer(&bufferDesc, 0, constantBuffers[i].GetAddressOf());
+	}
+
+	D3D11_SAMPLER_DESC sampDesc = {};
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+	Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler;
+	device->CreateSamplerState(&sampDesc, sampler.GetAddressOf());
+
+	D3D11_RASTERIZER_DESC rastDesc = {};
+	rastDesc.FillMode = D3D11_FILL_SOLID;
+	rastDesc.CullMode = D3D11_CULL_NONE;
+	rastDesc.DepthClipEnable = true;
+	Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterizer;
+	device->CreateRasterizerState(&rastDesc, rasterizer.GetAddressOf());
+
+	// A texture that can be both read from and rendered into, like a post process target
+	D3D11_TEXTURE2D_DESC texDesc = {};
+	texDesc.Width = 16;
+	texDesc.Height = 16;
+	texDesc.MipLevels = 1;
+	texDesc.ArraySize = 1;
+	texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	texDesc.SampleDesc.Count = 1;
+	texDesc.Usage = D3D11_USAGE_DEFAULT;
+	texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv;
+	Microsoft::WRL::ComPtr<ID3D11RenderTargetView> rtv;
+	device->CreateTexture2D(&texDesc, 0, texture.GetAddressOf());
+	if (texture)
+	{
+		device->CreateShaderResourceView(texture.Get(), 0, srv.GetAddressOf());
+		device->CreateRenderTargetView(texture.Get(), 0, rtv.GetAddressOf());
+	}
+
+	if (!vertexBuffers[0] || !vertexBuffers[1] || !constantBuffers[0] || !constantBuffers[1] || !sampler || !rasterizer || !srv || !rtv)
+		return checks;
+	checks.DeviceCreated = true;
+
+	RenderStateCache cache(context);
+
+	// Everything a draw might set, which should all be issued the first time and filtered after that
+	auto setAll = [&](int buffers)
+	{
+		cache.IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		cache.IASetVertexBuffer(0, vertexBuffers[buffers].Get(), 16, 0);
+		cache.VSSetConstantBuffer(0, constantBuffers[buffers].Get());
+		cache.PSSetConstantBuffer(1, constantBuffers[buffers].Get());
+		cache.PSSetShaderResource(0, srv.Get());
+		cache.PSSetSampler(0, sampler.Get());
+		cache.RSSetState(rasterizer.Get());
+		cache.OMSetDepthStencilState(0, 0);
+	};
+	const unsigned int callsPerSet = 8;
+	checks.CallsPerSet = callsPerSet;
+
+	// The first time through everything's unknown
+	setAll(0);
+	RenderStateStats first = cache.GetStats();
+	unsigned int firstIssued = first.InputAssembler.Issued + first.ConstantBuffers.Issued + first.ShaderResources.Issued + first.Samplers.Issued + first.States.Issued;
+
+	// The same again, which should all be dropped
+	cache.ResetStats();
+	setAll(0);
+	RenderStateStats repeat = cache.GetStats();
+	unsigned int repeatIssued = repeat.InputAssembler.Issued + repeat.ConstantBuffers.Issued + repeat.ShaderResources.Issued + repeat.Samplers.Issued + repeat.States.Issued;
+	unsigned int repeatFiltered = repeat.InputAssembler.Filtered + repeat.ConstantBuffers.Filtered + repeat.ShaderResources.Filtered + repeat.Samplers.Filtered + repeat.States.Filtered;
+	checks.RepeatsFiltered = repeatFiltered;
+	checks.FiltersRepeats = firstIssued == callsPerSet && repeatIssued == 0 && repeatFiltered == callsPerSet;
+
+	// The other buffers, which changes the vertex buffer and both constant buffers and nothing else
+	cache.ResetStats();
+	setAll(1);
+	RenderStateStats change = cache.GetStats();
+	Microsoft::WRL::ComPtr<ID3D11Buffer> boundCB;
+	context->PSGetConstantBuffers(1, 1, boundCB.GetAddressOf());
+	checks.IssuesChanges =
+		change.InputAssembler.Issued == 1 &&
+		change.ConstantBuffers.Issued == 2 &&
+		change.ShaderResources.Filtered == 1 &&
+		change.Samplers.Filtered == 1 &&
+		change.States.Filtered == 2 &&
+		boundCB.Get() == constantBuffers[1].Get();
+
+	// Something behind the cache's back, like a resize, then Invalidate() and the same values again
+	ID3D11Buffer* nullBuffer = 0;
+	context->PSSetConstantBuffers(1, 1, &nullBuffer);
+	cache.Invalidate();
+	cache.ResetStats();
+	setAll(1);
+	RenderStateStats invalidated = cache.GetStats();
+	unsigned int invalidatedIssued = invalidated.InputAssembler.Issued + invalidated.ConstantBuffers.Issued + invalidated.ShaderResources.Issued + invalidated.Samplers.Issued + invalidated.States.Issued;
+	boundCB.Reset();
+	context->PSGetConstantBuffers(1, 1, boundCB.GetAddressOf());
+	checks.InvalidateReissues = invalidatedIssued == callsPerSet && boundCB.Get() == constantBuffers[1].Get();
+
+	// Render into the texture whose SRV is bound, which makes D3D unbind the SRV,
+	// then go back to the back buffer (here, nothing) and read from it again
+	cache.OMSetRenderTargets(1, rtv.GetAddressOf(), 0);
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> boundSRV;
+	context->PSGetShaderResources(0, 1, boundSRV.GetAddressOf());
+	bool unboundByTarget = !boundSRV;
+
+	cache.OMSetRenderTargets(0, 0, 0);
+	cache.ResetStats();
+	cache.PSSetShaderResource(0, srv.Get());
+	RenderStateStats rebind = cache.GetStats();
+	boundSRV.Reset();
+	context->PSGetShaderResources(0, 1, boundSRV.GetAddressOf());
+	checks.RenderTargetsForgetSRVs = unboundByTarget && rebind.ShaderResources.Issued == 1 && boundSRV.Get() == srv.Get();
+
+	// Unbinding twice, where the second time has nothing left to do
+	cache.ResetStats();
+	cache.UnbindShaderResources();
+	boundSRV.Reset();
+	context->PSGetShaderResources(0, 1, boundSRV.GetAddressOf());
+	bool unbound = !boundSRV;
+	cache.UnbindShaderResources();
+	RenderStateStats unbinds = cache.GetStats();
+	checks.UnbindClearsSRVs = unbound && unbinds.ShaderResources.Issued == 2 && unbinds.ShaderResources.Filtered == 2;
+
+	return checks;
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <d3d11_1.h>
+#include <wrl/client.h>
+
+// How many registers of each kind the cache keeps track of, per stage
+#define RENDER_STATE_CONSTANT_BUFFER_SLOTS D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT
+#define RENDER_STATE_SHADER_RESOURCE_SLOTS D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT
+#define RENDER_STATE_SAMPLER_SLOTS D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT
+
+// Calls that reached the device context, and calls dropped because they'd set what was already set
+struct RenderStateCount
+{
+	unsigned int Issued = 0;
+	unsigned int Filtered = 0;
+};
+
+// --------------------------------------------------------
+// Counts of state calls through a RenderStateCache
+// since the last ResetStats(), by kind of call
+// --------------------------------------------------------
+struct RenderStateStats
+{
+	RenderStateCount Shaders;			// VSSetShader(), PSSetShader()
+	RenderStateCount ConstantBuffers;	// VS/PSSetConstantBuffer(), including ConstantBufferRing slots
+	RenderStateCount ShaderResources;	// VS/PSSetShaderResource()
+	RenderStateCount Samplers;			// VS/PSSetSampler()
+	RenderStateCount InputAssembler;	// Input layout, topology, vertex and index buffers
+	RenderStateCount States;			// Rasterizer and depth stencil states
+};
+
+// --------------------------------------------------------
+// Sits between our code and the device context, and drops
+// any state call that would set what's already set
+//
+// Every shader, constant buffer, SRV, sampler, input
+// assembler and render state set through here is remembered
+// per stage and register, and only reaches the context if
+// it's different.  The cache can't see calls made straight
+// to the context, so:
+// - Anything that sets state behind its back (like a resize
+//   that rebinds the back buffer) should call Invalidate()
+//   afterwards, which makes the next call of every kind go
+//   through no matter what
+// - OMSetRenderTargets() goes through here too, since
+//   binding a texture as a target quietly unbinds it
+//   wherever it was an SRV
+//
+// Remembering raw pointers is safe, since the context holds
+// a reference to everything bound to it, so nothing the
+// cache thinks is bound can be freed and have its address
+// reused.
+// --------------------------------------------------------
+class RenderStateCache
+{
+public:
+	RenderStateCache(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
+
+	/// <summary>
+	/// Forgets everything, so the next call of every kind reaches the context
+	/// </summary>
+	void Invalidate();
+
+	// Input assembler
+	void IASetInputLayout(ID3D11InputLayout* inputLayout);
+	void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+	void IASetVertexBuffer(unsigned int slot, ID3D11Buffer* buffer, unsigned int stride, unsigned int offset);
+	void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, unsigned int offset);
+
+	// Shaders, with no class instances
+	void VSSetShader(ID3D11VertexShader* shader);
+	void PSSetShader(ID3D11PixelShader* shader);
+
+	/// <summary>
+	/// Binds a whole constant buffer, or with a constant count, part of one (which needs D3D11.1)
+	/// </summary>
+	/// <param name="firstConstant">Offset into the buffer, in 16 byte constants</param>
+	/// <param name="numConstants">Size in 16 byte constants, or 0 for the whole buffer</param>
+	void VSSetConstantBuffer(unsigned int slot, ID3D11Buffer* buffer, unsigned int firstConstant = 0, unsigned int numConstants = 0);
+	void PSSetConstantBuffer(unsigned int slot, ID3D11Buffer* buffer, unsigned int firstConstant = 0, unsigned int numConstants = 0);
+
+	void VSSetShaderResource(unsigned int slot, ID3D11ShaderResourceView* srv);
+	void PSSetShaderResource(unsigned int slot, ID3D11ShaderResourceView* srv);
+	void VSSetSampler(unsigned int slot, ID3D11SamplerState* sampler);
+	void PSSetSampler(unsigned int slot, ID3D11SamplerState* sampler);
+
+	/// <summary>
+	/// Unbinds every SRV from both stages in one call per stage, like before rendering into something that was just read from
+	/// </summary>
+	void UnbindShaderResources();
+
+	// Render states, where null is the default
+	void RSSetState(ID3D11RasterizerState* state);
+	void OMSetDepthStencilState(ID3D11DepthStencilState* state, unsigned int stencilRef);
+
+	/// <summary>
+	/// Always reaches the context, and forgets which SRVs are bound since any of them might be one of these targets
+	/// </summary>
+	void OMSetRenderTargets(unsigned int count, ID3D11RenderTargetView* const* rtvs, ID3D11DepthStencilView* dsv);
+
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> GetContext();
+
+	// Counting, like ISimpleShader::UploadStats
+	RenderStateStats GetStats();
+	void ResetStats();
+
+private:
+
+	// One remembered value, which isn't known after Invalidate()
+	template<typename T>
+	struct Cached
+	{
+		T Value;
+		bool Known;
+	};
+
+	struct ConstantBufferBinding
+	{
+		ID3D11Buffer* Buffer;
+		unsigned int FirstConstant;
+		unsigned int NumConstants;
+		bool operator==(const ConstantBufferBinding& other) const
+		{
+			return Buffer == other.Buffer && FirstConstant == other.FirstConstant && NumConstants == other.NumConstants;
+		}
+	};
+
+	struct BufferBinding
+	{
+		ID3D11Buffer* Buffer;
+		unsigned int Format;	// Stride for vertex buffers, DXGI_FORMAT for index buffers
+		unsigned int Offset;
+		bool operator==(const BufferBinding& other) const
+		{
+			return Buffer == other.Buffer && Format == other.Format && Offset == other.Offset;
+		}
+	};
+
+	struct DepthStencilBinding
+	{
+		ID3D11DepthStencilState* State;
+		unsigned int StencilRef;
+		bool operator==(const DepthStencilBinding& other) const
+		{
+			return State == other.State && StencilRef == other.StencilRef;
+		}
+	};
+
+	// Everything a stage has bound
+	struct StageState
+	{
+		Cached<ConstantBufferBinding> ConstantBuffers[RENDER_STATE_CONSTANT_BUFFER_SLOTS];
+		Cached<ID3D11ShaderResourceView*> ShaderResources[RENDER_STATE_SHADER_RESOURCE_SLOTS];
+		Cached<ID3D11SamplerState*> Samplers[RENDER_STATE_SAMPLER_SLOTS];
+
+		// One past the highest SRV slot that might not be null, for UnbindShaderResources()
+		unsigned int ShaderResourceEnd;
+	};
+
+	/// <summary>
+	/// Remembers the value and returns true if it's a change, counting the call either way
+	/// </summary>
+	template<typename T>
+	bool Changed(Cached<T>& cached, const T& value, RenderStateCount& count)
+	{
+		if (cached.Known && cached.Value == value)
+		{
+			count.Filtered++;
+			return false;
+		}
+
+		cached.Value = value;
+		cached.Known = true;
+		count.Issued++;
+		return true;
+	}
+
+	bool SetConstantBuffer(StageState& stage, unsigned int slot, ID3D11Buffer* buffer, unsigned int firstConstant, unsigned int numConstants);
+	bool SetShaderResource(StageState& stage, unsigned int slot, ID3D11ShaderResourceView* srv);
+	void ForgetShaderResources(StageState& stage);
+
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext1> context1;
+
+	Cached<ID3D11InputLayout*> inputLayout;
+	Cached<D3D11_PRIMITIVE_TOPOLOGY> topology;
+	Cached<BufferBinding> vertexBuffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	Cached<BufferBinding> indexBuffer;
+
+	Cached<ID3D11VertexShader*> vertexShader;
+	Cached<ID3D11PixelShader*> pixelShader;
+	StageState vertexStage;
+	StageState pixelStage;
+
+	Cached<ID3D11RasterizerState*> rasterizerState;
+	Cached<DepthStencilBinding> depthStencilState;
+
+	RenderStateStats stats;
+};
+
+// Results of running the same state calls through a RenderStateCache more than once, on a WARP device
+struct RenderStateCacheChecks
+{
+	bool DeviceCreated;				// Without a device there's nothing to check, and the rest are false
+	unsigned int CallsPerSet;		// State calls in one set of everything a draw binds
+	unsigned int RepeatsFiltered;	// How many of them were dropped the second time
+	bool FiltersRepeats;			// Setting the same constant buffers, SRV, sampler, input assembler and render states again reaches nothing
+	bool IssuesChanges;				// Setting something different always gets through
+	bool InvalidateReissues;		// After Invalidate() (like after a resize), the same values get through again
+	bool RenderTargetsForgetSRVs;	// A texture bound as a target loses its SRV, and setting that SRV again gets through and really rebinds it
+	bool UnbindClearsSRVs;			// UnbindShaderResources() leaves nothing bound, and is filtered per stage when there's nothing to unbind
+};
+
+/// <summary>
+/// Creates a WARP device and some small resources, and checks which calls through a RenderStateCache reach its context
+/// </summary>
+RenderStateCacheChecks CheckRenderStateCache();
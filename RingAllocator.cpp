@@ -0,0 +1,87 @@
+#include "RingAllocator.h"
+
+RingAllocator::RingAllocator(unsigned int size, unsigned int alignment)
+{
+	this->alignment = alignment;
+	Reset(size);
+}
+
+unsigned int RingAllocator::Allocate(unsigned int size)
+{
+	unsigned int alignedSize = (size + alignment - 1) / alignment * alignment;
+	if (alignedSize == 0 || alignedSize > this->size)
+		return RING_ALLOCATION_FAILED;
+
+	// With nothing in flight, start over at the beginning so a
+	// big allocation doesn't have to skip the end of the ring
+	if (used == 0)
+		head = 0;
+
+	// Skip to the start if this won't fit before the end
+	unsigned int skipped = 0;
+	if (head + alignedSize > this->size)
+		skipped = this->size - head;
+
+	// Everything from the oldest frame in flight to the head is
+	// still being read, so the rest is all there is to work with
+	if (used + skipped + alignedSize > this->size)
+		return RING_ALLOCATION_FAILED;
+
+	if (skipped > 0)
+	{
+		head = 0;
+		used += skipped;
+		currentFrameBytes += skipped;
+	}
+
+	unsigned int offset = head;
+	head += alignedSize;
+	if (head == this->size)
+		head = 0;
+	used += alignedSize;
+	currentFrameBytes += alignedSize;
+	return offset;
+}
+
+void RingAllocator::EndFrame(unsigned long long fence)
+{
+	Frame frame = {};
+	frame.Fence = fence;
+	frame.Bytes = currentFrameBytes;
+	framesInFlight.push_back(frame);
+	currentFrameBytes = 0;
+}
+
+void RingAllocator::Retire(unsigned long long completedFence)
+{
+	// Frames finish in order, so stop at the first one that hasn't
+	while (!framesInFlight.empty() && framesInFlight.front().Fence <= completedFence)
+	{
+		used -= framesInFlight.front().Bytes;
+		framesInFlight.pop_front();
+	}
+}
+
+void RingAllocator::Reset(unsigned int size)
+{
+	this->size = size / alignment * alignment;
+	head = 0;
+	used = 0;
+	currentFrameBytes = 0;
+	framesInFlight.clear();
+}
+
+unsigned int RingAllocator::GetSize()
+{
+	return size;
+}
+
+unsigned int RingAllocator::GetUsedBytes()
+{
+	return used;
+}
+
+unsigned int RingAllocator::GetFramesInFlight()
+{
+	return (unsigned int)framesInFlight.size();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <deque>
+
+// What RingAllocator::Allocate() returns when there's no room
+#define RING_ALLOCATION_FAILED 0xFFFFFFFF
+
+// --------------------------------------------------------
+// Hands out space in a fixed size ring, for data the GPU
+// reads a frame or two after the CPU writes it
+//
+// - Allocations come off the head and are never freed one
+//   at a time. EndFrame() tags everything allocated since
+//   the last call with a fence value, and Retire() frees
+//   whole frames once the GPU has passed their fence.
+// - An allocation never wraps around the end of the ring.
+//   The bytes it skips to get back to the start belong to
+//   the current frame and are freed along with it.
+// - Nothing here knows about Direct3D: ConstantBufferRing
+//   decides what the memory is and what a fence is, so this
+//   part can be tested on its own
+// --------------------------------------------------------
+class RingAllocator
+{
+public:
+	/// <summary>
+	/// Sets up an empty ring
+	/// </summary>
+	/// <param name="size">Total bytes in the ring</param>
+	/// <param name="alignment">Every allocation's offset and size are rounded up to a multiple of this</param>
+	RingAllocator(unsigned int size, unsigned int alignment);
+
+	/// <summary>
+	/// Takes space from the head of the ring for the current frame
+	/// </summary>
+	/// <returns>The offset of the space, or RING_ALLOCATION_FAILED if the frames still in flight leave no room</returns>
+	unsigned int Allocate(unsigned int size);
+
+	/// <summary>
+	/// Closes the current frame, so its space is freed by the first Retire() that reaches this fence
+	/// </summary>
+	/// <param name="fence">Fence values have to go up by at least one every frame</param>
+	void EndFrame(unsigned long long fence);
+
+	/// <summary>
+	/// Frees the space of every closed frame whose fence is at or below the given one
+	/// </summary>
+	void Retire(unsigned long long completedFence);
+
+	/// <summary>
+	/// Forgets every allocation and frame, like a brand new ring of the given size
+	/// </summary>
+	void Reset(unsigned int size);
+
+	unsigned int GetSize();
+	unsigned int GetUsedBytes();		// Everything not yet retired, including the current frame
+	unsigned int GetFramesInFlight();	// Closed frames not yet retired
+
+private:
+
+	struct Frame
+	{
+		unsigned long long Fence;
+		unsigned int Bytes;
+	};
+
+	unsigned int size;
+	unsigned int alignment;
+
+	unsigned int head;					// Where the next allocation starts
+	unsigned int used;					// Bytes from the oldest frame in flight up to the head
+	unsigned int currentFrameBytes;		// How much of that the current frame took
+	std::deque<Frame> framesInFlight;	// Oldest first
+};
@@ -0,0 +1,352 @@
+#include "ShaderBenchmark.h"
+#include "SimpleShader.h"
+#include "Mesh.h"
+#include "ConstantBufferRing.h"
+#include "RingAllocator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	// --------------------------------------------------------
+	// A shader with one constant buffer, declared variable by
+	// variable instead of reflected from compiled bytecode, so
+	// the setters can be timed without a device. Variables get
+	// the offsets reflection would report for the same cbuffer,
+	// and everything else asks the shader for them.
+	// --------------------------------------------------------
+	class BenchmarkShader : public ISimpleShader
+	{
+	public:
+		BenchmarkShader(std::string bufferName) : ISimpleShader(0, 0)
+		{
+			constantBufferCount = 1;
+			constantBuffers = new SimpleConstantBuffer[1];
+			constantBuffers[0].Name = bufferName;
+			constantBuffers[0].Size = 0;
+			constantBuffers[0].LocalDataBuffer = 0;
+			cbTable.insert(std::pair<std::string, SimpleConstantBuffer*>(constantBuffers[0].Name, &constantBuffers[0]));
+		}
+
+		~BenchmarkShader() { CleanUp(); }
+
+		// Follows HLSL's cbuffer packing: each variable goes right after the last one unless it
+		// would straddle a 16 byte register, and matrices, structs and arrays start a new register
+		void AddVariable(std::string name, unsigned int size, bool startsRegister = false)
+		{
+			unsigned int offset = variableEnd;
+			if (startsRegister || size > 16 || offset / 16 != (offset + size - 1) / 16)
+				offset = (offset + 15) & ~15u;
+
+			SimpleShaderVariable var = { offset, size, 0 };
+			varTable.insert(std::pair<std::string, SimpleShaderVariable>(name, var));
+			constantBuffers[0].Variables.push_back(var);
+			variableEnd = offset + size;
+		}
+
+		// Sizes the buffer to fit the variables, rounded up to a whole register like reflection does
+		void CreateLocalData()
+		{
+			constantBuffers[0].Size = (variableEnd + 15) & ~15u;
+			constantBuffers[0].LocalDataBuffer = new unsigned char[constantBuffers[0].Size];
+			memset(constantBuffers[0].LocalDataBuffer, 0, constantBuffers[0].Size);
+		}
+
+		unsigned char* GetLocalData() { return constantBuffers[0].LocalDataBuffer; }
+		unsigned int GetLocalDataSize() { return constantBuffers[0].Size; }
+		unsigned int GetOffset(std::string name) { return GetVariableInfo(name)->ByteOffset; }
+
+		// What CopyAllBufferData() does for each buffer, minus the device
+		void Upload() { UploadBuffer(&constantBuffers[0]); }
+		const SimpleConstantBuffer& GetBuffer() { return constantBuffers[0]; }
+
+		bool SetShaderResourceView(std::string name, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { return false; }
+		bool SetSamplerState(std::string name, Microsoft::WRL::ComPtr<ID3D11SamplerState> samplerState) { return false; }
+
+	protected:
+		bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob) { return false; }
+		void SetShaderAndCBs() {}
+
+	private:
+		unsigned int variableEnd = 0;
+	};
+
+	XMFLOAT4X4 MakeMatrix(float seed)
+	{
+		XMFLOAT4X4 matrix;
+		for (int i = 0; i < 16; i++)
+			matrix.m[i / 4][i % 4] = seed + i;
+		return matrix;
+	}
+}
+
+ShaderSetterBenchmark BenchmarkShaderSetters(unsigned int drawCount, int repeats)
+{
+	ShaderSetterBenchmark results = {};
+	results.DrawCount = drawCount;
+
+	// The PerDraw cbuffer in ObjectConstants.hlsli, in declaration order
+	BenchmarkShader vs("PerDraw");
+	vs.AddVariable("positionOffset", 12);
+	vs.AddVariable("positionScale", 12);
+	vs.AddVariable("uvOffset", 8);
+	vs.AddVariable("uvScale", 8);
+	vs.CreateLocalData();
+	const unsigned int bufferSize = vs.GetLocalDataSize();
+
+	// DrawConstants is copied into ring slots whole, so it has to be laid out exactly the way the shader reads it
+	bool layoutMatches =
+		bufferSize == sizeof(DrawConstants) &&
+		vs.GetOffset("positionOffset") == offsetof(DrawConstants, PositionOffset) &&
+		vs.GetOffset("positionScale") == offsetof(DrawConstants, PositionScale) &&
+		vs.GetOffset("uvOffset") == offsetof(DrawConstants, UVOffset) &&
+		vs.GetOffset("uvScale") == offsetof(DrawConstants, UVScale);
+
+	// Every draw gets its own mesh ranges, so no write is ever skipped as unchanged
+	std::vector<PackedVertexRange> ranges(drawCount);
+	for (unsigned int i = 0; i < drawCount; i++)
+	{
+		ranges[i].PositionOffset = XMFLOAT3((float)i, 2, 3);
+		ranges[i].PositionScale = XMFLOAT3(1, (float)i, 3);
+		ranges[i].UVOffset = XMFLOAT2((float)i, 0);
+		ranges[i].UVScale = XMFLOAT2(1, (float)i);
+	}
+
+	// Looked up once, like Mesh::GetUnpackHandles()
+	SimpleShaderVariableHandle positionOffsetHandle = vs.GetVariableHandle("positionOffset");
+	SimpleShaderVariableHandle positionScaleHandle = vs.GetVariableHandle("positionScale");
+	SimpleShaderVariableHandle uvOffsetHandle = vs.GetVariableHandle("uvOffset");
+	SimpleShaderVariableHandle uvScaleHandle = vs.GetVariableHandle("uvScale");
+
+	// The ring, over CPU memory standing in for the mapped buffer, big enough for a frame in flight and the one being written
+	RingAllocator ring(CONSTANT_BUFFER_RING_ALIGNMENT * drawCount * 2, CONSTANT_BUFFER_RING_ALIGNMENT);
+	std::vector<unsigned char> ringData(ring.GetSize());
+	unsigned long long fence = 0;
+
+	// What the last draw left behind each way, to check they all agree
+	std::vector<unsigned char> nameBytes, handleBytes, ringBytes;
+
+	std::chrono::high_resolution_clock::duration bestName = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration bestHandle = bestName;
+	std::chrono::high_resolution_clock::duration bestRing = bestName;
+	for (int r = 0; r < repeats; r++)
+	{
+		// By name into the shader's own copy of PerDraw, then a copy per draw (counted, since there's no device)
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (const PackedVertexRange& range : ranges)
+		{
+			vs.SetFloat3("positionOffset", range.PositionOffset);
+			vs.SetFloat3("positionScale", range.PositionScale);
+			vs.SetFloat2("uvOffset", range.UVOffset);
+			vs.SetFloat2("uvScale", range.UVScale);
+			vs.Upload();
+		}
+		std::chrono::high_resolution_clock::time_point nameEnd = std::chrono::high_resolution_clock::now();
+		nameBytes.assign(vs.GetLocalData(), vs.GetLocalData() + bufferSize);
+		memset(vs.GetLocalData(), 0, bufferSize);
+
+		// Through handles, like Mesh::SetUnpackData()
+		std::chrono::high_resolution_clock::time_point handleStart = std::chrono::high_resolution_clock::now();
+		for (const PackedVertexRange& range : ranges)
+		{
+			vs.SetFloat3(positionOffsetHandle, range.PositionOffset);
+			vs.SetFloat3(positionScaleHandle, range.PositionScale);
+			vs.SetFloat2(uvOffsetHandle, range.UVOffset);
+			vs.SetFloat2(uvScaleHandle, range.UVScale);
+			vs.Upload();
+		}
+		std::chrono::high_resolution_clock::time_point handleEnd = std::chrono::high_resolution_clock::now();
+		handleBytes.assign(vs.GetLocalData(), vs.GetLocalData() + bufferSize);
+		memset(vs.GetLocalData(), 0, bufferSize);
+
+		// A slot each and one write of the whole DrawConstants, like Mesh::WriteDrawConstants(),
+		// with the frame before this one retired the way ConstantBufferRing::BeginFrame() would
+		if (fence > 0)
+			ring.Retire(fence - 1);
+		unsigned int lastOffset = 0;
+		std::chrono::high_resolution_clock::time_point ringStart = std::chrono::high_resolution_clock::now();
+		for (const PackedVertexRange& range : ranges)
+		{
+			DrawConstants constants = {};
+			constants.PositionOffset = range.PositionOffset;
+			constants.PositionScale = range.PositionScale;
+			constants.UVOffset = range.UVOffset;
+			constants.UVScale = range.UVScale;
+
+			lastOffset = ring.Allocate(sizeof(DrawConstants));
+			memcpy(&ringData[lastOffset], &constants, sizeof(DrawConstants));
+		}
+		std::chrono::high_resolution_clock::time_point ringEnd = std::chrono::high_resolution_clock::now();
+		ring.EndFrame(++fence);
+		ringBytes.assign(ringData.begin() + lastOffset, ringData.begin() + lastOffset + sizeof(DrawConstants));
+
+		bestName = std::min(bestName, nameEnd - start);
+		bestHandle = std::min(bestHandle, handleEnd - handleStart);
+		bestRing = std::min(bestRing, ringEnd - ringStart);
+	}
+
+	results.NameNanoseconds = std::chrono::duration<double, std::nano>(bestName).count() / drawCount;
+	results.HandleNanoseconds = std::chrono::duration<double, std::nano>(bestHandle).count() / drawCount;
+	results.RingNanoseconds = std::chrono::duration<double, std::nano>(bestRing).count() / drawCount;
+	results.ResultsMatch = layoutMatches && nameBytes == handleBytes && handleBytes == ringBytes;
+	return results;
+}
+
+ConstantBufferUploadChecks CheckConstantBufferUploads()
+{
+	ConstantBufferUploadChecks results = {};
+
+	BenchmarkShader vs("ExternalData");
+	vs.AddVariable("worldMatrix", 64);
+	vs.AddVariable("positionOffset", 12);
+	vs.AddVariable("uvScale", 8);
+	vs.CreateLocalData();
+	SimpleShaderVariableHandle uvScaleHandle = vs.GetVariableHandle("uvScale");
+
+	XMFLOAT4X4 world = MakeMatrix(1.0f);
+	XMFLOAT3 positionOffset(1, 2, 3);
+	XMFLOAT2 uvScale(4, 5);
+	SimpleShaderUploadStats before, after;
+
+	ISimpleShader::ResetUploadStats();
+
+	// A buffer that still holds what it started with has nothing to send
+	vs.Upload();
+	results.SkipsUntouched = ISimpleShader::UploadStats.UploadsSkipped == 1 && ISimpleShader::UploadStats.UploadsIssued == 0;
+
+	// One variable changing uploads the buffer once, with only that variable dirty
+	before = ISimpleShader::UploadStats;
+	vs.SetMatrix4x4("worldMatrix", world);
+	vs.Upload();
+	after = ISimpleShader::UploadStats;
+	results.UploadsChange =
+		after.UploadsIssued == before.UploadsIssued + 1 &&
+		after.BytesChanged == before.BytesChanged + 64 &&
+		after.BytesUploaded == before.BytesUploaded + vs.GetLocalDataSize();
+
+	// ...after which it's in sync again, so another copy is skipped
+	before = after;
+	vs.Upload();
+	after = ISimpleShader::UploadStats;
+	results.SkipsAfterUpload = after.UploadsSkipped == before.UploadsSkipped + 1 && after.UploadsIssued == before.UploadsIssued;
+
+	// Setting a variable to what it already holds, by name or handle, doesn't dirty anything
+	before = after;
+	vs.SetMatrix4x4("worldMatrix", world);
+	vs.Upload();
+	vs.SetFloat2(uvScaleHandle, XMFLOAT2(0, 0));
+	vs.Upload();
+	after = ISimpleShader::UploadStats;
+	results.SkipsSameValues = after.UploadsSkipped == before.UploadsSkipped + 2 && after.UploadsIssued == before.UploadsIssued;
+
+	// Two variables apart grow one range from the start of the first to the end of the second
+	before = after;
+	vs.SetFloat2(uvScaleHandle, uvScale);
+	vs.SetFloat3("positionOffset", positionOffset);
+	unsigned int expectedStart = vs.GetOffset("positionOffset");
+	unsigned int expectedEnd = vs.GetOffset("uvScale") + 8;
+	results.RangeCoversBoth = vs.GetBuffer().DirtyStart == expectedStart && vs.GetBuffer().DirtyEnd == expectedEnd;
+	vs.Upload();
+	after = ISimpleShader::UploadStats;
+	results.RangeCoversBoth = results.RangeCoversBoth &&
+		after.UploadsIssued == before.UploadsIssued + 1 &&
+		after.BytesChanged == before.BytesChanged + (expectedEnd - expectedStart) &&
+		vs.GetBuffer().DirtyEnd <= vs.GetBuffer().DirtyStart;
+
+	results.UploadsIssued = ISimpleShader::UploadStats.UploadsIssued;
+	results.UploadsSkipped = ISimpleShader::UploadStats.UploadsSkipped;
+	ISimpleShader::ResetUploadStats();
+	return results;
+}
+
+RingAllocatorChecks CheckRingAllocator()
+{
+	RingAllocatorChecks results = {};
+
+	// Four slots, like a ring of constant buffer slots
+	const unsigned int slot = CONSTANT_BUFFER_RING_ALIGNMENT;
+	RingAllocator ring(slot * 4, slot);
+
+	// Offsets and sizes both get rounded up to whole slots
+	unsigned int first = ring.Allocate(40);
+	unsigned int second = ring.Allocate(slot + 44);
+	unsigned int third = ring.Allocate(1);
+	results.Aligned = first == 0 && second == slot && third == slot * 3 && ring.GetUsedBytes() == slot * 4;
+
+	// Full, so the frame can't take any more
+	results.RefusesWhenFull = ring.Allocate(1) == RING_ALLOCATION_FAILED;
+
+	// Nothing comes back until the GPU has passed the frame's fence
+	ring.EndFrame(1);
+	ring.Retire(0);
+	results.KeepsUnfinishedFrames = ring.GetUsedBytes() == slot * 4 && ring.GetFramesInFlight() == 1 && ring.Allocate(1) == RING_ALLOCATION_FAILED;
+	ring.Retire(1);
+	results.RetiresFinishedFrames = ring.GetUsedBytes() == 0 && ring.GetFramesInFlight() == 0;
+
+	// Fill the front half and the third slot over two frames, then free the first frame
+	ring.Allocate(slot * 2);
+	ring.EndFrame(2);
+	ring.Allocate(slot);
+	ring.EndFrame(3);
+	ring.Retire(2);
+
+	// Two slots don't fit after the head (the fourth slot) without running into the frame still
+	// in flight, so they go back to the start, and the skipped slot belongs to this frame
+	unsigned int wrapped = ring.Allocate(slot * 2);
+	ring.EndFrame(4);
+	results.WrapsToStart = wrapped == 0 && ring.GetUsedBytes() == slot * 4;
+
+	// ...and is freed along with it, not before
+	ring.Retire(3);
+	bool skippedHeld = ring.GetUsedBytes() == slot * 3;
+	ring.Retire(4);
+	results.SkippedBytesRetired = skippedHeld && ring.GetUsedBytes() == 0;
+
+	// Lots of frames of random sizes with the GPU two frames behind, checking
+	// that nothing handed out overlaps anything the GPU might still be reading
+	struct Allocation { unsigned long long Fence; unsigned int Offset, Size; };
+	std::deque<Allocation> live;
+	std::mt19937 random(13);
+	std::uniform_int_distribution<unsigned int> sizes(1, slot * 3);
+	std::uniform_int_distribution<unsigned int> counts(0, 6);
+	RingAllocator stress(slot * 16, slot);
+	results.NeverOverlaps = true;
+	for (unsigned long long frame = 1; frame <= 10000; frame++)
+	{
+		if (frame > 2)
+		{
+			stress.Retire(frame - 2);
+			while (!live.empty() && live.front().Fence <= frame - 2)
+				live.pop_front();
+		}
+
+		for (unsigned int n = counts(random); n > 0; n--)
+		{
+			unsigned int size = sizes(random);
+			unsigned int offset = stress.Allocate(size);
+			if (offset == RING_ALLOCATION_FAILED)
+				continue;
+
+			unsigned int alignedSize = (size + slot - 1) / slot * slot;
+			if (offset % slot != 0 || offset + alignedSize > stress.GetSize())
+				results.NeverOverlaps = false;
+			for (const Allocation& other : live)
+			{
+				if (offset < other.Offset + other.Size && other.Offset < offset + alignedSize)
+					results.NeverOverlaps = false;
+			}
+			live.push_back({ frame, offset, alignedSize });
+		}
+		stress.EndFrame(frame);
+	}
+
+	return results;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+// Results of timing the three ways a draw's PerDraw constants (ObjectConstants.hlsli) can be written
+struct ShaderSetterBenchmark
+{
+	unsigned int DrawCount;		// How many draws' constants were written per run
+	double NameNanoseconds;		// Per draw, Set*() by name into the shader's own copy of PerDraw, then a copy (without the GPU part)
+	double HandleNanoseconds;	// Per draw, the same through handles, like Mesh::SetUnpackData()
+	double RingNanoseconds;		// Per draw, a RingAllocator slot and one write of the whole DrawConstants, like Game::Draw() now does
+	bool ResultsMatch;			// DrawConstants has PerDraw's layout, and all three leave the same bytes behind
+};
+
+/// <summary>
+/// Writes PerDraw constants for lots of draws by name, through handles and into ring slots.
+/// Uses a shader with the cbuffer layout from ObjectConstants.hlsli, but no device.
+/// </summary>
+/// <param name="drawCount">How many draws to write constants for per run</param>
+/// <param name="repeats">How many runs to do each way (the fastest one counts)</param>
+ShaderSetterBenchmark BenchmarkShaderSetters(unsigned int drawCount, int repeats);
+
+// Results of setting variables and copying buffers on a device-less shader, and reading back UploadStats
+struct ConstantBufferUploadChecks
+{
+	unsigned int UploadsIssued;		// Across the whole check (2 if everything works)
+	unsigned int UploadsSkipped;	// Across the whole check (4 if everything works)
+	bool SkipsUntouched;			// A buffer nothing was written to isn't uploaded
+	bool UploadsChange;				// Changing one variable uploads once, counting only its bytes as changed
+	bool SkipsAfterUpload;			// Copying again with nothing new is skipped
+	bool SkipsSameValues;			// Setting variables to the values they already hold, by name or by handle, is skipped
+	bool RangeCoversBoth;			// Two changed variables make one dirty range from the first's start to the second's end, cleared by the upload
+};
+
+/// <summary>
+/// Drives WriteLocalData() and UploadBuffer() through the Set*() and copy calls, and checks
+/// which copies ISimpleShader::UploadStats says were issued and which were skipped
+/// </summary>
+ConstantBufferUploadChecks CheckConstantBufferUploads();
+
+// Results of checking RingAllocator on its own, the part of ConstantBufferRing that doesn't need a device
+struct RingAllocatorChecks
+{
+	bool Aligned;				// Offsets and sizes are rounded up to the alignment
+	bool RefusesWhenFull;		// An allocation that doesn't fit fails instead of overwriting anything
+	bool KeepsUnfinishedFrames;	// Retiring an older fence doesn't free a frame
+	bool RetiresFinishedFrames;	// Retiring its fence frees all of it
+	bool WrapsToStart;			// An allocation that doesn't fit before the end skips to the start
+	bool SkippedBytesRetired;	// The bytes skipped at the end stay in use until that frame is retired
+	bool NeverOverlaps;			// Thousands of random frames, with the GPU two behind, never hand out space still in flight
+};
+
+/// <summary>
+/// Allocates, ends frames and retires fences on small rings, including wrapping around the end, and checks what's handed out
+/// </summary>
+RingAllocatorChecks CheckRingAllocator();
@@ -33,7 +33,8 @@ struct Light
     float Intensity; // All lights need an intensity
     float3 Color; // All lights need a color
     float SpotFalloff; // Spot lights need a value to define their “cone” size
-    float3 Padding; // Purposefully padding to hit the 16-byte boundary
+    int ShadowIndex; // Where its shadow views start in the shadow atlas, or -1 if it doesn't have any
+    float2 Padding; // Purposefully padding to hit the 16-byte boundary
 
 };
 
@@ -58,6 +59,41 @@ struct VertexShaderInput
 };
 
 
+// The compressed version of the above, matching PackedVertex in PackedVertex.h
+// - The input layout turns the 16 bit integers into 0-1 (UNORM) or -1-1 (SNORM) floats
+// - Use UnpackVertex() to get a regular VertexShaderInput back
+struct PackedVertexShaderInput
+{
+    float4 localPosition : POSITION; // XYZ within the mesh's bounds (UNORM)
+    float2 normal : NORMAL; // Octahedral encoded (SNORM)
+    float2 tangent : TANGENT; // Octahedral encoded (SNORM)
+    float2 uv : TEXCOORD; // Within the mesh's UV range (UNORM)
+};
+
+
+// Turns an octahedral encoded direction back into a 3D one
+// - Same math as OctahedralDecode() in PackedVertex.cpp
+float3 OctahedralDecode(float2 encoded)
+{
+    float3 direction = float3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+    float fold = saturate(-direction.z);
+    direction.xy += (direction.xy >= 0.0f) ? -fold : fold; // Per component
+    return normalize(direction);
+}
+
+
+// Undoes PackVertices(), given the mesh's PackedVertexRange
+VertexShaderInput UnpackVertex(PackedVertexShaderInput packed, float3 positionOffset, float3 positionScale, float2 uvOffset, float2 uvScale)
+{
+    VertexShaderInput input;
+    input.localPosition = positionOffset + packed.localPosition.xyz * positionScale;
+    input.normal = OctahedralDecode(packed.normal);
+    input.tangent = OctahedralDecode(packed.tangent);
+    input.uv = uvOffset + packed.uv * uvScale;
+    return input;
+}
+
+
 // Struct representing the data we expect to receive from earlier pipeline stages
 // - Should match the output of our corresponding vertex shader
 // - The name of the struct itself is unimportant
@@ -75,7 +111,6 @@ struct VertexToPixel
     float3 normal : NORMAL;
     float3 worldPosition : POSITION;
     float3 tangent : TANGENT; // TANGENT DIRECTION
-    float4 shadowMapPos : SHADOW_POSITION;
 };
 
 
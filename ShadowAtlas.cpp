@@ -0,0 +1,496 @@
+#include "ShadowAtlas.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+	// For powers of 2 only
+	unsigned int Log2(unsigned int value)
+	{
+		unsigned int result = 0;
+		while (value > 1)
+		{
+			value >>= 1;
+			result++;
+		}
+		return result;
+	}
+}
+
+float ComputeShadowImportance(const XMFLOAT3& center, float radius, const FrustumPlanes& frustum,
+	const XMFLOAT4X4& view, const XMFLOAT4X4& projection)
+{
+	for (const XMFLOAT4& plane : frustum.Planes)
+	{
+		if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+			return 0.0f;
+	}
+
+	// How tall the sphere looks on screen, where 1 is the whole height
+	float depth = center.x * view._13 + center.y * view._23 + center.z * view._33 + view._43;
+	if (depth <= radius)
+		return 1.0f;
+	return std::min(1.0f, radius * projection._22 / depth);
+}
+
+ShadowAtlas::ShadowAtlas(unsigned int size, unsigned int minTileSize, unsigned int maxTileSize, float hysteresis)
+{
+	this->size = size;
+	this->hysteresis = hysteresis;
+	maxTileDepth = Log2(size / maxTileSize);
+	minTileDepth = Log2(size / minTileSize);
+
+	nodes.resize(minTileDepth + 1);
+	freeNodes.resize(minTileDepth + 1);
+	for (unsigned int depth = 0; depth <= minTileDepth; depth++)
+		nodes[depth].resize((size_t)1 << (depth * 2));
+
+	Clear();
+}
+
+void ShadowAtlas::Clear()
+{
+	for (unsigned int depth = 0; depth <= minTileDepth; depth++)
+	{
+		std::fill(nodes[depth].begin(), nodes[depth].end(), (unsigned char)NODE_ABSENT);
+		freeNodes[depth].clear();
+	}
+	nodes[0][0] = NODE_FREE;
+	freeNodes[0].push_back(0);
+
+	placements.clear();
+	stats = {};
+	stats.FreeTexels = size * size;
+	stats.LargestFreeTile = size;
+}
+
+int ShadowAtlas::AllocateNode(unsigned int depth)
+{
+	// The smallest free node that's big enough
+	int found = (int)depth;
+	while (found >= 0 && freeNodes[found].empty())
+		found--;
+	if (found < 0)
+		return -1;
+
+	unsigned int node = freeNodes[found].back();
+	freeNodes[found].pop_back();
+
+	// Split it down to size, keeping the top left quarter each time
+	for (unsigned int d = (unsigned int)found; d < depth; d++)
+	{
+		nodes[d][node] = NODE_SPLIT;
+		unsigned int width = 1u << d;
+		unsigned int childWidth = width * 2;
+		unsigned int child = (node / width) * 2 * childWidth + (node % width) * 2;
+
+		// Backwards, so the next one handed out is the top right
+		unsigned int siblings[3] = { child + childWidth + 1, child + childWidth, child + 1 };
+		for (unsigned int sibling : siblings)
+		{
+			nodes[d + 1][sibling] = NODE_FREE;
+			freeNodes[d + 1].push_back(sibling);
+		}
+		node = child;
+	}
+
+	nodes[depth][node] = NODE_USED;
+	return (int)node;
+}
+
+void ShadowAtlas::RemoveFree(unsigned int depth, unsigned int node)
+{
+	std::vector<unsigned int>& list = freeNodes[depth];
+	list.erase(std::find(list.begin(), list.end(), node));
+}
+
+void ShadowAtlas::FreeNode(unsigned int depth, unsigned int node)
+{
+	// Merge with the siblings for as long as they're all free
+	while (depth > 0)
+	{
+		unsigned int width = 1u << depth;
+		unsigned int first = (node / width & ~1u) * width + (node % width & ~1u);
+		unsigned int quad[4] = { first, first + 1, first + width, first + width + 1 };
+
+		bool allFree = true;
+		for (unsigned int sibling : quad)
+		{
+			if (sibling != node && nodes[depth][sibling] != NODE_FREE)
+				allFree = false;
+		}
+		if (!allFree)
+			break;
+
+		for (unsigned int sibling : quad)
+		{
+			if (sibling != node)
+				RemoveFree(depth, sibling);
+			nodes[depth][sibling] = NODE_ABSENT;
+		}
+		node = (first / width / 2) * (width / 2) + (first % width) / 2;
+		depth--;
+	}
+
+	nodes[depth][node] = NODE_FREE;
+	freeNodes[depth].push_back(node);
+}
+
+bool ShadowAtlas::Allocate(unsigned int size, ShadowAtlasTile& tile)
+{
+	unsigned int rounded = this->size >> minTileDepth;
+	while (rounded < size)
+		rounded *= 2;
+	if (rounded > this->size)
+		return false;
+
+	unsigned int depth = Log2(this->size / rounded);
+	int node = AllocateNode(depth);
+	if (node < 0)
+		return false;
+
+	unsigned int width = 1u << depth;
+	tile.X = (node % width) * rounded;
+	tile.Y = (node / width) * rounded;
+	tile.Size = rounded;
+	return true;
+}
+
+void ShadowAtlas::Free(const ShadowAtlasTile& tile)
+{
+	unsigned int depth = Log2(size / tile.Size);
+	unsigned int width = 1u << depth;
+	FreeNode(depth, tile.Y / tile.Size * width + tile.X / tile.Size);
+}
+
+float ShadowAtlas::GetLevel(float importance)
+{
+	// Each halving of importance is one level, and one halving of the tile's width
+	float maxLevel = (float)(minTileDepth - maxTileDepth);
+	if (!(importance > 0.0f))
+		return maxLevel;
+	return std::min(std::max(-log2f(importance), 0.0f), maxLevel);
+}
+
+unsigned int ShadowAtlas::GetTileSize(float importance)
+{
+	return size >> (maxTileDepth + (unsigned int)roundf(GetLevel(importance)));
+}
+
+unsigned int ShadowAtlas::GetSize()
+{
+	return size;
+}
+
+ShadowAtlasStats ShadowAtlas::GetStats()
+{
+	return stats;
+}
+
+unsigned int ShadowAtlas::GetTiles(unsigned int owner, const ShadowAtlasTile** tiles)
+{
+	std::unordered_map<unsigned int, Placement>::iterator found = placements.find(owner);
+	if (found == placements.end() || found->second.Tiles.empty())
+	{
+		*tiles = nullptr;
+		return 0;
+	}
+	*tiles = found->second.Tiles.data();
+	return (unsigned int)found->second.Tiles.size();
+}
+
+void ShadowAtlas::FreePlacement(Placement& placement)
+{
+	for (const ShadowAtlasTile& tile : placement.Tiles)
+		Free(tile);
+	placement.Previous.swap(placement.Tiles);
+	placement.Tiles.clear();
+}
+
+bool ShadowAtlas::Place(const Placing& placing, unsigned int level, ShadowAtlasStats& frameStats)
+{
+	Placement& placement = placements[placing.Owner];
+	unsigned int tileSize = size >> (maxTileDepth + level);
+	for (unsigned int i = 0; i < placing.TileCount; i++)
+	{
+		ShadowAtlasTile tile;
+		if (!Allocate(tileSize, tile))
+		{
+			for (const ShadowAtlasTile& placed : placement.Tiles)
+				Free(placed);
+			placement.Tiles.clear();
+			return false;
+		}
+		placement.Tiles.push_back(tile);
+	}
+
+	// Anything that didn't land exactly where it was last frame needs drawing from scratch
+	for (unsigned int i = 0; i < placing.TileCount; i++)
+	{
+		const ShadowAtlasTile& tile = placement.Tiles[i];
+		if (i >= placement.Previous.size() || tile.X != placement.Previous[i].X ||
+			tile.Y != placement.Previous[i].Y || tile.Size != placement.Previous[i].Size)
+			frameStats.TilesPlaced++;
+	}
+	placement.Level = level;
+	return true;
+}
+
+ShadowAtlasStats ShadowAtlas::Pack(const std::vector<ShadowAtlasRequest>& requests)
+{
+	ShadowAtlasStats frameStats = {};
+
+	// Where everyone wants to be, sticking with last frame's
+	// size unless importance has gone far enough past halfway
+	std::vector<Placing> wanted(requests.size());
+	for (std::pair<const unsigned int, Placement>& entry : placements)
+		entry.second.Requested = false;
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		const ShadowAtlasRequest& request = requests[i];
+		float level = GetLevel(request.Importance);
+		wanted[i] = { request.Owner, request.TileCount, request.Importance, (unsigned int)roundf(level) };
+
+		std::unordered_map<unsigned int, Placement>::iterator found = placements.find(request.Owner);
+		if (found != placements.end() && found->second.TileCount == request.TileCount &&
+			fabsf(level - found->second.Wanted) <= 0.5f + hysteresis)
+			wanted[i].Level = found->second.Wanted;
+	}
+
+	// Owners nobody asked for give their tiles back
+	for (const ShadowAtlasRequest& request : requests)
+	{
+		std::unordered_map<unsigned int, Placement>::iterator found = placements.find(request.Owner);
+		if (found != placements.end())
+			found->second.Requested = true;
+	}
+	for (std::unordered_map<unsigned int, Placement>::iterator it = placements.begin(); it != placements.end();)
+	{
+		if (it->second.Requested)
+		{
+			it++;
+			continue;
+		}
+		FreePlacement(it->second);
+		it = placements.erase(it);
+	}
+
+	// Everyone who's new or changing size gets freed and placed again.
+	// Those that didn't fit last frame and still want the same size just
+	// get another go, since they'd only repack every frame if they failed.
+	std::vector<Placing> changed;
+	std::vector<bool> retrying;
+	for (const Placing& placing : wanted)
+	{
+		Placement& placement = placements[placing.Owner];
+		placement.Requested = true;
+		bool isNew = placement.TileCount != placing.TileCount;
+		if (!isNew && placement.Wanted == placing.Level && !placement.Tiles.empty())
+			continue;
+
+		if (!isNew && !placement.Tiles.empty())
+			frameStats.Resized++;
+		bool retry = !isNew && placement.Wanted == placing.Level;
+		FreePlacement(placement);
+		placement.TileCount = placing.TileCount;
+		placement.Wanted = placing.Level;
+		changed.push_back(placing);
+		retrying.push_back(retry);
+	}
+
+	std::vector<unsigned int> order(changed.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(),
+		[&](unsigned int a, unsigned int b) { return changed[a].Importance > changed[b].Importance; });
+	for (unsigned int i : order)
+	{
+		if (!Place(changed[i], changed[i].Level, frameStats) && !retrying[i])
+		{
+			frameStats.Repacked = true;
+			break;
+		}
+	}
+
+	// Something new didn't fit, so start over. The least important lights
+	// shrink (and then drop out) until everything adds up to no more than
+	// the atlas, and then the biggest tiles go in first, which in a quadtree
+	// always fits.
+	if (frameStats.Repacked)
+	{
+		for (std::pair<const unsigned int, Placement>& entry : placements)
+		{
+			if (!entry.second.Tiles.empty())
+				entry.second.Previous.swap(entry.second.Tiles);
+			entry.second.Tiles.clear();
+		}
+		for (unsigned int depth = 0; depth <= minTileDepth; depth++)
+		{
+			std::fill(nodes[depth].begin(), nodes[depth].end(), (unsigned char)NODE_ABSENT);
+			freeNodes[depth].clear();
+		}
+		nodes[0][0] = NODE_FREE;
+		freeNodes[0].push_back(0);
+
+		std::stable_sort(wanted.begin(), wanted.end(),
+			[](const Placing& a, const Placing& b) { return a.Importance > b.Importance; });
+		unsigned int maxLevel = minTileDepth - maxTileDepth;
+		unsigned long long capacity = (unsigned long long)size * size;
+		unsigned long long total = 0;
+		for (const Placing& placing : wanted)
+		{
+			unsigned long long tileSize = size >> (maxTileDepth + placing.Level);
+			total += placing.TileCount * tileSize * tileSize;
+		}
+		for (size_t i = wanted.size(); i-- > 0 && total > capacity;)
+		{
+			for (; wanted[i].Level < maxLevel && total > capacity; wanted[i].Level++)
+			{
+				unsigned long long tileSize = size >> (maxTileDepth + wanted[i].Level);
+				total -= wanted[i].TileCount * (tileSize * tileSize - tileSize * tileSize / 4);
+			}
+		}
+		size_t placedCount = wanted.size();
+		for (; placedCount > 0 && total > capacity; placedCount--)
+		{
+			unsigned long long tileSize = size >> minTileDepth;
+			total -= wanted[placedCount - 1].TileCount * tileSize * tileSize;
+		}
+
+		wanted.resize(placedCount);
+		std::stable_sort(wanted.begin(), wanted.end(),
+			[](const Placing& a, const Placing& b) { return a.Level < b.Level; });
+		frameStats.TilesPlaced = 0;
+		for (const Placing& placing : wanted)
+			Place(placing, placing.Level, frameStats);
+	}
+
+	for (const std::pair<const unsigned int, Placement>& entry : placements)
+	{
+		if (entry.second.Tiles.empty())
+			frameStats.Unplaced++;
+	}
+
+	frameStats.FreeTexels = 0;
+	frameStats.LargestFreeTile = 0;
+	for (int depth = (int)minTileDepth; depth >= 0; depth--)
+	{
+		unsigned int tileSize = size >> depth;
+		frameStats.FreeTexels += (unsigned int)freeNodes[depth].size() * tileSize * tileSize;
+		if (!freeNodes[depth].empty())
+			frameStats.LargestFreeTile = tileSize;
+	}
+	frameStats.UsedTexels = size * size - frameStats.FreeTexels;
+	frameStats.Fragmentation = frameStats.FreeTexels == 0 ? 0.0f :
+		1.0f - (float)frameStats.LargestFreeTile * frameStats.LargestFreeTile / frameStats.FreeTexels;
+
+	stats = frameStats;
+	return frameStats;
+}
+
+ShadowAtlasBenchmark BenchmarkShadowAtlas(unsigned int lightCount, unsigned int frameCount, float hysteresis)
+{
+	ShadowAtlasBenchmark results = {};
+	results.LightCount = lightCount;
+	results.FrameCount = frameCount;
+	results.Valid = true;
+
+	// Like Game's atlas: 4096 across, tiles from 128 to 1024
+	const unsigned int atlasSize = 4096;
+	const unsigned int minTile = 128;
+	const unsigned int maxTile = 1024;
+	ShadowAtlas atlas(atlasSize, minTile, maxTile, hysteresis);
+
+	// One in eight lights is directional and always matters the most, a
+	// few more are spots, and the rest are points. Each one's importance
+	// drifts slowly around its own base, plus a little noise every frame,
+	// and it goes out of view (and asks for nothing) when it gets too small.
+	std::mt19937 random(22);
+	std::uniform_real_distribution<float> bases(-5.0f, -0.5f);
+	std::uniform_real_distribution<float> phases(0.0f, XM_2PI);
+	std::uniform_real_distribution<float> speeds(0.002f, 0.02f);
+	std::uniform_real_distribution<float> noise(-0.08f, 0.08f);
+	std::vector<float> base(lightCount), phase(lightCount), speed(lightCount);
+	std::vector<unsigned int> tileCounts(lightCount);
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		base[i] = bases(random);
+		phase[i] = phases(random);
+		speed[i] = speeds(random);
+		tileCounts[i] = (i % 8 == 0 || i % 8 == 1 || i % 8 == 2) ? 1 : 6;
+	}
+
+	const unsigned int cells = atlasSize / minTile;
+	std::vector<unsigned char> covered(cells * cells);
+	std::vector<ShadowAtlasRequest> requests;
+	std::chrono::high_resolution_clock::duration packTime = std::chrono::high_resolution_clock::duration::zero();
+	for (unsigned int frame = 0; frame < frameCount; frame++)
+	{
+		requests.clear();
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			float importance = i % 8 == 0 ? 1.0f :
+				std::min(1.0f, exp2f(base[i] + 1.5f * sinf(phase[i] + frame * speed[i])) * (1.0f + noise(random)));
+			if (importance >= 1.0f / 64.0f)
+				requests.push_back({ i, tileCounts[i], importance });
+		}
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		ShadowAtlasStats stats = atlas.Pack(requests);
+		packTime += std::chrono::high_resolution_clock::now() - start;
+
+		results.TilesPlacedPerFrame += stats.TilesPlaced;
+		results.ResizesPerFrame += stats.Resized;
+		results.Repacks += stats.Repacked ? 1 : 0;
+		results.UnplacedPerFrame += stats.Unplaced;
+		results.AverageFragmentation += stats.Fragmentation;
+		results.AverageUtilization += (double)stats.UsedTexels / ((double)atlasSize * atlasSize);
+
+		// Every tile in bounds, aligned, a size the atlas hands out,
+		// and not overlapping any other, and the used space adds up
+		std::fill(covered.begin(), covered.end(), (unsigned char)0);
+		unsigned int usedCells = 0;
+		for (const ShadowAtlasRequest& request : requests)
+		{
+			const ShadowAtlasTile* tiles;
+			unsigned int count = atlas.GetTiles(request.Owner, &tiles);
+			if (count != 0 && count != request.TileCount)
+				results.Valid = false;
+			for (unsigned int t = 0; t < count; t++)
+			{
+				const ShadowAtlasTile& tile = tiles[t];
+				if (tile.Size < minTile || tile.Size > maxTile || (tile.Size & (tile.Size - 1)) != 0 ||
+					tile.X % tile.Size != 0 || tile.Y % tile.Size != 0 ||
+					tile.X + tile.Size > atlasSize || tile.Y + tile.Size > atlasSize)
+				{
+					results.Valid = false;
+					continue;
+				}
+				for (unsigned int y = tile.Y / minTile; y < (tile.Y + tile.Size) / minTile; y++)
+				{
+					for (unsigned int x = tile.X / minTile; x < (tile.X + tile.Size) / minTile; x++)
+					{
+						if (covered[y * cells + x]++)
+							results.Valid = false;
+						usedCells++;
+					}
+				}
+			}
+		}
+		if (usedCells * minTile * minTile != stats.UsedTexels)
+			results.Valid = false;
+	}
+
+	results.TilesPlacedPerFrame /= frameCount;
+	results.ResizesPerFrame /= frameCount;
+	results.UnplacedPerFrame /= frameCount;
+	results.AverageFragmentation /= frameCount;
+	results.AverageUtilization /= frameCount;
+	results.PackMicroseconds = std::chrono::duration<double, std::micro>(packTime).count() / frameCount;
+	return results;
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <unordered_map>
+#include <vector>
+#include "Frustum.h"
+
+// How many views (a tile each) the atlas can shadow from in one frame.
+// Matches MAX_SHADOW_ATLAS_VIEWS in PixelShader.hlsl.
+#define MAX_SHADOW_ATLAS_VIEWS 32
+
+// A square of the atlas, in texels from its top left corner
+struct ShadowAtlasTile
+{
+	unsigned int X;
+	unsigned int Y;
+	unsigned int Size;
+};
+
+// One light asking for room in the atlas this frame
+struct ShadowAtlasRequest
+{
+	unsigned int Owner;		// Anything that stays the same from frame to frame, like the light's index
+	unsigned int TileCount;	// How many tiles it needs, all the same size: 1 for a directional or spot light, 6 for a point light
+	float Importance;		// From 0 to 1, how much of the screen it can shadow, like from ComputeShadowImportance()
+};
+
+// How one Pack() went
+struct ShadowAtlasStats
+{
+	unsigned int TilesPlaced;	// Tiles that are somewhere new this frame (new, moved or resized), and need drawing from scratch
+	unsigned int Resized;		// Owners whose tiles changed size
+	unsigned int Unplaced;		// Owners that didn't fit at all, even at the smallest size
+	bool Repacked;				// Whether something didn't fit and everything got placed again from scratch
+	unsigned int UsedTexels;
+	unsigned int FreeTexels;
+	unsigned int LargestFreeTile;	// Width of the biggest tile that could still be allocated, or 0 if it's full
+	float Fragmentation;			// 0 when the free space is all one tile, approaching 1 as it's split into smaller ones
+};
+
+/// <summary>
+/// Says how important a light's shadow is by how big the sphere it reaches looks from the camera:
+/// 1 when it reaches the camera or fills the screen, and 0 when it's out of view entirely
+/// </summary>
+float ComputeShadowImportance(const DirectX::XMFLOAT3& center, float radius, const FrustumPlanes& frustum,
+	const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& projection);
+
+// --------------------------------------------------------
+// Hands out square tiles of one big shadow map to lots of
+// lights, bigger tiles for the lights that matter most
+//
+// Tiles are powers of two between the smallest and largest
+// tile sizes, allocated from a quadtree: each free square
+// splits into four when something smaller is needed, and
+// four free siblings merge back into their parent when the
+// last of them is freed.  Tiles never straddle each other,
+// so the only waste is free squares too small for what's
+// asked for, which GetStats() reports as fragmentation.
+//
+// Pack() gets called every frame with every shadowed light.
+// A light with importance 1 gets the largest tile, and each
+// halving of importance halves the tile's width.  To keep
+// tiles from flickering between sizes (and moving around)
+// as importance wobbles, a light only changes size once its
+// importance is more than the hysteresis past the halfway
+// point to the next size.  Lights that keep their size keep
+// their tiles, and only new or resized lights get placed,
+// most important first.  If one doesn't fit, everything is
+// placed again from scratch in order of importance, with
+// the least important lights shrinking until they fit.
+//
+// Nothing here touches D3D, so it can be checked and timed
+// on its own.
+// --------------------------------------------------------
+class ShadowAtlas
+{
+public:
+	/// <summary>
+	/// Makes an empty atlas
+	/// </summary>
+	/// <param name="size">Width of the whole atlas in texels, a power of 2</param>
+	/// <param name="minTileSize">Width of the smallest tile it'll hand out, a power of 2</param>
+	/// <param name="maxTileSize">Width of the largest, a power of 2 no bigger than size</param>
+	/// <param name="hysteresis">How far past halfway to the next size, in halvings, importance has to go to change a light's size</param>
+	ShadowAtlas(unsigned int size, unsigned int minTileSize, unsigned int maxTileSize, float hysteresis);
+
+	/// <summary>
+	/// Fits this frame's lights into the atlas, keeping last frame's tiles where it can. Owners that aren't asked for get freed.
+	/// </summary>
+	ShadowAtlasStats Pack(const std::vector<ShadowAtlasRequest>& requests);
+
+	/// <summary>
+	/// Gets the tiles Pack() gave an owner
+	/// </summary>
+	/// <returns>How many tiles it has, which is 0 if it didn't fit or wasn't asked for</returns>
+	unsigned int GetTiles(unsigned int owner, const ShadowAtlasTile** tiles);
+
+	/// <summary>
+	/// Works out the tile width for an importance, without any hysteresis
+	/// </summary>
+	unsigned int GetTileSize(float importance);
+
+	unsigned int GetSize();
+	ShadowAtlasStats GetStats();
+
+	/// <summary>
+	/// Frees every tile
+	/// </summary>
+	void Clear();
+
+	/// <summary>
+	/// Takes a tile straight from the quadtree, bypassing Pack(). Size gets rounded up to a power of 2.
+	/// </summary>
+	/// <returns>False if nothing that big is free</returns>
+	bool Allocate(unsigned int size, ShadowAtlasTile& tile);
+
+	/// <summary>
+	/// Gives a tile from Allocate() back
+	/// </summary>
+	void Free(const ShadowAtlasTile& tile);
+
+private:
+
+	// Tiles one owner got, all the same size. Levels count halvings from the largest tile size.
+	struct Placement
+	{
+		std::vector<ShadowAtlasTile> Tiles;
+		std::vector<ShadowAtlasTile> Previous;	// Where they were before they were last freed, to tell if they moved
+		unsigned int TileCount = 0;
+		unsigned int Wanted = 0;	// The level importance picked, which hysteresis sticks to
+		unsigned int Level = 0;		// The level it actually got, which is smaller after a repack if it didn't fit
+		bool Requested = false;
+	};
+	std::unordered_map<unsigned int, Placement> placements;
+
+	// Where a placement would like to be this frame, and how much it matters
+	struct Placing
+	{
+		unsigned int Owner;
+		unsigned int TileCount;
+		float Importance;
+		unsigned int Level;
+	};
+
+	float GetLevel(float importance);
+	bool Place(const Placing& placing, unsigned int level, ShadowAtlasStats& stats);
+	void FreePlacement(Placement& placement);
+
+	// The quadtree, one grid of nodes per depth, row by row.
+	// Depth 0 is the whole atlas, and each depth after it
+	// has twice as many nodes across, each half as wide.
+	enum NodeState : unsigned char { NODE_ABSENT, NODE_FREE, NODE_SPLIT, NODE_USED };
+	std::vector<std::vector<unsigned char>> nodes;
+	std::vector<std::vector<unsigned int>> freeNodes;
+	unsigned int size;
+	unsigned int maxTileDepth;	// Depth of the largest tiles Pack() hands out
+	unsigned int minTileDepth;	// ...and the smallest
+	float hysteresis;
+
+	ShadowAtlasStats stats;
+
+	int AllocateNode(unsigned int depth);
+	void FreeNode(unsigned int depth, unsigned int node);
+	void RemoveFree(unsigned int depth, unsigned int node);
+};
+
+// Results of packing a made up scene's worth of lights with wobbling importance for a while
+struct ShadowAtlasBenchmark
+{
+	unsigned int LightCount;
+	unsigned int FrameCount;
+	double TilesPlacedPerFrame;		// Churn: tiles that needed drawing from scratch
+	double ResizesPerFrame;			// Lights that changed size
+	unsigned int Repacks;			// Frames where everything got placed again
+	double UnplacedPerFrame;		// Lights that didn't get any room
+	double AverageFragmentation;	// From ShadowAtlasStats
+	double AverageUtilization;		// Fraction of the atlas in use
+	double PackMicroseconds;		// Average Pack() time
+	bool Valid;						// No tiles overlapped or went out of bounds, and every light had the tiles it asked for or none
+};
+
+/// <summary>
+/// Packs a mix of directional, spot and point lights whose importance drifts and jitters from frame to frame
+/// </summary>
+/// <param name="lightCount">How many lights ask for room each frame</param>
+/// <param name="frameCount">How many frames to pack</param>
+/// <param name="hysteresis">Passed to the ShadowAtlas, so it can be compared with 0</param>
+ShadowAtlasBenchmark BenchmarkShadowAtlas(unsigned int lightCount, unsigned int frameCount, float hysteresis);
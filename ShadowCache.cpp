@@ -0,0 +1,110 @@
+#include "ShadowCache.h"
+
+#include <cstring>
+#include <vector>
+
+using namespace DirectX;
+
+FrustumPlanes ExtractShadowCasterPlanes(const XMFLOAT4X4& lightView, const XMFLOAT4X4& cascadeProjection)
+{
+	// Without the near plane, nothing on the light's side of the box
+	// gets culled. The shadow pass clamps depth instead of clipping,
+	// so those casters still land in the map, flattened onto its near plane.
+	FrustumPlanes planes = ExtractFrustumPlanes(lightView, cascadeProjection);
+	planes.Planes[4] = XMFLOAT4(0, 0, 0, 1);
+	return planes;
+}
+
+ShadowCache::ShadowCache()
+{
+	staticVersion = 0;
+	hits = 0;
+	misses = 0;
+	Invalidate();
+}
+
+bool ShadowCache::NeedsRedraw(unsigned int cascade, const XMFLOAT4X4& viewProjection)
+{
+	// Bit for bit, since anything less means the texels moved
+	Layer& layer = layers[cascade];
+	if (layer.Valid && layer.StaticVersion == staticVersion &&
+		memcmp(&layer.ViewProjection, &viewProjection, sizeof(XMFLOAT4X4)) == 0)
+	{
+		hits++;
+		return false;
+	}
+
+	layer.ViewProjection = viewProjection;
+	layer.StaticVersion = staticVersion;
+	layer.Valid = true;
+	misses++;
+	return true;
+}
+
+void ShadowCache::InvalidateStatic()
+{
+	staticVersion++;
+}
+
+void ShadowCache::Invalidate()
+{
+	for (Layer& layer : layers)
+		layer.Valid = false;
+}
+
+unsigned int ShadowCache::GetHits()
+{
+	return hits;
+}
+
+unsigned int ShadowCache::GetMisses()
+{
+	return misses;
+}
+
+ShadowCacheChecks CheckShadowCache()
+{
+	ShadowCacheChecks results = {};
+
+	// Two cascades' worth of view projections, from a light
+	// pointing straight down +Z to keep the volumes easy to picture
+	XMFLOAT4X4 lightView = MakeShadowLightView(XMFLOAT3(0, 0, 1));
+	XMFLOAT4X4 projection, movedProjection;
+	XMStoreFloat4x4(&projection, XMMatrixOrthographicOffCenterLH(-10, 10, -10, 10, 40, 60));
+	XMStoreFloat4x4(&movedProjection, XMMatrixOrthographicOffCenterLH(-9.5f, 10.5f, -10, 10, 40, 60));
+	XMFLOAT4X4 viewProjection, movedViewProjection;
+	XMStoreFloat4x4(&viewProjection, XMLoadFloat4x4(&lightView) * XMLoadFloat4x4(&projection));
+	XMStoreFloat4x4(&movedViewProjection, XMLoadFloat4x4(&lightView) * XMLoadFloat4x4(&movedProjection));
+
+	ShadowCache cache;
+	results.MissesFirstTime = cache.NeedsRedraw(0, viewProjection) && cache.NeedsRedraw(1, viewProjection);
+	results.HitsWhenUnchanged = !cache.NeedsRedraw(0, viewProjection) && !cache.NeedsRedraw(1, viewProjection);
+
+	results.MissesWhenMoved = cache.NeedsRedraw(0, movedViewProjection);
+	results.CascadesIndependent = !cache.NeedsRedraw(1, viewProjection);
+	results.MissesWhenMoved = results.MissesWhenMoved && !cache.NeedsRedraw(0, movedViewProjection);
+
+	cache.InvalidateStatic();
+	results.MissesWhenStaticMoved =
+		cache.NeedsRedraw(0, movedViewProjection) && cache.NeedsRedraw(1, viewProjection) &&
+		!cache.NeedsRedraw(0, movedViewProjection) && !cache.NeedsRedraw(1, viewProjection);
+	results.HitsWhenUnchanged = results.HitsWhenUnchanged && cache.GetHits() == 6 && cache.GetMisses() == 5;
+
+	// In the box, between the light and the box, way back towards the
+	// light, beside the box, and past its far end
+	FrustumCuller culler;
+	culler.Add(WorldBounds{ XMFLOAT3(0, 0, 50), 1.0f, XMFLOAT3(1, 1, 1) });
+	culler.Add(WorldBounds{ XMFLOAT3(2, 3, 20), 1.0f, XMFLOAT3(1, 1, 1) });
+	culler.Add(WorldBounds{ XMFLOAT3(-5, 5, -1000), 1.0f, XMFLOAT3(1, 1, 1) });
+	culler.Add(WorldBounds{ XMFLOAT3(15, 0, 30), 1.0f, XMFLOAT3(1, 1, 1) });
+	culler.Add(WorldBounds{ XMFLOAT3(0, 0, 70), 1.0f, XMFLOAT3(1, 1, 1) });
+
+	std::vector<unsigned int> casters, inside;
+	culler.Cull(ExtractShadowCasterPlanes(lightView, projection), casters);
+	culler.Cull(ExtractFrustumPlanes(lightView, projection), inside);
+	results.CastersExtruded =
+		casters == std::vector<unsigned int>{ 0, 1, 2 } &&
+		inside == std::vector<unsigned int>{ 0 };
+
+	return results;
+}
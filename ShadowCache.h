@@ -0,0 +1,96 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include "Frustum.h"
+#include "ShadowCascades.h"
+
+// How many casters went where over one frame, across every cascade
+struct ShadowCasterStats
+{
+	unsigned int StaticDrawn;	// Static casters drawn into a cascade whose cached layer was stale
+	unsigned int StaticCached;	// Static casters skipped because their cascade's cached layer was still good
+	unsigned int DynamicDrawn;	// Moving casters, which get drawn over the cached layer every frame
+	unsigned int Culled;		// Casters that couldn't throw a shadow into a cascade
+};
+
+/// <summary>
+/// Gets the planes of the volume that can cast shadows into a cascade: its box,
+/// stretched back towards the light forever, since anything between the light
+/// and the box can still shade what's in it. Works with FrustumCuller and BoundingVolumeHierarchy.
+/// </summary>
+FrustumPlanes ExtractShadowCasterPlanes(const DirectX::XMFLOAT4X4& lightView, const DirectX::XMFLOAT4X4& cascadeProjection);
+
+// --------------------------------------------------------
+// Decides when each cascade's layer of static casters needs
+// drawing again
+//
+// Static casters only get drawn into their own depth layer
+// when something they depend on changes, and every frame
+// that layer gets copied into the real shadow map and only
+// the moving casters get drawn over it.  A layer is still
+// good as long as its cascade's view projection (which
+// covers the light direction and where the cascade sits)
+// is exactly what it was drawn with, and nothing static has
+// moved since, so it lasts as long as the camera and the
+// light hold still.
+//
+// Nothing here touches D3D, so the decisions can be checked
+// on their own.
+// --------------------------------------------------------
+class ShadowCache
+{
+public:
+	ShadowCache();
+
+	/// <summary>
+	/// Says whether a cascade's static layer needs drawing with this view projection,
+	/// and if so, assumes it's about to be and remembers it
+	/// </summary>
+	bool NeedsRedraw(unsigned int cascade, const DirectX::XMFLOAT4X4& viewProjection);
+
+	/// <summary>
+	/// Call when a static caster moves, appears or goes away, so every layer gets redrawn
+	/// </summary>
+	void InvalidateStatic();
+
+	/// <summary>
+	/// Forgets every layer, like when the shadow map's resolution changes
+	/// </summary>
+	void Invalidate();
+
+	// How many times NeedsRedraw() said a layer was still good, or not, since the start
+	unsigned int GetHits();
+	unsigned int GetMisses();
+
+private:
+
+	struct Layer
+	{
+		DirectX::XMFLOAT4X4 ViewProjection;
+		unsigned int StaticVersion;	// What staticVersion was when it was drawn
+		bool Valid;
+	};
+	Layer layers[SHADOW_CASCADE_COUNT];
+
+	// Goes up whenever anything static changes
+	unsigned int staticVersion;
+
+	unsigned int hits;
+	unsigned int misses;
+};
+
+// Results of checking the caching decisions and caster volumes against what they promise
+struct ShadowCacheChecks
+{
+	bool MissesFirstTime;		// Nothing's cached to begin with
+	bool HitsWhenUnchanged;		// The same view projection again is a hit
+	bool MissesWhenMoved;		// A different view projection (the light turning or the cascade moving) is a miss
+	bool MissesWhenStaticMoved;	// InvalidateStatic() makes every cascade a miss, once
+	bool CascadesIndependent;	// One cascade changing doesn't touch the others
+	bool CastersExtruded;		// Something between the light and a cascade's box counts, and things beside or past it don't
+};
+
+/// <summary>
+/// Runs ShadowCache and ExtractShadowCasterPlanes() through a few made up frames
+/// </summary>
+ShadowCacheChecks CheckShadowCache();
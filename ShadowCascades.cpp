@@ -0,0 +1,219 @@
+#include "ShadowCascades.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace DirectX;
+
+void ComputeCascadeSplits(float nearPlane, float farPlane, unsigned int count, float blend, float* splits)
+{
+	for (unsigned int i = 1; i <= count; i++)
+	{
+		float fraction = (float)i / count;
+		float logarithmic = nearPlane * powf(farPlane / nearPlane, fraction);
+		float uniform = nearPlane + (farPlane - nearPlane) * fraction;
+		splits[i - 1] = blend * logarithmic + (1.0f - blend) * uniform;
+	}
+
+	// Exactly, rather than whatever pow() rounded to
+	splits[count - 1] = farPlane;
+}
+
+void GetPerspectiveDepthRange(const XMFLOAT4X4& projection, float& nearPlane, float& farPlane)
+{
+	// _33 is far / (far - near) and _43 is -near * far / (far - near)
+	nearPlane = -projection._43 / projection._33;
+	farPlane = projection._43 / (1.0f - projection._33);
+}
+
+XMFLOAT4X4 MakeShadowLightView(const XMFLOAT3& lightDirection)
+{
+	// Any up works as long as it isn't parallel to the light
+	XMVECTOR direction = XMVector3Normalize(XMLoadFloat3(&lightDirection));
+	XMVECTOR up = fabsf(XMVectorGetY(direction)) > 0.99f ? XMVectorSet(0, 0, 1, 0) : XMVectorSet(0, 1, 0, 0);
+
+	XMFLOAT4X4 view;
+	XMStoreFloat4x4(&view, XMMatrixLookToLH(XMVectorZero(), direction, up));
+	return view;
+}
+
+ShadowCascade FitShadowCascade(const XMFLOAT4X4& cameraView, const XMFLOAT4X4& cameraProjection, float nearDistance, float farDistance,
+	const XMFLOAT4X4& lightView, unsigned int resolution, float casterDistance)
+{
+	// A slice of the view reaches out to x = d / _11 and y = d / _22 at distance d.
+	// The sphere around it is worked out in the camera's own space, where it
+	// doesn't depend on where the camera is or which way it faces, so turning
+	// around doesn't change its size by even a rounding error. Its center is
+	// where the near and far corners are the same distance away, or the
+	// middle of the far end if that's further out than the slice goes.
+	float slope = 1.0f / (cameraProjection._11 * cameraProjection._11) + 1.0f / (cameraProjection._22 * cameraProjection._22);
+	float centerDistance = std::min((nearDistance + farDistance) * (1.0f + slope) * 0.5f, farDistance);
+	float nearReach = nearDistance - centerDistance;
+	float farReach = farDistance - centerDistance;
+	float radius = sqrtf(std::max(
+		nearDistance * nearDistance * slope + nearReach * nearReach,
+		farDistance * farDistance * slope + farReach * farReach));
+
+	XMMATRIX cameraWorld = XMMatrixInverse(0, XMLoadFloat4x4(&cameraView));
+	XMVECTOR center = XMVector3TransformCoord(XMVectorSet(0, 0, centerDistance, 1), cameraWorld);
+
+	// Move the center in whole texels only, so as the camera moves the
+	// shadow map slides along under the scene without its texels
+	// landing somewhere new and making the edges crawl
+	XMFLOAT3 lightCenter;
+	XMStoreFloat3(&lightCenter, XMVector3TransformCoord(center, XMLoadFloat4x4(&lightView)));
+	float texelSize = radius * 2.0f / resolution;
+	lightCenter.x = floorf(lightCenter.x / texelSize) * texelSize;
+	lightCenter.y = floorf(lightCenter.y / texelSize) * texelSize;
+
+	ShadowCascade cascade;
+	XMMATRIX projection = XMMatrixOrthographicOffCenterLH(
+		lightCenter.x - radius, lightCenter.x + radius,
+		lightCenter.y - radius, lightCenter.y + radius,
+		lightCenter.z - radius - casterDistance, lightCenter.z + radius);
+	XMStoreFloat4x4(&cascade.Projection, projection);
+	XMStoreFloat4x4(&cascade.ViewProjection, XMMatrixMultiply(XMLoadFloat4x4(&lightView), projection));
+	cascade.NearDistance = nearDistance;
+	cascade.FarDistance = farDistance;
+	cascade.Radius = radius;
+	cascade.TexelSize = texelSize;
+	return cascade;
+}
+
+void FitShadowCascades(const XMFLOAT4X4& cameraView, const XMFLOAT4X4& cameraProjection, float maxDistance, float blend,
+	const XMFLOAT4X4& lightView, unsigned int resolution, float casterDistance, ShadowCascade cascades[SHADOW_CASCADE_COUNT])
+{
+	float nearPlane, farPlane;
+	GetPerspectiveDepthRange(cameraProjection, nearPlane, farPlane);
+
+	float splits[SHADOW_CASCADE_COUNT];
+	ComputeCascadeSplits(nearPlane, std::min(farPlane, maxDistance), SHADOW_CASCADE_COUNT, blend, splits);
+
+	float start = nearPlane;
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		cascades[i] = FitShadowCascade(cameraView, cameraProjection, start, splits[i], lightView, resolution, casterDistance);
+		start = splits[i];
+	}
+}
+
+ShadowCascadeChecks CheckShadowCascades(int repeats)
+{
+	ShadowCascadeChecks results = {};
+
+	// Splits at both ends of the blend, and everywhere between
+	const float nearPlane = 0.1f;
+	const float farPlane = 100.0f;
+	float splits[SHADOW_CASCADE_COUNT];
+
+	results.UniformSplits = true;
+	ComputeCascadeSplits(nearPlane, farPlane, SHADOW_CASCADE_COUNT, 0.0f, splits);
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		float expected = nearPlane + (farPlane - nearPlane) * (i + 1) / SHADOW_CASCADE_COUNT;
+		if (fabsf(splits[i] - expected) > expected * 1e-5f)
+			results.UniformSplits = false;
+	}
+
+	results.LogarithmicSplits = true;
+	ComputeCascadeSplits(nearPlane, farPlane, SHADOW_CASCADE_COUNT, 1.0f, splits);
+	float ratio = powf(farPlane / nearPlane, 1.0f / SHADOW_CASCADE_COUNT);
+	float previous = nearPlane;
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		if (fabsf(splits[i] / previous - ratio) > ratio * 1e-4f)
+			results.LogarithmicSplits = false;
+		previous = splits[i];
+	}
+
+	results.SplitsIncrease = true;
+	for (int step = 0; step <= 10; step++)
+	{
+		ComputeCascadeSplits(nearPlane, farPlane, SHADOW_CASCADE_COUNT, step / 10.0f, splits);
+		previous = nearPlane;
+		for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+		{
+			if (!(splits[i] > previous))
+				results.SplitsIncrease = false;
+			previous = splits[i];
+		}
+		if (splits[SHADOW_CASCADE_COUNT - 1] != farPlane)
+			results.SplitsIncrease = false;
+	}
+
+	// A camera like Game's, with a light coming down at an angle
+	const unsigned int resolution = 2048;
+	XMFLOAT4X4 projection;
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, 16.0f / 9.0f, 0.01f, 1000.0f));
+	XMFLOAT4X4 lightView = MakeShadowLightView(XMFLOAT3(1, -1, 1));
+
+	ShadowCascade first[SHADOW_CASCADE_COUNT];
+	XMFLOAT4X4 view;
+	XMStoreFloat4x4(&view, XMMatrixLookToLH(XMVectorSet(0, 2, -6, 0), XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0)));
+	FitShadowCascades(view, projection, 60.0f, 0.75f, lightView, resolution, 100.0f, first);
+
+	// Somewhere in the world that every cascade covers, and where it lands in each one's texels
+	XMVECTOR landmark = XMVectorSet(0.3f, 0.7f, -0.2f, 1);
+	XMFLOAT2 firstTexels[SHADOW_CASCADE_COUNT];
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		XMFLOAT3 position;
+		XMStoreFloat3(&position, XMVector3TransformCoord(landmark, XMLoadFloat4x4(&first[i].ViewProjection)));
+		firstTexels[i] = XMFLOAT2((position.x * 0.5f + 0.5f) * resolution, (0.5f - position.y * 0.5f) * resolution);
+	}
+
+	results.SizeStable = true;
+	results.SnappedToTexels = true;
+	results.CoversSlices = true;
+	for (int frame = 0; frame < 100; frame++)
+	{
+		// Drifting a bit at a time and turning every which way
+		float drift = frame * 0.0137f;
+		XMVECTOR position = XMVectorSet(drift, 2.0f + drift * 0.5f, -6.0f + drift * 0.25f, 0);
+		XMMATRIX rotation = XMMatrixRotationRollPitchYaw(sinf(frame * 0.3f) * 0.5f, frame * 0.21f, 0.0f);
+		XMStoreFloat4x4(&view, XMMatrixLookToLH(position, XMVector3TransformNormal(XMVectorSet(0, 0, 1, 0), rotation), XMVectorSet(0, 1, 0, 0)));
+
+		ShadowCascade cascades[SHADOW_CASCADE_COUNT];
+		FitShadowCascades(view, projection, 60.0f, 0.75f, lightView, resolution, 100.0f, cascades);
+
+		XMMATRIX cameraWorld = XMMatrixInverse(0, XMLoadFloat4x4(&view));
+		for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+		{
+			if (cascades[i].Radius != first[i].Radius || cascades[i].TexelSize != first[i].TexelSize)
+				results.SizeStable = false;
+
+			// The landmark can move by whole texels, give or take rounding
+			XMFLOAT3 projected;
+			XMStoreFloat3(&projected, XMVector3TransformCoord(landmark, XMLoadFloat4x4(&cascades[i].ViewProjection)));
+			float texelX = (projected.x * 0.5f + 0.5f) * resolution - firstTexels[i].x;
+			float texelY = (0.5f - projected.y * 0.5f) * resolution - firstTexels[i].y;
+			if (fabsf(texelX - roundf(texelX)) > 0.01f || fabsf(texelY - roundf(texelY)) > 0.01f)
+				results.SnappedToTexels = false;
+
+			for (int corner = 0; corner < 8; corner++)
+			{
+				float distance = (corner & 4) ? cascades[i].FarDistance : cascades[i].NearDistance;
+				XMVECTOR viewCorner = XMVectorSet(
+					((corner & 1) ? 1.0f : -1.0f) * distance / projection._11,
+					((corner & 2) ? 1.0f : -1.0f) * distance / projection._22,
+					distance, 1);
+				XMFLOAT3 clip;
+				XMStoreFloat3(&clip, XMVector3TransformCoord(XMVector3TransformCoord(viewCorner, cameraWorld), XMLoadFloat4x4(&cascades[i].ViewProjection)));
+				if (fabsf(clip.x) > 1.0f || fabsf(clip.y) > 1.0f || clip.z < 0.0f || clip.z > 1.0f)
+					results.CoversSlices = false;
+			}
+		}
+	}
+
+	std::chrono::high_resolution_clock::duration best = std::chrono::high_resolution_clock::duration::max();
+	for (int r = 0; r < repeats; r++)
+	{
+		ShadowCascade cascades[SHADOW_CASCADE_COUNT];
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		FitShadowCascades(view, projection, 60.0f, 0.75f, lightView, resolution, 100.0f, cascades);
+		best = std::min(best, std::chrono::high_resolution_clock::now() - start);
+	}
+	results.FitMicroseconds = std::chrono::duration<double, std::micro>(best).count();
+	return results;
+}
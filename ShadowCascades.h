@@ -0,0 +1,74 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// How many slices of the camera's view get their own shadow map.
+// Matches SHADOW_CASCADE_COUNT in PixelShader.hlsl.
+#define SHADOW_CASCADE_COUNT 4
+
+// One slice of the camera's view and the light's projection that covers it
+struct ShadowCascade
+{
+	DirectX::XMFLOAT4X4 Projection;		// Off center orthographic, in the light's view space
+	DirectX::XMFLOAT4X4 ViewProjection;	// The light's view times Projection, for world space positions
+	float NearDistance;					// The part of the camera's view it covers, along the camera's forward axis
+	float FarDistance;
+	float Radius;						// Of the sphere around that part, which is half the projection's width
+	float TexelSize;					// World units across one shadow map texel
+};
+
+/// <summary>
+/// Splits a view distance into cascades with the practical split scheme: a blend of
+/// logarithmic splits (even resolution for perspective) and uniform ones (even sizes)
+/// </summary>
+/// <param name="blend">0 is entirely uniform, 1 is entirely logarithmic</param>
+/// <param name="splits">Gets count distances, the far end of each cascade. The last one is always farPlane.</param>
+void ComputeCascadeSplits(float nearPlane, float farPlane, unsigned int count, float blend, float* splits);
+
+/// <summary>
+/// Reads the near and far clip distances back out of a perspective projection made by XMMatrixPerspectiveFovLH()
+/// </summary>
+void GetPerspectiveDepthRange(const DirectX::XMFLOAT4X4& projection, float& nearPlane, float& farPlane);
+
+/// <summary>
+/// Makes a view matrix that looks along a light's direction from the origin. Every cascade shares
+/// it and only moves its projection around, so a cascade never rotates under the scene.
+/// </summary>
+DirectX::XMFLOAT4X4 MakeShadowLightView(const DirectX::XMFLOAT3& lightDirection);
+
+/// <summary>
+/// Fits a stable orthographic projection around part of the camera's view
+/// </summary>
+/// <param name="nearDistance">Where the part starts, along the camera's forward axis</param>
+/// <param name="farDistance">Where it ends</param>
+/// <param name="lightView">From MakeShadowLightView()</param>
+/// <param name="resolution">Width of the shadow map the cascade renders into</param>
+/// <param name="casterDistance">How far towards the light, past the part's own bounds, casters can still throw shadows into it</param>
+ShadowCascade FitShadowCascade(const DirectX::XMFLOAT4X4& cameraView, const DirectX::XMFLOAT4X4& cameraProjection, float nearDistance, float farDistance,
+	const DirectX::XMFLOAT4X4& lightView, unsigned int resolution, float casterDistance);
+
+/// <summary>
+/// Splits the camera's view up to maxDistance and fits a cascade to each part
+/// </summary>
+/// <param name="maxDistance">How far from the camera shadows reach, if that's less than its far plane</param>
+/// <param name="blend">Passed to ComputeCascadeSplits()</param>
+void FitShadowCascades(const DirectX::XMFLOAT4X4& cameraView, const DirectX::XMFLOAT4X4& cameraProjection, float maxDistance, float blend,
+	const DirectX::XMFLOAT4X4& lightView, unsigned int resolution, float casterDistance, ShadowCascade cascades[SHADOW_CASCADE_COUNT]);
+
+// Results of checking the cascade math against what it promises
+struct ShadowCascadeChecks
+{
+	bool UniformSplits;			// A blend of 0 gives evenly spaced splits
+	bool LogarithmicSplits;		// A blend of 1 gives evenly spaced splits in log space
+	bool SplitsIncrease;		// Every blend gives increasing splits that end at the far plane
+	bool SizeStable;			// Turning the camera doesn't change any cascade's size
+	bool SnappedToTexels;		// Moving the camera only ever moves the shadow map by whole texels
+	bool CoversSlices;			// Every corner of each slice lands inside its cascade's projection
+	double FitMicroseconds;		// FitShadowCascades() for all the cascades
+};
+
+/// <summary>
+/// Checks the split distances and fitting against a moving, turning camera
+/// </summary>
+/// <param name="repeats">How many times to time FitShadowCascades() (the fastest one counts)</param>
+ShadowCascadeChecks CheckShadowCascades(int repeats);
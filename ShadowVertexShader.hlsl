@@ -1,17 +1,24 @@
 #include "ShaderIncludes.hlsli"
+#include "ObjectConstants.hlsli"
 
 
-cbuffer externalData : register(b0)
+// The light's view and projection, set once per frame
+cbuffer PerFrame : register(b0)
 {
-    matrix world;
     matrix view;
     matrix projection;
 };
 
 
 
-float4 main(VertexShaderInput input) : SV_POSITION
+#ifdef PACKED_VERTICES
+float4 main(PackedVertexShaderInput packedInput, InstanceInput instance) : SV_POSITION
 {
-    matrix wvp = mul(projection, mul(view, world));
+    VertexShaderInput input = UnpackVertex(packedInput, positionOffset, positionScale, uvOffset, uvScale);
+#else
+float4 main(VertexShaderInput input, InstanceInput instance) : SV_POSITION
+{
+#endif
+    matrix wvp = mul(projection, mul(view, GetWorldMatrix(instance)));
     return mul(wvp, float4(input.localPosition, 1.0f));
 }
\ No newline at end of file
@@ -4,6 +4,12 @@
 bool ISimpleShader::ReportErrors = false;
 bool ISimpleShader::ReportWarnings = false;
 
+// Nothing uploaded yet
+SimpleShaderUploadStats ISimpleShader::UploadStats;
+
+// Straight to the device context until someone sets one
+std::shared_ptr<RenderStateCache> ISimpleShader::StateCache;
+
 // To enable error reporting, use either or both 
 // of the following lines somewhere in your program, 
 // preferably before loading/using any shaders.
@@ -203,6 +209,11 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		constantBuffers[b].LocalDataBuffer = new unsigned char[bufferDesc.Size];
 		ZeroMemory(constantBuffers[b].LocalDataBuffer, bufferDesc.Size);
 
+		// The buffer was created without any data, so the
+		// first copy has to upload all of it
+		constantBuffers[b].DirtyStart = 0;
+		constantBuffers[b].DirtyEnd = bufferDesc.Size;
+
 		// Loop through all variables in this buffer
 		for (unsigned int v = 0; v < bufferDesc.Variables; v++)
 		{
@@ -345,16 +356,33 @@ void ISimpleShader::CopyAllBufferData()
 	// Ensure the shader is valid
 	if (!shaderValid) return;
 
-	// Loop through the constant buffers and copy all data
+	// Loop through the constant buffers and copy any that changed
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
-		// Copy the entire local data buffer
-		deviceContext->UpdateSubresource(
-			constantBuffers[i].ConstantBuffer.Get(), 0, 0,
-			constantBuffers[i].LocalDataBuffer, 0, 0);
+		if (constantBuffers[i].External)
+			continue;
+
+		UploadBuffer(&constantBuffers[i]);
 	}
 }
 
+// --------------------------------------------------------
+// Marks a constant buffer as bound by something else, so
+// SetShader() and CopyAllBufferData() skip it from now on
+//
+// bufferName - The name of the cbuffer in the shader
+//
+// Returns true if a buffer of the given name was found
+// --------------------------------------------------------
+bool ISimpleShader::SetExternalConstantBuffer(std::string bufferName)
+{
+	SimpleConstantBuffer* cb = FindConstantBuffer(bufferName);
+	if (!cb) return false;
+
+	cb->External = true;
+	return true;
+}
+
 // --------------------------------------------------------
 // Copies local data to the shader's specified constant buffer
 //
@@ -379,10 +407,8 @@ void ISimpleShader::CopyBufferData(unsigned int index)
 	SimpleConstantBuffer* cb = &this->constantBuffers[index];
 	if (!cb) return;
 
-	// Copy the data and get out
-	deviceContext->UpdateSubresource(
-		cb->ConstantBuffer.Get(), 0, 0,
-		cb->LocalDataBuffer, 0, 0);
+	// Copy the data (if it changed) and get out
+	UploadBuffer(cb);
 }
 
 // --------------------------------------------------------
@@ -401,10 +427,43 @@ void ISimpleShader::CopyBufferData(std::string bufferName)
 	SimpleConstantBuffer* cb = this->FindConstantBuffer(bufferName);
 	if (!cb) return;
 
-	// Copy the data and get out
-	deviceContext->UpdateSubresource(
-		cb->ConstantBuffer.Get(), 0, 0,
-		cb->LocalDataBuffer, 0, 0);
+	// Copy the data (if it changed) and get out
+	UploadBuffer(cb);
+}
+
+// --------------------------------------------------------
+// Copies a local data buffer to its constant buffer if
+// anything in it changed since the last time, and counts
+// the upload either way
+//
+// Constant buffers can only be updated whole in D3D11.0,
+// so the dirty range decides whether to upload, not how much
+//
+// A buffer with no GPU side (like the device-less shaders in
+// ShaderBenchmark.cpp) is only counted
+// --------------------------------------------------------
+void ISimpleShader::UploadBuffer(SimpleConstantBuffer* cb)
+{
+	if (cb->DirtyEnd <= cb->DirtyStart)
+	{
+		UploadStats.UploadsSkipped++;
+		return;
+	}
+
+	if (cb->ConstantBuffer)
+	{
+		deviceContext->UpdateSubresource(
+			cb->ConstantBuffer.Get(), 0, 0,
+			cb->LocalDataBuffer, 0, 0);
+	}
+
+	UploadStats.UploadsIssued++;
+	UploadStats.BytesChanged += cb->DirtyEnd - cb->DirtyStart;
+	UploadStats.BytesUploaded += cb->Size;
+
+	// In sync again
+	cb->DirtyStart = 0;
+	cb->DirtyEnd = 0;
 }
 
 
@@ -446,10 +505,7 @@ bool ISimpleShader::SetData(std::string name, const void* data, unsigned int siz
 	}
 
 	// Set the data in the local data buffer
-	memcpy(
-		constantBuffers[var->ConstantBufferIndex].LocalDataBuffer + var->ByteOffset,
-		data,
-		size);
+	WriteLocalData(var->ConstantBufferIndex, var->ByteOffset, data, size);
 
 	// Success
 	return true;
@@ -535,6 +591,48 @@ bool ISimpleShader::SetMatrix4x4(std::string name, const DirectX::XMFLOAT4X4 dat
 	return this->SetData(name, &data, sizeof(float) * 16);
 }
 
+// --------------------------------------------------------
+// Looks up a variable by name once, so it can be set
+// later without another lookup
+//
+// name - The name of the shader variable
+//
+// Returns a handle for the Set*() overloads that take one,
+// which isn't valid if the variable doesn't exist
+// --------------------------------------------------------
+SimpleShaderVariableHandle ISimpleShader::GetVariableHandle(std::string name)
+{
+	SimpleShaderVariableHandle handle;
+
+	// Look for the variable
+	SimpleShaderVariable* var = FindVariable(name, -1);
+	if (var == 0)
+	{
+		if (ReportWarnings)
+		{
+			LogWarning("SimpleShader::GetVariableHandle() - Shader variable '");
+			Log(name);
+			LogWarning("' not found. Ensure the name is spelled correctly and that it exists in a constant buffer in the shader.\n");
+		}
+		return handle;
+	}
+
+	handle.ByteOffset = var->ByteOffset;
+	handle.Size = var->Size;
+	handle.ConstantBufferIndex = var->ConstantBufferIndex;
+	return handle;
+}
+
+// --------------------------------------------------------
+// Reports a handle SetData() couldn't use, which is kept
+// out of line since it's the rare case
+// --------------------------------------------------------
+void ISimpleShader::WarnInvalidHandle()
+{
+	if (ReportWarnings)
+		LogWarning("SimpleShader::SetData() - Shader variable handle is invalid, belongs to another shader, or is smaller than the data being set.\n");
+}
+
 // --------------------------------------------------------
 // Determines if the shader contains the specified
 // variable within one of its constant buffers
@@ -869,21 +967,33 @@ void SimpleVertexShader::SetShaderAndCBs()
 	if (!shaderValid) return;
 
 	// Set the shader and input layout
-	deviceContext->IASetInputLayout(inputLayout.Get());
-	deviceContext->VSSetShader(shader.Get(), 0, 0);
+	if (StateCache)
+	{
+		StateCache->IASetInputLayout(inputLayout.Get());
+		StateCache->VSSetShader(shader.Get());
+	}
+	else
+	{
+		deviceContext->IASetInputLayout(inputLayout.Get());
+		deviceContext->VSSetShader(shader.Get(), 0, 0);
+	}
 
 	// Set the constant buffers
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
-		// Skip "buffers" that aren't true constant buffers
-		if (constantBuffers[i].Type != D3D11_CT_CBUFFER)
+		// Skip "buffers" that aren't true constant buffers,
+		// and ones that get bound some other way
+		if (constantBuffers[i].Type != D3D11_CT_CBUFFER || constantBuffers[i].External)
 			continue;
 
 		// This is a real constant buffer, so set it
-		deviceContext->VSSetConstantBuffers(
-			constantBuffers[i].BindIndex,
-			1,
-			constantBuffers[i].ConstantBuffer.GetAddressOf());
+		if (StateCache)
+			StateCache->VSSetConstantBuffer(constantBuffers[i].BindIndex, constantBuffers[i].ConstantBuffer.Get());
+		else
+			deviceContext->VSSetConstantBuffers(
+				constantBuffers[i].BindIndex,
+				1,
+				constantBuffers[i].ConstantBuffer.GetAddressOf());
 	}
 }
 
@@ -911,7 +1021,10 @@ bool SimpleVertexShader::SetShaderResourceView(std::string name, Microsoft::WRL:
 	}
 
 	// Set the shader resource view
-	deviceContext->VSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
+	if (StateCache)
+		StateCache->VSSetShaderResource(srvInfo->BindIndex, srv.Get());
+	else
+		deviceContext->VSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
 
 	// Success
 	return true;
@@ -941,7 +1054,10 @@ bool SimpleVertexShader::SetSamplerState(std::string name, Microsoft::WRL::ComPt
 	}
 
 	// Set the shader resource view
-	deviceContext->VSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
+	if (StateCache)
+		StateCache->VSSetSampler(sampInfo->BindIndex, samplerState.Get());
+	else
+		deviceContext->VSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
 
 	// Success
 	return true;
@@ -1012,20 +1128,27 @@ void SimplePixelShader::SetShaderAndCBs()
 	if (!shaderValid) return;
 
 	// Set the shader
-	deviceContext->PSSetShader(shader.Get(), 0, 0);
+	if (StateCache)
+		StateCache->PSSetShader(shader.Get());
+	else
+		deviceContext->PSSetShader(shader.Get(), 0, 0);
 
 	// Set the constant buffers
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
-		// Skip "buffers" that aren't true constant buffers
-		if (constantBuffers[i].Type != D3D11_CT_CBUFFER)
+		// Skip "buffers" that aren't true constant buffers,
+		// and ones that get bound some other way
+		if (constantBuffers[i].Type != D3D11_CT_CBUFFER || constantBuffers[i].External)
 			continue;
 
 		// This is a real constant buffer, so set it
-		deviceContext->PSSetConstantBuffers(
-			constantBuffers[i].BindIndex,
-			1,
-			constantBuffers[i].ConstantBuffer.GetAddressOf());
+		if (StateCache)
+			StateCache->PSSetConstantBuffer(constantBuffers[i].BindIndex, constantBuffers[i].ConstantBuffer.Get());
+		else
+			deviceContext->PSSetConstantBuffers(
+				constantBuffers[i].BindIndex,
+				1,
+				constantBuffers[i].ConstantBuffer.GetAddressOf());
 	}
 }
 
@@ -1053,7 +1176,10 @@ bool SimplePixelShader::SetShaderResourceView(std::string name, Microsoft::WRL::
 	}
 
 	// Set the shader resource view
-	deviceContext->PSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
+	if (StateCache)
+		StateCache->PSSetShaderResource(srvInfo->BindIndex, srv.Get());
+	else
+		deviceContext->PSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
 
 	// Success
 	return true;
@@ -1083,7 +1209,10 @@ bool SimplePixelShader::SetSamplerState(std::string name, Microsoft::WRL::ComPtr
 	}
 
 	// Set the shader resource view
-	deviceContext->PSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
+	if (StateCache)
+		StateCache->PSSetSampler(sampInfo->BindIndex, samplerState.Get());
+	else
+		deviceContext->PSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
 
 	// Success
 	return true;
@@ -1161,8 +1290,9 @@ void SimpleDomainShader::SetShaderAndCBs()
 	// Set the constant buffers
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
-		// Skip "buffers" that aren't true constant buffers
-		if (constantBuffers[i].Type != D3D11_CT_CBUFFER)
+		// Skip "buffers" that aren't true constant buffers,
+		// and ones that get bound some other way
+		if (constantBuffers[i].Type != D3D11_CT_CBUFFER || constantBuffers[i].External)
 			continue;
 
 		// This is a real constant buffer, so set it
@@ -1304,8 +1434,9 @@ void SimpleHullShader::SetShaderAndCBs()
 	// Set the constant buffers?
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
-		// Skip "buffers" that aren't true constant buffers
-		if (constantBuffers[i].Type != D3D11_CT_CBUFFER)
+		// Skip "buffers" that aren't true constant buffers,
+		// and ones that get bound some other way
+		if (constantBuffers[i].Type != D3D11_CT_CBUFFER || constantBuffers[i].External)
 			continue;
 
 		// This is a real constant buffer, so set it
@@ -1578,8 +1709,9 @@ void SimpleGeometryShader::SetShaderAndCBs()
 	// Set the constant buffers?
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
-		// Skip "buffers" that aren't true constant buffers
-		if (constantBuffers[i].Type != D3D11_CT_CBUFFER)
+		// Skip "buffers" that aren't true constant buffers,
+		// and ones that get bound some other way
+		if (constantBuffers[i].Type != D3D11_CT_CBUFFER || constantBuffers[i].External)
 			continue;
 
 		// This is a real constant buffer, so set it
@@ -1788,8 +1920,9 @@ void SimpleComputeShader::SetShaderAndCBs()
 	// Set the constant buffers?
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
-		// Skip "buffers" that aren't true constant buffers
-		if (constantBuffers[i].Type != D3D11_CT_CBUFFER)
+		// Skip "buffers" that aren't true constant buffers,
+		// and ones that get bound some other way
+		if (constantBuffers[i].Type != D3D11_CT_CBUFFER || constantBuffers[i].External)
 			continue;
 
 		// This is a real constant buffer, so set it
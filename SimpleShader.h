@@ -7,10 +7,13 @@
 #include <DirectXMath.h>
 #include <wrl/client.h>
 
+#include <memory>
 #include <unordered_map>
 #include <vector>
 #include <string>
 
+#include "RenderStateCache.h"
+
 
 // --------------------------------------------------------
 // Used by simple shaders to store information about
@@ -23,6 +26,24 @@ struct SimpleShaderVariable
 	unsigned int ConstantBufferIndex;
 };
 
+// Constant buffer index of a handle that doesn't point at anything
+#define SIMPLE_SHADER_INVALID_HANDLE 0xFFFFFFFF
+
+// --------------------------------------------------------
+// Where a variable lives in a shader's constant buffers,
+// looked up by name once with GetVariableHandle() so the
+// setters that take it can skip hashing the name on every
+// call.  Only valid for the shader that returned it.
+// --------------------------------------------------------
+struct SimpleShaderVariableHandle
+{
+	unsigned int ByteOffset = 0;
+	unsigned int Size = 0;
+	unsigned int ConstantBufferIndex = SIMPLE_SHADER_INVALID_HANDLE;
+
+	bool IsValid() const { return ConstantBufferIndex != SIMPLE_SHADER_INVALID_HANDLE; }
+};
+
 // --------------------------------------------------------
 // Contains information about a specific
 // constant buffer in a shader, as well as
@@ -37,6 +58,28 @@ struct SimpleConstantBuffer
 	Microsoft::WRL::ComPtr<ID3D11Buffer> ConstantBuffer = 0;
 	unsigned char* LocalDataBuffer = 0;
 	std::vector<SimpleShaderVariable> Variables;
+
+	// The bytes of LocalDataBuffer that changed since the last
+	// upload, if DirtyEnd is past DirtyStart.  Setting a variable
+	// to what it already holds doesn't count as a change.
+	unsigned int DirtyStart = 0;
+	unsigned int DirtyEnd = 0;
+
+	// Bound by something else, like a ConstantBufferRing slot,
+	// so setting the shader leaves its register alone
+	bool External = false;
+};
+
+// --------------------------------------------------------
+// Counts of constant buffer uploads across every shader,
+// since the last ISimpleShader::ResetUploadStats()
+// --------------------------------------------------------
+struct SimpleShaderUploadStats
+{
+	unsigned int UploadsIssued = 0;			// Copies that called UpdateSubresource() because something changed
+	unsigned int UploadsSkipped = 0;		// Copies skipped because nothing had changed since the last upload
+	unsigned long long BytesChanged = 0;	// Size of the dirty ranges that were uploaded
+	unsigned long long BytesUploaded = 0;	// Size of the whole buffers that were uploaded, since D3D11 can't update part of one
 };
 
 // --------------------------------------------------------
@@ -75,6 +118,9 @@ public:
 	void CopyBufferData(unsigned int index);
 	void CopyBufferData(std::string bufferName);
 
+	// Hands a constant buffer's register over to code that binds its own buffer there
+	bool SetExternalConstantBuffer(std::string bufferName);
+
 	// Sets arbitrary shader data
 	bool SetData(std::string name, const void* data, unsigned int size);
 
@@ -89,6 +135,18 @@ public:
 	bool SetMatrix4x4(std::string name, const float data[16]);
 	bool SetMatrix4x4(std::string name, const DirectX::XMFLOAT4X4 data);
 
+	// Sets shader data through a handle from GetVariableHandle(), which is just a
+	// bounds check, compare and memcpy, inline so the copies are a known size
+	SimpleShaderVariableHandle GetVariableHandle(std::string name);
+	inline bool SetData(const SimpleShaderVariableHandle& handle, const void* data, unsigned int size);
+
+	bool SetInt(const SimpleShaderVariableHandle& handle, int data) { return SetData(handle, &data, sizeof(int)); }
+	bool SetFloat(const SimpleShaderVariableHandle& handle, float data) { return SetData(handle, &data, sizeof(float)); }
+	bool SetFloat2(const SimpleShaderVariableHandle& handle, const DirectX::XMFLOAT2& data) { return SetData(handle, &data, sizeof(float) * 2); }
+	bool SetFloat3(const SimpleShaderVariableHandle& handle, const DirectX::XMFLOAT3& data) { return SetData(handle, &data, sizeof(float) * 3); }
+	bool SetFloat4(const SimpleShaderVariableHandle& handle, const DirectX::XMFLOAT4& data) { return SetData(handle, &data, sizeof(float) * 4); }
+	bool SetMatrix4x4(const SimpleShaderVariableHandle& handle, const DirectX::XMFLOAT4X4& data) { return SetData(handle, &data, sizeof(float) * 16); }
+
 	// Setting shader resources
 	virtual bool SetShaderResourceView(std::string name, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) = 0;
 	virtual bool SetSamplerState(std::string name, Microsoft::WRL::ComPtr<ID3D11SamplerState> samplerState) = 0;
@@ -122,6 +180,14 @@ public:
 	static bool ReportErrors;
 	static bool ReportWarnings;
 
+	// Upload counting
+	static SimpleShaderUploadStats UploadStats;
+	static void ResetUploadStats() { UploadStats = SimpleShaderUploadStats(); }
+
+	// Vertex and pixel shaders set themselves and their resources through
+	// this when there is one, so calls that change nothing get dropped
+	static std::shared_ptr<RenderStateCache> StateCache;
+
 protected:
 
 	bool shaderValid;
@@ -153,6 +219,11 @@ protected:
 	// Helpers for finding data by name
 	SimpleShaderVariable* FindVariable(std::string name, int size);
 	SimpleConstantBuffer* FindConstantBuffer(std::string name);
+	void WarnInvalidHandle();
+
+	// Helpers for keeping track of what needs uploading
+	inline void WriteLocalData(unsigned int bufferIndex, unsigned int byteOffset, const void* data, unsigned int size);
+	void UploadBuffer(SimpleConstantBuffer* cb);
 
 	// Error logging
 	void Log(std::string message, WORD color);
@@ -165,6 +236,65 @@ protected:
 	void LogWarningW(std::wstring message);
 };
 
+// --------------------------------------------------------
+// Sets a variable through a handle with arbitrary data
+// of the specified size
+//
+// handle - The variable's handle from GetVariableHandle()
+// data - The data to set in the buffer
+// size - The size of the data (this must be less than or equal to the variable's size)
+//
+// Returns true if data is copied, false if the handle isn't
+// valid for this shader
+// --------------------------------------------------------
+inline bool ISimpleShader::SetData(const SimpleShaderVariableHandle& handle, const void* data, unsigned int size)
+{
+	// Invalid handles, handles from a different shader that
+	// wouldn't fit in this one's buffers and oversized data
+	// all fail the same way
+	if (handle.ConstantBufferIndex >= constantBufferCount ||
+		size > handle.Size ||
+		handle.ByteOffset + size > constantBuffers[handle.ConstantBufferIndex].Size)
+	{
+		WarnInvalidHandle();
+		return false;
+	}
+
+	// Set the data in the local data buffer
+	WriteLocalData(handle.ConstantBufferIndex, handle.ByteOffset, data, size);
+
+	// Success
+	return true;
+}
+
+// --------------------------------------------------------
+// Copies data into a local data buffer and grows the
+// buffer's dirty range to cover it, unless it's the same
+// as what's already there
+// --------------------------------------------------------
+inline void ISimpleShader::WriteLocalData(unsigned int bufferIndex, unsigned int byteOffset, const void* data, unsigned int size)
+{
+	SimpleConstantBuffer* cb = &constantBuffers[bufferIndex];
+	unsigned char* destination = cb->LocalDataBuffer + byteOffset;
+
+	// Nothing to upload if nothing changed
+	if (memcmp(destination, data, size) == 0)
+		return;
+
+	memcpy(destination, data, size);
+
+	if (cb->DirtyEnd <= cb->DirtyStart)
+	{
+		cb->DirtyStart = byteOffset;
+		cb->DirtyEnd = byteOffset + size;
+	}
+	else
+	{
+		if (byteOffset < cb->DirtyStart) cb->DirtyStart = byteOffset;
+		if (byteOffset + size > cb->DirtyEnd) cb->DirtyEnd = byteOffset + size;
+	}
+}
+
 // --------------------------------------------------------
 // Derived class for VERTEX shaders ///////////////////////
 // --------------------------------------------------------
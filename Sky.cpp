@@ -21,8 +21,9 @@ Sky::Sky(std::shared_ptr<Mesh> mesh, Microsoft::WRL::ComPtr<ID3D11SamplerState>
 
 	device->CreateDepthStencilState(&depthStencilDesc, depthStencil.GetAddressOf());
 
-	vs = std::make_shared<SimpleVertexShader>(device, context,
-		FixPath(L"SkyVertexShader.cso").c_str());
+	vs = Mesh::LoadVertexShader(device, context,
+		FixPath(L"SkyVertexShader.cso"), FixPath(L"PackedSkyVertexShader.cso"));
+	unpackHandles = Mesh::GetUnpackHandles(vs);
 	ps = std::make_shared<SimplePixelShader>(device, context,
 		FixPath(L"SkyPixelShader.cso").c_str());
 
@@ -37,10 +38,10 @@ Sky::Sky(std::shared_ptr<Mesh> mesh, Microsoft::WRL::ComPtr<ID3D11SamplerState>
 	);
 }
 
-void Sky::Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_ptr<Camera> camera)
+void Sky::Draw(std::shared_ptr<RenderStateCache> stateCache, std::shared_ptr<Camera> camera)
 {
-	context->RSSetState(rasterizer.Get());
-	context->OMSetDepthStencilState(depthStencil.Get(), 0);
+	stateCache->RSSetState(rasterizer.Get());
+	stateCache->OMSetDepthStencilState(depthStencil.Get(), 0);
 
 
 	vs->SetShader();
@@ -48,6 +49,7 @@ void Sky::Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_
 
 	vs->SetMatrix4x4("viewMatrix", camera->GetViewMatrix());
 	vs->SetMatrix4x4("projectionMatrix", camera->GetProjectionMatrix());
+	mesh->SetUnpackData(vs, unpackHandles);
 	vs->CopyAllBufferData();
 
 	ps->SetShaderResourceView("T_Sky", srv);
@@ -56,9 +58,8 @@ void Sky::Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_
 	// Set mesh buffers and draw
 	mesh->Draw();
 
-	// Reset my rasterizer state to the default
-	context->RSSetState(0); // Null (or 0) puts back the defaults
-	context->OMSetDepthStencilState(0, 0);
+	// No putting the default states back, since whatever draws
+	// next sets the states it needs and the cache drops the rest
 }
 
 
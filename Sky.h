@@ -19,7 +19,10 @@ public:
 
 	Sky(std::shared_ptr<Mesh> mesh, Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, const std::wstring& relativeFolderPath);
 
-	void Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_ptr<Camera> camera);
+	/// <summary>
+	/// Draws the sky with its own rasterizer and depth states, which stay set afterwards
+	/// </summary>
+	void Draw(std::shared_ptr<RenderStateCache> stateCache, std::shared_ptr<Camera> camera);
 
 
 private:
@@ -59,6 +62,7 @@ private:
 	std::shared_ptr<Mesh> mesh; //for the geometry to use when drawing the sky
 	std::shared_ptr<SimplePixelShader> ps; //for the sky - specific pixel shader
 	std::shared_ptr<SimpleVertexShader> vs; //for the sky - specific vertex shader
+	PackedVertexHandles unpackHandles; //where vs keeps the mesh's unpacking data
 
 
 
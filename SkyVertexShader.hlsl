@@ -5,6 +5,13 @@ cbuffer ExternalData : register(b0)
 {
     matrix viewMatrix;
     matrix projectionMatrix;
+
+#ifdef PACKED_VERTICES
+    float3 positionOffset;
+    float3 positionScale;
+    float2 uvOffset;
+    float2 uvScale;
+#endif
 }
 
 
@@ -15,8 +22,14 @@ cbuffer ExternalData : register(b0)
 // - Output is a single struct of data to pass down the pipeline
 // - Named "main" because that's the default the shader compiler looks for
 // --------------------------------------------------------
+#ifdef PACKED_VERTICES
+VertexToPixel_Sky main(PackedVertexShaderInput packedInput)
+{
+    VertexShaderInput input = UnpackVertex(packedInput, positionOffset, positionScale, uvOffset, uvScale);
+#else
 VertexToPixel_Sky main(VertexShaderInput input)
 {
+#endif
 	// Set up output struct
     VertexToPixel_Sky output;
 
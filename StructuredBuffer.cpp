@@ -0,0 +1,85 @@
+#include "StructuredBuffer.h"
+
+#include <cstring>
+
+StructuredBuffer::StructuredBuffer(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, unsigned int stride, unsigned int initialCount)
+{
+	this->device = device;
+	this->context = context;
+	this->stride = stride;
+	capacity = 0;
+	CreateBuffer(initialCount > 0 ? initialCount : 1);
+}
+
+void* StructuredBuffer::Map(unsigned int count)
+{
+	if (count > capacity)
+		CreateBuffer(count * 2);
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (!buffer || FAILED(context->Map(buffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return 0;
+	return mapped.pData;
+}
+
+void StructuredBuffer::Unmap()
+{
+	context->Unmap(buffer.Get(), 0);
+}
+
+bool StructuredBuffer::SetData(const void* data, unsigned int count)
+{
+	void* mapped = Map(count);
+	if (!mapped)
+		return false;
+	if (count > 0)
+		memcpy(mapped, data, (size_t)stride * count);
+	Unmap();
+	return true;
+}
+
+Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> StructuredBuffer::GetSRV()
+{
+	return srv;
+}
+
+unsigned int StructuredBuffer::GetStride()
+{
+	return stride;
+}
+
+unsigned int StructuredBuffer::GetCapacity()
+{
+	return capacity;
+}
+
+void StructuredBuffer::CreateBuffer(unsigned int count)
+{
+	D3D11_BUFFER_DESC desc = {};
+	desc.ByteWidth = stride * count;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.StructureByteStride = stride;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = count;
+
+	// Anything still bound keeps the old ones alive until it's rebound
+	buffer.Reset();
+	srv.Reset();
+	if (SUCCEEDED(device->CreateBuffer(&desc, 0, buffer.GetAddressOf())) &&
+		SUCCEEDED(device->CreateShaderResourceView(buffer.Get(), &srvDesc, srv.GetAddressOf())))
+	{
+		capacity = count;
+	}
+	else
+	{
+		buffer.Reset();
+		capacity = 0;
+	}
+}
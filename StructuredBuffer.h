@@ -0,0 +1,52 @@
+#pragma once
+
+#include <d3d11.h>
+#include <wrl/client.h>
+
+// --------------------------------------------------------
+// A dynamic structured buffer that shaders read through a
+// StructuredBuffer<T>, rewritten every frame
+//
+// Works like InstanceBuffer: Map() discards the old contents
+// and grows the buffer (to double what it needs) when the
+// elements don't fit.  Growing makes a new buffer, and so a
+// new view of it, so get GetSRV() again after mapping.
+// --------------------------------------------------------
+class StructuredBuffer
+{
+public:
+	StructuredBuffer(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, unsigned int stride, unsigned int initialCount);
+
+	/// <summary>
+	/// Discards the buffer and maps it for writing
+	/// </summary>
+	/// <param name="count">How many elements will be written</param>
+	/// <returns>Where element 0 goes, with each one stride bytes after the last, or null if mapping failed</returns>
+	void* Map(unsigned int count);
+
+	/// <summary>
+	/// Unmaps the buffer, which has to happen before a shader reads it
+	/// </summary>
+	void Unmap();
+
+	/// <summary>
+	/// Maps, copies count elements in and unmaps
+	/// </summary>
+	/// <returns>False if mapping failed</returns>
+	bool SetData(const void* data, unsigned int count);
+
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetSRV();
+	unsigned int GetStride();
+	unsigned int GetCapacity();
+
+private:
+
+	void CreateBuffer(unsigned int count);
+
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> buffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv;
+	unsigned int stride;
+	unsigned int capacity;
+};
@@ -0,0 +1,303 @@
+#include "TangentGenerator.h"
+
+#include <DirectXMath.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace DirectX;
+
+// The SIMD loop reads each position as four floats
+static_assert(offsetof(Vertex, Normal) == offsetof(Vertex, Position) + sizeof(XMFLOAT3), "Position must be followed by more floats");
+
+namespace
+{
+	// Adds each triangle's tangent to its three vertices, four triangles at a time.
+	// The math is the same as the scalar version, lane for lane and in the same order,
+	// and the sums happen in triangle order too, so the results are identical.
+	// "tangents" points at the first tangent to sum into, "tangentStride" bytes apart.
+	void AccumulateTangents(const Vertex* verts, const unsigned int* indices, int firstTriangle, int endTriangle, XMFLOAT3* tangents, size_t tangentStride)
+	{
+		char* tangentBytes = (char*)tangents;
+		int triangle = firstTriangle;
+
+		for (; triangle + 4 <= endTriangle; triangle += 4)
+		{
+			const unsigned int* tri = indices + triangle * 3;
+
+			// Edges of each triangle in position and uv space, one triangle per vector...
+			XMVECTOR edge1[4], edge2[4], uvEdges[4];
+			for (int k = 0; k < 4; k++)
+			{
+				const Vertex& v1 = verts[tri[k * 3 + 0]];
+				const Vertex& v2 = verts[tri[k * 3 + 1]];
+				const Vertex& v3 = verts[tri[k * 3 + 2]];
+
+				// Loading four floats grabs Normal.x too, but that lane is never used
+				XMVECTOR p1 = XMLoadFloat4((const XMFLOAT4*)&v1.Position);
+				edge1[k] = XMLoadFloat4((const XMFLOAT4*)&v2.Position) - p1;
+				edge2[k] = XMLoadFloat4((const XMFLOAT4*)&v3.Position) - p1;
+
+				XMVECTOR uv1 = XMLoadFloat2(&v1.UV);
+				uvEdges[k] = XMVectorMergeXY(XMLoadFloat2(&v2.UV) - uv1, XMLoadFloat2(&v3.UV) - uv1); // s1 s2 t1 t2
+			}
+
+			// ...then transposed so each vector holds one value for all four triangles
+			XMMATRIX e1 = XMMatrixTranspose(XMMATRIX(edge1[0], edge1[1], edge1[2], edge1[3]));
+			XMMATRIX e2 = XMMatrixTranspose(XMMATRIX(edge2[0], edge2[1], edge2[2], edge2[3]));
+			XMMATRIX uv = XMMatrixTranspose(XMMATRIX(uvEdges[0], uvEdges[1], uvEdges[2], uvEdges[3]));
+			XMVECTOR s1 = uv.r[0];
+			XMVECTOR s2 = uv.r[1];
+			XMVECTOR t1 = uv.r[2];
+			XMVECTOR t2 = uv.r[3];
+
+			XMVECTOR r = XMVectorReciprocal(s1 * t2 - s2 * t1);
+			XMFLOAT4A tx, ty, tz;
+			XMStoreFloat4A(&tx, (t2 * e1.r[0] - t1 * e2.r[0]) * r);
+			XMStoreFloat4A(&ty, (t2 * e1.r[1] - t1 * e2.r[1]) * r);
+			XMStoreFloat4A(&tz, (t2 * e1.r[2] - t1 * e2.r[2]) * r);
+
+			// The scatter is plain adds, in the same order as the scalar version
+			const float* x = &tx.x;
+			const float* y = &ty.x;
+			const float* z = &tz.x;
+			for (int k = 0; k < 4; k++)
+			{
+				for (int corner = 0; corner < 3; corner++)
+				{
+					XMFLOAT3* tangent = (XMFLOAT3*)(tangentBytes + tri[k * 3 + corner] * tangentStride);
+					tangent->x += x[k];
+					tangent->y += y[k];
+					tangent->z += z[k];
+				}
+			}
+		}
+
+		// Leftovers, one at a time
+		for (; triangle < endTriangle; triangle++)
+		{
+			const unsigned int* tri = indices + triangle * 3;
+			const Vertex& v1 = verts[tri[0]];
+			const Vertex& v2 = verts[tri[1]];
+			const Vertex& v3 = verts[tri[2]];
+
+			XMVECTOR p1 = XMLoadFloat3(&v1.Position);
+			XMVECTOR edge1 = XMLoadFloat3(&v2.Position) - p1;
+			XMVECTOR edge2 = XMLoadFloat3(&v3.Position) - p1;
+
+			float s1 = v2.UV.x - v1.UV.x;
+			float t1 = v2.UV.y - v1.UV.y;
+			float s2 = v3.UV.x - v1.UV.x;
+			float t2 = v3.UV.y - v1.UV.y;
+			float r = 1.0f / (s1 * t2 - s2 * t1);
+
+			XMVECTOR tangent = (edge1 * t2 - edge2 * t1) * r;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				XMFLOAT3* sum = (XMFLOAT3*)(tangentBytes + tri[corner] * tangentStride);
+				XMStoreFloat3(sum, XMLoadFloat3(sum) + tangent);
+			}
+		}
+	}
+
+	// Gram-Schmidt, so the normal and tangent are exactly 90 degrees apart
+	XMVECTOR Orthonormalize(XMVECTOR normal, XMVECTOR tangent)
+	{
+		return XMVector3Normalize(tangent - normal * XMVector3Dot(normal, tangent));
+	}
+
+	// Splits [0, count) into "parts" nearly even ranges and returns where "part" starts
+	int RangeStart(int count, unsigned int parts, unsigned int part)
+	{
+		return (int)((long long)count * part / parts);
+	}
+
+	double TrianglesPerSecond(int triangles, std::chrono::high_resolution_clock::duration time)
+	{
+		double seconds = std::chrono::duration<double>(time).count();
+		return seconds > 0.0 ? triangles / seconds : 0.0;
+	}
+}
+
+// Chris Cascioli's tangent code, citation in Mesh.h
+void GenerateTangentsScalar(Vertex* verts, int numVerts, const unsigned int* indices, int numIndices)
+{
+	// Reset tangents
+	for (int i = 0; i < numVerts; i++)
+	{
+		verts[i].Tangent = XMFLOAT3(0, 0, 0);
+	}
+
+	// Calculate tangents one whole triangle at a time
+	for (int i = 0; i < numIndices;)
+	{
+		// Grab indices and vertices of first triangle
+		unsigned int i1 = indices[i++];
+		unsigned int i2 = indices[i++];
+		unsigned int i3 = indices[i++];
+		Vertex* v1 = &verts[i1];
+		Vertex* v2 = &verts[i2];
+		Vertex* v3 = &verts[i3];
+
+		// Calculate vectors relative to triangle positions
+		float x1 = v2->Position.x - v1->Position.x;
+		float y1 = v2->Position.y - v1->Position.y;
+		float z1 = v2->Position.z - v1->Position.z;
+
+		float x2 = v3->Position.x - v1->Position.x;
+		float y2 = v3->Position.y - v1->Position.y;
+		float z2 = v3->Position.z - v1->Position.z;
+
+		// Do the same for vectors relative to triangle uv's
+		float s1 = v2->UV.x - v1->UV.x;
+		float t1 = v2->UV.y - v1->UV.y;
+
+		float s2 = v3->UV.x - v1->UV.x;
+		float t2 = v3->UV.y - v1->UV.y;
+
+		// Create vectors for tangent calculation
+		float r = 1.0f / (s1 * t2 - s2 * t1);
+
+		float tx = (t2 * x1 - t1 * x2) * r;
+		float ty = (t2 * y1 - t1 * y2) * r;
+		float tz = (t2 * z1 - t1 * z2) * r;
+
+		// Adjust tangents of each vert of the triangle
+		v1->Tangent.x += tx;
+		v1->Tangent.y += ty;
+		v1->Tangent.z += tz;
+
+		v2->Tangent.x += tx;
+		v2->Tangent.y += ty;
+		v2->Tangent.z += tz;
+
+		v3->Tangent.x += tx;
+		v3->Tangent.y += ty;
+		v3->Tangent.z += tz;
+	}
+
+	// Ensure all of the tangents are orthogonal to the normals
+	for (int i = 0; i < numVerts; i++)
+	{
+		XMVECTOR tangent = Orthonormalize(XMLoadFloat3(&verts[i].Normal), XMLoadFloat3(&verts[i].Tangent));
+		XMStoreFloat3(&verts[i].Tangent, tangent);
+	}
+}
+
+void GenerateTangents(Vertex* verts, int numVerts, const unsigned int* indices, int numIndices, unsigned int threadCount)
+{
+	int numTriangles = numIndices / 3;
+	if (numVerts <= 0 || numTriangles <= 0)
+		return;
+
+	// One thread can sum straight into the vertices, just like the scalar version
+	if (threadCount <= 1)
+	{
+		for (int i = 0; i < numVerts; i++)
+		{
+			verts[i].Tangent = XMFLOAT3(0, 0, 0);
+		}
+
+		AccumulateTangents(verts, indices, 0, numTriangles, &verts[0].Tangent, sizeof(Vertex));
+
+		for (int i = 0; i < numVerts; i++)
+		{
+			XMStoreFloat3(&verts[i].Tangent, Orthonormalize(XMLoadFloat3(&verts[i].Normal), XMLoadFloat3(&verts[i].Tangent)));
+		}
+		return;
+	}
+
+	// Otherwise every thread gets a slice of the triangles and its own set of sums,
+	// since welded vertices are shared between triangles that could land on any thread
+	std::vector<XMFLOAT3> sums((size_t)numVerts * threadCount, XMFLOAT3(0, 0, 0));
+	std::vector<std::thread> threads;
+
+	for (unsigned int t = 0; t < threadCount; t++)
+	{
+		threads.emplace_back([&, t]() {
+			AccumulateTangents(verts, indices,
+				RangeStart(numTriangles, threadCount, t), RangeStart(numTriangles, threadCount, t + 1),
+				&sums[(size_t)numVerts * t], sizeof(XMFLOAT3));
+		});
+	}
+	for (std::thread& thread : threads) thread.join();
+	threads.clear();
+
+	// Then each thread adds up every set for a slice of the vertices and finishes them off
+	for (unsigned int t = 0; t < threadCount; t++)
+	{
+		threads.emplace_back([&, t]() {
+			int end = RangeStart(numVerts, threadCount, t + 1);
+			for (int i = RangeStart(numVerts, threadCount, t); i < end; i++)
+			{
+				XMVECTOR tangent = XMLoadFloat3(&sums[i]);
+				for (unsigned int set = 1; set < threadCount; set++)
+				{
+					tangent += XMLoadFloat3(&sums[(size_t)numVerts * set + i]);
+				}
+
+				XMStoreFloat3(&verts[i].Tangent, Orthonormalize(XMLoadFloat3(&verts[i].Normal), tangent));
+			}
+		});
+	}
+	for (std::thread& thread : threads) thread.join();
+}
+
+unsigned int GetTangentThreadCount(int numIndices)
+{
+	if (numIndices / 3 < TANGENT_PARALLEL_MIN_TRIANGLES)
+		return 1;
+
+	// Each thread needs a whole copy of the tangent sums, so don't go overboard
+	unsigned int cores = std::thread::hardware_concurrency();
+	return std::min(std::max(cores, 1u), 8u);
+}
+
+TangentBenchmark BenchmarkTangents(const Vertex* verts, int numVerts, const unsigned int* indices, int numIndices, int repeats)
+{
+	TangentBenchmark results = {};
+	results.ThreadCount = std::min(std::max(std::thread::hardware_concurrency(), 2u), 8u);
+
+	int numTriangles = numIndices / 3;
+	std::vector<Vertex> scalar(verts, verts + numVerts);
+	std::vector<Vertex> simd(verts, verts + numVerts);
+	std::vector<Vertex> parallel(verts, verts + numVerts);
+
+	std::chrono::high_resolution_clock::duration bestScalar = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration bestSimd = bestScalar;
+	std::chrono::high_resolution_clock::duration bestParallel = bestScalar;
+
+	for (int i = 0; i < std::max(repeats, 1); i++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		GenerateTangentsScalar(&scalar[0], numVerts, indices, numIndices);
+		std::chrono::high_resolution_clock::time_point scalarEnd = std::chrono::high_resolution_clock::now();
+		GenerateTangents(&simd[0], numVerts, indices, numIndices, 1);
+		std::chrono::high_resolution_clock::time_point simdEnd = std::chrono::high_resolution_clock::now();
+		GenerateTangents(&parallel[0], numVerts, indices, numIndices, results.ThreadCount);
+		std::chrono::high_resolution_clock::time_point parallelEnd = std::chrono::high_resolution_clock::now();
+
+		bestScalar = std::min(bestScalar, scalarEnd - start);
+		bestSimd = std::min(bestSimd, simdEnd - scalarEnd);
+		bestParallel = std::min(bestParallel, parallelEnd - simdEnd);
+	}
+
+	results.ScalarTrianglesPerSecond = TrianglesPerSecond(numTriangles, bestScalar);
+	results.SimdTrianglesPerSecond = TrianglesPerSecond(numTriangles, bestSimd);
+	results.ParallelTrianglesPerSecond = TrianglesPerSecond(numTriangles, bestParallel);
+
+	results.SimdMatchesScalar = memcmp(&scalar[0], &simd[0], sizeof(Vertex) * numVerts) == 0;
+	for (int i = 0; i < numVerts; i++)
+	{
+		const XMFLOAT3& a = scalar[i].Tangent;
+		const XMFLOAT3& b = parallel[i].Tangent;
+		float difference = std::max(fabsf(a.x - b.x), std::max(fabsf(a.y - b.y), fabsf(a.z - b.z)));
+		results.ParallelMaxDifference = std::max(results.ParallelMaxDifference, difference);
+	}
+
+	return results;
+}
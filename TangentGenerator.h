@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Vertex.h"
+
+// Meshes with at least this many triangles get their tangents built on several threads
+#define TANGENT_PARALLEL_MIN_TRIANGLES 32768
+
+// Results of timing the tangent generators against each other on one mesh
+struct TangentBenchmark
+{
+	double ScalarTrianglesPerSecond;	// The original one-triangle-at-a-time loop
+	double SimdTrianglesPerSecond;		// Four triangles at a time, one thread
+	double ParallelTrianglesPerSecond;	// Four triangles at a time, on every thread
+	unsigned int ThreadCount;			// How many threads the parallel version used
+	bool SimdMatchesScalar;				// The single threaded SIMD results should be bit for bit identical
+	float ParallelMaxDifference;		// Largest difference of any tangent component vs. the scalar results
+};
+
+/// <summary>
+/// The original scalar tangent calculation, kept as the reference for testing and benchmarking
+/// </summary>
+void GenerateTangentsScalar(Vertex* verts, int numVerts, const unsigned int* indices, int numIndices);
+
+/// <summary>
+/// Calculates tangents four triangles at a time with DirectXMath. With one thread the results
+/// match GenerateTangentsScalar() exactly. With more, each thread sums into its own buffer and
+/// the buffers are added up afterwards, which rounds a little differently.
+/// </summary>
+/// <param name="threadCount">How many threads to use, like GetTangentThreadCount() returns</param>
+void GenerateTangents(Vertex* verts, int numVerts, const unsigned int* indices, int numIndices, unsigned int threadCount);
+
+/// <summary>
+/// Picks how many threads are worth using: 1 for small meshes, otherwise up to one per core
+/// </summary>
+unsigned int GetTangentThreadCount(int numIndices);
+
+/// <summary>
+/// Times all three generators on copies of the given vertices and compares their results
+/// </summary>
+/// <param name="repeats">How many times to run each one (the fastest run counts)</param>
+TangentBenchmark BenchmarkTangents(const Vertex* verts, int numVerts, const unsigned int* indices, int numIndices, int repeats);
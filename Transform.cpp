@@ -5,6 +5,11 @@ Transform::Transform() {
 	position = XMFLOAT3(0, 0, 0);
 	rotation = XMFLOAT3(0, 0, 0);
 	scale = XMFLOAT3(1, 1, 1);
+	orientation = XMFLOAT4(0, 0, 0, 1);
+	right = XMFLOAT3(1, 0, 0);
+	up = XMFLOAT3(0, 1, 0);
+	forward = XMFLOAT3(0, 0, 1);
+	orientationDirty = false;
 	XMStoreFloat4x4(&worldMatrix, XMMatrixIdentity());
 	XMStoreFloat4x4(&worldInverseTransposeMatrix, XMMatrixIdentity());
 	worldMatrixDirty = false;
@@ -25,12 +30,14 @@ void Transform::SetPosition(XMFLOAT3 position)
 void Transform::SetRotation(float pitch, float yaw, float roll)
 {
 	rotation = XMFLOAT3(pitch, yaw, roll);
+	orientationDirty = true;
 	worldMatrixDirty = true;
 }
 
 void Transform::SetRotation(XMFLOAT3 rotation)
 {
 	this->rotation = rotation;
+	orientationDirty = true;
 	worldMatrixDirty = true;
 }
 
@@ -61,37 +68,36 @@ XMFLOAT3 Transform::GetPitchYawRoll()
 	return rotation;
 }
 
-DirectX::XMFLOAT3 Transform::GetRight()
+XMFLOAT4 Transform::GetOrientation()
 {
-	XMVECTOR axis = XMVectorSet(1, 0, 0, 0);
-	XMVECTOR rotationVector = XMQuaternionRotationRollPitchYaw(rotation.x, rotation.y, rotation.z);
+	if (orientationDirty) {
+		UpdateOrientation();
+	}
+	return orientation;
+}
 
-	XMVECTOR direction = XMVector3Rotate(axis, rotationVector);
-	XMFLOAT3 returnValue;
-	XMStoreFloat3(&returnValue, direction);
-	return returnValue;
+DirectX::XMFLOAT3 Transform::GetRight()
+{
+	if (orientationDirty) {
+		UpdateOrientation();
+	}
+	return right;
 }
 
 DirectX::XMFLOAT3 Transform::GetUp()
 {
-	XMVECTOR axis = XMVectorSet(0, 1, 0, 0);
-	XMVECTOR rotationVector = XMQuaternionRotationRollPitchYaw(rotation.x, rotation.y, rotation.z);
-
-	XMVECTOR direction = XMVector3Rotate(axis, rotationVector);
-	XMFLOAT3 returnValue;
-	XMStoreFloat3(&returnValue, direction);
-	return returnValue;
+	if (orientationDirty) {
+		UpdateOrientation();
+	}
+	return up;
 }
 
 DirectX::XMFLOAT3 Transform::GetForward()
 {
-	XMVECTOR axis = XMVectorSet(0, 0, 1, 0);
-	XMVECTOR rotationVector = XMQuaternionRotationRollPitchYaw(rotation.x, rotation.y, rotation.z);
-
-	XMVECTOR direction = XMVector3Rotate(axis, rotationVector);
-	XMFLOAT3 returnValue;
-	XMStoreFloat3(&returnValue, direction);
-	return returnValue;
+	if (orientationDirty) {
+		UpdateOrientation();
+	}
+	return forward;
 }
 
 XMFLOAT3 Transform::GetScale()
@@ -118,7 +124,10 @@ XMFLOAT4X4 Transform::GetWorldInverseTransposeMatrix()
 void Transform::UpdateMatrices() {
 	worldMatrixDirty = false;
 	XMMATRIX positionMatrix = XMMatrixTranslation(position.x, position.y, position.z);
-	XMMATRIX rotationMatrix = XMMatrixRotationRollPitchYaw(rotation.x, rotation.y, rotation.z);
+	if (orientationDirty) {
+		UpdateOrientation();
+	}
+	XMMATRIX rotationMatrix = XMMatrixRotationQuaternion(XMLoadFloat4(&orientation));
 	XMMATRIX scaleMatrix = XMMatrixScaling(scale.x, scale.y, scale.z);
 
 	XMMATRIX world = scaleMatrix * rotationMatrix * positionMatrix;
@@ -128,6 +137,18 @@ void Transform::UpdateMatrices() {
 		XMMatrixInverse(0, XMMatrixTranspose(world)));
 }
 
+void Transform::UpdateOrientation() {
+	orientationDirty = false;
+	XMVECTOR quaternion = XMQuaternionRotationRollPitchYaw(rotation.x, rotation.y, rotation.z);
+	XMStoreFloat4(&orientation, quaternion);
+
+	// Rotating the x, y and z axes gives the rows of the rotation matrix
+	XMMATRIX rotationMatrix = XMMatrixRotationQuaternion(quaternion);
+	XMStoreFloat3(&right, rotationMatrix.r[0]);
+	XMStoreFloat3(&up, rotationMatrix.r[1]);
+	XMStoreFloat3(&forward, rotationMatrix.r[2]);
+}
+
 void Transform::MoveAbsolute(float x, float y, float z)
 {
 	position = XMFLOAT3(position.x + x, position.y + y, position.z + z);
@@ -142,25 +163,33 @@ void Transform::MoveAbsolute(XMFLOAT3 offset)
 
 void Transform::MoveRelative(float x, float y, float z)
 {
-	XMVECTOR absoluteMoveVector = XMVectorSet(x, y, z, 0);
-	XMVECTOR rotationVector = XMQuaternionRotationRollPitchYaw(rotation.x, rotation.y, rotation.z);
+	if (orientationDirty) {
+		UpdateOrientation();
+	}
 
-	XMVECTOR relativeMoveVector = XMVector3Rotate(absoluteMoveVector, rotationVector);
+	// Same as rotating (x, y, z) by the orientation, but without the quaternion math
+	XMVECTOR relativeMoveVector =
+		XMLoadFloat3(&right) * x +
+		XMLoadFloat3(&up) * y +
+		XMLoadFloat3(&forward) * z;
 
 	XMVECTOR newPosition = XMLoadFloat3(&position);
 	newPosition += relativeMoveVector;
 	XMStoreFloat3(&position, newPosition);
+	worldMatrixDirty = true;
 }
 
 void Transform::Rotate(float pitch, float yaw, float roll)
 {
 	rotation = XMFLOAT3(rotation.x + pitch, rotation.y + yaw, rotation.z + roll);
+	orientationDirty = true;
 	worldMatrixDirty = true;
 }
 
 void Transform::Rotate(XMFLOAT3 rotation)
 {
 	this->rotation = XMFLOAT3(this->rotation.x + rotation.x, this->rotation.y + rotation.y, this->rotation.z + rotation.z);
+	orientationDirty = true;
 	worldMatrixDirty = true;
 }
 
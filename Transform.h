@@ -18,6 +18,7 @@ public:
 	DirectX::XMFLOAT3 GetPosition();
 	float* GetPositionPointer();
 	DirectX::XMFLOAT3 GetPitchYawRoll();
+	DirectX::XMFLOAT4 GetOrientation();
 	DirectX::XMFLOAT3 GetRight();
 	DirectX::XMFLOAT3 GetUp();
 	DirectX::XMFLOAT3 GetForward();
@@ -39,10 +40,19 @@ public:
 private:
 
 	void UpdateMatrices();
+	void UpdateOrientation();
 
 	DirectX::XMFLOAT3 position;
 
+	// Pitch, yaw and roll are what gets set, but everything that
+	// uses the rotation works off of this quaternion and the basis
+	// vectors, rebuilt only after the rotation changes
 	DirectX::XMFLOAT3 rotation;
+	DirectX::XMFLOAT4 orientation;
+	DirectX::XMFLOAT3 right;
+	DirectX::XMFLOAT3 up;
+	DirectX::XMFLOAT3 forward;
+	bool orientationDirty;
 
 	DirectX::XMFLOAT3 scale;
 
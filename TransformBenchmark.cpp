@@ -0,0 +1,381 @@
+#include "TransformBenchmark.h"
+#include "TransformSystem.h"
+#include "Transform.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	// Benchmarks add the matrices they read into this, so the reads can't be optimized away
+	volatile float benchmarkSink;
+
+	float MaxDifference(const XMFLOAT4X4& a, const XMFLOAT4X4& b)
+	{
+		float difference = 0.0f;
+		for (int row = 0; row < 4; row++)
+		{
+			for (int column = 0; column < 4; column++)
+			{
+				difference = std::max(difference, fabsf(a.m[row][column] - b.m[row][column]));
+			}
+		}
+		return difference;
+	}
+}
+
+TransformBenchmark BenchmarkTransforms(unsigned int count, unsigned int movingStride, int repeats)
+{
+	TransformBenchmark results = {};
+	results.Count = count;
+	movingStride = std::max(movingStride, 1u);
+
+	// Scattered starting values, the same for both
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> positionRange(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> angleRange(-XM_PI, XM_PI);
+	std::uniform_real_distribution<float> scaleRange(0.5f, 2.0f);
+
+	std::vector<XMFLOAT3> positions(count);
+	std::vector<XMFLOAT3> rotations(count);
+	std::vector<XMFLOAT3> scales(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		positions[i] = XMFLOAT3(positionRange(random), positionRange(random), positionRange(random));
+		rotations[i] = XMFLOAT3(angleRange(random), angleRange(random), angleRange(random));
+		scales[i] = XMFLOAT3(scaleRange(random), scaleRange(random), scaleRange(random));
+	}
+
+	// Laid out like Game's entities, each with its own heap allocated Transform
+	std::vector<std::shared_ptr<Transform>> objects(count);
+	TransformSystem system;
+	system.Reserve(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		objects[i] = std::make_shared<Transform>();
+		system.Create();
+	}
+
+	std::chrono::high_resolution_clock::duration bestPerObject = std::chrono::high_resolution_clock::duration::max();
+	std::chrono::high_resolution_clock::duration bestSystem = bestPerObject;
+	float sink = 0.0f;
+
+	// Frame 0 sets everything up, the rest only change the moving ones
+	for (int frame = 0; frame <= std::max(repeats, 1); frame++)
+	{
+		for (unsigned int i = 0; frame > 0 && i < count; i += movingStride)
+		{
+			positions[i].y += 0.01f;
+			rotations[i].y += 0.01f;
+		}
+
+		// Like Game::Update(), everything gets set every frame whether it moved or not,
+		// then Draw() grabs both matrices of every object
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < count; i++)
+		{
+			objects[i]->SetPosition(positions[i]);
+			objects[i]->SetRotation(rotations[i]);
+			objects[i]->SetScale(scales[i]);
+		}
+		for (unsigned int i = 0; i < count; i++)
+		{
+			sink += objects[i]->GetWorldMatrix().m[3][0] + objects[i]->GetWorldInverseTransposeMatrix().m[0][3];
+		}
+
+		std::chrono::high_resolution_clock::time_point perObjectEnd = std::chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < count; i++)
+		{
+			system.SetPosition(i, positions[i]);
+			system.SetRotation(i, rotations[i]);
+			system.SetScale(i, scales[i]);
+		}
+		system.UpdateMatrices();
+		for (unsigned int i = 0; i < count; i++)
+		{
+			sink += system.GetWorldMatrix(i).m[3][0] + system.GetWorldInverseTransposeMatrix(i).m[0][3];
+		}
+		std::chrono::high_resolution_clock::time_point systemEnd = std::chrono::high_resolution_clock::now();
+
+		if (frame > 0)
+		{
+			bestPerObject = std::min(bestPerObject, perObjectEnd - start);
+			bestSystem = std::min(bestSystem, systemEnd - perObjectEnd);
+		}
+	}
+
+	results.MovingCount = (count + movingStride - 1) / movingStride;
+	results.PerObjectMilliseconds = std::chrono::duration<double, std::milli>(bestPerObject).count();
+	results.SystemMilliseconds = std::chrono::duration<double, std::milli>(bestSystem).count();
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		results.MaxDifference = std::max(results.MaxDifference, MaxDifference(objects[i]->GetWorldMatrix(), system.GetWorldMatrix(i)));
+		results.MaxDifference = std::max(results.MaxDifference, MaxDifference(objects[i]->GetWorldInverseTransposeMatrix(), system.GetWorldInverseTransposeMatrix(i)));
+	}
+
+	benchmarkSink = sink;
+	return results;
+}
+
+HierarchyBenchmark BenchmarkTransformHierarchy(unsigned int count, unsigned int changedCount, int repeats)
+{
+	HierarchyBenchmark results = {};
+	results.Count = count;
+	results.ChangedCount = changedCount = std::min(std::max(changedCount, 1u), count);
+
+	// A tree where every transform has four children
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> offsetRange(-2.0f, 2.0f);
+	std::uniform_real_distribution<float> angleRange(-XM_PI, XM_PI);
+	std::uniform_real_distribution<float> scaleRange(0.9f, 1.1f);
+
+	TransformSystem system;
+	system.Reserve(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		system.Create(i == 0 ? TRANSFORM_NONE : (i - 1) / 4);
+		system.SetPosition(i, XMFLOAT3(offsetRange(random), offsetRange(random), offsetRange(random)));
+		system.SetRotation(i, XMFLOAT3(angleRange(random), angleRange(random), angleRange(random)));
+		system.SetScale(i, XMFLOAT3(scaleRange(random), scaleRange(random), scaleRange(random)));
+	}
+	system.UpdateMatrices();
+
+	std::chrono::high_resolution_clock::duration best = std::chrono::high_resolution_clock::duration::max();
+	for (int frame = 0; frame < std::max(repeats, 1); frame++)
+	{
+		for (unsigned int k = 0; k < changedCount; k++)
+		{
+			// Counting back from the end, so the changes are mostly leaves and not the root
+			unsigned int index = count - 1 - (unsigned int)((unsigned long long)k * count / changedCount);
+			XMFLOAT3 position = system.GetPosition(index);
+			position.y += 0.01f;
+			system.SetPosition(index, position);
+		}
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		results.RebuiltCount = system.UpdateMatrices();
+		best = std::min(best, std::chrono::high_resolution_clock::now() - start);
+	}
+
+	results.UpdateMilliseconds = std::chrono::duration<double, std::milli>(best).count();
+	return results;
+}
+
+namespace
+{
+	// Transform's rotation math from before it cached anything
+	struct UncachedTransform
+	{
+		XMFLOAT3 position;
+		XMFLOAT3 rotation;
+
+		XMFLOAT3 RotateAxis(XMVECTOR axis)
+		{
+			XMFLOAT3 direction;
+			XMStoreFloat3(&direction, XMVector3Rotate(axis, XMQuaternionRotationRollPitchYaw(rotation.x, rotation.y, rotation.z)));
+			return direction;
+		}
+
+		void MoveRelative(float x, float y, float z)
+		{
+			XMVECTOR move = XMVector3Rotate(XMVectorSet(x, y, z, 0), XMQuaternionRotationRollPitchYaw(rotation.x, rotation.y, rotation.z));
+			XMStoreFloat3(&position, XMLoadFloat3(&position) + move);
+		}
+	};
+
+	float MaxDifference(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return std::max(fabsf(a.x - b.x), std::max(fabsf(a.y - b.y), fabsf(a.z - b.z)));
+	}
+}
+
+BasisBenchmark BenchmarkTransformBasis(int frames, bool rotateEveryFrame)
+{
+	BasisBenchmark results = {};
+	frames = std::max(frames, 1);
+
+	const XMFLOAT3 startPosition(0, 2, -10);
+	const XMFLOAT3 startRotation(0.2f, 0.5f, 0);
+	const float step = 0.01f;
+	const float turn = 0.0001f;
+
+	// Each frame holds W and D, then builds the view matrix's inputs, like Camera::Update()
+	UncachedTransform uncached = { startPosition, startRotation };
+	XMFLOAT3 uncachedForward, uncachedUp;
+	float sink = 0.0f;
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		if (rotateEveryFrame)
+			uncached.rotation = XMFLOAT3(uncached.rotation.x + turn, uncached.rotation.y + turn, uncached.rotation.z);
+
+		uncached.MoveRelative(0, 0, step);
+		uncached.MoveRelative(step, 0, 0);
+		uncachedForward = uncached.RotateAxis(XMVectorSet(0, 0, 1, 0));
+		uncachedUp = uncached.RotateAxis(XMVectorSet(0, 1, 0, 0));
+		sink += uncachedForward.x + uncachedUp.y;
+	}
+	std::chrono::high_resolution_clock::time_point uncachedEnd = std::chrono::high_resolution_clock::now();
+
+	Transform cached;
+	cached.SetPosition(startPosition);
+	cached.SetRotation(startRotation);
+	XMFLOAT3 cachedForward, cachedUp;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		if (rotateEveryFrame)
+			cached.Rotate(turn, turn, 0);
+
+		cached.MoveRelative(0, 0, step);
+		cached.MoveRelative(step, 0, 0);
+		cachedForward = cached.GetForward();
+		cachedUp = cached.GetUp();
+		sink += cachedForward.x + cachedUp.y;
+	}
+	std::chrono::high_resolution_clock::time_point cachedEnd = std::chrono::high_resolution_clock::now();
+
+	results.UncachedNanoseconds = std::chrono::duration<double, std::nano>(uncachedEnd - start).count() / frames;
+	results.CachedNanoseconds = std::chrono::duration<double, std::nano>(cachedEnd - uncachedEnd).count() / frames;
+	results.MaxDifference = std::max(MaxDifference(uncached.position, cached.GetPosition()),
+		std::max(MaxDifference(uncachedForward, cachedForward), MaxDifference(uncachedUp, cachedUp)));
+
+	benchmarkSink = sink;
+	return results;
+}
+
+namespace
+{
+	// One chain's worth of local values, with each world matrix multiplied out the slow way
+	struct ReferenceChain
+	{
+		std::vector<unsigned int> indices;
+		std::vector<XMFLOAT3> positions, rotations, scales;
+
+		float MaxDifference(TransformSystem& system)
+		{
+			XMMATRIX parent = XMMatrixIdentity();
+			float difference = 0.0f;
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				XMMATRIX local =
+					XMMatrixScaling(scales[i].x, scales[i].y, scales[i].z) *
+					XMMatrixRotationRollPitchYaw(rotations[i].x, rotations[i].y, rotations[i].z) *
+					XMMatrixTranslation(positions[i].x, positions[i].y, positions[i].z);
+				XMMATRIX world = local * parent;
+				parent = world;
+
+				XMFLOAT4X4 expectedWorld, expectedInverseTranspose;
+				XMStoreFloat4x4(&expectedWorld, world);
+				XMStoreFloat4x4(&expectedInverseTranspose, XMMatrixInverse(nullptr, XMMatrixTranspose(world)));
+				const XMFLOAT4X4& actualWorld = system.GetWorldMatrix(indices[i]);
+				const XMFLOAT4X4& actualInverseTranspose = system.GetWorldInverseTransposeMatrix(indices[i]);
+				for (int row = 0; row < 4; row++)
+				{
+					for (int column = 0; column < 4; column++)
+					{
+						difference = std::max(difference, fabsf(actualWorld.m[row][column] - expectedWorld.m[row][column]));
+						difference = std::max(difference, fabsf(actualInverseTranspose.m[row][column] - expectedInverseTranspose.m[row][column]));
+					}
+				}
+			}
+			return difference;
+		}
+	};
+
+	// Whose world matrices the last update rebuilt, as a sorted list
+	std::vector<unsigned int> GetChangedIndices(TransformSystem& system)
+	{
+		std::vector<unsigned int> changedIndices;
+		for (unsigned int i = 0; i < system.GetCount(); i++)
+		{
+			if (system.WorldMatrixChanged(i))
+				changedIndices.push_back(i);
+		}
+		return changedIndices;
+	}
+}
+
+HierarchyChecks CheckTransformHierarchy(unsigned int depth)
+{
+	HierarchyChecks results = {};
+	depth = std::max(depth, 3u);
+	results.Depth = depth;
+
+	// Small turns and offsets with scales close to 1, so the ends of the chains stay
+	// a reasonable size, and a few non-uniform scales to keep the inverse transposes honest
+	std::mt19937 random(9);
+	std::uniform_real_distribution<float> positionRange(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> angleRange(-0.1f, 0.1f);
+	std::uniform_real_distribution<float> scaleRange(0.99f, 1.01f);
+
+	// The first chain takes consecutive indices. The second is threaded through
+	// every 64th one, with unrelated roots in between, so each of its links is
+	// found in a later dirty bit word than its parent.
+	TransformSystem system;
+	ReferenceChain chains[2];
+	unsigned int total = depth * 64 + depth;
+	system.Reserve(total);
+	for (unsigned int i = 0; i < depth; i++)
+		chains[0].indices.push_back(system.Create(i == 0 ? TRANSFORM_NONE : chains[0].indices.back()));
+	while (system.GetCount() < total)
+	{
+		unsigned int next = system.GetCount();
+		bool inChain = (next - depth) % 64 == 0 && chains[1].indices.size() < depth;
+		unsigned int parent = inChain && !chains[1].indices.empty() ? chains[1].indices.back() : TRANSFORM_NONE;
+		unsigned int index = system.Create(parent);
+		if (inChain)
+			chains[1].indices.push_back(index);
+	}
+
+	for (ReferenceChain& chain : chains)
+	{
+		for (size_t i = 0; i < chain.indices.size(); i++)
+		{
+			chain.positions.push_back(XMFLOAT3(positionRange(random), positionRange(random), positionRange(random)));
+			chain.rotations.push_back(XMFLOAT3(angleRange(random), angleRange(random), angleRange(random)));
+			chain.scales.push_back(i % 7 == 0 ? XMFLOAT3(scaleRange(random), scaleRange(random), scaleRange(random)) : XMFLOAT3(1, 1, 1));
+			system.SetPosition(chain.indices[i], chain.positions[i]);
+			system.SetRotation(chain.indices[i], chain.rotations[i]);
+			system.SetScale(chain.indices[i], chain.scales[i]);
+		}
+	}
+	system.UpdateMatrices();
+
+	results.RootRebuildsChain = true;
+	results.MiddleRebuildsBelow = true;
+	results.LeafRebuildsOnlyLeaf = true;
+	results.NothingWhenUnchanged = true;
+
+	for (ReferenceChain& chain : chains)
+	{
+		// Moves one link, then checks exactly it and the links after it were rebuilt
+		auto moveLink = [&](size_t link) {
+			chain.positions[link].x += 0.5f;
+			system.SetPosition(chain.indices[link], chain.positions[link]);
+			unsigned int rebuilt = system.UpdateMatrices();
+			std::vector<unsigned int> expected(chain.indices.begin() + link, chain.indices.end());
+			std::sort(expected.begin(), expected.end());
+			return rebuilt == expected.size() && GetChangedIndices(system) == expected;
+		};
+
+		results.RootRebuildsChain = moveLink(0) && results.RootRebuildsChain;
+		results.MiddleRebuildsBelow = moveLink(depth / 2) && results.MiddleRebuildsBelow;
+		results.LeafRebuildsOnlyLeaf = moveLink(depth - 1) && results.LeafRebuildsOnlyLeaf;
+		results.NothingWhenUnchanged = system.UpdateMatrices() == 0 && GetChangedIndices(system).empty() && results.NothingWhenUnchanged;
+
+		results.MaxDifference = std::max(results.MaxDifference, chain.MaxDifference(system));
+	}
+
+	// Every link multiplies in another matrix's worth of rounding
+	results.MatchesReference = results.MaxDifference <= depth * 1e-6f;
+	return results;
+}
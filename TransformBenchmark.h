@@ -0,0 +1,71 @@
+#pragma once
+
+// Results of timing TransformSystem against a Transform per object
+struct TransformBenchmark
+{
+	unsigned int Count;				// How many transforms
+	unsigned int MovingCount;		// How many of them change every frame
+	double PerObjectMilliseconds;	// Set*() then Get*Matrix() on a shared_ptr<Transform> each, like Game::Update() and Draw()
+	double SystemMilliseconds;		// The same Set*() calls on a TransformSystem, then one UpdateMatrices()
+	float MaxDifference;			// Largest difference of any matrix element between the two
+};
+
+/// <summary>
+/// Times a frame's worth of transform updates both ways and compares the resulting matrices
+/// </summary>
+/// <param name="count">How many transforms</param>
+/// <param name="movingStride">Every movingStride-th transform changes each frame (1 for all of them)</param>
+/// <param name="repeats">How many frames to run each way (the fastest one counts)</param>
+TransformBenchmark BenchmarkTransforms(unsigned int count, unsigned int movingStride, int repeats);
+
+// Results of timing UpdateMatrices() on a hierarchy where only a few transforms change
+struct HierarchyBenchmark
+{
+	unsigned int Count;				// How many transforms, in a tree four children wide
+	unsigned int ChangedCount;		// How many of them got a new position each frame
+	unsigned int RebuiltCount;		// How many world matrices that caused to be rebuilt
+	double UpdateMilliseconds;		// Time for UpdateMatrices()
+};
+
+/// <summary>
+/// Builds a tree of transforms, then times UpdateMatrices() after changing a few of them
+/// </summary>
+/// <param name="count">How many transforms</param>
+/// <param name="changedCount">How many to change each frame, spread evenly through the tree</param>
+/// <param name="repeats">How many frames to run (the fastest one counts)</param>
+HierarchyBenchmark BenchmarkTransformHierarchy(unsigned int count, unsigned int changedCount, int repeats);
+
+// Results of timing what Camera::Update() asks of its Transform each frame
+struct BasisBenchmark
+{
+	double UncachedNanoseconds;	// Per frame, rebuilding the quaternion from pitch, yaw and roll on every call like Transform used to
+	double CachedNanoseconds;	// Per frame, with Transform's cached quaternion and basis vectors
+	float MaxDifference;		// Largest difference in the final position, forward or up between the two
+};
+
+/// <summary>
+/// Moves and turns a Transform like a camera would, with and without its cached orientation
+/// </summary>
+/// <param name="frames">How many frames to simulate</param>
+/// <param name="rotateEveryFrame">Whether the camera is also being turned every frame (like dragging the mouse)</param>
+BasisBenchmark BenchmarkTransformBasis(int frames, bool rotateEveryFrame);
+
+// Results of checking UpdateMatrices() on long chains of parents and children
+struct HierarchyChecks
+{
+	unsigned int Depth;				// How many transforms in each chain
+	float MaxDifference;			// Largest difference of any world or inverse transpose matrix element from multiplying the chain out by hand
+	bool MatchesReference;			// MaxDifference is within a millionth per link
+	bool RootRebuildsChain;			// Moving the root rebuilt every transform in the chain, and nothing else
+	bool MiddleRebuildsBelow;		// Moving one in the middle rebuilt it and everything after it, but nothing before it
+	bool LeafRebuildsOnlyLeaf;		// Moving the last one rebuilt only that one
+	bool NothingWhenUnchanged;		// An update with nothing set rebuilt nothing
+};
+
+/// <summary>
+/// Builds chains of transforms where each one is the parent of the next, one made of consecutive
+/// indices and one threaded through every 64th index (so each link is in the next dirty bit word),
+/// then moves transforms along them and compares the matrices and rebuild counts with what they should be
+/// </summary>
+/// <param name="depth">How many transforms in each chain</param>
+HierarchyChecks CheckTransformHierarchy(unsigned int depth);
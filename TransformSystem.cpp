@@ -0,0 +1,337 @@
+#include "TransformSystem.h"
+#include "BitScan.h"
+
+#include <algorithm>
+
+using namespace DirectX;
+
+namespace
+{
+	unsigned int CountBits(unsigned long long bits)
+	{
+		bits = bits - ((bits >> 1) & 0x5555555555555555ull);
+		bits = (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+		bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		return (unsigned int)((bits * 0x0101010101010101ull) >> 56);
+	}
+
+	void SetBit(std::vector<unsigned long long>& bits, unsigned int index)
+	{
+		bits[index >> 6] |= 1ull << (index & 63);
+	}
+
+	unsigned int RoundUpToBlock(unsigned int count)
+	{
+		return (count + 3) & ~3u;
+	}
+
+	// Takes one row of four matrices, stored as one vector per column (one lane per matrix),
+	// and writes it into each matrix
+	void StoreRows(XMFLOAT4X4* matrices[4], int row, XMVECTOR column0, XMVECTOR column1, XMVECTOR column2, XMVECTOR column3)
+	{
+		XMMATRIX rows = XMMatrixTranspose(XMMATRIX(column0, column1, column2, column3));
+		for (int k = 0; k < 4; k++)
+		{
+			XMStoreFloat4((XMFLOAT4*)matrices[k]->m[row], rows.r[k]);
+		}
+	}
+}
+
+TransformSystem::TransformSystem()
+{
+	dirtyCount = 0;
+	anyChanged = false;
+	count = 0;
+}
+
+unsigned int TransformSystem::Create(unsigned int parent)
+{
+	// Grow every array by a whole block of four at a time
+	if (count == positionX.size())
+	{
+		unsigned int padded = count + 4;
+		positionX.resize(padded, 0.0f);
+		positionY.resize(padded, 0.0f);
+		positionZ.resize(padded, 0.0f);
+		pitch.resize(padded, 0.0f);
+		yaw.resize(padded, 0.0f);
+		roll.resize(padded, 0.0f);
+		scaleX.resize(padded, 1.0f);
+		scaleY.resize(padded, 1.0f);
+		scaleZ.resize(padded, 1.0f);
+
+		XMFLOAT4X4 identity;
+		XMStoreFloat4x4(&identity, XMMatrixIdentity());
+		localMatrices.resize(padded, identity);
+		localInverseTransposeMatrices.resize(padded, identity);
+		worldMatrices.resize(padded, identity);
+		worldInverseTransposeMatrices.resize(padded, identity);
+
+		localDirty.resize((padded + 63) / 64, 0);
+		worldDirty.resize((padded + 63) / 64, 0);
+		linked.resize((padded + 63) / 64, 0);
+		changed.resize((padded + 63) / 64, 0);
+	}
+
+	unsigned int index = count++;
+	parents.push_back(parent);
+	firstChildren.push_back(TRANSFORM_NONE);
+	nextSiblings.push_back(TRANSFORM_NONE);
+
+	// The defaults already match the identity matrices, so a root starts out clean,
+	// but a child needs its parent's world matrix
+	if (parent != TRANSFORM_NONE)
+	{
+		nextSiblings[index] = firstChildren[parent];
+		firstChildren[parent] = index;
+		SetBit(linked, parent);
+		SetBit(linked, index);
+		MarkDirty(index);
+	}
+	return index;
+}
+
+unsigned int TransformSystem::GetCount()
+{
+	return count;
+}
+
+void TransformSystem::Reserve(unsigned int count)
+{
+	unsigned int padded = RoundUpToBlock(count);
+	positionX.reserve(padded);
+	positionY.reserve(padded);
+	positionZ.reserve(padded);
+	pitch.reserve(padded);
+	yaw.reserve(padded);
+	roll.reserve(padded);
+	scaleX.reserve(padded);
+	scaleY.reserve(padded);
+	scaleZ.reserve(padded);
+	parents.reserve(count);
+	firstChildren.reserve(count);
+	nextSiblings.reserve(count);
+	localMatrices.reserve(padded);
+	localInverseTransposeMatrices.reserve(padded);
+	worldMatrices.reserve(padded);
+	worldInverseTransposeMatrices.reserve(padded);
+	localDirty.reserve((padded + 63) / 64);
+	worldDirty.reserve((padded + 63) / 64);
+	linked.reserve((padded + 63) / 64);
+	changed.reserve((padded + 63) / 64);
+}
+
+unsigned int TransformSystem::GetParent(unsigned int index)
+{
+	return parents[index];
+}
+
+void TransformSystem::SetPosition(unsigned int index, XMFLOAT3 position)
+{
+	if (positionX[index] == position.x && positionY[index] == position.y && positionZ[index] == position.z)
+		return;
+
+	positionX[index] = position.x;
+	positionY[index] = position.y;
+	positionZ[index] = position.z;
+	MarkDirty(index);
+}
+
+void TransformSystem::SetRotation(unsigned int index, XMFLOAT3 pitchYawRoll)
+{
+	if (pitch[index] == pitchYawRoll.x && yaw[index] == pitchYawRoll.y && roll[index] == pitchYawRoll.z)
+		return;
+
+	pitch[index] = pitchYawRoll.x;
+	yaw[index] = pitchYawRoll.y;
+	roll[index] = pitchYawRoll.z;
+	MarkDirty(index);
+}
+
+void TransformSystem::SetScale(unsigned int index, XMFLOAT3 scale)
+{
+	if (scaleX[index] == scale.x && scaleY[index] == scale.y && scaleZ[index] == scale.z)
+		return;
+
+	scaleX[index] = scale.x;
+	scaleY[index] = scale.y;
+	scaleZ[index] = scale.z;
+	MarkDirty(index);
+}
+
+XMFLOAT3 TransformSystem::GetPosition(unsigned int index)
+{
+	return XMFLOAT3(positionX[index], positionY[index], positionZ[index]);
+}
+
+XMFLOAT3 TransformSystem::GetPitchYawRoll(unsigned int index)
+{
+	return XMFLOAT3(pitch[index], yaw[index], roll[index]);
+}
+
+XMFLOAT3 TransformSystem::GetScale(unsigned int index)
+{
+	return XMFLOAT3(scaleX[index], scaleY[index], scaleZ[index]);
+}
+
+const XMFLOAT4X4& TransformSystem::GetWorldMatrix(unsigned int index)
+{
+	return worldMatrices[index];
+}
+
+const XMFLOAT4X4& TransformSystem::GetWorldInverseTransposeMatrix(unsigned int index)
+{
+	return worldInverseTransposeMatrices[index];
+}
+
+unsigned int TransformSystem::UpdateMatrices()
+{
+	// Forget what changed last time, even if nothing changes this time
+	if (anyChanged)
+	{
+		std::fill(changed.begin(), changed.end(), 0ull);
+		anyChanged = false;
+	}
+
+	if (dirtyCount == 0)
+		return 0;
+	anyChanged = true;
+
+	// Transforms outside the hierarchy are done after the first step, so they're counted here
+	unsigned int rebuilt = 0;
+
+	// First the local matrices of everything that changed...
+	for (size_t word = 0; word < localDirty.size(); word++)
+	{
+		unsigned long long bits = localDirty[word];
+		if (bits == 0)
+			continue;
+		localDirty[word] = 0;
+		worldDirty[word] |= bits & linked[word];
+		changed[word] |= bits;
+		rebuilt += CountBits(bits & ~linked[word]);
+
+		// Any dirty transform in a block of four rebuilds the whole block,
+		// which doesn't change the clean ones since their inputs are the same
+		for (unsigned int block = 0; block < 64 && (bits >> block) != 0; block += 4)
+		{
+			if ((bits >> block) & 0xF)
+				RebuildLocalBlock((unsigned int)word * 64 + block);
+		}
+	}
+	dirtyCount = 0;
+
+	// ...then the world matrices of those in the hierarchy, front to back so parents are always
+	// done before their children. Children get marked as they're reached, and always come later.
+	for (size_t word = 0; word < worldDirty.size(); word++)
+	{
+		// A rebuild can mark children further along in this same word, so keep checking it
+		while (worldDirty[word] != 0)
+		{
+			unsigned int bit = LowestBit(worldDirty[word]);
+			worldDirty[word] &= worldDirty[word] - 1;
+			changed[word] |= 1ull << bit;
+
+			RebuildWorld((unsigned int)word * 64 + bit);
+			rebuilt++;
+		}
+	}
+
+	return rebuilt;
+}
+
+bool TransformSystem::WorldMatrixChanged(unsigned int index)
+{
+	return (changed[index >> 6] >> (index & 63)) & 1;
+}
+
+void TransformSystem::MarkDirty(unsigned int index)
+{
+	unsigned long long bit = 1ull << (index & 63);
+	unsigned long long& word = localDirty[index >> 6];
+	if (!(word & bit))
+	{
+		word |= bit;
+		dirtyCount++;
+	}
+}
+
+void TransformSystem::RebuildLocalBlock(unsigned int first)
+{
+	XMVECTOR sinPitch, cosPitch, sinYaw, cosYaw, sinRoll, cosRoll;
+	XMVectorSinCos(&sinPitch, &cosPitch, XMLoadFloat4((const XMFLOAT4*)&pitch[first]));
+	XMVectorSinCos(&sinYaw, &cosYaw, XMLoadFloat4((const XMFLOAT4*)&yaw[first]));
+	XMVectorSinCos(&sinRoll, &cosRoll, XMLoadFloat4((const XMFLOAT4*)&roll[first]));
+
+	// The same terms XMMatrixRotationRollPitchYaw() uses, for four rotations at once
+	XMVECTOR r00 = cosRoll * cosYaw + sinRoll * sinPitch * sinYaw;
+	XMVECTOR r01 = sinRoll * cosPitch;
+	XMVECTOR r02 = sinRoll * sinPitch * cosYaw - cosRoll * sinYaw;
+	XMVECTOR r10 = cosRoll * sinPitch * sinYaw - sinRoll * cosYaw;
+	XMVECTOR r11 = cosRoll * cosPitch;
+	XMVECTOR r12 = sinRoll * sinYaw + cosRoll * sinPitch * cosYaw;
+	XMVECTOR r20 = cosPitch * sinYaw;
+	XMVECTOR r21 = XMVectorNegate(sinPitch);
+	XMVECTOR r22 = cosPitch * cosYaw;
+
+	XMVECTOR x = XMLoadFloat4((const XMFLOAT4*)&positionX[first]);
+	XMVECTOR y = XMLoadFloat4((const XMFLOAT4*)&positionY[first]);
+	XMVECTOR z = XMLoadFloat4((const XMFLOAT4*)&positionZ[first]);
+	XMVECTOR sx = XMLoadFloat4((const XMFLOAT4*)&scaleX[first]);
+	XMVECTOR sy = XMLoadFloat4((const XMFLOAT4*)&scaleY[first]);
+	XMVECTOR sz = XMLoadFloat4((const XMFLOAT4*)&scaleZ[first]);
+	XMVECTOR zero = XMVectorZero();
+	XMVECTOR one = XMVectorSplatOne();
+
+	// A transform without a parent has its local matrix as its world matrix, so write those
+	// straight into place. Everything else gets combined with its parent's later.
+	XMFLOAT4X4* world[4];
+	XMFLOAT4X4* inverseTranspose[4];
+	for (unsigned int k = 0; k < 4; k++)
+	{
+		bool root = first + k >= count || parents[first + k] == TRANSFORM_NONE;
+		world[k] = root ? &worldMatrices[first + k] : &localMatrices[first + k];
+		inverseTranspose[k] = root ? &worldInverseTransposeMatrices[first + k] : &localInverseTransposeMatrices[first + k];
+	}
+
+	// Local = scale * rotation * translation, so each rotation row just gets scaled
+	StoreRows(world, 0, r00 * sx, r01 * sx, r02 * sx, zero);
+	StoreRows(world, 1, r10 * sy, r11 * sy, r12 * sy, zero);
+	StoreRows(world, 2, r20 * sz, r21 * sz, r22 * sz, zero);
+	StoreRows(world, 3, x, y, z, one);
+
+	// With a pure rotation in there, the inverse transpose is the rotation divided by the
+	// scale instead, with -(translation dot rotation row) / scale down the last column.
+	// That's what XMMatrixInverse(XMMatrixTranspose(local)) works out to, minus the 4x4 inverse.
+	XMVECTOR inverseX = XMVectorReciprocal(sx);
+	XMVECTOR inverseY = XMVectorReciprocal(sy);
+	XMVECTOR inverseZ = XMVectorReciprocal(sz);
+	XMVECTOR w0 = XMVectorNegate(x * r00 + y * r01 + z * r02) * inverseX;
+	XMVECTOR w1 = XMVectorNegate(x * r10 + y * r11 + z * r12) * inverseY;
+	XMVECTOR w2 = XMVectorNegate(x * r20 + y * r21 + z * r22) * inverseZ;
+
+	StoreRows(inverseTranspose, 0, r00 * inverseX, r01 * inverseX, r02 * inverseX, w0);
+	StoreRows(inverseTranspose, 1, r10 * inverseY, r11 * inverseY, r12 * inverseY, w1);
+	StoreRows(inverseTranspose, 2, r20 * inverseZ, r21 * inverseZ, r22 * inverseZ, w2);
+	// (The last row is always 0 0 0 1, which the identity it started as already has)
+}
+
+void TransformSystem::RebuildWorld(unsigned int index)
+{
+	// Roots already got their world matrices from RebuildLocalBlock()
+	unsigned int parent = parents[index];
+	if (parent != TRANSFORM_NONE)
+	{
+		// (local * parent)^-T = local^-T * parent^-T, so the inverse transposes chain
+		// the same way and never need a real inverse, even with non-uniform scales
+		XMMATRIX world = XMLoadFloat4x4(&localMatrices[index]) * XMLoadFloat4x4(&worldMatrices[parent]);
+		XMMATRIX inverseTranspose = XMLoadFloat4x4(&localInverseTransposeMatrices[index]) * XMLoadFloat4x4(&worldInverseTransposeMatrices[parent]);
+		XMStoreFloat4x4(&worldMatrices[index], world);
+		XMStoreFloat4x4(&worldInverseTransposeMatrices[index], inverseTranspose);
+	}
+
+	for (unsigned int child = firstChildren[index]; child != TRANSFORM_NONE; child = nextSiblings[child])
+	{
+		SetBit(worldDirty, child);
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+// Parent of a transform with no parent
+#define TRANSFORM_NONE 0xFFFFFFFF
+
+// --------------------------------------------------------
+// Positions, rotations and scales for lots of objects at once,
+// stored as structure of arrays (one array per component)
+// instead of one Transform object per entity
+//
+// - Setters only mark a transform dirty when a value actually
+//   changes, with one bit per transform
+// - UpdateMatrices() rebuilds the world and world inverse
+//   transpose matrices of everything dirty in a single sweep,
+//   four transforms per iteration with DirectXMath
+// - Matrices are as of the last UpdateMatrices(), so call it
+//   once per frame after moving things and before drawing
+//
+// Transforms can have a parent, given when they're created.
+// Since a parent has to exist first, its index is always lower
+// than its children's, so the arrays are always in topological
+// order and world matrices resolve front to back in one pass.
+// Only transforms that changed, and everything below them,
+// get their world matrices rebuilt.
+// --------------------------------------------------------
+class TransformSystem
+{
+public:
+	TransformSystem();
+
+	/// <summary>
+	/// Adds a transform at the origin with no rotation and a scale of 1
+	/// </summary>
+	/// <param name="parent">Index of an existing transform to be relative to, or TRANSFORM_NONE</param>
+	/// <returns>The new transform's index, which never changes</returns>
+	unsigned int Create(unsigned int parent = TRANSFORM_NONE);
+	unsigned int GetCount();
+
+	/// <summary>
+	/// Makes room for this many transforms, so creating them doesn't reallocate
+	/// </summary>
+	void Reserve(unsigned int count);
+
+	unsigned int GetParent(unsigned int index);
+
+	// Positions, rotations and scales are all relative to the parent
+	void SetPosition(unsigned int index, DirectX::XMFLOAT3 position);
+	void SetRotation(unsigned int index, DirectX::XMFLOAT3 pitchYawRoll);
+	void SetScale(unsigned int index, DirectX::XMFLOAT3 scale);
+
+	DirectX::XMFLOAT3 GetPosition(unsigned int index);
+	DirectX::XMFLOAT3 GetPitchYawRoll(unsigned int index);
+	DirectX::XMFLOAT3 GetScale(unsigned int index);
+
+	const DirectX::XMFLOAT4X4& GetWorldMatrix(unsigned int index);
+	const DirectX::XMFLOAT4X4& GetWorldInverseTransposeMatrix(unsigned int index);
+
+	/// <summary>
+	/// Rebuilds the matrices of every transform that changed since the last call, along with their children
+	/// </summary>
+	/// <returns>How many world matrices were rebuilt</returns>
+	unsigned int UpdateMatrices();
+
+	/// <summary>
+	/// Did the last UpdateMatrices() rebuild this transform's world matrix, either because it or a parent changed?
+	/// </summary>
+	bool WorldMatrixChanged(unsigned int index);
+
+private:
+
+	void MarkDirty(unsigned int index);
+	void RebuildLocalBlock(unsigned int first);
+	void RebuildWorld(unsigned int index);
+
+	// One array per component, always a multiple of 4 long so the
+	// sweep can load any block of four without a scalar leftover loop
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> pitch, yaw, roll;
+	std::vector<float> scaleX, scaleY, scaleZ;
+
+	// The hierarchy, with each transform's children in a linked list
+	std::vector<unsigned int> parents;
+	std::vector<unsigned int> firstChildren;
+	std::vector<unsigned int> nextSiblings;
+
+	// Relative to the parent, then the final result
+	std::vector<DirectX::XMFLOAT4X4> localMatrices;
+	std::vector<DirectX::XMFLOAT4X4> localInverseTransposeMatrices;
+	std::vector<DirectX::XMFLOAT4X4> worldMatrices;
+	std::vector<DirectX::XMFLOAT4X4> worldInverseTransposeMatrices;
+
+	// One bit per transform, 64 to a word: which local values changed,
+	// and which world matrices need rebuilding because of that.
+	// Transforms with no parent and no children skip that second step,
+	// so "linked" marks the ones that don't.
+	std::vector<unsigned long long> localDirty;
+	std::vector<unsigned long long> worldDirty;
+	std::vector<unsigned long long> linked;
+	unsigned int dirtyCount;
+
+	// Same layout: whose world matrices the last UpdateMatrices() rebuilt
+	std::vector<unsigned long long> changed;
+	bool anyChanged;
+
+	unsigned int count;
+};
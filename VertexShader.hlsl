@@ -1,13 +1,11 @@
 #include "ShaderIncludes.hlsli"
+#include "ObjectConstants.hlsli"
 
-cbuffer ExternalData : register(b0)
+// The same for every object, set once per frame
+cbuffer PerFrame : register(b0)
 {
-	matrix worldMatrix;
 	matrix viewMatrix;
 	matrix projectionMatrix;
-    matrix worldInvTranspose;
-    matrix lightView;
-    matrix lightProjection;
 }
 
 // --------------------------------------------------------
@@ -17,8 +15,17 @@ cbuffer ExternalData : register(b0)
 // - Output is a single struct of data to pass down the pipeline
 // - Named "main" because that's the default the shader compiler looks for
 // --------------------------------------------------------
-VertexToPixel main( VertexShaderInput input )
+#ifdef PACKED_VERTICES
+VertexToPixel main(PackedVertexShaderInput packedInput, InstanceInput instance)
 {
+    VertexShaderInput input = UnpackVertex(packedInput, positionOffset, positionScale, uvOffset, uvScale);
+#else
+VertexToPixel main( VertexShaderInput input, InstanceInput instance )
+{
+#endif
+    matrix worldMatrix = GetWorldMatrix(instance);
+    matrix worldInvTranspose = GetWorldInvTranspose(instance);
+
 	// Set up output struct
 	VertexToPixel output;
 
@@ -42,9 +49,6 @@ VertexToPixel main( VertexShaderInput input )
 	
 
 	output.uv = input.uv;
-	
-    matrix shadowWVP = mul(lightProjection, mul(lightView, worldMatrix));
-    output.shadowMapPos = mul(shadowWVP, float4(input.localPosition, 1.0f));
 
 	// Whatever we return will make its way through the pipeline to the
 	// next programmable stage we're using (the pixel shader for now)